@@ -0,0 +1,154 @@
+# Building blocks of the pipelined autoscan mode (autoscan.concurrency)
+
+# Congestion window of a pipelined scan: how many upstream requests may be in flight.
+# Additive increase, multiplicative decrease as in TCP: an uncongested response grows the
+# limit by 1/limit (about one request per round trip of the whole window), while a 429 / 5xx,
+# a failed request or a latency average beyond latency_factor times the fastest seen halves it.
+# The limit is halved at most once per window of responses, so a burst of errors from one
+# round trip counts as a single congestion signal.
+class AimdWindow
+  DEFAULT_LATENCY_FACTOR = 3.0
+  DECREASE_FACTOR = 0.5
+  LATENCY_SMOOTHING = 0.2   # Weight of a new sample in the latency average
+  BASELINE_DRIFT = 1.001    # Lets the fastest latency seen follow a slower upstream over time
+  WAIT_INTERVAL = 0.5       # Seconds between checks of the halt event while waiting for a slot
+
+  attr_reader :min, :max
+
+  def initialize(max:, min: 1, initial: min, latency_factor: DEFAULT_LATENCY_FACTOR)
+    raise ArgumentError, "window bounds must satisfy 1 <= min <= max: #{min}..#{max}" unless min >= 1 && min <= max
+
+    @min = min
+    @max = max
+    @limit = initial.clamp(min, max).to_f
+    @latency_factor = latency_factor
+    @in_flight = 0
+    @latency = nil
+    @baseline = nil
+    @since_decrease = max
+    @decreases = 0
+    @mutex = Mutex.new
+    @slot = ConditionVariable.new
+  end
+
+  # Waits for a free slot; false when halt (a Concurrent event) resolves first
+  def acquire(halt = nil)
+    @mutex.synchronize do
+      while @in_flight >= @limit.to_i
+        return false if halt&.resolved?
+
+        @slot.wait(@mutex, WAIT_INTERVAL)
+      end
+      @in_flight += 1
+    end
+    true
+  end
+
+  # Returns a slot with what its request saw. congested: throttled, failed or overloaded
+  # upstream; latency of such responses says nothing about the path and is not sampled
+  def release(latency_ms:, congested: false)
+    @mutex.synchronize do
+      @in_flight -= 1
+      @since_decrease += 1
+      observe_latency(latency_ms) if latency_ms && !congested
+
+      if congested || slow?
+        decrease if @since_decrease >= @limit
+      else
+        @limit = [@limit + 1.0 / @limit, @max].min
+      end
+      @slot.broadcast
+    end
+  end
+
+  def limit = @mutex.synchronize { @limit.to_i }
+
+  def register_metrics(source)
+    attributes = { source: source }
+    Metrics.register('tpc.autoscan.window', kind: :gauge, description: 'Upstream requests the autoscan window allows',
+                                            attributes: attributes) { stats[:limit] }
+    Metrics.register('tpc.autoscan.in_flight', kind: :gauge, description: 'Autoscan upstream requests in flight',
+                                               attributes: attributes) { stats[:in_flight] }
+    Metrics.register('tpc.autoscan.window_decreases', description: 'Autoscan window decreases on congestion',
+                                                      attributes: attributes) { stats[:decreases] }
+  end
+
+  def stats
+    @mutex.synchronize do
+      { limit: @limit.to_i, in_flight: @in_flight, min: @min, max: @max, decreases: @decreases,
+        latency_ms: @latency&.round, baseline_ms: @baseline&.round }
+    end
+  end
+
+  private
+
+  def observe_latency(latency_ms)
+    @latency = @latency ? @latency + LATENCY_SMOOTHING * (latency_ms - @latency) : latency_ms.to_f
+    @baseline = @baseline ? [latency_ms.to_f, @baseline * BASELINE_DRIFT].min : latency_ms.to_f
+  end
+
+  def slow? = @baseline && @latency > @baseline * @latency_factor
+
+  def decrease
+    return if @limit <= @min
+
+    @limit = [@limit * DECREASE_FACTOR, @min].max
+    @since_decrease = 0
+    @decreases += 1
+  end
+end
+
+# Resume point of a scan whose tiles finish out of order. Tiles are opened in scan order and
+# position is the last tile before which every opened tile is done: where a restarted scan
+# can continue without missing one. An abandoned tile (the scan stopped before it finished)
+# holds the position back for good but no longer counts as pending.
+class ScanWatermark
+  attr_reader :position
+
+  def initialize
+    @mutex = Mutex.new
+    @idle = ConditionVariable.new
+    @tiles = {} # seq => [x, y, state], in scan order
+    @next_seq = 0
+    @pending = 0
+    @position = nil
+  end
+
+  # Sequence number of the next tile in scan order
+  def open(x, y)
+    @mutex.synchronize do
+      seq = @next_seq
+      @next_seq += 1
+      @tiles[seq] = [x, y, :open]
+      @pending += 1
+      seq
+    end
+  end
+
+  # Marks a tile done (or abandoned); the new position as [x, y] when it moved, else nil
+  def finish(seq, done: true)
+    @mutex.synchronize do
+      @tiles[seq][2] = done ? :done : :abandoned
+      @pending -= 1
+
+      moved = nil
+      while (first = @tiles.first) && first[1][2] == :done
+        @tiles.shift
+        moved = first[1][0, 2]
+      end
+      @position = moved if moved
+      @idle.broadcast if @pending.zero?
+      moved
+    end
+  end
+
+  def pending = @mutex.synchronize { @pending }
+
+  # True once no opened tile is pending; waits up to timeout seconds for that
+  def wait_idle(timeout)
+    @mutex.synchronize do
+      @idle.wait(@mutex, timeout) unless @pending.zero?
+      @pending.zero?
+    end
+  end
+end
@@ -5,7 +5,11 @@ require 'json'
 require 'concurrent-ruby'
 require_relative 'ext/terrain_downsample_extension'
 require_relative 'vips_tile_validator'
-require_relative 'geometry_tile_calculator'
+require_relative 'coverage_index'
+require_relative 'metatile'
+require_relative 'autoscan_pipeline'
+require_relative 'tile_storage'
+require_relative 'tile_shards'
 require_relative 'observability_setup'
 
 class BackgroundTileLoader
@@ -14,6 +18,8 @@ class BackgroundTileLoader
   RETRY_BACKOFF_FACTOR = 2.5
   MAX_403_PERCENT = 0.05
   MAX_403_CEILING = 500_000
+  DEFAULT_PROCESS_THREADS = 2 # autoscan.concurrency.process_threads
+  DAILY_BUDGET_POLL = 60      # Seconds between checks for a new day once daily_limit is reached
 
   TRANSIENT_STATUS_CODES = [429, 500, 502, 503, 504].freeze
   CRITICAL_STATUS_CODES = [401, 403].freeze
@@ -38,11 +44,47 @@ class BackgroundTileLoader
     @pending_403_tiles = []
     @max_403_for_zoom = 1
     @json_mutex = Mutex.new
+    @scan_mutex = Mutex.new
+    @coverage = coverage_for(route)
+    @concurrency = self.class.concurrency_config(route)
+    @metatile = Metatile.config(route, source_name) unless @concurrency # The pipelined scan fetches single tiles
+    if @concurrency
+      @fetch_window = AimdWindow.new(
+        max: @concurrency[:max_in_flight], min: @concurrency[:min_in_flight],
+        initial: @concurrency[:initial_in_flight], latency_factor: @concurrency[:latency_factor]
+      )
+      @fetch_window.register_metrics(source_name)
+    end
 
     setup_progress_table
     load_todays_progress
   end
 
+  # autoscan.concurrency with defaults filled in; nil keeps scans sequential
+  def self.concurrency_config(route)
+    config = route.dig(:autoscan, :concurrency)
+    return nil unless config && config.fetch(:enabled, true)
+
+    max_in_flight = Integer(config[:max_in_flight] || 8)
+    min_in_flight = Integer(config[:min_in_flight] || 1)
+    process_threads = Integer(config[:process_threads] || DEFAULT_PROCESS_THREADS)
+    raise ArgumentError, "process_threads must be at least 1: #{process_threads}" if process_threads < 1
+    if min_in_flight < 1 || min_in_flight > max_in_flight
+      raise ArgumentError, "concurrency needs 1 <= min_in_flight <= max_in_flight: #{min_in_flight}..#{max_in_flight}"
+    end
+
+    {
+      max_in_flight: max_in_flight,
+      min_in_flight: min_in_flight,
+      initial_in_flight: Integer(config[:initial_in_flight] || [2, max_in_flight].min).clamp(min_in_flight, max_in_flight),
+      latency_factor: Float(config[:latency_factor] || AimdWindow::DEFAULT_LATENCY_FACTOR),
+      process_threads: process_threads
+    }
+  end
+
+  # AIMD window stats of a pipelined scan, nil for sequential scans
+  def fetch_window_stats = @fetch_window&.stats
+
   def start
     return unless @config[:enabled]
     return if running?
@@ -152,7 +194,8 @@ class BackgroundTileLoader
       
       zoom_levels.each do |z|
         reset_zoom_progress(z)
-        @route[:db][:misses].where(zoom_level: z).delete
+        tile_db(z)[:misses].where(zoom_level: z).delete
+        @route[:miss_index]&.forget_zoom(z)
         LOGGER.info("Deleted misses for zoom #{z} of #{@source_name}")
       end
       
@@ -175,9 +218,9 @@ class BackgroundTileLoader
 
     @wal_task = Concurrent::TimerTask.new(execution_interval: 15) do
       begin
-        result = @route[:db].run "PRAGMA wal_checkpoint(PASSIVE)"
-        if result&.is_a?(Array) && result[0] == 1
-          @route[:db].run "PRAGMA wal_checkpoint(RESTART)"
+        TileShards.dbs(@route).each do |db|
+          result = db.run "PRAGMA wal_checkpoint(PASSIVE)"
+          db.run "PRAGMA wal_checkpoint(RESTART)" if result&.is_a?(Array) && result[0] == 1
         end
       rescue => e
         LOGGER.warn("event=autoscan_wal_checkpoint_error source=#{@source_name} error=#{e.message}")
@@ -188,6 +231,9 @@ class BackgroundTileLoader
 
   private
 
+  # Database holding zoom z (the route's shard of z)
+  def tile_db(z) = TileShards.db(@route, z)
+
   def setup_progress_table
     @route[:db].create_table?(:tile_scan_progress) do
       String :source, null: false
@@ -300,8 +346,8 @@ class BackgroundTileLoader
         return
       end
 
-      tile_boundaries = get_bounds_for_zoom(z)
-      return unless tile_boundaries
+      segments = @coverage.segments(z)
+      return if segments.empty?
 
       @current_progress[z] = load_progress(z)
       @consecutive_403_count = 0
@@ -313,7 +359,7 @@ class BackgroundTileLoader
       
       update_status(z, 'active')
 
-      scan_result = scan_zoom_boundaries(z, tile_boundaries, token)
+      scan_result = scan_zoom_boundaries(z, segments, token)
       case scan_result
       when :critical_error
         update_status(z, 'critical_error')
@@ -336,7 +382,7 @@ class BackgroundTileLoader
       else
         expected = expected_tiles_count(z)
         actual_tiles = cached_tiles_count(z)
-        errors = @route[:db][:misses].where(zoom_level: z).count
+        errors = tile_db(z)[:misses].where(zoom_level: z).count
         remaining = expected - actual_tiles - errors
         span&.add_attributes(status: 'incomplete', actual_tiles: actual_tiles, expected: expected, errors: errors, remaining: remaining)
         LOGGER.error(
@@ -352,11 +398,7 @@ class BackgroundTileLoader
     end
   end
 
-  def scan_zoom_boundaries(z, tile_boundaries, token)
-    segments = []
-    segments << tile_boundaries[:west][z] if tile_boundaries[:west] && tile_boundaries[:west][z]
-    segments << tile_boundaries[:east][z] if tile_boundaries[:east] && tile_boundaries[:east][z]
-
+  def scan_zoom_boundaries(z, segments, token)
     segments.each do |bounds|
       result = scan_zoom_grid(z, bounds, token)
       return result unless result == :completed
@@ -367,6 +409,59 @@ class BackgroundTileLoader
   end
 
   def scan_zoom_grid(z, bounds, token)
+    return scan_zoom_grid_pipelined(z, bounds, token) if @concurrency
+
+    each_grid_tile(z, bounds) do |curr_x, curr_y|
+      return :cancelled if token.resolved?
+
+      @current_progress[z][:x] = curr_x
+      @current_progress[z][:y] = curr_y
+
+      result = fetch_tile(curr_x, curr_y, z, token)
+
+      case result
+      when :success
+        @consecutive_403_count = 0
+        
+        retry_pending_403_tiles(z, token) if @pending_403_tiles.any?
+        
+        @tiles_today += 1
+        @tiles_processed += 1
+        save_progress(curr_x, curr_y, z) if @tiles_processed % 10 == 0
+        sleep calculate_delay
+
+      when :permanent_error
+        @tiles_processed += 1
+        save_progress(curr_x, curr_y, z) if @tiles_processed % 10 == 0
+        sleep calculate_delay
+
+      when :skipped
+        @tiles_processed += 1
+        save_progress(curr_x, curr_y, z) if @tiles_processed % 10 == 0
+        sleep 0.001
+
+      when :source_unavailable
+        LOGGER.error("event=autoscan_scan_stop source=#{@source_name} reason=source_unavailable z=#{z} x=#{curr_x} y=#{curr_y}")
+        return :source_unavailable
+
+      when :critical_stop
+        LOGGER.error("event=autoscan_scan_stop source=#{@source_name} reason=critical_stop z=#{z} x=#{curr_x} y=#{curr_y}")
+        return :critical_error
+
+      when :cancelled
+        return :cancelled
+      end
+    end
+
+    final_x = @current_progress[z]&.dig(:x)
+    final_y = @current_progress[z]&.dig(:y)
+    save_progress(final_x, final_y, z) if @tiles_processed % 10 != 0
+
+    :completed
+  end
+
+  # Yields the grid's tiles column by column, starting at the zoom's saved progress
+  def each_grid_tile(z, bounds)
     min_x, min_y, max_x, max_y = bounds.values_at(:min_x, :min_y, :max_x, :max_y)
     x, y = @current_progress[z].values_at(:x, :y)
 
@@ -383,57 +478,171 @@ class BackgroundTileLoader
       curr_y = curr_x == first_x ? start_y : min_y
 
       while curr_y <= max_y
-        return :cancelled if token.resolved?
-
-        @current_progress[z][:x] = curr_x
-        @current_progress[z][:y] = curr_y
-
-        result = fetch_tile(curr_x, curr_y, z, token)
-
-        case result
-        when :success
-          @consecutive_403_count = 0
-          
-          retry_pending_403_tiles(z, token) if @pending_403_tiles.any?
-          
-          @tiles_today += 1
-          @tiles_processed += 1
-          save_progress(curr_x, curr_y, z) if @tiles_processed % 10 == 0
-          sleep calculate_delay
-
-        when :permanent_error
-          @tiles_processed += 1
-          save_progress(curr_x, curr_y, z) if @tiles_processed % 10 == 0
-          sleep calculate_delay
-
-        when :skipped
-          @tiles_processed += 1
-          save_progress(curr_x, curr_y, z) if @tiles_processed % 10 == 0
-          sleep 0.001
-
-        when :source_unavailable
-          LOGGER.error("event=autoscan_scan_stop source=#{@source_name} reason=source_unavailable z=#{z} x=#{curr_x} y=#{curr_y}")
-          return :source_unavailable
-
-        when :critical_stop
-          LOGGER.error("event=autoscan_scan_stop source=#{@source_name} reason=critical_stop z=#{z} x=#{curr_x} y=#{curr_y}")
-          return :critical_error
-
-        when :cancelled
-          return :cancelled
-        end
-        
+        yield curr_x, curr_y
         curr_y += 1
       end
-      
+
       curr_x += 1
     end
+  end
 
-    final_x = @current_progress[z]&.dig(:x)
-    final_y = @current_progress[z]&.dig(:y)
-    save_progress(final_x, final_y, z) if @tiles_processed % 10 != 0
+  # autoscan.concurrency: up to max_in_flight fetch threads send requests over keep-alive
+  # connections (route[:autoscan_client]) while the AIMD window sets how many are in flight;
+  # decoding, validation and the write run on process_threads behind them, so network, CPU
+  # and disk overlap. Tiles finish out of order, so progress is the scan watermark, and
+  # daily_limit caps the tiles fetched per day instead of pacing each request.
+  def scan_zoom_grid_pipelined(z, bounds, token)
+    scan = PipelinedScan.new(
+      z, Concurrent::Promises.resolvable_event, ScanWatermark.new,
+      Concurrent::Semaphore.new(@concurrency[:max_in_flight] * 2 + @concurrency[:process_threads]),
+      Thread::Queue.new, Thread::SizedQueue.new(@concurrency[:process_threads] * 2), nil, nil
+    )
+    fetchers = Array.new(@concurrency[:max_in_flight]) { Thread.new { pipeline_fetch_worker(scan) } }
+    processors = Array.new(@concurrency[:process_threads]) { Thread.new { pipeline_process_worker(scan) } }
+
+    each_grid_tile(z, bounds) do |x, y|
+      break if pipeline_halted?(scan, token)
 
+      if tile_exists?(x, y, z) || miss_permanent?(x, y, z)
+        finish_pipelined_tile(scan, scan.watermark.open(x, y), :skipped)
+        next
+      end
+      break unless wait_for_daily_budget(scan, token) && acquire_backlog(scan, token)
+
+      scan.fetch_queue << { x: x, y: y, seq: scan.watermark.open(x, y), attempts: 0, not_before: nil }
+    end
+
+    halt_pipelined_scan(scan) if token.resolved?
+    until scan.watermark.wait_idle(AimdWindow::WAIT_INTERVAL)
+      halt_pipelined_scan(scan) if token.resolved?
+    end
+    raise scan.error if scan.error
+    return :cancelled if token.resolved?
+
+    if scan.stop
+      x, y = scan.watermark.position || @current_progress[z].values_at(:x, :y)
+      LOGGER.error("event=autoscan_scan_stop source=#{@source_name} reason=#{scan.stop} z=#{z} x=#{x} y=#{y}")
+      return scan.stop == :critical_stop ? :critical_error : :source_unavailable
+    end
+
+    save_progress(@current_progress[z][:x], @current_progress[z][:y], z)
     :completed
+  ensure
+    if scan
+      halt_pipelined_scan(scan)
+      scan.fetch_queue.close
+      fetchers&.each(&:join)
+      scan.process_queue.close
+      processors&.each(&:join)
+    end
+  end
+
+  PipelinedScan = Struct.new(:z, :halt, :watermark, :backlog, :fetch_queue, :process_queue, :stop, :error)
+
+  def pipeline_fetch_worker(scan)
+    client = @route[:autoscan_client] || @route[:client]
+    headers = get_headers(keep_alive: true)
+
+    while (job = scan.fetch_queue.pop)
+      wait = job[:not_before] && job[:not_before] - Observability.monotonic_time
+      scan.halt.wait(wait) if wait&.positive?
+      next finish_pipelined_tile(scan, job[:seq], :abandoned) if scan.halt.resolved? || !@fetch_window.acquire(scan.halt)
+
+      fetched = request_upstream_tile(job[:x], job[:y], scan.z, client, headers)
+      status = fetched[:response]&.status
+      @fetch_window.release(latency_ms: fetched[:duration_ms],
+                            congested: fetched.key?(:result) || TRANSIENT_STATUS_CODES.include?(status))
+      scan.process_queue << [job, fetched]
+    end
+  end
+
+  def pipeline_process_worker(scan)
+    while (item = scan.process_queue.pop)
+      job, fetched = item
+      process_pipelined_tile(scan, job, fetched)
+    end
+  end
+
+  def process_pipelined_tile(scan, job, fetched)
+    x, y = job.values_at(:x, :y)
+    return finish_pipelined_tile(scan, job[:seq], :abandoned) if scan.halt.resolved?
+
+    result = fetched[:result] || process_upstream_response(fetched, x, y, scan.z)
+    attempts = job[:attempts] + 1
+    outcome = apply_fetch_result(x, y, scan.z, result, attempts)
+
+    case outcome
+    when :retry
+      delay = calculate_retry_delay(attempts + 1)
+      log_transient_retry(x, y, scan.z, result, attempts, delay)
+      scan.fetch_queue << job.merge(attempts: attempts, not_before: Observability.monotonic_time + delay)
+    when :critical_stop, :source_unavailable
+      @scan_mutex.synchronize { scan.stop ||= outcome }
+      finish_pipelined_tile(scan, job[:seq], :abandoned)
+      halt_pipelined_scan(scan)
+    else
+      finish_pipelined_tile(scan, job[:seq], outcome)
+      retry_pending_403_tiles(scan.z, scan.halt) if outcome == :success && @scan_mutex.synchronize { @pending_403_tiles.any? }
+    end
+  rescue => e
+    @scan_mutex.synchronize { scan.error ||= e }
+    finish_pipelined_tile(scan, job[:seq], :abandoned)
+    halt_pipelined_scan(scan)
+  end
+
+  # Counts a tile, moves the zoom's progress to the watermark and frees its backlog slot
+  def finish_pipelined_tile(scan, seq, outcome)
+    save = @scan_mutex.synchronize do
+      unless outcome == :abandoned
+        @tiles_today += 1 if outcome == :success
+        @tiles_processed += 1
+      end
+      position = scan.watermark.finish(seq, done: outcome != :abandoned)
+      @current_progress[scan.z][:x], @current_progress[scan.z][:y] = position if position
+      outcome != :abandoned && (@tiles_processed % 10).zero?
+    end
+    scan.backlog.release unless outcome == :skipped
+    save_progress(@current_progress[scan.z][:x], @current_progress[scan.z][:y], scan.z) if save
+  end
+
+  def halt_pipelined_scan(scan) = scan.halt.resolve(false)
+
+  def pipeline_halted?(scan, token)
+    halt_pipelined_scan(scan) if token.resolved?
+    scan.halt.resolved?
+  end
+
+  def acquire_backlog(scan, token)
+    until scan.backlog.try_acquire(1, AimdWindow::WAIT_INTERVAL)
+      return false if pipeline_halted?(scan, token)
+    end
+    true
+  end
+
+  # Waits while today's fetched tiles are at daily_limit; false when the scan halts first
+  def wait_for_daily_budget(scan, token)
+    limit = @config[:daily_limit] || 1000
+    @budget_day ||= Date.today
+    return true if @tiles_today < limit && @budget_day == Date.today
+
+    LOGGER.info("event=autoscan_daily_limit source=#{@source_name} tiles_today=#{@tiles_today} daily_limit=#{limit}") if @budget_day == Date.today
+    until pipeline_halted?(scan, token)
+      if @budget_day != Date.today
+        @scan_mutex.synchronize { @tiles_today = 0 }
+        @budget_day = Date.today
+        return true
+      end
+      token.wait(DAILY_BUDGET_POLL)
+    end
+    false
+  end
+
+  # Counts a finished tile toward today's and the scan's totals
+  def count_tile(outcome)
+    @scan_mutex.synchronize do
+      @tiles_today += 1 if outcome == :success
+      @tiles_processed += 1
+    end
   end
 
   def fetch_tile(x, y, z, token = nil)
@@ -447,78 +656,88 @@ class BackgroundTileLoader
       return :cancelled if token&.resolved?
 
       result = perform_tile_fetch(x, y, z)
+      outcome = apply_fetch_result(x, y, z, result, attempts)
+      return outcome unless outcome == :retry
 
-      if result[:success]
-        @consecutive_403_count = 0
-        
-        if validate_and_save_tile(z, x, y, result[:data])
-          return :success
-        else
-          return :permanent_error
-        end
-      end
+      delay = calculate_retry_delay(attempts + 1)
+      log_transient_retry(x, y, z, result, attempts, delay)
+      sleep(delay)
+    end
 
-      if result[:status] == 403
-        @consecutive_403_count += 1
+    :source_unavailable
+  end
+
+  # What a fetch result means for its tile: :success, :permanent_error, :critical_stop,
+  # :source_unavailable, or :retry for a transient error with attempts left. Saves the tile
+  # and records misses; the 403 counters are shared by the threads of a pipelined scan
+  def apply_fetch_result(x, y, z, result, attempts)
+    if result[:success]
+      @scan_mutex.synchronize { @consecutive_403_count = 0 }
+      return validate_and_save_tile(z, x, y, result[:data]) ? :success : :permanent_error
+    end
+
+    if result[:status] == 403
+      consecutive_403 = @scan_mutex.synchronize do
         @pending_403_tiles << {x: x, y: y, z: z}
-        
-        if @consecutive_403_count >= @max_403_for_zoom
-          LOGGER.error(
-            "event=autoscan_consecutive_403_limit source=#{@source_name} " \
-            "zoom=#{z} x=#{x} y=#{y} consecutive_403=#{@consecutive_403_count} " \
-            "max_403=#{@max_403_for_zoom}"
-          )
-          handle_critical_error(result)
-          return :critical_stop
-        end
-        return :permanent_error
+        @consecutive_403_count += 1
       end
 
-      error_class = classify_error(result[:status], result[:reason])
-
-      case error_class
-      when :critical
+      if consecutive_403 >= @max_403_for_zoom
+        LOGGER.error(
+          "event=autoscan_consecutive_403_limit source=#{@source_name} " \
+          "zoom=#{z} x=#{x} y=#{y} consecutive_403=#{consecutive_403} " \
+          "max_403=#{@max_403_for_zoom}"
+        )
         handle_critical_error(result)
         return :critical_stop
+      end
+      return :permanent_error
+    end
 
-      when :permanent
-        record_permanent_miss(x, y, z, result)
-        return :permanent_error
+    error_class = classify_error(result[:status], result[:reason])
 
-      when :transient
-        if attempts >= MAX_RETRY_ATTEMPTS
-          handle_source_unavailable(x, y, z, attempts)
-          return :source_unavailable
-        end
+    case error_class
+    when :critical
+      handle_critical_error(result)
+      :critical_stop
 
-        delay = calculate_retry_delay(attempts + 1)
+    when :permanent
+      record_permanent_miss(x, y, z, result)
+      :permanent_error
 
-        if result[:status] == 429
-          LOGGER.warn(
-            "event=autoscan_rate_limited source=#{@source_name} z=#{z} x=#{x} y=#{y} " \
-            "retry=#{attempts + 1} max_retries=#{MAX_RETRY_ATTEMPTS} delay_s=#{delay.round(1)}"
-          )
-        else
-          LOGGER.warn(
-            "event=autoscan_transient_retry source=#{@source_name} z=#{z} x=#{x} y=#{y} " \
-            "status=#{result[:status]} reason=#{result[:reason]} retry=#{attempts + 1} " \
-            "max_retries=#{MAX_RETRY_ATTEMPTS} delay_s=#{delay.round(1)}"
-          )
-        end
-
-        sleep(delay)
+    when :transient
+      if attempts >= MAX_RETRY_ATTEMPTS
+        handle_source_unavailable(x, y, z, attempts)
+        return :source_unavailable
       end
+
+      :retry
     end
+  end
 
-    :source_unavailable
+  def log_transient_retry(x, y, z, result, attempts, delay)
+    if result[:status] == 429
+      LOGGER.warn(
+        "event=autoscan_rate_limited source=#{@source_name} z=#{z} x=#{x} y=#{y} " \
+        "retry=#{attempts + 1} max_retries=#{MAX_RETRY_ATTEMPTS} delay_s=#{delay.round(1)}"
+      )
+    else
+      LOGGER.warn(
+        "event=autoscan_transient_retry source=#{@source_name} z=#{z} x=#{x} y=#{y} " \
+        "status=#{result[:status]} reason=#{result[:reason]} retry=#{attempts + 1} " \
+        "max_retries=#{MAX_RETRY_ATTEMPTS} delay_s=#{delay.round(1)}"
+      )
+    end
   end
 
   def retry_pending_403_tiles(z, token)
-    return if @pending_403_tiles.empty?
-    
-    tiles_to_retry = @pending_403_tiles.dup
-    @pending_403_tiles.clear
-    
+    tiles_to_retry = @scan_mutex.synchronize do
+      taken = @pending_403_tiles.dup
+      @pending_403_tiles.clear
+      taken
+    end
+    return if tiles_to_retry.empty?
+
     LOGGER.info("Retrying #{tiles_to_retry.size} tiles with previous 403 responses for #{@source_name}")
     
     tiles_to_retry.each do |tile_info|
@@ -529,23 +748,22 @@ class BackgroundTileLoader
       
       if result[:success]
         if validate_and_save_tile(z, x, y, result[:data])
-          @tiles_today += 1
-          @tiles_processed += 1
+          count_tile(:success)
           LOGGER.debug("Successfully loaded tile #{z}/#{x}/#{y} on retry (was 403)")
         else
-          @tiles_processed += 1
+          count_tile(:permanent_error)
           LOGGER.debug("Tile #{z}/#{x}/#{y} failed validation on retry - marked as invalid")
         end
       elsif result[:status] == 403
         record_permanent_miss(x, y, z, result)
-        @tiles_processed += 1
+        count_tile(:permanent_error)
         LOGGER.debug("Tile #{z}/#{x}/#{y} still returns 403 on retry - marking as permanent error")
       else
         error_class = classify_error(result[:status], result[:reason])
         case error_class
         when :permanent
           record_permanent_miss(x, y, z, result)
-          @tiles_processed += 1
+          count_tile(:permanent_error)
         when :transient
           LOGGER.warn(
             "event=autoscan_retry_transient_skip source=#{@source_name} z=#{z} x=#{x} y=#{y} " \
@@ -553,14 +771,14 @@ class BackgroundTileLoader
           )
         end
       end
-      
-      sleep calculate_delay
+
+      sleep calculate_delay unless @concurrency
     end
     
     LOGGER.info("Completed retry of #{tiles_to_retry.size} tiles for #{@source_name}")
   end
 
-  def get_headers
+  def get_headers(keep_alive: false)
     config_headers = (@route[:headers]&.dig(:request) || {}).transform_keys(&:to_s)
 
     browser_headers = {
@@ -568,7 +786,7 @@ class BackgroundTileLoader
       'Accept-Language' => 'en-US,en;q=0.9,ru;q=0.8',
       'Accept-Encoding' => 'gzip, deflate, br',
       'DNT' => '1',
-      'Connection' => 'close',
+      'Connection' => keep_alive ? 'keep-alive' : 'close',
       'Upgrade-Insecure-Requests' => '1',
       'Sec-Fetch-Dest' => 'image',
       'Sec-Fetch-Mode' => 'no-cors',
@@ -581,14 +799,14 @@ class BackgroundTileLoader
   end
 
   def tile_exists?(x, y, z)
-    @route[:db][:tiles]
+    tile_db(z)[:tiles]
       .where(zoom_level: z, tile_column: x, tile_row: tms_y(z, y))
       .where(Sequel.lit('generated = 0 OR generated IS NULL'))
       .get(1)
   end
 
   def miss_permanent?(x, y, z)
-    row = @route[:db][:misses].where(zoom_level: z, tile_column: x, tile_row: tms_y(z, y)).select(:reason).first
+    row = tile_db(z)[:misses].where(zoom_level: z, tile_column: x, tile_row: tms_y(z, y)).select(:reason).first
     return false unless row
 
     reason = row[:reason].to_s
@@ -600,9 +818,13 @@ class BackgroundTileLoader
     base_delay * (0.8 + rand * 0.4)
   end
 
-  def get_bounds_for_zoom(z)
-    bounds_str = @config[:bounds] || @route.dig(:metadata, :bounds) || "-180,-85.0511,180,85.0511"
-    GeometryTileCalculator.tiles_for_bounds_string(bounds_str, z)
+  # autoscan.bounds narrows the scan to part of the route's coverage; otherwise the route's
+  # index (config.ru builds it at startup) is shared
+  def coverage_for(route)
+    max_zoom = route[:maxzoom] || CoverageIndex::DEFAULT_MAX_ZOOM
+    return CoverageIndex.new(@config[:bounds], max_zoom) if @config[:bounds]
+
+    route[:coverage] || CoverageIndex.for_route(route) || CoverageIndex.new(CoverageIndex::WORLD_BOUNDS, max_zoom)
   end
 
   def load_progress(z)
@@ -658,6 +880,22 @@ class BackgroundTileLoader
     (1 << z) - 1 - y
   end
 
+  # LercFFI.lerc_to_terrain options: the route's encoding, reduction and lossless WebP are
+  # applied in the single native encode; lossy WebP still goes through convert_to_webp
+  def lerc_terrain_options
+    options = { encoding: @route.dig(:metadata, :encoding) || 'mapbox', format: 'png', png: 'fast' }
+    webp_config = @route[:webp_config] || {}
+    if output_format == 'webp' && webp_config[:lossless] != false && webp_config[:effort]
+      options[:format] = 'webp'
+      options[:effort] = webp_config[:effort]
+    end
+    if @route[:downsample_config]&.dig(:enabled)
+      options[:target_size] = @route[:downsample_config][:target_size]
+      options[:method] = @route[:downsample_config][:method]
+    end
+    options
+  end
+
   def convert_to_webp(data)
     webp_config = @route[:webp_config] || {}
     lossless = webp_config[:lossless].nil? ? true : webp_config[:lossless]
@@ -790,7 +1028,7 @@ class BackgroundTileLoader
   end
 
   def cached_tiles_count(z)
-    @route[:db][:tiles]
+    tile_db(z)[:tiles]
       .where(zoom_level: z)
       .exclude(generated: -1)
       .count
@@ -799,7 +1037,7 @@ class BackgroundTileLoader
   def zoom_complete?(z)
     expected = expected_tiles_count(z)
     actual_tiles = cached_tiles_count(z)
-    errors = @route[:db][:misses].where(zoom_level: z).count
+    errors = tile_db(z)[:misses].where(zoom_level: z).count
     processed = actual_tiles + errors
 
     row = @route[:db][:tile_scan_progress].where(source: @source_name, zoom_level: z).first
@@ -818,10 +1056,7 @@ class BackgroundTileLoader
     end
   end
 
-  def expected_tiles_count(z)
-    bounds_str = @config[:bounds] || @route.dig(:metadata, :bounds) || "-180,-85.0511,180,85.0511"
-    GeometryTileCalculator.count_tiles_in_bounds_string(bounds_str, z)
-  end
+  def expected_tiles_count(z) = @coverage.count(z)
 
   def reset_zoom_progress(z)
     @route[:db][:tile_scan_progress].where(source: @source_name, zoom_level: z).update(
@@ -852,17 +1087,69 @@ class BackgroundTileLoader
   end
 
   def perform_tile_fetch(x, y, z)
+    if @metatile && (url = Metatile.url(@metatile, @route, z, x, y))
+      result = perform_metatile_fetch(x, y, z, url)
+      return result if result
+    end
+
+    fetched = request_upstream_tile(x, y, z, @route[:client], get_headers)
+    fetched[:result] || process_upstream_response(fetched, x, y, z)
+  end
+
+  # One request for the block around x/y (Metatile); the block's other tiles are saved here,
+  # so the scan skips them as cached and they do not count against daily_limit. nil when
+  # the block's image has to be fetched tile by tile.
+  def perform_metatile_fetch(x, y, z, url)
+    fetched = request_upstream_tile(x, y, z, @route[:client], get_headers, url: url)
+    result = fetched[:result] || process_upstream_response(fetched, x, y, z, metatile: true)
+    return result unless result[:success]
+
+    tiles = Metatile.slice(@metatile, @route, result[:data], x, y)
+    if tiles.nil?
+      return { success: false, status: 200, reason: 'corrupted', details: 'Metatile image does not decode', body: nil }
+    elsif tiles == false
+      LOGGER.warn("event=autoscan_metatile_unsupported source=#{@source_name} z=#{z} x=#{x} y=#{y}")
+      return nil
+    end
+
+    store = lambda do
+      tiles.each do |(tx, ty), data|
+        next if [tx, ty] == [x, y] || !@coverage.cover?(z, tx, ty) || tile_exists?(tx, ty, z)
+
+        validate_and_save_tile(z, tx, ty, data)
+      end
+    end
+    @route[:write_queue] ? store.call : tile_db(z).transaction(&store)
+    result.merge(data: tiles[[x, y]])
+  end
+
+  # Request stage of a fetch: { response:, duration_ms:, started_at:, finished_at: }, or
+  # { result:, duration_ms: } with the fetch_error result when the request itself failed.
+  # url: the metatile request instead of the tile's
+  def request_upstream_tile(x, y, z, client, headers, url: nil)
     started_at = Observability.monotonic_time
     wall_started_at = Time.now.utc
-    target_url = @route[:target].gsub('{z}', z.to_s).gsub('{x}', x.to_s).gsub('{y}', y.to_s)
-    target_url += "?#{URI.encode_www_form(@route[:query_params])}" if @route[:query_params]
-    headers = get_headers
+    target_url = url || @route[:target].gsub('{z}', z.to_s).gsub('{x}', x.to_s).gsub('{y}', y.to_s)
+    target_url += "?#{URI.encode_www_form(@route[:query_params])}" if @route[:query_params] && !url
 
-    begin
-      response, duration_ms, upstream_started_at, upstream_finished_at = Observability.measure_duration do
-        @route[:client].get(target_url, nil, headers)
-      end
+    response, duration_ms, upstream_started_at, upstream_finished_at = Observability.measure_duration do
+      client.get(target_url, nil, headers)
+    end
+    { response: response, duration_ms: duration_ms, started_at: upstream_started_at, finished_at: upstream_finished_at }
+  rescue => e
+    result = fetch_exception_result(e, x, y, z, started_at, wall_started_at)
+    { result: result, duration_ms: ((Observability.monotonic_time - started_at) * 1000).round }
+  end
+
+  # Decode and convert stage of a fetch: the result hash perform_tile_fetch returns. A
+  # metatile's image is returned unconverted; Metatile.slice encodes its tiles
+  def process_upstream_response(fetched, x, y, z, metatile: false)
+    started_at = Observability.monotonic_time
+    wall_started_at = fetched[:started_at]
+    response, duration_ms, upstream_started_at, upstream_finished_at =
+      fetched.values_at(:response, :duration_ms, :started_at, :finished_at)
 
+    begin
       if response.status == 204
         result = {
           success: false,
@@ -908,7 +1195,9 @@ class BackgroundTileLoader
         end
 
         begin
-          decoded = LercFFI.lerc_to_mapbox_png(data)
+          lerc_options = lerc_terrain_options
+          decoded = LercFFI.lerc_to_terrain(data, **lerc_options)
+          TileStageMetrics.record_native(@source_name, LercFFI, 'lerc_to_terrain')
           if decoded.nil?
             result = {
               success: false,
@@ -921,7 +1210,7 @@ class BackgroundTileLoader
             return result
           end
           data = decoded
-          current_format = 'png'
+          current_format = lerc_options[:format]
         rescue => e
           result = {
             success: false,
@@ -950,7 +1239,9 @@ class BackgroundTileLoader
 
       target_format = output_format
 
-      if @route[:downsample_config]&.dig(:enabled) && data && !data.empty?
+      if metatile
+        # Sliced and encoded by perform_metatile_fetch
+      elsif @route[:downsample_config]&.dig(:enabled) && !lerc_options&.key?(:target_size) && data && !data.empty?
         begin
           encoding = @route[:metadata][:encoding]
           target_size = @route[:downsample_config][:target_size]
@@ -961,7 +1252,8 @@ class BackgroundTileLoader
             data = img.write_to_buffer('.png')
           end
 
-          data = TerrainDownsampleFFI.downsample_png(data, target_size, encoding, method)
+          data = TerrainDownsampleFFI.downsample_png(data, target_size, encoding, method, png: 'fast')
+          TileStageMetrics.record_native(@source_name, TerrainDownsampleFFI, 'downsample_png')
 
           if target_format == 'webp'
             data = convert_to_webp(data)
@@ -977,7 +1269,7 @@ class BackgroundTileLoader
           observe_upstream_fetch_result(result, response, duration_ms, z, x, y, started_at: upstream_started_at, finished_at: upstream_finished_at, error_class: e.class.name, error: e.message)
           return result
         end
-      elsif target_format == 'webp'
+      elsif target_format == 'webp' && !(lerc_options && current_format == 'webp')
         begin
           data = convert_to_webp(data)
         rescue => e
@@ -999,31 +1291,34 @@ class BackgroundTileLoader
       observe_upstream_fetch_result(result, response, duration_ms, z, x, y, started_at: upstream_started_at, finished_at: upstream_finished_at)
       result
     rescue => e
-      result = {
-        success: false,
-        status: 500,
-        reason: 'fetch_error',
-        details: "Background fetch error: #{e.message}",
-        body: nil
-      }
-      UpstreamObservability.record(
-        source: @source_name,
-        z: z,
-        x: x,
-        y: y,
-        status: 0,
-        reason: 'autoscan_fetch_exception',
-        duration_ms: ((Observability.monotonic_time - started_at) * 1000).round,
-        started_at: wall_started_at,
-        finished_at: Time.now.utc,
-        host: Observability.upstream_host(@route[:target]),
-        error_class: e.class.name,
-        error: e.message
-      )
-      result
+      fetch_exception_result(e, x, y, z, started_at - duration_ms / 1000.0, wall_started_at)
     end
   end
 
+  def fetch_exception_result(error, x, y, z, started_at, wall_started_at)
+    UpstreamObservability.record(
+      source: @source_name,
+      z: z,
+      x: x,
+      y: y,
+      status: 0,
+      reason: 'autoscan_fetch_exception',
+      duration_ms: ((Observability.monotonic_time - started_at) * 1000).round,
+      started_at: wall_started_at,
+      finished_at: Time.now.utc,
+      host: Observability.upstream_host(@route[:target]),
+      error_class: error.class.name,
+      error: error.message
+    )
+    {
+      success: false,
+      status: 500,
+      reason: 'fetch_error',
+      details: "Background fetch error: #{error.message}",
+      body: nil
+    }
+  end
+
   def observe_upstream_fetch_result(result, response, duration_ms, z, x, y, started_at: nil, finished_at: nil, **attrs)
     UpstreamObservability.record(
       source: @source_name,
@@ -1073,19 +1368,23 @@ class BackgroundTileLoader
   end
 
   def save_tile_to_db(z, x, y, data)
-    @route[:db][:tiles].insert_conflict(
-      target: [:zoom_level, :tile_column, :tile_row],
-      update: {
-        tile_data: Sequel[:excluded][:tile_data],
+    write_tile_row(z, x, y, data)
+    @route[:tile_cache]&.invalidate(z, x, tms_y(z, y))
+    @route[:tile_variants]&.invalidate(z, x, tms_y(z, y))
+  end
+
+  def write_tile_row(z, x, y, data)
+    return @route[:write_queue].save_tile(z, x, tms_y(z, y), data) if @route[:write_queue]
+
+    TileStageMetrics.measure(@source_name, :store) do
+      TileStorage.upsert(tile_db(z)).insert(
+        zoom_level: z,
+        tile_column: x,
+        tile_row: tms_y(z, y),
+        tile_data: Sequel.blob(data),
         updated_at: Sequel.lit("datetime('now', 'utc')")
-      }
-    ).insert(
-      zoom_level: z,
-      tile_column: x,
-      tile_row: tms_y(z, y),
-      tile_data: Sequel.blob(data),
-      updated_at: Sequel.lit("datetime('now', 'utc')")
-    )
+      )
+    end
   end
 
   def record_permanent_miss(x, y, z, result)
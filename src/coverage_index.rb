@@ -0,0 +1,60 @@
+# frozen_string_literal: true
+
+require_relative 'geometry_tile_calculator'
+
+# Tile coverage of a bounds string ("west,south,east,north"), precomputed per zoom. The float
+# projection of GeometryTileCalculator runs once per zoom when the index is built and leaves
+# sorted, disjoint x-runs of integer tile ranges, [min_x, max_x, min_y, max_y] — one per
+# bbox segment, two when the bounds cross the antimeridian, merged where they touch.
+# cover? is a binary search over the runs of a zoom; autoscan and the stats iterate and count
+# the same runs, so every consumer agrees on what is covered.
+#
+# The index is immutable once built and shared by the request threads without locking.
+# Zooms above max_zoom are computed on each call rather than cached.
+class CoverageIndex
+  WORLD_BOUNDS = '-180,-85.0511,180,85.0511'
+  DEFAULT_MAX_ZOOM = 20
+
+  attr_reader :bounds
+
+  # Index of the route's metadata bounds; nil when the route has none (everything is covered)
+  def self.for_route(route)
+    bounds_str = route.dig(:metadata, :bounds)
+    bounds_str && new(bounds_str, route[:maxzoom] || DEFAULT_MAX_ZOOM)
+  end
+
+  def initialize(bounds_str, max_zoom = DEFAULT_MAX_ZOOM)
+    @bounds = bounds_str
+    @zooms = (0..max_zoom).map { build_runs(_1) }.freeze
+  end
+
+  def cover?(z, x, y)
+    run = runs(z).bsearch { |_min_x, max_x, _min_y, _max_y| max_x >= x }
+    !run.nil? && x >= run[0] && y >= run[2] && y <= run[3]
+  end
+
+  def runs(z) = (z >= 0 && @zooms[z]) || build_runs(z)
+
+  # The runs of a zoom as the boundary hashes of GeometryTileCalculator.tiles_for_bbox
+  def segments(z) = runs(z).map { |min_x, max_x, min_y, max_y| { min_x:, min_y:, max_x:, max_y: } }
+
+  def count(z) = runs(z).sum { |min_x, max_x, min_y, max_y| (max_x - min_x + 1) * (max_y - min_y + 1) }
+
+  private
+
+  # Both segments of an antimeridian bbox share their latitude range, so runs that touch or
+  # overlap (bounds wider than 360°) merge into one and the x-runs stay disjoint
+  def build_runs(z)
+    boundaries = GeometryTileCalculator.tiles_for_bounds_string(@bounds, z)
+    runs = boundaries.values.filter_map { _1[z]&.values_at(:min_x, :max_x, :min_y, :max_y) }.sort
+
+    runs.each_with_object([]) do |run, merged|
+      last = merged.last
+      if last && run[0] <= last[1] + 1 && run.values_at(2, 3) == last.values_at(2, 3)
+        last[1] = [last[1], run[1]].max
+      else
+        merged << run
+      end
+    end.each(&:freeze).freeze
+  end
+end
@@ -2,22 +2,29 @@ require 'sequel'
 Sequel.extension :migration
 require_relative 'metadata_manager'
 require_relative 'observability_setup'
+require_relative 'tile_write_queue'
+require_relative 'tile_cache'
+require_relative 'miss_index'
+require_relative 'tile_storage'
+require_relative 'tile_stats'
+require_relative 'tile_changes'
+require_relative 'tile_locks'
+require_relative 'tile_shards'
 
 module DatabaseManager
   extend self
 
-  def setup_route_database(route, route_name)
-    db_path = "sqlite://" + route[:mbtiles_file]
-    db = Sequel.connect(db_path, max_connections: 20, **Observability.sql_logging_options)
+  # Keys setup_route_database sets on the route
+  ROUTE_KEYS = %i[db content_type tile_size tile_shards write_queue tile_locks tile_cache miss_index blob_reader].freeze
 
-    Observability.configure_sql_logging(db)
-    configure_sqlite_pragmas(db)
-    create_tables(db)
-    apply_migrations(db)
+  # A setup that fails partway stops and closes what it had started (writer threads, sweepers,
+  # readers, connections) and puts the route's keys back, so a retry starts from nothing
+  def setup_route_database(route, route_name)
+    configured = route.slice(*ROUTE_KEYS) # miss_index also names the index's config block
+    started = []
+    db = open_database(route[:mbtiles_file], route, route_name).tap { started << _1 }
     route[:db] = db
     
-    integrate_wal_files(db, route_name)
-    
     MetadataManager.sync_metadata(db, route, route_name)
     
     format_value = db[:metadata].where(name: 'format').get(:value)
@@ -26,12 +33,149 @@ module DatabaseManager
     tile_size_value = db[:metadata].where(name: 'tileSize').get(:value)
     route[:tile_size] = tile_size_value ? tile_size_value.to_i : nil
 
-    route[:locks] = Hash.new { |h,k| h[k] = Mutex.new }
+    route[:tile_shards] = TileShards.open(route, route_name) { |file, name| open_database(file, route, name).tap { started << _1 } }
+    files = route[:tile_shards]&.map { [_1.db, _1.file, _1.name] } || [[db, route[:mbtiles_file], route_name]]
+
+    queues = files.map { |shard_db, _, name| create_write_queue(shard_db, route, name) }.tap { started.concat(_1.compact) }
+    route[:write_queue] = TileShards.combine(route, queues, TileShards::WriteQueue)
+    locks = files.zip(queues).map { |(shard_db, _, name), queue| create_tile_locks(shard_db, route, name, queue) }
+    route[:tile_locks] = TileShards.combine(route, locks, TileShards::Locks)
+    route[:tile_cache] = create_tile_cache(route, route_name)
+    indexes = files.map { |shard_db, _, name| create_miss_index(shard_db, route, name) }.tap { started.concat(_1.compact) }
+    route[:miss_index] = TileShards.combine(route, indexes, TileShards::MissIndex)
+    readers = files.map { |shard_db, file, name| create_blob_reader(shard_db, file, route, name) }.tap { started.concat(_1.compact) }
+    route[:blob_reader] = TileShards.combine(route, readers, TileShards::BlobReader)
+    readers.compact.each(&:close) unless route[:blob_reader] # Blob I/O for all of the files or none
+
+    db
+  rescue
+    release(started.reverse, route_name)
+    ROUTE_KEYS.each { route.delete(_1) }
+    route.merge!(configured)
+    raise
+  end
+
+  # Stops and closes what setup_route_database built (a later step of open_route failing,
+  # shutdown); the queued writes are committed before the connections go
+  def close_route_database(route, route_name)
+    return unless route[:db] # Not set up (miss_index is still its config block)
 
+    components = [route[:miss_index], route[:blob_reader], route[:write_queue], *TileShards.dbs(route)]
+    release(components.compact, route_name)
+  end
+
+  # Connection to one of the route's files (its mbtiles_file or a shard), brought to the
+  # current schema with its WAL checkpointed; disconnected again when that fails
+  def open_database(file, route, name)
+    db = Sequel.connect("sqlite://" + file, max_connections: 20, tile_storage: TileStorage.layout(route),
+                                            after_connect: TileStorage.method(:register_functions),
+                                            **Observability.sql_logging_options)
+
+    Observability.configure_sql_logging(db)
+    configure_sqlite_pragmas(db)
+    create_tables(db)
+    apply_migrations(db)
+    TileStorage.configure(db, name)
+    TileStats.install(db)
+    route.dig(:gap_filling, :enabled) ? TileChanges.install(db) : TileChanges.uninstall(db)
+    integrate_wal_files(db, name)
     db
+  rescue
+    db&.disconnect
+    raise
+  end
+
+  # Write-behind queue for tiles, misses and reconstruction writes (write_behind.enabled: false
+  # keeps every write inline)
+  def create_write_queue(db, route, route_name)
+    config = route[:write_behind] || {}
+    return nil if config[:enabled] == false
+
+    TileWriteQueue.new(
+      db, route_name.to_s,
+      max_rows: config[:max_rows] || TileWriteQueue::DEFAULT_MAX_ROWS,
+      flush_interval_ms: config[:flush_ms] || TileWriteQueue::DEFAULT_FLUSH_MS
+    )
   end
 
-  def vacuum_all_databases(routes) = routes.each { |name, route| vacuum_database(route[:db], name) }
+  # Coalescing of cache misses: per process, and across workers and replicas sharing the
+  # file through lease rows (coalescing.shared: false keeps it per process)
+  def create_tile_locks(db, route, route_name, write_queue = route[:write_queue])
+    config = route[:coalescing] || {}
+    TileLocks.new(
+      db, route_name.to_s,
+      shared: config[:shared] != false,
+      write_queue: write_queue,
+      lease_ttl: config[:lease_ttl] || TileLocks::DEFAULT_LEASE_TTL,
+      wait_timeout: config[:wait_timeout] || TileLocks::DEFAULT_WAIT,
+      poll_ms: config[:poll_ms] || TileLocks::DEFAULT_POLL_MS
+    ).tap(&:register_metrics)
+  end
+
+  # Hot-tile cache in front of the tiles table (memory_cache.enabled: false turns it off)
+  def create_tile_cache(route, route_name)
+    config = route[:memory_cache] || {}
+    return nil if config[:enabled] == false
+
+    TileCache.new(max_bytes: (config[:max_mb] || TileCache::DEFAULT_MAX_MB) << 20, ttl: config[:ttl]).tap do |cache|
+      cache.register_metrics(route_name.to_s)
+    end
+  end
+
+  # Negative index over the misses table with a background sweep of expired misses
+  # (miss_index.enabled: false looks up and expires misses in SQLite on every request)
+  def create_miss_index(db, route, route_name)
+    config = route[:miss_index] || {}
+    return nil if config[:enabled] == false
+
+    MissIndex.new(
+      db, route_name.to_s,
+      timeout: route[:miss_timeout] || 300,
+      recent_entries: config[:recent_entries] || MissIndex::DEFAULT_RECENT_ENTRIES,
+      sweep_interval: config[:sweep_interval] || MissIndex::DEFAULT_SWEEP_INTERVAL,
+      ttl: config[:ttl]
+    ).load.tap do |index|
+      index.register_metrics
+      index.start_sweeper
+    end
+  end
+
+  # Tile reads through SQLite blob I/O for the serving path (blob_io.enabled: false reads
+  # through Sequel). Needs the tile_blob extension and a sqlite3 gem built against the system
+  # SQLite; otherwise tiles are read through Sequel as before.
+  def create_blob_reader(db, file, route, route_name)
+    return nil if route.dig(:blob_io, :enabled) == false
+    return nil unless defined?(TileBlobFFI)
+
+    unless TileBlobFFI.available?
+      LOGGER.info("event=tile_blob_io_unavailable source=#{route_name} reason=sqlite_symbols_not_exported")
+      return nil
+    end
+
+    TileBlobFFI::Reader.new(file, *TileStorage.blob_lookup(db))
+  rescue TileBlobFFI::Error => e
+    LOGGER.warn("event=tile_blob_io_unavailable source=#{route_name} error=#{e.message}")
+    nil
+  end
+
+  # Each component is released even when an earlier one fails
+  def release(components, route_name)
+    components.each do |component|
+      case component
+      when Sequel::Database then component.disconnect
+      when MissIndex, TileShards::MissIndex then component.stop_sweeper
+      else component.close # Write queues and blob readers
+      end
+    rescue => e
+      LOGGER.warn("event=route_release_failed source=#{route_name} component=#{component.class} error=#{e.message}")
+    end
+  end
+
+  def vacuum_all_databases(routes)
+    routes.each do |name, route|
+      (route[:tile_shards]&.map { [_1.db, _1.name] } || [[route[:db], name]]).each { |db, db_name| vacuum_database(db, db_name) }
+    end
+  end
 
   def vacuum_database(db, name = nil)
     name_str = name ? " for #{name}" : ""
@@ -60,18 +204,26 @@ module DatabaseManager
 
   def record_miss(route, z, x, y, reason, details, status, body)
     tile_row = (1 << z) - 1 - y
+    ts = Time.now.to_i
+    route[:miss_index]&.record(z, x, tile_row, ts: ts, status: status, reason: reason)
 
-    route[:db][:misses].where(
+    if (queue = route[:write_queue])
+      queue.record_miss(z, x, tile_row, ts: ts, reason: reason, details: details, status: status, response_body: body)
+      return log_problem_miss(route, z, x, y, reason, status, details)
+    end
+
+    db = TileShards.db(route, z)
+    db[:misses].where(
       zoom_level: z,
       tile_column: x,
       tile_row: tile_row
     ).delete
 
-    route[:db][:misses].insert(
+    db[:misses].insert(
       zoom_level: z,
       tile_column: x,
       tile_row: tile_row,
-      ts: Time.now.to_i,
+      ts: ts,
       reason: reason,
       details: details,
       status: status,
@@ -132,11 +284,22 @@ module DatabaseManager
       index [:zoom_level, :status], name: :idx_misses_zoom_status
       index :ts, name: :idx_misses_ts
     }
+    db.create_table?(:tile_locks) {
+      Integer :zoom_level, null: false
+      Integer :tile_column, null: false
+      Integer :tile_row, null: false
+      String :owner, null: false
+      String :token, null: false
+      Integer :expires_at, null: false
+      primary_key [:zoom_level, :tile_column, :tile_row], name: :tile_locks_pk
+    }
   end
 
   def apply_migrations(db)
     migrations_path = File.join(__dir__, 'migrations')
     return unless Dir.exist?(migrations_path) && !Dir[File.join(migrations_path, '*.rb')].empty?
+    # schema_info records the applied version, so a file that is current is never scanned again
+    return if Sequel::Migrator.is_current?(db, migrations_path, table: :schema_info)
 
     otl_span('db.migrations', {}) do
       Sequel::Migrator.run(db, migrations_path, table: :schema_info)
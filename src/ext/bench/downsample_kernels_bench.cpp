@@ -0,0 +1,234 @@
+// Microbenchmark for the terrain 2×2 reduction kernels.
+// Compares the legacy per-pixel float path against the specialized kernels and the
+// scalar code-domain reference on a synthetic 512×512 source (one reconstructed 256 px parent tile).
+// With 'check' it only verifies them and exits non-zero on a failure: the vector row kernels
+// must match the scalar ones bit for bit (row widths around the 8-pixel step, every 24-bit
+// code), and the specialized kernels must stay within one code unit of the legacy float path.
+#include "../terrain_downsample_kernels.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+constexpr int SOURCE_SIZE = 512;
+constexpr int TARGET_SIZE = SOURCE_SIZE / 2;
+
+std::vector<std::uint8_t> make_source(bool is_terrarium) {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> noise(-5.0f, 5.0f);
+    std::vector<std::uint8_t> rgb(static_cast<std::size_t>(SOURCE_SIZE) * SOURCE_SIZE * 3);
+    for (int y = 0; y < SOURCE_SIZE; ++y) {
+        for (int x = 0; x < SOURCE_SIZE; ++x) {
+            const float elevation = 1500.0f * std::sin(x * 0.02f) * std::cos(y * 0.015f) + noise(rng);
+            std::uint8_t* p = rgb.data() + (static_cast<std::size_t>(y) * SOURCE_SIZE + x) * 3;
+            if (is_terrarium) {
+                encode_terrarium(elevation, p[0], p[1], p[2]);
+            } else {
+                encode_mapbox_terrain_rgb(elevation, p[0], p[1], p[2]);
+            }
+        }
+    }
+    return rgb;
+}
+
+// Pre-specialization reference: per-pixel method switch and encoding branch, float decode/encode
+void legacy_downsample_rgb(const std::uint8_t* input_ptr, int source_width, int scale_factor,
+                           std::uint8_t* output_ptr, int target_size,
+                           bool is_terrarium, DownsampleMethod method) {
+    const auto decode = [&](int x, int y) {
+        const std::uint8_t* p = input_ptr + (y * source_width + x) * 3;
+        return is_terrarium ? decode_terrarium(p[0], p[1], p[2]) : decode_mapbox_terrain_rgb(p[0], p[1], p[2]);
+    };
+
+    for (int out_y = 0; out_y < target_size; ++out_y) {
+        for (int out_x = 0; out_x < target_size; ++out_x) {
+            const int src_x = out_x * scale_factor;
+            const int src_y = out_y * scale_factor;
+            std::uint8_t r = 0, g = 0, b = 0;
+
+            if (method == DownsampleMethod::Nearest) {
+                const std::uint8_t* p = input_ptr + (src_y * source_width + src_x) * 3;
+                r = p[0];
+                g = p[1];
+                b = p[2];
+            } else {
+                const float e00 = decode(src_x, src_y), e10 = decode(src_x + 1, src_y);
+                const float e01 = decode(src_x, src_y + 1), e11 = decode(src_x + 1, src_y + 1);
+                const float value = method == DownsampleMethod::Maximum
+                    ? std::max({e00, e10, e01, e11})
+                    : (e00 + e10 + e01 + e11) * 0.25f;
+                if (is_terrarium) {
+                    encode_terrarium(value, r, g, b);
+                } else {
+                    encode_mapbox_terrain_rgb(value, r, g, b);
+                }
+            }
+
+            *output_ptr++ = r;
+            *output_ptr++ = g;
+            *output_ptr++ = b;
+        }
+    }
+}
+
+template <typename Fn>
+double time_ns_per_tile(Fn&& fn, int iterations) {
+    fn();
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) fn();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+void run_rows(ReduceRow2x2Fn reduce, const std::vector<std::uint8_t>& src, std::vector<std::uint8_t>& dst) {
+    const std::size_t in_stride = SOURCE_SIZE * 3u;
+    for (int out_y = 0; out_y < TARGET_SIZE; ++out_y) {
+        const std::uint8_t* row0 = src.data() + 2 * out_y * in_stride;
+        reduce(row0, row0 + in_stride, dst.data() + out_y * TARGET_SIZE * 3u, TARGET_SIZE);
+    }
+}
+
+ReduceRow2x2Fn portable_row_kernel(DownsampleMethod method) {
+    return method == DownsampleMethod::Maximum ? reduce_row_2x2_codes_portable<DownsampleMethod::Maximum>
+                                               : reduce_row_2x2_codes_portable<DownsampleMethod::Average>;
+}
+
+ReduceRow2x2Fn dispatched_row_kernel(DownsampleMethod method) {
+    return method == DownsampleMethod::Maximum ? reduce_row_2x2<DownsampleMethod::Maximum>()
+                                               : reduce_row_2x2<DownsampleMethod::Average>();
+}
+
+std::size_t mismatches(const std::vector<std::uint8_t>& a, const std::vector<std::uint8_t>& b) {
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < a.size(); i += 3) {
+        if (a[i] != b[i] || a[i + 1] != b[i + 1] || a[i + 2] != b[i + 2]) ++count;
+    }
+    return count;
+}
+
+const char* method_name(DownsampleMethod method) {
+    switch (method) {
+        case DownsampleMethod::Nearest: return "nearest";
+        case DownsampleMethod::Maximum: return "maximum";
+        case DownsampleMethod::Average: break;
+    }
+    return "average";
+}
+
+// Largest difference of the packed 24-bit codes of two images
+long max_code_difference(const std::vector<std::uint8_t>& a, const std::vector<std::uint8_t>& b) {
+    long largest = 0;
+    for (std::size_t i = 0; i < a.size(); i += 3) {
+        largest = std::max(largest, std::labs(static_cast<long>(rgb_code(&a[i])) - static_cast<long>(rgb_code(&b[i]))));
+    }
+    return largest;
+}
+
+int check_kernels() {
+    int failures = 0;
+    std::mt19937 rng(7);
+
+    // Any 24-bit code, at widths that end inside and on the vector step
+    std::uniform_int_distribution<std::uint32_t> any_code(0, 0xFFFFFF);
+    for (const int target : {1, 7, 8, 9, 15, 16, 17, 31, 255, 256}) {
+        const std::size_t in_stride = static_cast<std::size_t>(target) * 6u;
+        std::vector<std::uint8_t> rows(in_stride * 2 + 32); // Slack the vector loads may read
+        for (std::size_t i = 0; i + 3 <= in_stride * 2; i += 3) store_rgb_code(any_code(rng), &rows[i]);
+
+        for (const DownsampleMethod method : {DownsampleMethod::Average, DownsampleMethod::Maximum}) {
+            std::vector<std::uint8_t> scalar(static_cast<std::size_t>(target) * 3u), vector(scalar.size());
+            portable_row_kernel(method)(rows.data(), rows.data() + in_stride, scalar.data(), target);
+            dispatched_row_kernel(method)(rows.data(), rows.data() + in_stride, vector.data(), target);
+            if (scalar != vector) {
+                std::printf("FAIL vector/scalar %s width %d: %zu pixels differ\n", method_name(method), target, mismatches(scalar, vector));
+                ++failures;
+            }
+        }
+    }
+
+    // Rough terrain over the elevations tiles carry, against the pre-specialization float path
+    for (const bool is_terrarium : {false, true}) {
+        std::uniform_real_distribution<float> elevation(-450.0f, 8800.0f);
+        std::vector<std::uint8_t> src(static_cast<std::size_t>(SOURCE_SIZE) * SOURCE_SIZE * 3);
+        for (std::size_t i = 0; i < src.size(); i += 3) {
+            if (is_terrarium) {
+                encode_terrarium(elevation(rng), src[i], src[i + 1], src[i + 2]);
+            } else {
+                encode_mapbox_terrain_rgb(elevation(rng), src[i], src[i + 1], src[i + 2]);
+            }
+        }
+
+        for (const DownsampleMethod method : {DownsampleMethod::Nearest, DownsampleMethod::Average, DownsampleMethod::Maximum}) {
+            std::vector<std::uint8_t> legacy(TARGET_SIZE * TARGET_SIZE * 3u), specialized(legacy.size());
+            legacy_downsample_rgb(src.data(), SOURCE_SIZE, 2, legacy.data(), TARGET_SIZE, is_terrarium, method);
+            select_downsample_kernel(is_terrarium, method)(src.data(), SOURCE_SIZE, 2, specialized.data(), TARGET_SIZE);
+
+            // The code-domain mean rounds exactly; the float path may land one code off
+            const long tolerance = method == DownsampleMethod::Average ? 1 : 0;
+            if (const long difference = max_code_difference(legacy, specialized); difference > tolerance) {
+                std::printf("FAIL legacy %s %s: %ld codes apart\n", is_terrarium ? "terrarium" : "mapbox", method_name(method), difference);
+                ++failures;
+            }
+        }
+    }
+
+    std::printf("kernel check: %s (%s vector kernel)\n", failures ? "FAILED" : "ok",
+                dispatched_row_kernel(DownsampleMethod::Average) != portable_row_kernel(DownsampleMethod::Average) ? "with" : "without");
+    return failures ? 1 : 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc > 1 && std::string_view(argv[1]) == "check") return check_kernels();
+
+    const int iterations = argc > 1 ? std::atoi(argv[1]) : 2000;
+    const bool vectorized = dispatched_row_kernel(DownsampleMethod::Average) != portable_row_kernel(DownsampleMethod::Average);
+    int exit_code = 0;
+
+    std::printf("%-10s %-8s %12s %12s %12s %9s %s\n",
+                "encoding", "method", "legacy ns", "scalar ns", "kernel ns", "speedup", "mismatch(legacy/scalar)");
+
+    for (const bool is_terrarium : {false, true}) {
+        const std::vector<std::uint8_t> src = make_source(is_terrarium);
+
+        for (const DownsampleMethod method : {DownsampleMethod::Nearest, DownsampleMethod::Average, DownsampleMethod::Maximum}) {
+            const DownsampleKernel kernel = select_downsample_kernel(is_terrarium, method);
+            std::vector<std::uint8_t> legacy(TARGET_SIZE * TARGET_SIZE * 3u);
+            std::vector<std::uint8_t> scalar(legacy.size());
+            std::vector<std::uint8_t> specialized(legacy.size());
+
+            const double legacy_ns = time_ns_per_tile([&] {
+                legacy_downsample_rgb(src.data(), SOURCE_SIZE, 2, legacy.data(), TARGET_SIZE, is_terrarium, method);
+            }, iterations);
+            const double kernel_ns = time_ns_per_tile([&] {
+                kernel(src.data(), SOURCE_SIZE, 2, specialized.data(), TARGET_SIZE);
+            }, iterations);
+
+            // Vector and scalar code kernels must agree bit for bit; the float path may differ by one code on ties
+            double scalar_ns = 0.0;
+            std::size_t scalar_diff = 0;
+            if (method == DownsampleMethod::Nearest) {
+                scalar = legacy;
+                scalar_diff = mismatches(legacy, specialized);
+            } else {
+                scalar_ns = time_ns_per_tile([&] { run_rows(portable_row_kernel(method), src, scalar); }, iterations);
+                scalar_diff = mismatches(scalar, specialized);
+            }
+            if (scalar_diff != 0) exit_code = 1;
+
+            std::printf("%-10s %-8s %12.0f %12.0f %12.0f %8.1fx %zu/%zu\n",
+                        is_terrarium ? "terrarium" : "mapbox", method_name(method),
+                        legacy_ns, scalar_ns, kernel_ns, legacy_ns / kernel_ns,
+                        mismatches(legacy, specialized), scalar_diff);
+        }
+    }
+
+    std::printf("vector kernel: %s\n", vectorized ? "enabled" : "unavailable (scalar fallback)");
+    return exit_code;
+}
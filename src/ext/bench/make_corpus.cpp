@@ -0,0 +1,197 @@
+// Writes the benchmark corpus (bench/corpus) with the codecs the extensions read:
+// one 2×2 quad of children per set, all cut from the same deterministic heightfield, so
+// every run and every machine measures the same bytes.
+//   lerc/       ArcGIS-style 257×257 float elevation, maxZError 0.1 m (libLerc)
+//   mapbox/     Mapbox Terrain-RGB children, PNG and lossless WebP
+//   terrarium/  Terrarium children, PNG and lossless WebP
+//   imagery/    opaque RGB imagery children (PNG) and lossy WebP q75, plus one RGBA quad with
+//               a transparent edge (imagery_alpha/)
+// Children are numbered in the order of the quad calls: 0/1 the southern (bottom) half,
+// 2/3 the northern one, west before east.
+#include "../terrain_downsample_kernels.h"
+
+#include <Lerc_c_api.h>
+#include <png.h>
+#include <webp/encode.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+namespace {
+
+constexpr int TILE_SIZE = 256;
+constexpr int LERC_SIZE = 257;  // ArcGIS elevation tiles overlap their neighbour by one pixel
+constexpr int QUAD_SIZE = TILE_SIZE * 2;
+constexpr unsigned LERC_DT_FLOAT = 6;
+
+// Integer lattice hash → [0, 1)
+float lattice(int x, int y, int octave) {
+    std::uint32_t h = static_cast<std::uint32_t>(x) * 374761393u + static_cast<std::uint32_t>(y) * 668265263u +
+                      static_cast<std::uint32_t>(octave) * 2147483647u;
+    h = (h ^ (h >> 13)) * 1274126177u;
+    return static_cast<float>((h ^ (h >> 16)) & 0xffffff) / 16777216.0f;
+}
+
+float value_noise(float x, float y, int octave) {
+    const int x0 = static_cast<int>(std::floor(x)), y0 = static_cast<int>(std::floor(y));
+    const float fx = x - x0, fy = y - y0;
+    const float sx = fx * fx * (3 - 2 * fx), sy = fy * fy * (3 - 2 * fy);
+    const float top = lattice(x0, y0, octave) + sx * (lattice(x0 + 1, y0, octave) - lattice(x0, y0, octave));
+    const float bottom = lattice(x0, y0 + 1, octave) + sx * (lattice(x0 + 1, y0 + 1, octave) - lattice(x0, y0 + 1, octave));
+    return top + sy * (bottom - top);
+}
+
+// Mountain-like fBm in metres; (x, y) in pixels of the quad, y growing southwards
+float elevation(float x, float y) {
+    float sum = 0.0f, amplitude = 1.0f, frequency = 1.0f / 96.0f;
+    for (int octave = 0; octave < 5; ++octave) {
+        sum += amplitude * value_noise(x * frequency, y * frequency, octave);
+        amplitude *= 0.5f;
+        frequency *= 2.0f;
+    }
+    return 150.0f + 2400.0f * sum / 1.94f;
+}
+
+// Top-left pixel of quad child i (TMS order: children 2/3 are the northern half)
+void child_origin(int child, int& ox, int& oy) {
+    ox = (child % 2) * TILE_SIZE;
+    oy = child < 2 ? TILE_SIZE : 0;
+}
+
+bool write_file(const std::string& path, const void* data, std::size_t size) {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) return false;
+    const bool ok = std::fwrite(data, 1, size, file) == size;
+    return std::fclose(file) == 0 && ok;
+}
+
+bool write_png(const std::string& path, const std::uint8_t* pixels, int channels) {
+    png_image image{};
+    image.version = PNG_IMAGE_VERSION;
+    image.width = TILE_SIZE;
+    image.height = TILE_SIZE;
+    image.format = channels == 4 ? PNG_FORMAT_RGBA : PNG_FORMAT_RGB;
+
+    png_alloc_size_t size = 0;
+    if (!png_image_write_to_memory(&image, nullptr, &size, 0, pixels, 0, nullptr)) return false;
+    std::vector<std::uint8_t> out(size);
+    const bool ok = png_image_write_to_memory(&image, out.data(), &size, 0, pixels, 0, nullptr) != 0;
+    png_image_free(&image);
+    return ok && write_file(path, out.data(), size);
+}
+
+// quality < 0: lossless
+bool write_webp(const std::string& path, const std::uint8_t* pixels, int channels, float quality) {
+    std::uint8_t* out = nullptr;
+    const int stride = TILE_SIZE * channels;
+    std::size_t size = 0;
+    if (quality < 0) {
+        size = channels == 4 ? WebPEncodeLosslessRGBA(pixels, TILE_SIZE, TILE_SIZE, stride, &out)
+                             : WebPEncodeLosslessRGB(pixels, TILE_SIZE, TILE_SIZE, stride, &out);
+    } else {
+        size = channels == 4 ? WebPEncodeRGBA(pixels, TILE_SIZE, TILE_SIZE, stride, quality, &out)
+                             : WebPEncodeRGB(pixels, TILE_SIZE, TILE_SIZE, stride, quality, &out);
+    }
+    const bool ok = size > 0 && write_file(path, out, size);
+    WebPFree(out);
+    return ok;
+}
+
+bool write_lerc(const std::string& path, const std::vector<float>& grid) {
+    unsigned int size = 0;
+    if (lerc_computeCompressedSize(grid.data(), LERC_DT_FLOAT, 1, LERC_SIZE, LERC_SIZE, 1, 0, nullptr, 0.1, &size) != 0) {
+        return false;
+    }
+    std::vector<unsigned char> out(size);
+    unsigned int written = 0;
+    if (lerc_encode(grid.data(), LERC_DT_FLOAT, 1, LERC_SIZE, LERC_SIZE, 1, 0, nullptr, 0.1,
+                    out.data(), size, &written) != 0) {
+        return false;
+    }
+    return write_file(path, out.data(), written);
+}
+
+// Hillshaded, elevation-tinted "aerial" colour with some fine texture
+void imagery_pixel(float x, float y, std::uint8_t* rgb) {
+    const float e = elevation(x, y);
+    const float dx = elevation(x + 1, y) - elevation(x - 1, y);
+    const float dy = elevation(x, y + 1) - elevation(x, y - 1);
+    const float shade = std::clamp(0.75f - 0.004f * (dx - dy), 0.2f, 1.0f);
+    const float texture = 0.85f + 0.3f * lattice(static_cast<int>(x), static_cast<int>(y), 9);
+    const float t = std::clamp((e - 150.0f) / 2400.0f, 0.0f, 1.0f);
+    const float base[3] = {60 + 140 * t, 110 + 60 * t, 50 + 130 * t};
+    for (int c = 0; c < 3; ++c) {
+        rgb[c] = static_cast<std::uint8_t>(std::clamp(base[c] * shade * texture, 0.0f, 255.0f));
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const std::string root = argc > 1 ? argv[1] : "corpus";
+    for (const char* dir : {"", "/lerc", "/mapbox", "/terrarium", "/imagery", "/imagery_alpha"}) {
+        mkdir((root + dir).c_str(), 0755);
+    }
+
+    bool ok = true;
+    std::vector<std::uint8_t> rgb(static_cast<std::size_t>(TILE_SIZE) * TILE_SIZE * 3);
+    std::vector<std::uint8_t> rgba(static_cast<std::size_t>(TILE_SIZE) * TILE_SIZE * 4);
+    std::vector<float> grid(static_cast<std::size_t>(LERC_SIZE) * LERC_SIZE);
+
+    for (int child = 0; child < 4; ++child) {
+        int ox = 0, oy = 0;
+        child_origin(child, ox, oy);
+        const std::string name = std::to_string(child);
+
+        for (int y = 0; y < LERC_SIZE; ++y) {
+            for (int x = 0; x < LERC_SIZE; ++x) {
+                grid[static_cast<std::size_t>(y) * LERC_SIZE + x] = elevation(static_cast<float>(ox + x), static_cast<float>(oy + y));
+            }
+        }
+        ok &= write_lerc(root + "/lerc/" + name + ".lerc", grid);
+
+        for (const bool is_terrarium : {false, true}) {
+            for (int y = 0; y < TILE_SIZE; ++y) {
+                for (int x = 0; x < TILE_SIZE; ++x) {
+                    const float e = grid[static_cast<std::size_t>(y) * LERC_SIZE + x];
+                    std::uint8_t* p = rgb.data() + (static_cast<std::size_t>(y) * TILE_SIZE + x) * 3;
+                    if (is_terrarium) {
+                        encode_elevation<TerrainEncoding::Terrarium>(e, p);
+                    } else {
+                        encode_elevation<TerrainEncoding::Mapbox>(e, p);
+                    }
+                }
+            }
+            const std::string dir = root + (is_terrarium ? "/terrarium/" : "/mapbox/");
+            ok &= write_png(dir + name + ".png", rgb.data(), 3);
+            ok &= write_webp(dir + name + ".webp", rgb.data(), 3, -1.0f);
+        }
+
+        for (int y = 0; y < TILE_SIZE; ++y) {
+            for (int x = 0; x < TILE_SIZE; ++x) {
+                const std::size_t i = static_cast<std::size_t>(y) * TILE_SIZE + x;
+                imagery_pixel(static_cast<float>(ox + x), static_cast<float>(oy + y), rgb.data() + i * 3);
+                // Coverage ends along a diagonal through the quad, as at the edge of a survey
+                const bool covered = (ox + x) + (QUAD_SIZE - (oy + y)) < QUAD_SIZE + TILE_SIZE / 2;
+                for (int c = 0; c < 3; ++c) rgba[i * 4 + c] = covered ? rgb[i * 3 + c] : 0;
+                rgba[i * 4 + 3] = covered ? 255 : 0;
+            }
+        }
+        ok &= write_png(root + "/imagery/" + name + ".png", rgb.data(), 3);
+        ok &= write_webp(root + "/imagery/" + name + ".webp", rgb.data(), 3, 75.0f);
+        ok &= write_png(root + "/imagery_alpha/" + name + ".png", rgba.data(), 4);
+        ok &= write_webp(root + "/imagery_alpha/" + name + ".webp", rgba.data(), 4, 75.0f);
+    }
+
+    if (!ok) {
+        std::fprintf(stderr, "Failed to write the corpus to %s\n", root.c_str());
+        return 1;
+    }
+    std::printf("Corpus written to %s\n", root.c_str());
+    return 0;
+}
@@ -0,0 +1,83 @@
+# Training workload of the PGO build (pgo_build.sh): runs every extension built in ext/ over
+# the benchmark corpus with the option mix the service uses, so the profile covers each
+# encoding, reduction method, kernel, codec and the LERC 257→256 crop rather than one hot path.
+# Extensions that are not built are skipped.
+#   ruby ext/bench/pgo_training.rb [passes, default 3]
+
+CORPUS = File.join(__dir__, 'corpus')
+PASSES = (ARGV[0] || 3).to_i
+TERRAIN_ENCODINGS = %w[mapbox terrarium].freeze
+TERRAIN_METHODS = %w[average nearest maximum].freeze
+RASTER_KERNELS = %w[box nearest linear cubic mitchell lanczos2 lanczos3].freeze
+PNG_PRESETS = %w[fast default max].freeze
+
+def load_extension(name)
+  require_relative "../#{name}"
+  true
+rescue LoadError => e
+  warn "pgo_training: #{name} skipped (#{e.message})"
+  false
+end
+
+def corpus_quad(set, ext) = (0..3).map { |i| File.binread(File.join(CORPUS, set, "#{i}.#{ext}")) }
+
+# Partial quads are common at coverage edges: missing children take the fill paths
+def partial(quad) = [quad[0], nil, quad[2], nil]
+
+def train_lerc
+  blobs = (0..3).map { |i| File.binread(File.join(CORPUS, 'lerc', "#{i}.lerc")) }
+  PNG_PRESETS.each { |preset| blobs.each { |blob| LercFFI.lerc_to_mapbox_png(blob, png: preset) } }
+  TERRAIN_ENCODINGS.product(%w[png webp], [nil, 128, 64], TERRAIN_METHODS) do |encoding, format, target_size, method|
+    options = { encoding: encoding, format: format, png: 'fast', target_size: target_size, method: method }.compact
+    blobs.each { |blob| LercFFI.lerc_to_terrain(blob, **options) }
+  end
+  LercFFI.lerc_to_mapbox_png_batch(blobs, png: 'fast')
+  LercFFI.lerc_to_terrain_batch(blobs * 2, encoding: 'terrarium', format: 'webp')
+end
+
+def train_terrain
+  TERRAIN_ENCODINGS.each do |encoding|
+    children = corpus_quad(encoding, 'png')
+    TERRAIN_METHODS.product([128, 64]) do |method, target_size|
+      children.each { |child| TerrainDownsampleFFI.downsample_png(child, target_size, encoding, method, png: 'fast') }
+    end
+    TERRAIN_METHODS.product(%w[png webp]) do |method, format|
+      TerrainDownsampleFFI.downsample_quad(children, encoding, method, format, png: 'max')
+      TerrainDownsampleFFI.downsample_quad(partial(children), encoding, method, format, png: 'default')
+    end
+    TerrainDownsampleFFI.downsample_batch([children, partial(children)] * 2, encoding, 'average', 'png', png: 'max')
+  end
+end
+
+def train_raster
+  %w[imagery imagery_alpha].product(%w[png webp]) do |set, ext|
+    children = corpus_quad(set, ext)
+    RASTER_KERNELS.product(%w[png webp]) do |kernel, format|
+      RasterDownsampleFFI.downsample_quad(children, kernel, format)
+      RasterDownsampleFFI.downsample_quad(partial(children), kernel, format)
+    end
+    RasterDownsampleFFI.downsample_batch([children, partial(children)] * 2, 'linear', 'png', png: { level: 9 })
+  end
+end
+
+def train_validator
+  %w[mapbox terrarium imagery imagery_alpha].product(%w[png webp]) do |set, ext|
+    corpus_quad(set, ext).each do |tile|
+      TileValidatorFFI.validate(tile, true)
+      TileValidatorFFI.validate(tile, false)
+      TileValidatorFFI.validate(tile.byteslice(0, tile.bytesize / 2), true)
+    end
+  end
+end
+
+trainers = {
+  'lerc_extension' => :train_lerc,
+  'terrain_downsample_extension' => :train_terrain,
+  'raster_downsample_extension' => :train_raster,
+  'tile_validator_extension' => :train_validator
+}.select { |name, _| load_extension(name) }
+
+started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+PASSES.times { trainers.each_value { |trainer| send(trainer) } }
+puts "pgo_training: #{trainers.keys.join(', ')} x#{PASSES} in " \
+     "#{(Process.clock_gettime(Process::CLOCK_MONOTONIC) - started).round(1)}s"
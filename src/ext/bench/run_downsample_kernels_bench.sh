@@ -0,0 +1,10 @@
+#!/bin/bash
+set -e
+
+command -v g++ >/dev/null 2>&1 || { echo "Error: g++ required"; exit 1; }
+
+cd "$(dirname "$0")"
+echo "Building downsample_kernels_bench..."
+ARCH_FLAGS=$([ "$(uname -m)" = "x86_64" ] && echo "-march=x86-64" || echo "")
+g++ -std=c++23 -O3 $ARCH_FLAGS -Wall -Wextra -o downsample_kernels_bench downsample_kernels_bench.cpp
+./downsample_kernels_bench "$@"
@@ -0,0 +1,83 @@
+#!/bin/bash
+# Builds tile_pipeline_bench once per extension build variant (the TPC_EXT_NATIVE /
+# TPC_EXT_LTO flags of the extconf files) and prints tiles/s of every stage side by side.
+# WebP and LERC stages are included when libwebp and Lerc_c_api.h are found.
+# TPC_BENCH_VARIANTS picks variants (default: "generic native lto native+lto");
+# other arguments go to the benchmark, e.g. --min-ms 1000.
+set -e
+
+for tool in ruby g++ pkg-config; do
+    command -v $tool >/dev/null 2>&1 || { echo "Error: $tool required"; exit 1; }
+done
+
+if ! pkg-config --exists libpng; then
+    echo "Error: libpng not found. Please install libpng-dev"
+    exit 1
+fi
+
+cd "$(dirname "$0")"
+
+RUBY_INCLUDES=$(ruby -rrbconfig -e 'print "-I#{RbConfig::CONFIG["rubyhdrdir"]} -I#{RbConfig::CONFIG["rubyarchhdrdir"]}"')
+CXXFLAGS="-std=c++23 -O3 -Wall -Wextra -Wpedantic -Wno-unused-function -fno-rtti -I/usr/local/include $RUBY_INCLUDES $(pkg-config --cflags libpng)"
+LIBS="$(pkg-config --libs libpng) -lz"
+
+if pkg-config --exists libwebp; then
+    CXXFLAGS+=" -DTPC_BENCH_WEBP $(pkg-config --cflags libwebp)"
+    LIBS+=" $(pkg-config --libs libwebp)"
+else
+    echo "libwebp not found: WebP stages skipped"
+fi
+
+if echo '#include <Lerc_c_api.h>' | g++ -E -x c++ -I/usr/local/include - >/dev/null 2>&1; then
+    CXXFLAGS+=" -DTPC_BENCH_LERC"
+    LIBS+=" -L/usr/local/lib -lLerc"
+else
+    echo "Lerc_c_api.h not found: LERC stages skipped"
+fi
+
+GENERIC_ARCH=$([ "$(uname -m)" = "x86_64" ] && echo "-march=x86-64 -mtune=generic" || echo "")
+RESULTS=$(mktemp -d)
+trap 'rm -rf "$RESULTS"' EXIT
+
+for variant in ${TPC_BENCH_VARIANTS:-generic native lto native+lto}; do
+    case "$variant" in
+        generic)    flags="$GENERIC_ARCH" ;;
+        native)     flags="-march=native -mtune=native" ;;
+        lto)        flags="$GENERIC_ARCH -flto" ;;
+        native+lto) flags="-march=native -mtune=native -flto" ;;
+        *) echo "Error: unknown variant $variant (expected generic, native, lto or native+lto)"; exit 1 ;;
+    esac
+
+    binary="tile_pipeline_bench_${variant/+/_}"
+    echo "Building $binary ($flags)..."
+    g++ $CXXFLAGS $flags -o "$binary" tile_pipeline_bench.cpp $flags $LIBS
+    "./$binary" --corpus corpus --tsv "$@" > "$RESULTS/$variant.tsv"
+    echo "$variant" >> "$RESULTS/variants"
+done
+
+ruby - "$RESULTS" <<'RUBY'
+dir = ARGV[0]
+variants = File.readlines(File.join(dir, 'variants'), chomp: true)
+rows = {}
+variants.each do |variant|
+  File.foreach(File.join(dir, "#{variant}.tsv")) do |line|
+    set, stage, kind, tiles_per_second, ns_per_pixel, bytes = line.chomp.split("\t")
+    row = (rows[[set, stage, kind]] ||= { bytes: bytes, ns: ns_per_pixel })
+    row[variant] = tiles_per_second.to_f
+  end
+end
+
+base = variants.first
+puts format('%-14s %-8s %-14s %9s %12s  %s', 'set', 'stage', 'variant', 'ns/px', 'B/tile',
+            variants.map { |v| format('%12s', "#{v} t/s") }.join(' '))
+rows.each do |(set, stage, kind), row|
+  speeds = variants.map do |v|
+    next format('%12s', '-') unless row[v]
+
+    ratio = v == base ? '' : format(' %4.2fx', row[v] / row[base])
+    format('%12s', "#{row[v].round}#{ratio}")
+  end
+  puts format('%-14s %-8s %-14s %9.2f %12s  %s', set, stage, kind, row[:ns].to_f, row[:bytes], speeds.join(' '))
+end
+puts "ns/px and B/tile: #{base} build"
+RUBY
@@ -0,0 +1,440 @@
+// Stage benchmark of the native tile pipeline on the checked-in corpus (bench/corpus).
+// Runs decode, reduce and encode of terrain quads (Mapbox / Terrarium, PNG and WebP
+// children), imagery quads and ArcGIS LERC tiles through the same headers the extensions
+// are built from, and reports per stage:
+//   tiles/s   tiles through the stage per second (a quad's children count as four decodes)
+//   ns/px     nanoseconds per pixel of the stage's input
+//   B/tile    heap bytes requested per tile (malloc/calloc/realloc, output buffers included)
+// Buffers that the extensions keep per thread (scratch_arena.h) are reused across
+// iterations here too, so B/tile is what a warm worker allocates.
+//
+// Usage: tile_pipeline_bench [--corpus DIR] [--min-ms N] [--tsv]
+// Build with run_tile_pipeline_bench.sh, which also compares TPC_EXT_NATIVE / TPC_EXT_LTO builds.
+#include "../gvl_call.h"
+#include "../png_codec.h"
+#include "../raster_downsample_kernels.h"
+#include "../scratch_arena.h"
+#include "../terrain_downsample_kernels.h"
+#ifdef TPC_BENCH_WEBP
+#include "../webp_codec.h"
+#include <webp/decode.h>
+#endif
+#ifdef TPC_BENCH_LERC
+#include <Lerc_c_api.h>
+#endif
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Heap accounting: glibc's allocator is wrapped for the whole binary, so libpng, zlib,
+// libwebp and libLerc allocations are counted along with the harness's own
+#if defined(__GLIBC__)
+extern "C" {
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t count, std::size_t size);
+void* __libc_realloc(void* ptr, std::size_t size);
+void __libc_free(void* ptr);
+}
+
+namespace {
+bool g_counting = false;
+std::size_t g_allocated_bytes = 0;
+}  // namespace
+
+extern "C" void* malloc(std::size_t size) {
+    if (g_counting) g_allocated_bytes += size;
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(std::size_t count, std::size_t size) {
+    if (g_counting) g_allocated_bytes += count * size;
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, std::size_t size) {
+    if (g_counting) g_allocated_bytes += size;
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void* ptr) {
+    __libc_free(ptr);
+}
+
+constexpr bool ALLOCATIONS_COUNTED = true;
+#else
+namespace {
+bool g_counting = false;
+std::size_t g_allocated_bytes = 0;
+}  // namespace
+
+constexpr bool ALLOCATIONS_COUNTED = false;
+#endif
+
+namespace {
+
+constexpr int TILE_SIZE = 256;
+constexpr int MOSAIC_SIZE = TILE_SIZE * 2;
+constexpr std::size_t TILE_PIXELS = static_cast<std::size_t>(TILE_SIZE) * TILE_SIZE;
+constexpr std::size_t MOSAIC_PIXELS = TILE_PIXELS * 4;
+
+// TMS rows grow northwards, so children 2/3 form the top half of the image
+constexpr std::array<std::pair<int, int>, 4> QUADRANT_ORIGIN{{{0, 1}, {1, 1}, {0, 0}, {1, 0}}};
+
+struct Options {
+    std::string corpus = "corpus";
+    double min_ms = 300.0;
+    bool tsv = false;
+};
+
+struct StageResult {
+    double tiles_per_second = 0.0;
+    double ns_per_pixel = 0.0;
+    double bytes_per_tile = 0.0;
+};
+
+using Blob = std::vector<std::uint8_t>;
+using Quad = std::array<Blob, 4>;
+
+bool read_file(const std::string& path, Blob& out) {
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) return false;
+    std::fseek(file, 0, SEEK_END);
+    const long size = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+    out.resize(size > 0 ? static_cast<std::size_t>(size) : 0);
+    const bool ok = size > 0 && std::fread(out.data(), 1, out.size(), file) == out.size();
+    std::fclose(file);
+    return ok;
+}
+
+// The four children <dir>/0..3.<ext>; false when any is missing
+bool read_quad(const Options& options, const char* set, const char* ext, Quad& quad) {
+    for (int i = 0; i < 4; ++i) {
+        if (!read_file(options.corpus + "/" + set + "/" + std::to_string(i) + "." + ext, quad[i])) return false;
+    }
+    return true;
+}
+
+// Runs fn (one pass over tiles_per_pass tiles of pixels_per_tile input pixels each) for at
+// least min_ms after a warm-up pass; heap use is taken from one separate counted pass
+template <typename Fn>
+StageResult measure(const Options& options, int tiles_per_pass, std::size_t pixels_per_tile, Fn&& fn) {
+    if (!fn()) {
+        std::fprintf(stderr, "stage failed on the corpus\n");
+        std::exit(1);
+    }
+
+    g_allocated_bytes = 0;
+    g_counting = true;
+    fn();
+    g_counting = false;
+    const std::size_t allocated = g_allocated_bytes;
+
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+    long passes = 0;
+    double elapsed_ns = 0.0;
+    do {
+        fn();
+        ++passes;
+        elapsed_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    } while (elapsed_ns < options.min_ms * 1e6);
+
+    const double tiles = static_cast<double>(passes) * tiles_per_pass;
+    return {tiles * 1e9 / elapsed_ns, elapsed_ns / (tiles * static_cast<double>(pixels_per_tile)),
+            static_cast<double>(allocated) / tiles_per_pass};
+}
+
+void report(const Options& options, const char* set, const char* stage, const char* variant, const StageResult& result) {
+    if (options.tsv) {
+        std::printf("%s\t%s\t%s\t%.1f\t%.3f\t%.0f\n", set, stage, variant,
+                    result.tiles_per_second, result.ns_per_pixel, result.bytes_per_tile);
+        return;
+    }
+    std::printf("%-14s %-8s %-14s %10.0f %9.2f %12.0f\n", set, stage, variant,
+                result.tiles_per_second, result.ns_per_pixel, result.bytes_per_tile);
+}
+
+// RAII wrapper for libpng png_image, as in the extensions
+struct PngImage {
+    png_image image{};
+    PngImage() { image.version = PNG_IMAGE_VERSION; }
+    ~PngImage() { png_image_free(&image); }
+    PngImage(const PngImage&) = delete;
+    PngImage& operator=(const PngImage&) = delete;
+};
+
+bool decode_png_into(const Blob& blob, png_uint_32 format, std::uint8_t* dst, std::size_t row_stride) {
+    PngImage png;
+    if (!png_image_begin_read_from_memory(&png.image, blob.data(), blob.size())) return false;
+    if (png.image.width != TILE_SIZE || png.image.height != TILE_SIZE) return false;
+    png.image.format = format;
+    return png_image_finish_read(&png.image, nullptr, dst, static_cast<png_int_32>(row_stride), nullptr) != 0;
+}
+
+#ifdef TPC_BENCH_WEBP
+bool decode_webp_into(const Blob& blob, int channels, std::uint8_t* dst, std::size_t row_stride) {
+    const std::size_t available = row_stride * (TILE_SIZE - 1) + static_cast<std::size_t>(TILE_SIZE) * channels;
+    const int stride = static_cast<int>(row_stride);
+    return (channels == 4 ? WebPDecodeRGBAInto(blob.data(), blob.size(), dst, available, stride)
+                          : WebPDecodeRGBInto(blob.data(), blob.size(), dst, available, stride)) != nullptr;
+}
+#endif
+
+// Decodes the four children into their quadrants of a 512×512 mosaic
+bool decode_quad(const Quad& quad, bool webp, int channels, std::uint8_t* mosaic) {
+    const std::size_t row_stride = static_cast<std::size_t>(MOSAIC_SIZE) * channels;
+    for (std::size_t i = 0; i < 4; ++i) {
+        const auto [qx, qy] = QUADRANT_ORIGIN[i];
+        std::uint8_t* dst = mosaic + qy * TILE_SIZE * row_stride + qx * TILE_SIZE * channels;
+#ifdef TPC_BENCH_WEBP
+        if (webp) {
+            if (!decode_webp_into(quad[i], channels, dst, row_stride)) return false;
+            continue;
+        }
+#endif
+        (void)webp;
+        if (!decode_png_into(quad[i], channels == 4 ? PNG_FORMAT_RGBA : PNG_FORMAT_RGB, dst, row_stride)) return false;
+    }
+    return true;
+}
+
+// Encodes into a fresh buffer, as every extension call writes a new String
+template <typename Encode>
+bool encode_into(EncodedBuffer& out, Encode&& encode) {
+    out = EncodedBuffer();
+    return encode(out) && out.size() > 0;
+}
+
+const char* method_name(DownsampleMethod method) {
+    switch (method) {
+        case DownsampleMethod::Nearest: return "nearest";
+        case DownsampleMethod::Maximum: return "maximum";
+        case DownsampleMethod::Average: break;
+    }
+    return "average";
+}
+
+void bench_terrain(const Options& options, const char* set, bool is_terrarium) {
+    ScratchBuffer<std::uint8_t> mosaic_buffer, tile_buffer;
+    std::uint8_t* mosaic = mosaic_buffer.take(MOSAIC_PIXELS * 3);
+    std::uint8_t* tile = tile_buffer.take(TILE_PIXELS * 3);
+    EncodedBuffer out;
+
+    for (const char* ext : {"png", "webp"}) {
+        const bool webp = std::string_view(ext) == "webp";
+#ifndef TPC_BENCH_WEBP
+        if (webp) continue;
+#endif
+        Quad quad;
+        if (!read_quad(options, set, ext, quad)) continue;
+        report(options, set, "decode", ext,
+               measure(options, 4, TILE_PIXELS, [&] { return decode_quad(quad, webp, 3, mosaic); }));
+    }
+
+    Quad png_quad;
+    if (!read_quad(options, set, "png", png_quad) || !decode_quad(png_quad, false, 3, mosaic)) {
+        std::fprintf(stderr, "%s: corpus PNG quad missing or unreadable\n", set);
+        std::exit(1);
+    }
+
+    for (const DownsampleMethod method : {DownsampleMethod::Average, DownsampleMethod::Maximum, DownsampleMethod::Nearest}) {
+        const DownsampleKernel kernel = select_downsample_kernel(is_terrarium, method);
+        report(options, set, "reduce", method_name(method), measure(options, 1, MOSAIC_PIXELS, [&] {
+            kernel(mosaic, MOSAIC_SIZE, 2, tile, TILE_SIZE);
+            return true;
+        }));
+    }
+
+    const std::array<std::pair<const char*, PngEncodeOptions>, 3> presets{{
+        {"png/fast", PNG_PRESET_FAST}, {"png/default", PNG_PRESET_DEFAULT}, {"png/max", PNG_PRESET_MAX}}};
+    for (const auto& [name, preset] : presets) {
+        report(options, set, "encode", name, measure(options, 1, TILE_PIXELS, [&] {
+            return encode_into(out, [&](EncodedBuffer& buffer) { return encode_png(tile, TILE_SIZE, TILE_SIZE, 3, preset, buffer); });
+        }));
+    }
+#ifdef TPC_BENCH_WEBP
+    report(options, set, "encode", "webp/lossless", measure(options, 1, TILE_PIXELS, [&] {
+        return encode_into(out, [&](EncodedBuffer& buffer) {
+            return encode_webp_lossless(tile, TILE_SIZE, TILE_SIZE, 3, WEBP_DEFAULT_EFFORT, buffer);
+        });
+    }));
+#endif
+
+    // downsample_quad as the reconstructor calls it: PNG children → average → PNG
+    const DownsampleKernel average = select_downsample_kernel(is_terrarium, DownsampleMethod::Average);
+    report(options, set, "quad", "png/default", measure(options, 1, MOSAIC_PIXELS, [&] {
+        if (!decode_quad(png_quad, false, 3, mosaic)) return false;
+        average(mosaic, MOSAIC_SIZE, 2, tile, TILE_SIZE);
+        return encode_into(out, [&](EncodedBuffer& buffer) {
+            return encode_png(tile, TILE_SIZE, TILE_SIZE, 3, PNG_PRESET_DEFAULT, buffer);
+        });
+    }));
+}
+
+void bench_imagery(const Options& options, const char* set, int output_channels) {
+    ScratchBuffer<std::uint8_t> mosaic_buffer, tile_buffer;
+    ScratchBuffer<float> rows_buffer;
+    std::uint8_t* mosaic = mosaic_buffer.take(MOSAIC_PIXELS * 4);
+    std::uint8_t* tile = tile_buffer.take(TILE_PIXELS * 4);
+    float* rows = rows_buffer.take(TILE_PIXELS * 8);
+    EncodedBuffer out;
+
+    for (const char* ext : {"png", "webp"}) {
+        const bool webp = std::string_view(ext) == "webp";
+#ifndef TPC_BENCH_WEBP
+        if (webp) continue;
+#endif
+        Quad quad;
+        if (!read_quad(options, set, ext, quad)) continue;
+        report(options, set, "decode", ext,
+               measure(options, 4, TILE_PIXELS, [&] { return decode_quad(quad, webp, 4, mosaic); }));
+    }
+
+    Quad png_quad;
+    if (!read_quad(options, set, "png", png_quad) || !decode_quad(png_quad, false, 4, mosaic)) {
+        std::fprintf(stderr, "%s: corpus PNG quad missing or unreadable\n", set);
+        std::exit(1);
+    }
+
+    const std::array<std::pair<const char*, RasterKernel>, 4> kernels{{
+        {"box", RasterKernel::Box}, {"linear", RasterKernel::Linear},
+        {"mitchell", RasterKernel::Mitchell}, {"lanczos3", RasterKernel::Lanczos3}}};
+    for (const auto& [name, kernel] : kernels) {
+        const RasterReduceKernel reduce = select_raster_kernel(kernel);
+        report(options, set, "reduce", name, measure(options, 1, MOSAIC_PIXELS, [&] {
+            reduce(mosaic, TILE_SIZE, rows, tile);
+            return true;
+        }));
+    }
+
+    // Opaque quads are written as RGB, as the extension and Vips do
+    select_raster_kernel(RasterKernel::Linear)(mosaic, TILE_SIZE, rows, tile);
+    if (output_channels == 3) drop_alpha_in_place(tile, TILE_PIXELS);
+
+    report(options, set, "encode", "png/default", measure(options, 1, TILE_PIXELS, [&] {
+        return encode_into(out, [&](EncodedBuffer& buffer) {
+            return encode_png(tile, TILE_SIZE, TILE_SIZE, output_channels, PNG_PRESET_DEFAULT, buffer);
+        });
+    }));
+#ifdef TPC_BENCH_WEBP
+    report(options, set, "encode", "webp/q75", measure(options, 1, TILE_PIXELS, [&] {
+        return encode_into(out, [&](EncodedBuffer& buffer) {
+            return encode_webp(tile, TILE_SIZE, TILE_SIZE, output_channels, WebpEncodeOptions{}, buffer);
+        });
+    }));
+#endif
+}
+
+#ifdef TPC_BENCH_LERC
+// lerc_to_terrain without the Ruby layer: decode the float grid, quantize the 256×256 crop, encode
+void bench_lerc(const Options& options) {
+    std::array<Blob, 4> blobs;
+    for (int i = 0; i < 4; ++i) {
+        if (!read_file(options.corpus + "/lerc/" + std::to_string(i) + ".lerc", blobs[i])) return;
+    }
+
+    constexpr int DT_FLOAT = 6;
+    std::array<unsigned int, 11> info{};
+    std::array<double, 3> ranges{};
+    if (lerc_getBlobInfo(blobs[0].data(), static_cast<unsigned int>(blobs[0].size()), info.data(), ranges.data(),
+                         static_cast<int>(info.size()), static_cast<int>(ranges.size())) != 0) {
+        std::fprintf(stderr, "lerc: corpus tile unreadable\n");
+        std::exit(1);
+    }
+    const int cols = static_cast<int>(info[3]), rows = static_cast<int>(info[4]);
+    const std::size_t lerc_pixels = static_cast<std::size_t>(cols) * rows;
+
+    ScratchBuffer<float> elevation_buffer;
+    ScratchBuffer<std::uint8_t> rgb_buffer;
+    float* elevation = elevation_buffer.take(lerc_pixels);
+    std::uint8_t* rgb = rgb_buffer.take(TILE_PIXELS * 3);
+    EncodedBuffer out;
+
+    report(options, "lerc", "decode", "lerc", measure(options, 4, lerc_pixels, [&] {
+        for (const Blob& blob : blobs) {
+            const auto size = static_cast<unsigned int>(blob.size());
+            if (lerc_getBlobInfo(blob.data(), size, info.data(), ranges.data(),
+                                 static_cast<int>(info.size()), static_cast<int>(ranges.size())) != 0 ||
+                lerc_decode(blob.data(), size, 0, nullptr, 1, cols, rows, 1, DT_FLOAT, elevation) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }));
+
+    for (const bool is_terrarium : {false, true}) {
+        report(options, "lerc", "quantize", is_terrarium ? "terrarium" : "mapbox", measure(options, 1, TILE_PIXELS, [&] {
+            std::uint8_t* p = rgb;
+            for (int y = 0; y < TILE_SIZE; ++y) {
+                const float* row = elevation + static_cast<std::size_t>(y) * cols;
+                for (int x = 0; x < TILE_SIZE; ++x, p += 3) {
+                    if (is_terrarium) {
+                        encode_elevation<TerrainEncoding::Terrarium>(row[x], p);
+                    } else {
+                        encode_elevation<TerrainEncoding::Mapbox>(row[x], p);
+                    }
+                }
+            }
+            return true;
+        }));
+    }
+
+    report(options, "lerc", "encode", "png/fast", measure(options, 1, TILE_PIXELS, [&] {
+        return encode_into(out, [&](EncodedBuffer& buffer) { return encode_png(rgb, TILE_SIZE, TILE_SIZE, 3, PNG_PRESET_FAST, buffer); });
+    }));
+#ifdef TPC_BENCH_WEBP
+    report(options, "lerc", "encode", "webp/lossless", measure(options, 1, TILE_PIXELS, [&] {
+        return encode_into(out, [&](EncodedBuffer& buffer) {
+            return encode_webp_lossless(rgb, TILE_SIZE, TILE_SIZE, 3, WEBP_DEFAULT_EFFORT, buffer);
+        });
+    }));
+#endif
+}
+#endif
+
+Options parse_options(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        if (arg == "--corpus" && i + 1 < argc) {
+            options.corpus = argv[++i];
+        } else if (arg == "--min-ms" && i + 1 < argc) {
+            options.min_ms = std::atof(argv[++i]);
+        } else if (arg == "--tsv") {
+            options.tsv = true;
+        } else {
+            std::fprintf(stderr, "Usage: %s [--corpus DIR] [--min-ms N] [--tsv]\n", argv[0]);
+            std::exit(2);
+        }
+    }
+    return options;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const Options options = parse_options(argc, argv);
+
+    if (!options.tsv) {
+        const bool vectorized = reduce_row_2x2<DownsampleMethod::Average>() != reduce_row_2x2_codes_portable<DownsampleMethod::Average>;
+        std::printf("terrain vector kernel: %s, heap accounting: %s\n",
+                    vectorized ? "enabled" : "unavailable (scalar fallback)", ALLOCATIONS_COUNTED ? "on" : "unavailable");
+        std::printf("%-14s %-8s %-14s %10s %9s %12s\n", "set", "stage", "variant", "tiles/s", "ns/px", "B/tile");
+    }
+
+#ifdef TPC_BENCH_LERC
+    bench_lerc(options);
+#endif
+    bench_terrain(options, "mapbox", false);
+    bench_terrain(options, "terrarium", true);
+    bench_imagery(options, "imagery", 3);
+    bench_imagery(options, "imagery_alpha", 4);
+    return 0;
+}
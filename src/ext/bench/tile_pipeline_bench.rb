@@ -0,0 +1,107 @@
+# End-to-end benchmark of the Ruby-level tile paths on the checked-in corpus (bench/corpus):
+# the native calls as config.ru, the background loader and the reconstructor make them, and
+# the Vips fallbacks of TileReconstructor. Reports tiles/s, ms per tile, Ruby objects
+# allocated per tile (GC pressure) and output bytes per tile; native heap use per stage
+# comes from tile_pipeline_bench.cpp (run_tile_pipeline_bench.sh).
+#
+# Build the extensions first (ext/setup_*_ext.sh), then from src/:
+#   bundle exec ruby ext/bench/tile_pipeline_bench.rb [seconds per case, default 1]
+# Cases whose extension (or Vips) is not available are skipped.
+
+CORPUS = File.join(__dir__, 'corpus')
+SECONDS = (ARGV[0] || 1).to_f
+
+def load_optional(name)
+  require_relative name
+  true
+rescue LoadError => e
+  warn "skipped #{name}: #{e.message}"
+  false
+end
+
+def corpus_quad(set, ext)
+  paths = (0..3).map { |i| File.join(CORPUS, set, "#{i}.#{ext}") }
+  paths.all? { |path| File.exist?(path) } ? paths.map { |path| File.binread(path) } : nil
+end
+
+# tiles: tiles handled by one call; the block runs until SECONDS have passed after a warm-up
+def bench(name, tiles: 1)
+  output = yield
+  return puts(format('%-52s %s', name, 'no output (unsupported input)')) if output.nil? || output == false
+
+  GC.start
+  objects_before = GC.stat(:total_allocated_objects)
+  calls = 0
+  started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  elapsed = 0.0
+  while elapsed < SECONDS
+    yield
+    calls += 1
+    elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - started
+  end
+  objects = GC.stat(:total_allocated_objects) - objects_before
+
+  count = calls * tiles
+  bytes = Array(output).sum { |tile| tile.is_a?(String) ? tile.bytesize : 0 } / tiles
+  puts format('%-52s %9.1f %9.2f %10.1f %10d', name, count / elapsed, elapsed * 1000 / count, objects.fdiv(count), bytes)
+end
+
+puts format('%-52s %9s %9s %10s %10s', 'case', 'tiles/s', 'ms/tile', 'objs/tile', 'out B')
+
+if load_optional('../lerc_extension')
+  lerc = (0..3).map { |i| File.binread(File.join(CORPUS, 'lerc', "#{i}.lerc")) }
+  bench('LercFFI.lerc_to_mapbox_png') { LercFFI.lerc_to_mapbox_png(lerc[0]) }
+  bench('LercFFI.lerc_to_mapbox_png png: fast') { LercFFI.lerc_to_mapbox_png(lerc[0], png: 'fast') }
+  bench('LercFFI.lerc_to_terrain terrarium') { LercFFI.lerc_to_terrain(lerc[0], encoding: 'terrarium', png: 'fast') }
+  bench('LercFFI.lerc_to_terrain webp') { LercFFI.lerc_to_terrain(lerc[0], format: 'webp') }
+  bench('LercFFI.lerc_to_terrain target_size: 128') { LercFFI.lerc_to_terrain(lerc[0], target_size: 128, png: 'fast') }
+  bench('LercFFI.lerc_to_terrain_batch (4)', tiles: 4) { LercFFI.lerc_to_terrain_batch(lerc, png: 'fast') }
+end
+
+if load_optional('../terrain_downsample_extension')
+  %w[mapbox terrarium].each do |encoding|
+    children = corpus_quad(encoding, 'png')
+    bench("TerrainDownsampleFFI.downsample_png #{encoding}") do
+      TerrainDownsampleFFI.downsample_png(children[0], 128, encoding, 'average', png: 'fast')
+    end
+    %w[png webp].each do |format|
+      bench("TerrainDownsampleFFI.downsample_quad #{encoding} #{format}") do
+        TerrainDownsampleFFI.downsample_quad(children, encoding, 'average', format, png: 'max')
+      end
+    end
+    bench("TerrainDownsampleFFI.downsample_batch #{encoding} (8)", tiles: 8) do
+      TerrainDownsampleFFI.downsample_batch(Array.new(8, children), encoding, 'average', 'png', png: 'max')
+    end
+  end
+end
+
+if load_optional('../raster_downsample_extension')
+  %w[imagery imagery_alpha].each do |set|
+    children = corpus_quad(set, 'png')
+    webp_children = corpus_quad(set, 'webp')
+    bench("RasterDownsampleFFI.downsample_quad #{set} png") { RasterDownsampleFFI.downsample_quad(children, 'linear', 'png') }
+    bench("RasterDownsampleFFI.downsample_quad #{set} webp") { RasterDownsampleFFI.downsample_quad(webp_children, 'linear', 'webp') }
+    bench("RasterDownsampleFFI.downsample_batch #{set} (8)", tiles: 8) do
+      RasterDownsampleFFI.downsample_batch(Array.new(8, children), 'linear', 'png')
+    end
+  end
+end
+
+if load_optional('../../tile_reconstructor')
+  reconstructor = TileReconstructor.allocate
+  %w[imagery imagery_alpha].each do |set|
+    children = corpus_quad(set, 'png')
+    bench("Vips downsample_raster_with_vips #{set} png") do
+      reconstructor.send(:downsample_raster_with_vips, children, 'png', :linear, {})
+    end
+    bench("Vips downsample_raster_with_vips #{set} webp") do
+      reconstructor.send(:downsample_raster_with_vips, children, 'webp', :linear, { Q: 75 })
+    end
+  end
+  %w[mapbox terrarium].each do |encoding|
+    webp_children = corpus_quad(encoding, 'webp')
+    bench("TileReconstructor#downsample_terrain_tiles #{encoding} webp children") do
+      reconstructor.send(:downsample_terrain_tiles, webp_children, encoding: encoding, format: 'webp')
+    end
+  end
+end
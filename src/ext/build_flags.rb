@@ -0,0 +1,49 @@
+# Compiler flags shared by the extconf files:
+#   TPC_EXT_NATIVE=1    tune for the build machine (-march=native) instead of generic x86-64
+#   TPC_EXT_LTO=1       link-time optimization
+#   TPC_EXT_PGO=stage   profile-guided optimization (GCC): 'generate' builds instrumented
+#                       extensions that write profiles to pgo-profile/, 'use' rebuilds with
+#                       them. pgo_build.sh runs both stages around the corpus training run.
+module TpcBuildFlags
+  PGO_STAGES = %w[generate use].freeze
+  PGO_PROFILE_DIR = File.expand_path("pgo-profile", __dir__)
+
+  def self.apply
+    native = ENV["TPC_EXT_NATIVE"] == "1"
+    lto    = ENV["TPC_EXT_LTO"] == "1"
+
+    arch_flags =
+      if native
+        " -march=native -mtune=native"
+      else
+        " -march=x86-64 -mtune=generic"
+      end
+
+    $CXXFLAGS += " -std=c++23 -O3#{arch_flags}#{lto ? ' -flto' : ''} -Wno-unused-function"
+    $CXXFLAGS += " -Wall -Wextra -Wpedantic"
+    $CXXFLAGS += " -fno-rtti"
+    $CPPFLAGS += " -I/usr/local/include"
+
+    profile_flags = pgo_flags(ENV["TPC_EXT_PGO"])
+    $CXXFLAGS += profile_flags
+    $LDFLAGS += profile_flags
+  end
+
+  # Worker-pool batches run on several threads, so counters are updated atomically while
+  # training. Functions the corpus does not reach keep their regular -O3 code
+  # (-fprofile-partial-training) instead of being optimized for size as never executed.
+  def self.pgo_flags(stage)
+    return "" if stage.nil? || stage.empty? || stage == "0"
+    unless PGO_STAGES.include?(stage)
+      abort "TPC_EXT_PGO=#{stage}: expected generate or use (run pgo_build.sh for the two-stage build)"
+    end
+
+    if stage == "generate"
+      " -fprofile-generate=#{PGO_PROFILE_DIR} -fprofile-update=prefer-atomic"
+    else
+      abort "No PGO profile in #{PGO_PROFILE_DIR}: run the generate stage and the training first" unless Dir.exist?(PGO_PROFILE_DIR)
+
+      " -fprofile-use=#{PGO_PROFILE_DIR} -fprofile-partial-training -Wno-missing-profile"
+    end
+  end
+end
@@ -0,0 +1,134 @@
+// Decoded tile handed from one reconstruction level to the next.
+// A quad call with keep_pixels: true returns a DecodedTile instead of a String: #data is
+// the encoded tile to store, and passing the object itself as a child of the next quad
+// feeds its pixels straight into the mosaic, skipping the SQLite read and the decode.
+// The pixel buffer lives in native memory and is freed with the Ruby object.
+#pragma once
+
+#include "ruby.h"
+#include "gvl_call.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <utility>
+
+// Internal linkage throughout: Ruby loads extensions with RTLD_GLOBAL, and each extension
+// must resolve to its own DecodedTile class and data type
+namespace {
+
+// Pixels produced by a job; filled without the GVL, wrapped into a DecodedTile afterwards
+struct TilePixels {
+    std::unique_ptr<std::uint8_t[]> data;
+    int size = 0;       // tile width and height
+    int channels = 0;   // 3 (RGB) or 4 (straight RGBA)
+    bool opaque = true; // no pixel with alpha < 255
+
+    std::size_t bytes() const noexcept {
+        return static_cast<std::size_t>(size) * size * static_cast<std::size_t>(channels);
+    }
+
+    // Copies a size×size image; may throw std::bad_alloc
+    void assign(const std::uint8_t* pixels, int tile_size, int tile_channels, bool tile_opaque) {
+        size = tile_size;
+        channels = tile_channels;
+        opaque = tile_opaque;
+        data = std::make_unique_for_overwrite<std::uint8_t[]>(bytes());
+        std::memcpy(data.get(), pixels, bytes());
+    }
+};
+
+struct DecodedTile {
+    TilePixels pixels;
+    VALUE data = Qnil; // encoded tile, as returned without keep_pixels
+};
+
+namespace decoded_tile_detail {
+
+inline void mark(void* ptr) {
+    rb_gc_mark(static_cast<DecodedTile*>(ptr)->data);
+}
+
+inline void release(void* ptr) {
+    delete static_cast<DecodedTile*>(ptr);
+}
+
+inline std::size_t memsize(const void* ptr) {
+    return sizeof(DecodedTile) + static_cast<const DecodedTile*>(ptr)->pixels.bytes();
+}
+
+const rb_data_type_t data_type = {
+    "tiles_proxy_cache/decoded_tile",
+    {mark, release, memsize, nullptr, {nullptr}},
+    nullptr,
+    nullptr,
+    RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+VALUE tile_class = Qnil;
+
+inline VALUE tile_data(VALUE self) {
+    return static_cast<DecodedTile*>(rb_check_typeddata(self, &data_type))->data;
+}
+
+inline VALUE tile_size(VALUE self) {
+    return INT2NUM(static_cast<DecodedTile*>(rb_check_typeddata(self, &data_type))->pixels.size);
+}
+
+}  // namespace decoded_tile_detail
+
+// Defines <module>::DecodedTile (#data, #size); not instantiable from Ruby
+inline void define_decoded_tile_class(VALUE module) {
+    using namespace decoded_tile_detail;
+    tile_class = rb_define_class_under(module, "DecodedTile", rb_cObject);
+    rb_gc_register_mark_object(tile_class);
+    rb_undef_alloc_func(tile_class);
+    rb_define_method(tile_class, "data", tile_data, 0);
+    rb_define_method(tile_class, "size", tile_size, 0);
+}
+
+// Under the GVL: takes ownership of pixels; data is the encoded String for storage
+inline VALUE wrap_decoded_tile(TilePixels&& pixels, VALUE data) {
+    using namespace decoded_tile_detail;
+    auto* tile = new DecodedTile{std::move(pixels), data};
+    return TypedData_Wrap_Struct(tile_class, &data_type, tile);
+}
+
+// The DecodedTile behind value, or nullptr when value is not one
+inline const DecodedTile* decoded_tile_of(VALUE value) noexcept {
+    if (!rb_typeddata_is_kind_of(value, &decoded_tile_detail::data_type)) return nullptr;
+    return static_cast<const DecodedTile*>(RTYPEDDATA_DATA(value));
+}
+
+// One child of a quad: encoded bytes, pixels of a DecodedTile, or neither (missing)
+struct QuadChild {
+    InputBytes encoded;
+    const TilePixels* decoded = nullptr;
+
+    bool empty() const noexcept { return decoded == nullptr && encoded.empty(); }
+};
+
+// Children must be String, DecodedTile or nil
+inline bool valid_quad_child(VALUE child) noexcept {
+    return NIL_P(child) || RB_TYPE_P(child, T_STRING) || decoded_tile_of(child) != nullptr;
+}
+
+// Under the GVL; the DecodedTile (kept alive by the caller's children Array) outlives the job
+inline QuadChild make_quad_child(VALUE child) {
+    QuadChild quad_child;
+    if (const DecodedTile* tile = decoded_tile_of(child)) {
+        quad_child.decoded = &tile->pixels;
+    } else if (!NIL_P(child) && RSTRING_LEN(child) > 0) {
+        quad_child.encoded = InputBytes(child);
+    }
+    return quad_child;
+}
+
+// keep_pixels: option of the quad calls
+inline bool parse_keep_pixels(VALUE opts) {
+    return !NIL_P(opts) && RTEST(rb_hash_aref(opts, ID2SYM(rb_intern("keep_pixels"))));
+}
+
+}  // namespace
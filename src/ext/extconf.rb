@@ -1,21 +1,17 @@
 require "mkmf"
+require_relative "build_flags"
 
-native = ENV["TPC_EXT_NATIVE"] == "1"
-lto    = ENV["TPC_EXT_LTO"] == "1"
-
-arch_flags =
-  if native
-    " -march=native -mtune=native"
-  else
-    " -march=x86-64 -mtune=generic"
-  end
-
-$CXXFLAGS += " -std=c++23 -O3#{arch_flags}#{lto ? ' -flto' : ''} -Wno-unused-function"
-$CXXFLAGS += " -Wall -Wextra -Wpedantic"
-$CXXFLAGS += " -fno-rtti"
-$CPPFLAGS += " -I/usr/local/include"
+TpcBuildFlags.apply
 
 $srcs = ["lerc_extension.cpp"]
 $LIBS += " -lLerc"
 
+unless pkg_config("libpng")
+  abort "libpng not found. Please install libpng-dev"
+end
+
+unless pkg_config("libwebp")
+  abort "libwebp not found. Please install libwebp-dev"
+end
+
 create_makefile("lerc_extension")
\ No newline at end of file
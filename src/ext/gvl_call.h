@@ -0,0 +1,166 @@
+// Helpers for running native work with the GVL released and for the batch call options.
+// Everything executed inside without_gvl() must stay off the Ruby API: no VALUE
+// access, no allocation of Ruby objects and no rb_raise. Report failures through a
+// status code and raise only after the GVL has been re-acquired.
+#pragma once
+
+#include "ruby.h"
+#include "ruby/thread.h"
+
+#include <atomic>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+template <typename Fn>
+void without_gvl(Fn&& fn) {
+    using Callable = std::remove_reference_t<Fn>;
+    void* (*trampoline)(void*) = [](void* data) -> void* {
+        (*static_cast<Callable*>(data))();
+        return nullptr;
+    };
+    // No unblocking function: the work is CPU-bound and finishes on its own
+    rb_thread_call_without_gvl(trampoline, static_cast<void*>(&fn), nullptr, nullptr);
+}
+
+// Read-only view of a String's bytes that stays valid while the GVL is released.
+// Frozen heap-backed strings cannot be mutated by other threads and are borrowed in place
+// (the VALUE held here keeps the object alive); anything else is copied up front.
+class InputBytes {
+public:
+    InputBytes() = default;
+
+    explicit InputBytes(VALUE str) : str_(str) {
+        const auto* ptr = reinterpret_cast<const std::uint8_t*>(RSTRING_PTR(str));
+        const auto len = static_cast<std::size_t>(RSTRING_LEN(str));
+        // Embedded contents live in the object slot, which GC compaction may move
+        if (OBJ_FROZEN(str) && RB_FL_TEST_RAW(str, RSTRING_NOEMBED)) {
+            data_ = ptr;
+            size_ = len;
+        } else {
+            copy_.assign(ptr, ptr + len);
+            data_ = copy_.data();
+            size_ = copy_.size();
+        }
+    }
+
+    InputBytes(const InputBytes&) = delete;
+    InputBytes& operator=(const InputBytes&) = delete;
+    InputBytes(InputBytes&&) noexcept = default;  // moving the vector keeps data_ valid
+    InputBytes& operator=(InputBytes&&) noexcept = default;
+
+    const std::uint8_t* data() const noexcept { return data_; }
+    std::size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+    VALUE value() const noexcept { return str_; }
+
+private:
+    VALUE str_ = Qnil;
+    const std::uint8_t* data_ = nullptr;
+    std::size_t size_ = 0;
+    std::vector<std::uint8_t> copy_;
+};
+
+// Encoder output. The destination String is allocated under the GVL (rb_str_buf_new, sized
+// to the largest output seen so far) and the encoder writes straight into its buffer, so the
+// result needs no final copy. Output that outgrows it continues in a spill vector instead.
+class EncodedBuffer {
+public:
+    // Under the GVL: allocates the destination; the caller keeps the returned String alive
+    VALUE allocate() {
+        const VALUE str = rb_str_buf_new(static_cast<long>(capacity_hint().load(std::memory_order_relaxed)));
+        attach(str);
+        return str;
+    }
+
+    void attach(VALUE str) noexcept {
+        dst_ = RSTRING_PTR(str);
+        capacity_ = static_cast<std::size_t>(rb_str_capacity(str));
+    }
+
+    // Appends encoder output; safe without the GVL. Returns false when out of memory.
+    bool append(const std::uint8_t* data, std::size_t length) noexcept {
+        if (!spilled_ && size_ + length <= capacity_) {
+            std::memcpy(dst_ + size_, data, length);
+            size_ += length;
+            return true;
+        }
+        try {
+            if (!spilled_) {
+                spill_.reserve((size_ + length) * 2);
+                spill_.assign(dst_, dst_ + size_);
+                spilled_ = true;
+            }
+            spill_.insert(spill_.end(), data, data + length);
+            size_ += length;
+            return true;
+        } catch (const std::bad_alloc&) {
+            return false;
+        }
+    }
+
+    std::size_t size() const noexcept { return size_; }
+    explicit operator bool() const noexcept { return size_ > 0; }
+
+    // Under the GVL: str is the String passed to attach(); trims it to the written length.
+    VALUE finish(VALUE str) const {
+        std::atomic<std::size_t>& hint = capacity_hint();
+        if (size_ > hint.load(std::memory_order_relaxed)) hint.store(size_ + size_ / 8, std::memory_order_relaxed);
+
+        if (spilled_ || NIL_P(str)) {
+            return rb_str_new(reinterpret_cast<const char*>(spill_.data()), static_cast<long>(spill_.size()));
+        }
+        return rb_str_resize(str, static_cast<long>(size_));
+    }
+
+private:
+    static std::atomic<std::size_t>& capacity_hint() noexcept {
+        static std::atomic<std::size_t> hint{64 * 1024};
+        return hint;
+    }
+
+    char* dst_ = nullptr;
+    std::size_t capacity_ = 0;
+    std::size_t size_ = 0;
+    bool spilled_ = false;
+    std::vector<std::uint8_t> spill_;
+};
+
+// Error captured during native work; raised by the caller after all C++ state is released
+struct NativeError {
+    VALUE klass = Qnil;
+    char message[256] = {};
+
+    explicit operator bool() const noexcept { return !NIL_P(klass); }
+
+    __attribute__((format(printf, 3, 4)))
+    void set(VALUE error_class, const char* format, ...) noexcept {
+        klass = error_class;
+        va_list args;
+        va_start(args, format);
+        std::vsnprintf(message, sizeof(message), format, args);
+        va_end(args);
+    }
+};
+
+[[noreturn]] inline void raise_native_error(const NativeError& error) {
+    rb_raise(error.klass, "%s", error.message);
+}
+
+// threads: option of the batch calls; 0 means use the whole native worker pool
+inline unsigned parse_batch_threads(VALUE opts) {
+    if (NIL_P(opts)) return 0;
+
+    const VALUE threads = rb_hash_aref(opts, ID2SYM(rb_intern("threads")));
+    if (NIL_P(threads)) return 0;
+
+    const int count = NUM2INT(threads);
+    if (count < 0) rb_raise(rb_eArgError, "threads must be >= 0, got %d", count);
+    return static_cast<unsigned>(count);
+}
@@ -1,105 +1,447 @@
 #include "ruby.h"
 #include <Lerc_c_api.h>
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
+#include "gvl_call.h"
+#include "png_codec.h"
+#include "scratch_arena.h"
+#include "stage_stats.h"
+#include "terrain_downsample_kernels.h"
+#include "webp_codec.h"
+#include "worker_pool.h"
 
 #include <array>
 #include <memory>
+#include <new>
 #include <vector>
 #include <algorithm>
 #include <cstdint>
 #include <stdexcept>
 #include <cmath>
 #include <climits>
+#include <string_view>
 
-extern "C" VALUE lerc_to_mapbox_png(VALUE /*self*/, VALUE lerc_data) {
-    try {
-        Check_Type(lerc_data, T_STRING);
-        const auto* blob = reinterpret_cast<const unsigned char*>(RSTRING_PTR(lerc_data));
-        const auto   n   = static_cast<unsigned int>(RSTRING_LEN(lerc_data));
-        if (n == 0) rb_raise(rb_eArgError, "Empty LERC data");
-
-        constexpr int   DT_FLOAT      = 6;
-        constexpr int   LERC_OK       = 0;
-        constexpr float MAPBOX_OFFSET = 10000.0f;
-        constexpr float MAPBOX_SCALE  = 0.1f;
-        constexpr int32_t MAX_24BIT   = 16777215;
-        constexpr int ARCGIS_TILE_SIZE = 257;  // ArcGIS elevation tile standard size
-        constexpr int MAPBOX_TILE_SIZE = 256;  // Standard web tile size
-
-        std::array<unsigned int, 11> info{};
-        std::array<double, 3> ranges{};
-        if (const int rc = lerc_getBlobInfo(blob, n, info.data(), ranges.data(),
-                                            static_cast<int>(info.size()), static_cast<int>(ranges.size()));
-            rc != LERC_OK) {
-            rb_raise(rb_eRuntimeError, "LERC getBlobInfo failed: code %d", rc);
+// Outcome of the decode/encode pass run without the GVL
+enum class LercStatus {
+    Ok,
+    NoData,
+    BlobInfoFailed,
+    InvalidDimensions,
+    UnsupportedType,
+    DimensionsTooLarge,
+    DecodeFailed,
+    RgbTooLarge,
+    PngFailed,
+    WebpFailed,
+    OutOfMemory,
+    CppException
+};
+
+// Reduces the decoded float grid before quantization, so the encoding step is applied once to
+// the reduced value rather than compounded through decode → average → re-encode.
+// Samples the same pixels as downsample_rgb: the top-left 2×2 of each scale×scale block.
+template <DownsampleMethod M>
+void reduce_elevation(const float* elev, int source_cols, int scale_factor, float* out, int target_size) noexcept {
+    for (int out_y = 0; out_y < target_size; ++out_y) {
+        const float* row0 = elev + static_cast<std::size_t>(out_y) * scale_factor * source_cols;
+        const float* row1 = row0 + source_cols;
+        for (int out_x = 0; out_x < target_size; ++out_x) {
+            const int i = out_x * scale_factor;
+            if constexpr (M == DownsampleMethod::Nearest) {
+                *out++ = row0[i];
+            } else if constexpr (M == DownsampleMethod::Maximum) {
+                *out++ = std::max({row0[i], row0[i + 1], row1[i], row1[i + 1]});
+            } else {
+                *out++ = (row0[i] + row0[i + 1] + row1[i] + row1[i + 1]) * 0.25f;
+            }
         }
+    }
+}
+
+using ElevationReducer = void (*)(const float*, int, int, float*, int);
+
+ElevationReducer select_elevation_reducer(DownsampleMethod method) noexcept {
+    switch (method) {
+        case DownsampleMethod::Nearest: return reduce_elevation<DownsampleMethod::Nearest>;
+        case DownsampleMethod::Maximum: return reduce_elevation<DownsampleMethod::Maximum>;
+        case DownsampleMethod::Average: break;
+    }
+    return reduce_elevation<DownsampleMethod::Average>;
+}
+
+enum class TerrainFormat {
+    Png,
+    Webp
+};
+
+// What the decoded elevation becomes: encoding, optional reduction and output codec
+struct TerrainOutputOptions {
+    bool is_terrarium = false;
+    TerrainFormat format = TerrainFormat::Png;
+    PngEncodeOptions png = PNG_PRESET_DEFAULT;
+    int webp_effort = WEBP_DEFAULT_EFFORT;
+    int target_size = 0;  // 0 keeps the decoded tile size
+    ElevationReducer reduce = nullptr;
+};
+
+struct LercJob {
+    LercStatus status = LercStatus::Ok;
+    std::array<int, 3> detail{};
+    EncodedBuffer output;
+    StageStats stats;
+};
+
+// Reused by every conversion on this thread (see scratch_arena.h)
+struct LercScratch {
+    ScratchBuffer<float> elevation;
+    ScratchBuffer<float> reduced;
+    ScratchBuffer<std::uint8_t> rgb;
+
+    void trim() noexcept {
+        elevation.trim();
+        reduced.trim();
+        rgb.trim();
+    }
+};
+
+LercScratch& lerc_scratch() noexcept {
+    thread_local LercScratch scratch;
+    return scratch;
+}
+
+template <TerrainEncoding E>
+void quantize_elevation(const float* elev, int source_cols, int width, int height, std::uint8_t* rgb) noexcept {
+    for (int y = 0; y < height; ++y) {
+        const float* row = elev + static_cast<std::size_t>(y) * source_cols;
+        for (int x = 0; x < width; ++x, rgb += 3) {
+            encode_elevation<E>(row[x], rgb);
+        }
+    }
+}
+
+void lerc_to_terrain_job(const InputBytes& input, const TerrainOutputOptions& options, LercJob& job) {
+    const auto* blob = input.data();
+    const auto   n   = static_cast<unsigned int>(input.size());
+    StageClock clock(job.stats);
+    clock.count_input(input.size());
+
+    constexpr int DT_FLOAT = 6;
+    constexpr int LERC_OK  = 0;
+    constexpr int ARCGIS_TILE_SIZE = 257;  // ArcGIS elevation tile standard size
+    constexpr int MAPBOX_TILE_SIZE = 256;  // Standard web tile size
+
+    const auto fail = [&job](LercStatus status, int a = 0, int b = 0, int c = 0) {
+        job.status = status;
+        job.detail = {a, b, c};
+    };
+
+    std::array<unsigned int, 11> info{};
+    std::array<double, 3> ranges{};
+    if (const int rc = lerc_getBlobInfo(blob, n, info.data(), ranges.data(),
+                                        static_cast<int>(info.size()), static_cast<int>(ranges.size()));
+        rc != LERC_OK) {
+        return fail(LercStatus::BlobInfoFailed, rc);
+    }
+
+    const int nCols = static_cast<int>(info[3]);
+    const int nRows = static_cast<int>(info[4]);
+    const int nBands= static_cast<int>(info[5]);
+    const int nValidPixels = static_cast<int>(info[6]);
+    const int type  = static_cast<int>(info[1]);
+
+    if (nCols <= 0 || nRows <= 0 || nBands <= 0)
+        return fail(LercStatus::InvalidDimensions, nCols, nRows, nBands);
+    if (type != DT_FLOAT)
+        return fail(LercStatus::UnsupportedType, type, DT_FLOAT);
+    if (nValidPixels <= 0)
+        return fail(LercStatus::NoData);
+
+    if (static_cast<std::size_t>(nCols) > SIZE_MAX / static_cast<std::size_t>(nRows) / static_cast<std::size_t>(nBands))
+        return fail(LercStatus::DimensionsTooLarge, nCols, nRows, nBands);
+
+    LercScratch& scratch = lerc_scratch();
+    const std::size_t total = static_cast<std::size_t>(nCols) * nRows * nBands;
+    float* elev = scratch.elevation.take(total);
+
+    if (const int rc = lerc_decode(blob, n, 0, nullptr, 1,
+                                   nCols, nRows, nBands, type, elev);
+        rc != LERC_OK) {
+        return fail(LercStatus::DecodeFailed, rc);
+    }
+    clock.lap(NativeStage::Decode);
+
+    const int tw = (nCols == ARCGIS_TILE_SIZE) ? MAPBOX_TILE_SIZE : nCols;
+    const int th = (nRows == ARCGIS_TILE_SIZE) ? MAPBOX_TILE_SIZE : nRows;
+
+    // Reduce on the float grid; the 257→256 crop above is just the first tw×th of each row
+    const float* grid = elev;
+    int grid_cols = nCols;
+    int out_w = tw, out_h = th;
+    if (options.target_size > 0 && (tw > options.target_size || th > options.target_size)) {
+        out_w = out_h = options.target_size;
+        float* reduced = scratch.reduced.take(static_cast<std::size_t>(out_w) * out_h);
+        options.reduce(elev, nCols, tw / options.target_size, reduced, options.target_size);
+        grid = reduced;
+        grid_cols = out_w;
+        clock.lap(NativeStage::Downsample);
+    }
+
+    if (static_cast<std::size_t>(out_w) > SIZE_MAX / static_cast<std::size_t>(out_h) / 3u)
+        return fail(LercStatus::RgbTooLarge, out_w, out_h);
+
+    const std::size_t rgb_size = static_cast<std::size_t>(out_w) * out_h * 3u;
+    std::uint8_t* rgb = scratch.rgb.take(rgb_size);
+
+    if (options.is_terrarium) {
+        quantize_elevation<TerrainEncoding::Terrarium>(grid, grid_cols, out_w, out_h, rgb);
+    } else {
+        quantize_elevation<TerrainEncoding::Mapbox>(grid, grid_cols, out_w, out_h, rgb);
+    }
+    clock.lap(NativeStage::Quantize);
+
+    if (options.format == TerrainFormat::Webp) {
+        if (!encode_webp_lossless(rgb, out_w, out_h, 3, options.webp_effort, job.output))
+            return fail(LercStatus::WebpFailed);
+    } else if (!encode_png(rgb, out_w, out_h, 3, options.png, job.output)) {
+        return fail(LercStatus::PngFailed);
+    }
+    clock.lap(NativeStage::Encode);
+    clock.count_output(job.output.size());
+}
+
+void describe_failure(const LercJob& job, NativeError& error) noexcept {
+    const auto& d = job.detail;
+    switch (job.status) {
+        case LercStatus::BlobInfoFailed:
+            error.set(rb_eRuntimeError, "LERC getBlobInfo failed: code %d", d[0]);
+            break;
+        case LercStatus::InvalidDimensions:
+            error.set(rb_eRuntimeError, "Invalid LERC dimensions: %dx%dx%d", d[0], d[1], d[2]);
+            break;
+        case LercStatus::UnsupportedType:
+            error.set(rb_eRuntimeError, "Unsupported LERC data type: %d (expected %d)", d[0], d[1]);
+            break;
+        case LercStatus::DimensionsTooLarge:
+            error.set(rb_eRuntimeError, "LERC dimensions too large: %dx%dx%d", d[0], d[1], d[2]);
+            break;
+        case LercStatus::DecodeFailed:
+            error.set(rb_eRuntimeError, "LERC decode failed: code %d", d[0]);
+            break;
+        case LercStatus::RgbTooLarge:
+            error.set(rb_eRuntimeError, "RGB buffer size too large: %dx%d", d[0], d[1]);
+            break;
+        case LercStatus::PngFailed:
+            error.set(rb_eRuntimeError, "PNG creation failed");
+            break;
+        case LercStatus::WebpFailed:
+            error.set(rb_eRuntimeError, "WebP creation failed");
+            break;
+        case LercStatus::OutOfMemory:
+            error.set(rb_eNoMemError, "Failed to allocate LERC buffers");
+            break;
+        case LercStatus::CppException:
+            error.set(rb_eRuntimeError, "Unknown C++ exception occurred");
+            break;
+        case LercStatus::Ok:
+        case LercStatus::NoData:
+            break;
+    }
+}
+
+void run_lerc_job(const InputBytes& input, const TerrainOutputOptions& options, LercJob& job) noexcept {
+    try {
+        lerc_to_terrain_job(input, options, job);
+    } catch (const std::bad_alloc&) {
+        job.status = LercStatus::OutOfMemory;
+    } catch (...) {
+        job.status = LercStatus::CppException;
+    }
+    lerc_scratch().trim();
+}
 
-        const int nCols = static_cast<int>(info[3]);
-        const int nRows = static_cast<int>(info[4]);
-        const int nBands= static_cast<int>(info[5]);
-        const int nValidPixels = static_cast<int>(info[6]);
-        const int type  = static_cast<int>(info[1]);
-
-        if (nCols <= 0 || nRows <= 0 || nBands <= 0)
-            rb_raise(rb_eRuntimeError, "Invalid LERC dimensions: %dx%dx%d", nCols, nRows, nBands);
-        if (type != DT_FLOAT)
-            rb_raise(rb_eRuntimeError, "Unsupported LERC data type: %d (expected %d)", type, DT_FLOAT);
-        if (nValidPixels <= 0)
+// output is the String the job's EncodedBuffer was attached to
+VALUE lerc_job_result(const LercJob& job, VALUE output, NativeError& error) {
+    switch (job.status) {
+        case LercStatus::Ok: return job.output.finish(output);
+        case LercStatus::NoData: return Qnil;
+        default:
+            describe_failure(job, error);
             return Qnil;
+    }
+}
 
-        if (nCols > SIZE_MAX / nRows / nBands)
-            rb_raise(rb_eRuntimeError, "LERC dimensions too large: %dx%dx%d", nCols, nRows, nBands);
+VALUE lerc_to_terrain_impl(VALUE lerc_data, const TerrainOutputOptions& options, NativeError& error) {
+    const InputBytes input(lerc_data);
+    LercJob job;
+    VALUE output = job.output.allocate();
 
-        const std::size_t total = static_cast<std::size_t>(nCols) * nRows * nBands;
-        std::vector<float> elev(total);
+    without_gvl([&]() noexcept { run_lerc_job(input, options, job); });
+    publish_stage_stats(job.stats);
 
-        if (const int rc = lerc_decode(blob, n, 0, nullptr, 1,
-                                       nCols, nRows, nBands, type, elev.data());
-            rc != LERC_OK) {
-            rb_raise(rb_eRuntimeError, "LERC decode failed: code %d", rc);
+    const VALUE result = lerc_job_result(job, output, error);
+    RB_GC_GUARD(output);
+    return result;
+}
+
+VALUE lerc_to_terrain_batch_impl(VALUE blobs, const TerrainOutputOptions& options, unsigned threads) {
+    const long count = RARRAY_LEN(blobs);
+    std::vector<InputBytes> inputs(static_cast<std::size_t>(count));
+    std::vector<LercJob> jobs(static_cast<std::size_t>(count));
+    std::vector<NativeError> errors(static_cast<std::size_t>(count));
+
+    for (long i = 0; i < count; ++i) {
+        VALUE blob = rb_ary_entry(blobs, i);
+        if (!RB_TYPE_P(blob, T_STRING)) {
+            errors[i].set(rb_eTypeError, "wrong argument type %s (expected String)", rb_obj_classname(blob));
+        } else if (RSTRING_LEN(blob) == 0) {
+            errors[i].set(rb_eArgError, "Empty LERC data");
+        } else {
+            inputs[i] = InputBytes(blob);
         }
+    }
 
-        const int tw = (nCols == ARCGIS_TILE_SIZE) ? MAPBOX_TILE_SIZE : nCols;
-        const int th = (nRows == ARCGIS_TILE_SIZE) ? MAPBOX_TILE_SIZE : nRows;
-        
-        if (tw > SIZE_MAX / th / 3u)
-            rb_raise(rb_eRuntimeError, "RGB buffer size too large: %dx%d", tw, th);
-        
-        const std::size_t rgb_size = static_cast<std::size_t>(tw) * th * 3u;
-        std::vector<std::uint8_t> rgb(rgb_size);
-
-        const float* elev_ptr = elev.data();
-        std::uint8_t* rgb_ptr = rgb.data();
-        
-        for (int y = 0; y < th; ++y) {
-            const int row = y * nCols;
-            for (int x = 0; x < tw; ++x) {
-                const float e = elev_ptr[row + x];
-                const int32_t code = std::clamp(
-                    static_cast<int32_t>(std::round((e + MAPBOX_OFFSET) / MAPBOX_SCALE)), 0, MAX_24BIT);
-                
-                *rgb_ptr++ = static_cast<std::uint8_t>((code >> 16) & 0xFF);
-                *rgb_ptr++ = static_cast<std::uint8_t>((code >> 8)  & 0xFF);
-                *rgb_ptr++ = static_cast<std::uint8_t>( code        & 0xFF);
-            }
+    // Destination Strings live in a Ruby Array while the pool writes into them
+    VALUE outputs = rb_ary_new_capa(count);
+    for (long i = 0; i < count; ++i) {
+        rb_ary_push(outputs, errors[i] ? Qnil : jobs[i].output.allocate());
+    }
+
+    without_gvl([&]() noexcept {
+        WorkerPool::shared().parallel_for(inputs.size(), threads, [&](std::size_t i) {
+            if (!errors[i]) run_lerc_job(inputs[i], options, jobs[i]);
+        });
+    });
+
+    StageStats stats;
+    for (const LercJob& job : jobs) stats += job.stats;
+    publish_stage_stats(stats);
+
+    VALUE results = rb_ary_new_capa(count);
+    for (long i = 0; i < count; ++i) {
+        NativeError& error = errors[i];
+        const VALUE result = error ? Qnil : lerc_job_result(jobs[i], rb_ary_entry(outputs, i), error);
+        rb_ary_push(results, error ? rb_exc_new_cstr(error.klass, error.message) : result);
+    }
+    RB_GC_GUARD(outputs);
+    return results;
+}
+
+// String or Symbol option value; empty when the key is absent
+std::string_view option_name(VALUE opts, const char* key) {
+    VALUE value = rb_hash_aref(opts, ID2SYM(rb_intern(key)));
+    if (NIL_P(value)) return {};
+    if (RB_TYPE_P(value, T_SYMBOL)) value = rb_sym2str(value);
+    Check_Type(value, T_STRING);
+    return {RSTRING_PTR(value), static_cast<std::size_t>(RSTRING_LEN(value))};
+}
+
+DownsampleMethod parse_downsample_method(std::string_view method) {
+    if (method.empty() || method == "average") return DownsampleMethod::Average;
+    if (method == "nearest") return DownsampleMethod::Nearest;
+    if (method == "maximum") return DownsampleMethod::Maximum;
+
+    rb_raise(rb_eArgError, "Unknown downsample method: %.*s (expected 'average', 'nearest', or 'maximum')",
+             static_cast<int>(method.size()), method.data());
+}
+
+// Options: encoding: ('mapbox' | 'terrarium'), format: ('png' | 'webp'), effort: (WebP 0-9),
+// png: (see png_codec.h), target_size: and method: (downsample_png sampling, applied to the float grid)
+TerrainOutputOptions parse_terrain_output_options(VALUE opts) {
+    TerrainOutputOptions options;
+    options.png = parse_png_options(opts);
+    options.webp_effort = parse_webp_effort(opts);
+    if (NIL_P(opts)) return options;
+
+    if (const std::string_view encoding = option_name(opts, "encoding"); encoding == "terrarium") {
+        options.is_terrarium = true;
+    } else if (!encoding.empty() && encoding != "mapbox") {
+        rb_raise(rb_eArgError, "Unknown encoding type: %.*s (expected 'mapbox' or 'terrarium')",
+                 static_cast<int>(encoding.size()), encoding.data());
+    }
+
+    if (const std::string_view format = option_name(opts, "format"); format == "webp") {
+        options.format = TerrainFormat::Webp;
+    } else if (!format.empty() && format != "png") {
+        rb_raise(rb_eArgError, "Unsupported output format: %.*s (expected 'png' or 'webp')",
+                 static_cast<int>(format.size()), format.data());
+    }
+
+    const VALUE target_size = rb_hash_aref(opts, ID2SYM(rb_intern("target_size")));
+    if (!NIL_P(target_size)) {
+        options.target_size = NUM2INT(target_size);
+        if (options.target_size <= 0 || options.target_size > 1024) {
+            rb_raise(rb_eArgError, "Invalid target size: %d (must be 1-1024)", options.target_size);
         }
+        options.reduce = select_elevation_reducer(parse_downsample_method(option_name(opts, "method")));
+    }
 
-        int png_len = 0;
-        using png_ptr = std::unique_ptr<unsigned char, void(*)(void*)>;
-        png_ptr png{ stbi_write_png_to_mem(rgb.data(), tw * 3, tw, th, 3, &png_len), std::free };
-        if (!png) rb_raise(rb_eRuntimeError, "PNG creation failed");
+    return options;
+}
+
+VALUE lerc_to_terrain_checked(VALUE lerc_data, const TerrainOutputOptions& options) {
+    Check_Type(lerc_data, T_STRING);
+    if (RSTRING_LEN(lerc_data) == 0) rb_raise(rb_eArgError, "Empty LERC data");
+
+    NativeError error;
+    const VALUE result = lerc_to_terrain_impl(lerc_data, options, error);
+    RB_GC_GUARD(lerc_data);
+    if (error) raise_native_error(error);
+    return result;
+}
+
+VALUE lerc_to_terrain_batch_checked(VALUE blobs, VALUE opts, const TerrainOutputOptions& options) {
+    Check_Type(blobs, T_ARRAY);
+    const unsigned threads = parse_batch_threads(opts);
 
-        return rb_str_new(reinterpret_cast<const char*>(png.get()), static_cast<long>(png_len));
+    try {
+        const VALUE results = lerc_to_terrain_batch_impl(blobs, options, threads);
+        RB_GC_GUARD(blobs);
+        return results;
     } catch (const std::exception& e) {
         rb_raise(rb_eRuntimeError, "C++ exception: %s", e.what());
-    } catch (...) {
-        rb_raise(rb_eRuntimeError, "Unknown C++ exception occurred");
     }
-    return Qnil;
+}
+
+// Options: png: preset name ('fast', 'default', 'max') or { preset:, level:, filter: }
+extern "C" VALUE lerc_to_mapbox_png(int argc, VALUE* argv, VALUE /*self*/) {
+    VALUE lerc_data, opts;
+    rb_scan_args(argc, argv, "1:", &lerc_data, &opts);
+
+    TerrainOutputOptions options;
+    options.png = parse_png_options(opts);
+    return lerc_to_terrain_checked(lerc_data, options);
+}
+
+// Decodes LERC straight to the route's terrain tile: Mapbox or Terrarium RGB, optionally
+// reduced to target_size: on the float grid, encoded once as PNG or lossless WebP.
+// Returns nil for no-data tiles.
+extern "C" VALUE lerc_to_terrain(int argc, VALUE* argv, VALUE /*self*/) {
+    VALUE lerc_data, opts;
+    rb_scan_args(argc, argv, "1:", &lerc_data, &opts);
+    return lerc_to_terrain_checked(lerc_data, parse_terrain_output_options(opts));
+}
+
+// Converts an Array of LERC blobs on the native worker pool. Results keep input order;
+// failed items yield their exception object instead of raising. Options: threads: (default nproc), png:.
+extern "C" VALUE lerc_to_mapbox_png_batch(int argc, VALUE* argv, VALUE /*self*/) {
+    VALUE blobs, opts;
+    rb_scan_args(argc, argv, "1:", &blobs, &opts);
+
+    TerrainOutputOptions options;
+    options.png = parse_png_options(opts);
+    return lerc_to_terrain_batch_checked(blobs, opts, options);
+}
+
+// Batch form of lerc_to_terrain; takes its options plus threads:
+extern "C" VALUE lerc_to_terrain_batch(int argc, VALUE* argv, VALUE /*self*/) {
+    VALUE blobs, opts;
+    rb_scan_args(argc, argv, "1:", &blobs, &opts);
+    return lerc_to_terrain_batch_checked(blobs, opts, parse_terrain_output_options(opts));
 }
 
 extern "C" void Init_lerc_extension(void) {
     VALUE LercFFI = rb_define_module("LercFFI");
-    rb_define_singleton_method(LercFFI, "lerc_to_mapbox_png", lerc_to_mapbox_png, 1);
+    rb_define_singleton_method(LercFFI, "lerc_to_mapbox_png", lerc_to_mapbox_png, -1);
+    rb_define_singleton_method(LercFFI, "lerc_to_mapbox_png_batch", lerc_to_mapbox_png_batch, -1);
+    rb_define_singleton_method(LercFFI, "lerc_to_terrain", lerc_to_terrain, -1);
+    rb_define_singleton_method(LercFFI, "lerc_to_terrain_batch", lerc_to_terrain_batch, -1);
+    define_stage_stats_methods(LercFFI);
 }
@@ -0,0 +1,38 @@
+#!/bin/bash
+# Profile-guided build of the given extconf files (default: all extensions built in Docker).
+# Stage 1 builds them instrumented (TPC_EXT_PGO=generate), bench/pgo_training.rb runs them
+# over the checked-in corpus, stage 2 rebuilds them with the profile (TPC_EXT_PGO=use).
+# TPC_EXT_NATIVE / TPC_EXT_LTO apply to both stages. Requires GCC.
+#   ./pgo_build.sh [extconf.rb ...]
+set -e
+
+cd "$(dirname "$0")"
+
+EXTCONFS=("$@")
+if [ ${#EXTCONFS[@]} -eq 0 ]; then
+    EXTCONFS=(extconf.rb terrain_downsample_extconf.rb raster_downsample_extconf.rb tile_validator_extconf.rb tile_blob_extconf.rb)
+fi
+
+if ! g++ --version 2>/dev/null | grep -q "Free Software Foundation"; then
+    echo "Error: the PGO build needs GCC as g++"
+    exit 1
+fi
+
+build_stage() {
+    for conf in "${EXTCONFS[@]}"; do
+        TPC_EXT_PGO=$1 ruby "$conf"
+        make clean >/dev/null
+        make
+    done
+}
+
+echo "PGO stage 1: instrumented build..."
+rm -rf pgo-profile
+build_stage generate
+
+echo "PGO training on bench/corpus..."
+ruby bench/pgo_training.rb "${TPC_PGO_PASSES:-3}"
+
+echo "PGO stage 2: optimized build..."
+build_stage use
+echo "✅ PGO build done: $(ls *.so)"
@@ -0,0 +1,138 @@
+// libpng-based PNG encoder with configurable zlib level and row filter.
+// Replaces stbi_write_png_to_mem: stb has no speed knob and compresses poorly for its cost.
+#pragma once
+
+#include "ruby.h"
+#include "gvl_call.h"
+#include <png.h>
+#include <zlib.h>
+
+#include <csetjmp>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+struct PngEncodeOptions {
+    int level = 6;               // zlib level 0-9
+    int filter = PNG_FILTER_UP;  // PNG_FILTER_* mask; PNG_ALL_FILTERS = adaptive per row
+    int strategy = Z_DEFAULT_STRATEGY;
+};
+
+// fast: live cache-miss path; default: balanced; max: offline reconstruction.
+// Up is a good fixed filter for terrain RGB, whose rows change slowly.
+constexpr PngEncodeOptions PNG_PRESET_FAST{1, PNG_FILTER_UP, Z_DEFAULT_STRATEGY};
+constexpr PngEncodeOptions PNG_PRESET_DEFAULT{6, PNG_FILTER_UP, Z_DEFAULT_STRATEGY};
+constexpr PngEncodeOptions PNG_PRESET_MAX{9, PNG_ALL_FILTERS, Z_DEFAULT_STRATEGY};
+
+namespace png_codec_detail {
+
+inline void write_to_buffer(png_structp png, png_bytep data, png_size_t length) {
+    if (!static_cast<EncodedBuffer*>(png_get_io_ptr(png))->append(data, length)) {
+        png_error(png, "out of memory");
+    }
+}
+
+inline void flush_noop(png_structp) {}
+
+// Only trivially destructible state lives in this frame: libpng reports errors via longjmp
+inline bool encode(png_structp png, png_infop info, const std::uint8_t* pixels, int width, int height,
+                   std::size_t row_stride, int color_type, const PngEncodeOptions& options,
+                   EncodedBuffer* out) {
+    if (setjmp(png_jmpbuf(png))) {
+        return false;
+    }
+
+    png_set_write_fn(png, out, write_to_buffer, flush_noop);
+    png_set_IHDR(png, info, static_cast<png_uint_32>(width), static_cast<png_uint_32>(height), 8, color_type,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_set_compression_level(png, options.level);
+    png_set_compression_strategy(png, options.strategy);
+    png_set_filter(png, PNG_FILTER_TYPE_BASE, options.filter);
+    // One IDAT chunk for a typical tile instead of many 8 KB ones
+    png_set_compression_buffer_size(png, 1u << 16);
+
+    png_write_info(png, info);
+    for (int y = 0; y < height; ++y) {
+        png_write_row(png, pixels + static_cast<std::size_t>(y) * row_stride);
+    }
+    png_write_end(png, nullptr);
+    return true;
+}
+
+}  // namespace png_codec_detail
+
+// Encodes 8-bit gray/GA/RGB/RGBA pixels (channels 1-4) and appends the PNG stream to out.
+// Safe without the GVL; returns false on libpng or allocation failure.
+inline bool encode_png(const std::uint8_t* pixels, int width, int height, int channels,
+                       const PngEncodeOptions& options, EncodedBuffer& out) noexcept {
+    constexpr int color_types[] = {PNG_COLOR_TYPE_GRAY, PNG_COLOR_TYPE_GRAY_ALPHA, PNG_COLOR_TYPE_RGB, PNG_COLOR_TYPE_RGB_ALPHA};
+    if (channels < 1 || channels > 4 || width <= 0 || height <= 0) return false;
+
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    if (!png) return false;
+    png_infop info = png_create_info_struct(png);
+    if (!info) {
+        png_destroy_write_struct(&png, nullptr);
+        return false;
+    }
+
+    const std::size_t row_stride = static_cast<std::size_t>(width) * static_cast<std::size_t>(channels);
+    const bool ok = png_codec_detail::encode(png, info, pixels, width, height, row_stride,
+                                             color_types[channels - 1], options, &out);
+    png_destroy_write_struct(&png, &info);
+    return ok;
+}
+
+inline int parse_png_filter(std::string_view name) {
+    if (name == "none") return PNG_FILTER_NONE;
+    if (name == "sub") return PNG_FILTER_SUB;
+    if (name == "up") return PNG_FILTER_UP;
+    if (name == "avg") return PNG_FILTER_AVG;
+    if (name == "paeth") return PNG_FILTER_PAETH;
+    if (name == "adaptive") return PNG_ALL_FILTERS;
+
+    rb_raise(rb_eArgError, "Unknown PNG filter: %.*s (expected none, sub, up, avg, paeth or adaptive)",
+             static_cast<int>(name.size()), name.data());
+}
+
+inline PngEncodeOptions parse_png_preset(std::string_view name) {
+    if (name == "fast") return PNG_PRESET_FAST;
+    if (name == "default") return PNG_PRESET_DEFAULT;
+    if (name == "max") return PNG_PRESET_MAX;
+
+    rb_raise(rb_eArgError, "Unknown PNG preset: %.*s (expected fast, default or max)",
+             static_cast<int>(name.size()), name.data());
+}
+
+// png: option of the native calls: nil, a preset name ('fast', 'default', 'max') or a Hash
+// { preset:, level:, filter: } where level/filter override the preset
+inline PngEncodeOptions parse_png_options(VALUE opts) {
+    if (NIL_P(opts)) return PNG_PRESET_DEFAULT;
+
+    const VALUE png = rb_hash_aref(opts, ID2SYM(rb_intern("png")));
+    if (NIL_P(png)) return PNG_PRESET_DEFAULT;
+
+    const auto view = [](VALUE str) {
+        Check_Type(str, T_STRING);
+        return std::string_view{RSTRING_PTR(str), static_cast<std::size_t>(RSTRING_LEN(str))};
+    };
+
+    if (RB_TYPE_P(png, T_SYMBOL)) return parse_png_preset(rb_id2name(SYM2ID(png)));
+    if (!RB_TYPE_P(png, T_HASH)) return parse_png_preset(view(png));
+
+    const VALUE preset = rb_hash_aref(png, ID2SYM(rb_intern("preset")));
+    PngEncodeOptions options = NIL_P(preset) ? PNG_PRESET_DEFAULT : parse_png_preset(view(rb_String(preset)));
+
+    const VALUE level = rb_hash_aref(png, ID2SYM(rb_intern("level")));
+    if (!NIL_P(level)) {
+        options.level = NUM2INT(level);
+        if (options.level < 0 || options.level > 9) {
+            rb_raise(rb_eArgError, "Invalid PNG level: %d (must be 0-9)", options.level);
+        }
+    }
+
+    const VALUE filter = rb_hash_aref(png, ID2SYM(rb_intern("filter")));
+    if (!NIL_P(filter)) options.filter = parse_png_filter(view(rb_String(filter)));
+
+    return options;
+}
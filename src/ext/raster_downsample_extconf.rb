@@ -0,0 +1,16 @@
+require "mkmf"
+require_relative "build_flags"
+
+TpcBuildFlags.apply
+
+$srcs = ["raster_downsample_extension.cpp"]
+
+unless pkg_config("libpng")
+  abort "libpng not found. Please install libpng-dev"
+end
+
+unless pkg_config("libwebp")
+  abort "libwebp not found. Please install libwebp-dev"
+end
+
+create_makefile("raster_downsample_extension")
@@ -0,0 +1,612 @@
+#include "ruby.h"
+#include <png.h>
+#include <webp/decode.h>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "gvl_call.h"
+#include "decoded_tile.h"
+#include "png_codec.h"
+#include "webp_codec.h"
+#include "scratch_arena.h"
+#include "stage_stats.h"
+#include "worker_pool.h"
+#include "raster_downsample_kernels.h"
+
+// Internal linkage: Ruby loads extensions with RTLD_GLOBAL and the terrain extension
+// defines helpers with the same names
+namespace {
+
+// RAII wrapper for libpng png_image
+struct PngImage {
+    png_image image{};
+    PngImage() { image.version = PNG_IMAGE_VERSION; }
+    ~PngImage() { png_image_free(&image); }
+    PngImage(const PngImage&) = delete;
+    PngImage& operator=(const PngImage&) = delete;
+};
+
+// Reused by every call on this thread (see scratch_arena.h)
+struct RasterScratch {
+    ScratchBuffer<std::uint8_t> mosaic;
+    ScratchBuffer<float> rows;
+    ScratchBuffer<std::uint8_t> output;
+
+    void trim() noexcept {
+        mosaic.trim();
+        rows.trim();
+        output.trim();
+    }
+};
+
+RasterScratch& raster_scratch() noexcept {
+    thread_local RasterScratch scratch;
+    return scratch;
+}
+
+// Outcome of work done without the GVL; mapped to a Ruby value or exception afterwards
+enum class RasterStatus {
+    Ok,
+    NoData,
+    Unsupported,
+    PngEncodeFailed,
+    WebpEncodeFailed,
+    OutOfMemory,
+    CppException
+};
+
+enum class RasterFormat {
+    Png,
+    Webp
+};
+
+struct RasterOutputOptions {
+    RasterFormat format = RasterFormat::Png;
+    PngEncodeOptions png;
+    WebpEncodeOptions webp;
+    bool keep_pixels = false;
+};
+
+struct RasterJob {
+    RasterStatus status = RasterStatus::Ok;
+    EncodedBuffer output;
+    TilePixels pixels;  // reduced RGBA tile, kept for keep_pixels: true
+    StageStats stats;
+};
+
+enum class ChildFormat {
+    Missing,
+    Png,
+    Webp,
+    Decoded
+};
+
+// Header of one child, read before the mosaic is sized
+struct ChildHeader {
+    ChildFormat format = ChildFormat::Missing;
+    int width = 0;
+    int height = 0;
+    bool has_alpha = false;
+    PngImage png;
+};
+
+using QuadChildren = std::array<QuadChild, 4>;
+
+// Sniffs and reads one child's header. Missing and unreadable children become transparent
+// quadrants, like fill_missing_tiles; formats only Vips can read make the quad Unsupported.
+bool probe_child(const QuadChild& quad_child, ChildHeader& header) {
+    static constexpr std::uint8_t PNG_SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    if (const TilePixels* decoded = quad_child.decoded) {
+        if (decoded->channels != 4) return false;
+        header.format = ChildFormat::Decoded;
+        header.width = header.height = decoded->size;
+        header.has_alpha = !decoded->opaque;
+        return true;
+    }
+
+    const InputBytes& child = quad_child.encoded;
+    const std::uint8_t* data = child.data();
+    const std::size_t size = child.size();
+    if (child.empty()) return true;
+
+    if (size >= 8 && std::memcmp(data, PNG_SIGNATURE, 8) == 0) {
+        if (!png_image_begin_read_from_memory(&header.png.image, data, size)) return true;
+        header.format = ChildFormat::Png;
+        header.width = static_cast<int>(header.png.image.width);
+        header.height = static_cast<int>(header.png.image.height);
+        header.has_alpha = (header.png.image.format & PNG_FORMAT_FLAG_ALPHA) != 0;
+        return true;
+    }
+
+    if (size >= 12 && std::memcmp(data, "RIFF", 4) == 0 && std::memcmp(data + 8, "WEBP", 4) == 0) {
+        WebPBitstreamFeatures features;
+        if (WebPGetFeatures(data, size, &features) != VP8_STATUS_OK) return true;
+        if (features.has_animation) return false;
+        header.format = ChildFormat::Webp;
+        header.width = features.width;
+        header.height = features.height;
+        header.has_alpha = features.has_alpha != 0;
+        return true;
+    }
+
+    return false;
+}
+
+// Decodes a probed child (or copies DecodedTile pixels) straight into its RGBA quadrant of the mosaic
+bool decode_child_into_mosaic(const QuadChild& quad_child, ChildHeader& header, std::uint8_t* dst,
+                              std::size_t row_stride, std::size_t available) {
+    if (header.format == ChildFormat::Decoded) {
+        const TilePixels& decoded = *quad_child.decoded;
+        const std::size_t tile_row = static_cast<std::size_t>(decoded.size) * 4u;
+        for (int y = 0; y < decoded.size; ++y) {
+            std::memcpy(dst + y * row_stride, decoded.data.get() + y * tile_row, tile_row);
+        }
+        return true;
+    }
+
+    const InputBytes& child = quad_child.encoded;
+    if (header.format == ChildFormat::Png) {
+        header.png.image.format = PNG_FORMAT_RGBA;
+        return png_image_finish_read(&header.png.image, nullptr, dst, static_cast<png_int_32>(row_stride), nullptr) != 0;
+    }
+    return WebPDecodeRGBAInto(child.data(), child.size(), dst, available, static_cast<int>(row_stride)) != nullptr;
+}
+
+void clear_quadrant(std::uint8_t* dst, std::size_t row_stride, int tile_size) noexcept {
+    for (int y = 0; y < tile_size; ++y) {
+        std::memset(dst + y * row_stride, 0, static_cast<std::size_t>(tile_size) * 4u);
+    }
+}
+
+bool encode_raster(const std::uint8_t* pixels, int tile_size, int channels, const RasterOutputOptions& options,
+                   EncodedBuffer& out) noexcept {
+    if (options.format == RasterFormat::Webp) {
+        return encode_webp(pixels, tile_size, tile_size, channels, options.webp, out);
+    }
+    return encode_png(pixels, tile_size, tile_size, channels, options.png, out);
+}
+
+// Mosaic → reduce → encode for one quad; safe to run without the GVL
+RasterStatus downsample_quad_job(const QuadChildren& child_blobs, RasterReduceKernel reduce,
+                                 const RasterOutputOptions& options, RasterJob& job) {
+    StageClock clock(job.stats);
+    for (const QuadChild& child : child_blobs) clock.count_input(child.encoded.size());
+
+    std::array<ChildHeader, 4> headers;
+    int tile_size = 0;
+    for (std::size_t i = 0; i < 4; ++i) {
+        if (!probe_child(child_blobs[i], headers[i])) return RasterStatus::Unsupported;
+        if (headers[i].format != ChildFormat::Missing && tile_size == 0) tile_size = headers[i].width;
+    }
+
+    if (tile_size == 0) return RasterStatus::NoData;
+    if (tile_size > 1024) return RasterStatus::Unsupported;
+    for (const ChildHeader& header : headers) {
+        if (header.format != ChildFormat::Missing && (header.width != tile_size || header.height != tile_size)) {
+            return RasterStatus::Unsupported;
+        }
+    }
+
+    const int mosaic_size = tile_size * 2;
+    const std::size_t row_stride = static_cast<std::size_t>(mosaic_size) * 4u;
+    const std::size_t mosaic_bytes = row_stride * mosaic_size;
+    RasterScratch& scratch = raster_scratch();
+    std::uint8_t* mosaic = scratch.mosaic.take(mosaic_bytes);
+
+    // TMS rows grow northwards, so children 2/3 form the top half of the image
+    constexpr std::array<std::pair<int, int>, 4> quadrant_origin{{{0, 1}, {1, 1}, {0, 0}, {1, 0}}};
+
+    int decoded_count = 0;
+    bool opaque = true;
+    for (std::size_t i = 0; i < 4; ++i) {
+        const auto [qx, qy] = quadrant_origin[i];
+        const std::size_t offset = qy * tile_size * row_stride + qx * tile_size * 4u;
+        std::uint8_t* dst = mosaic + offset;
+
+        if (headers[i].format != ChildFormat::Missing &&
+            decode_child_into_mosaic(child_blobs[i], headers[i], dst, row_stride, mosaic_bytes - offset)) {
+            ++decoded_count;
+            opaque &= !headers[i].has_alpha;
+        } else {
+            clear_quadrant(dst, row_stride, tile_size);
+            opaque = false;
+        }
+    }
+
+    if (decoded_count == 0) return RasterStatus::NoData;
+    clock.lap(NativeStage::Decode);
+
+    const std::size_t pixel_count = static_cast<std::size_t>(tile_size) * tile_size;
+    std::uint8_t* output = scratch.output.take(pixel_count * 4u);
+    float* rows = scratch.rows.take(pixel_count * 8u);
+    reduce(mosaic, tile_size, rows, output);
+    if (options.keep_pixels) job.pixels.assign(output, tile_size, 4, opaque);
+
+    // Opaque quads keep an RGB output, as Vips does when no child has alpha
+    if (opaque) drop_alpha_in_place(output, pixel_count);
+    clock.lap(NativeStage::Downsample);
+
+    const bool encoded = encode_raster(output, tile_size, opaque ? 3 : 4, options, job.output);
+    clock.lap(NativeStage::Encode);
+    clock.count_output(job.output.size());
+    if (encoded) return RasterStatus::Ok;
+    return options.format == RasterFormat::Webp ? RasterStatus::WebpEncodeFailed : RasterStatus::PngEncodeFailed;
+}
+
+void describe_failure(RasterStatus status, NativeError& error) noexcept {
+    switch (status) {
+        case RasterStatus::PngEncodeFailed:
+            error.set(rb_eRuntimeError, "PNG creation failed");
+            break;
+        case RasterStatus::WebpEncodeFailed:
+            error.set(rb_eRuntimeError, "WebP creation failed");
+            break;
+        case RasterStatus::OutOfMemory:
+            error.set(rb_eNoMemError, "Failed to allocate downsample buffers");
+            break;
+        case RasterStatus::CppException:
+            error.set(rb_eRuntimeError, "Unknown C++ exception occurred");
+            break;
+        case RasterStatus::Ok:
+        case RasterStatus::NoData:
+        case RasterStatus::Unsupported:
+            break;
+    }
+}
+
+// Ok → String (DecodedTile with keep_pixels), NoData → nil, Unsupported → false; failures
+// are described in error. output is the String the job's EncodedBuffer was attached to.
+VALUE quad_job_result(RasterJob& job, VALUE output, NativeError& error) {
+    switch (job.status) {
+        case RasterStatus::Ok: {
+            const VALUE data = job.output.finish(output);
+            return job.pixels.data ? wrap_decoded_tile(std::move(job.pixels), data) : data;
+        }
+        case RasterStatus::NoData: return Qnil;
+        case RasterStatus::Unsupported: return Qfalse;
+        default:
+            describe_failure(job.status, error);
+            return Qnil;
+    }
+}
+
+void run_quad_job(RasterJob& job, const QuadChildren& child_blobs, RasterReduceKernel reduce,
+                  const RasterOutputOptions& options) noexcept {
+    try {
+        job.status = downsample_quad_job(child_blobs, reduce, options, job);
+    } catch (const std::bad_alloc&) {
+        job.status = RasterStatus::OutOfMemory;
+    } catch (...) {
+        job.status = RasterStatus::CppException;
+    }
+    raster_scratch().trim();
+}
+
+// Collects the non-empty children of a validated 4-element array; runs under the GVL
+QuadChildren collect_quad_children(VALUE children) {
+    QuadChildren child_blobs{};
+    for (long i = 0; i < 4; ++i) {
+        child_blobs[i] = make_quad_child(rb_ary_entry(children, i));
+    }
+    return child_blobs;
+}
+
+// Checks an Array of 4 children (String or nil) without raising; fills error on mismatch
+bool valid_quad(VALUE children, NativeError& error) {
+    if (!RB_TYPE_P(children, T_ARRAY)) {
+        error.set(rb_eTypeError, "Expected Array of 4 children, got %s", rb_obj_classname(children));
+        return false;
+    }
+    if (RARRAY_LEN(children) != 4) {
+        error.set(rb_eArgError, "Expected 4 children, got %ld", RARRAY_LEN(children));
+        return false;
+    }
+    for (long i = 0; i < 4; ++i) {
+        VALUE child = rb_ary_entry(children, i);
+        if (!valid_quad_child(child)) {
+            error.set(rb_eTypeError, "Child %ld must be String, DecodedTile or nil, got %s", i, rb_obj_classname(child));
+            return false;
+        }
+    }
+    return true;
+}
+
+RasterKernel parse_raster_kernel(VALUE kernel_val) {
+    Check_Type(kernel_val, T_STRING);
+    const std::string_view kernel{RSTRING_PTR(kernel_val), static_cast<size_t>(RSTRING_LEN(kernel_val))};
+
+    if (kernel == "box") return RasterKernel::Box;
+    if (kernel == "nearest") return RasterKernel::Nearest;
+    if (kernel == "linear") return RasterKernel::Linear;
+    if (kernel == "cubic") return RasterKernel::Cubic;
+    if (kernel == "mitchell") return RasterKernel::Mitchell;
+    if (kernel == "lanczos2") return RasterKernel::Lanczos2;
+    if (kernel == "lanczos3") return RasterKernel::Lanczos3;
+
+    rb_raise(rb_eArgError,
+             "Unknown kernel: %s (expected 'box', 'nearest', 'linear', 'cubic', 'mitchell', 'lanczos2' or 'lanczos3')",
+             kernel.data());
+}
+
+RasterOutputOptions parse_raster_output_options(VALUE format_val, VALUE opts) {
+    Check_Type(format_val, T_STRING);
+    const std::string_view format{RSTRING_PTR(format_val), static_cast<size_t>(RSTRING_LEN(format_val))};
+
+    RasterOutputOptions options;
+    if (format == "png") {
+        options.format = RasterFormat::Png;
+        options.png = parse_png_options(opts);
+    } else if (format == "webp") {
+        options.format = RasterFormat::Webp;
+        options.webp = parse_webp_options(opts);
+    } else {
+        rb_raise(rb_eArgError, "Unsupported output format: %s (expected 'png' or 'webp')", format.data());
+    }
+    options.keep_pixels = parse_keep_pixels(opts);
+    return options;
+}
+
+VALUE downsample_quad_impl(VALUE children, RasterReduceKernel reduce, const RasterOutputOptions& options,
+                           NativeError& error) {
+    const QuadChildren child_blobs = collect_quad_children(children);
+
+    RasterJob job;
+    VALUE output = job.output.allocate();
+    without_gvl([&]() noexcept { run_quad_job(job, child_blobs, reduce, options); });
+    publish_stage_stats(job.stats);
+
+    const VALUE result = quad_job_result(job, output, error);
+    RB_GC_GUARD(output);
+    return result;
+}
+
+VALUE downsample_batch_impl(VALUE quads, RasterReduceKernel reduce, const RasterOutputOptions& options,
+                            unsigned threads) {
+    const long count = RARRAY_LEN(quads);
+    std::vector<QuadChildren> inputs(static_cast<std::size_t>(count));
+    std::vector<RasterJob> jobs(static_cast<std::size_t>(count));
+    std::vector<NativeError> errors(static_cast<std::size_t>(count));
+
+    for (long i = 0; i < count; ++i) {
+        VALUE quad = rb_ary_entry(quads, i);
+        if (valid_quad(quad, errors[i])) inputs[i] = collect_quad_children(quad);
+    }
+
+    // Destination Strings live in a Ruby Array while the pool writes into them
+    VALUE outputs = rb_ary_new_capa(count);
+    for (long i = 0; i < count; ++i) {
+        rb_ary_push(outputs, errors[i] ? Qnil : jobs[i].output.allocate());
+    }
+
+    without_gvl([&]() noexcept {
+        WorkerPool::shared().parallel_for(inputs.size(), threads, [&](std::size_t i) {
+            if (!errors[i]) run_quad_job(jobs[i], inputs[i], reduce, options);
+        });
+    });
+
+    StageStats stats;
+    for (const RasterJob& job : jobs) stats += job.stats;
+    publish_stage_stats(stats);
+
+    VALUE results = rb_ary_new_capa(count);
+    for (long i = 0; i < count; ++i) {
+        NativeError& error = errors[i];
+        const VALUE result = error ? Qnil : quad_job_result(jobs[i], rb_ary_entry(outputs, i), error);
+        rb_ary_push(results, error ? rb_exc_new_cstr(error.klass, error.message) : result);
+    }
+    RB_GC_GUARD(outputs);
+    return results;
+}
+
+// Sub-tiles per side of the largest metatile slice_metatile accepts
+constexpr int MAX_METATILE_SPAN = 8;
+
+struct SliceJob {
+    RasterStatus status = RasterStatus::Ok;
+    std::vector<EncodedBuffer> outputs;  // span × span sub-tiles, northern row first
+    std::vector<RasterStatus> statuses;
+    StageStats stats;
+};
+
+bool opaque_rgba(const std::uint8_t* pixels, std::size_t count) noexcept {
+    for (std::size_t i = 0; i < count; ++i) {
+        if (pixels[i * 4u + 3] != 255) return false;
+    }
+    return true;
+}
+
+// Copies sub-tile i out of the decoded metatile and encodes it; runs on a pool thread with
+// that thread's scratch buffers
+RasterStatus encode_slice(const std::uint8_t* image, std::size_t row_stride, int span, int tile_size,
+                          bool has_alpha, std::size_t i, const RasterOutputOptions& options, EncodedBuffer& out) noexcept {
+    try {
+        const std::size_t tile_row = static_cast<std::size_t>(tile_size) * 4u;
+        const std::size_t pixel_count = static_cast<std::size_t>(tile_size) * tile_size;
+        const std::uint8_t* origin = image + (i / span) * tile_size * row_stride + (i % span) * tile_row;
+        RasterScratch& scratch = raster_scratch();
+        std::uint8_t* pixels = scratch.output.take(pixel_count * 4u);
+        for (int y = 0; y < tile_size; ++y) {
+            std::memcpy(pixels + y * tile_row, origin + y * row_stride, tile_row);
+        }
+
+        // Opaque sub-tiles are written as RGB, like opaque quads
+        const bool opaque = !has_alpha || opaque_rgba(pixels, pixel_count);
+        if (opaque) drop_alpha_in_place(pixels, pixel_count);
+        const bool encoded = encode_raster(pixels, tile_size, opaque ? 3 : 4, options, out);
+        // Only this buffer: on the calling thread the mosaic still holds the decoded metatile
+        scratch.output.trim();
+        if (encoded) return RasterStatus::Ok;
+        return options.format == RasterFormat::Webp ? RasterStatus::WebpEncodeFailed : RasterStatus::PngEncodeFailed;
+    } catch (const std::bad_alloc&) {
+        return RasterStatus::OutOfMemory;
+    } catch (...) {
+        return RasterStatus::CppException;
+    }
+}
+
+// Decode once → cut into span × span tiles → encode them on the worker pool; safe to run
+// without the GVL
+RasterStatus slice_metatile_job(const QuadChild& source, int span, const RasterOutputOptions& options,
+                                unsigned threads, SliceJob& job) {
+    StageClock clock(job.stats);
+    clock.count_input(source.encoded.size());
+
+    ChildHeader header;
+    if (!probe_child(source, header)) return RasterStatus::Unsupported;
+    if (header.format == ChildFormat::Missing) return RasterStatus::NoData;
+    if (header.width != header.height || header.width % span != 0) return RasterStatus::Unsupported;
+    const int tile_size = header.width / span;
+    if (tile_size > 1024) return RasterStatus::Unsupported;
+
+    const std::size_t row_stride = static_cast<std::size_t>(header.width) * 4u;
+    const std::size_t image_bytes = row_stride * static_cast<std::size_t>(header.height);
+    std::uint8_t* image = raster_scratch().mosaic.take(image_bytes);
+    if (!decode_child_into_mosaic(source, header, image, row_stride, image_bytes)) return RasterStatus::NoData;
+    clock.lap(NativeStage::Decode);
+
+    WorkerPool::shared().parallel_for(job.outputs.size(), threads, [&](std::size_t i) {
+        job.statuses[i] = encode_slice(image, row_stride, span, tile_size, header.has_alpha, i, options, job.outputs[i]);
+    });
+    clock.lap(NativeStage::Encode);
+
+    for (std::size_t i = 0; i < job.outputs.size(); ++i) {
+        clock.count_output(job.outputs[i].size());
+        if (job.statuses[i] != RasterStatus::Ok) return job.statuses[i];
+    }
+    return RasterStatus::Ok;
+}
+
+void run_slice_job(SliceJob& job, const QuadChild& source, int span, const RasterOutputOptions& options,
+                   unsigned threads) noexcept {
+    try {
+        job.status = slice_metatile_job(source, span, options, threads, job);
+    } catch (const std::bad_alloc&) {
+        job.status = RasterStatus::OutOfMemory;
+    } catch (...) {
+        job.status = RasterStatus::CppException;
+    }
+    raster_scratch().trim();
+}
+
+VALUE slice_metatile_impl(VALUE blob, int span, const RasterOutputOptions& options, unsigned threads,
+                          NativeError& error) {
+    const QuadChild source = make_quad_child(blob);
+    const std::size_t count = static_cast<std::size_t>(span) * span;
+
+    SliceJob job;
+    job.outputs.resize(count);
+    job.statuses.assign(count, RasterStatus::Ok);
+    VALUE outputs = rb_ary_new_capa(static_cast<long>(count));
+    for (EncodedBuffer& output : job.outputs) rb_ary_push(outputs, output.allocate());
+
+    without_gvl([&]() noexcept { run_slice_job(job, source, span, options, threads); });
+    publish_stage_stats(job.stats);
+
+    VALUE result = Qnil;
+    switch (job.status) {
+        case RasterStatus::Ok:
+            result = rb_ary_new_capa(static_cast<long>(count));
+            for (std::size_t i = 0; i < count; ++i) {
+                rb_ary_push(result, job.outputs[i].finish(rb_ary_entry(outputs, static_cast<long>(i))));
+            }
+            break;
+        case RasterStatus::NoData: break;
+        case RasterStatus::Unsupported:
+            result = Qfalse;
+            break;
+        default:
+            describe_failure(job.status, error);
+    }
+    RB_GC_GUARD(outputs);
+    RB_GC_GUARD(blob);
+    return result;
+}
+
+}  // namespace
+
+// Builds a parent tile from 4 PNG/WebP children [(2x,2y), (2x+1,2y), (2x,2y+1), (2x+1,2y+1)] in TMS order.
+// Children are decoded once into one 2N×2N RGBA mosaic (northern row first); missing or
+// unreadable children stay transparent. The mosaic is reduced on premultiplied alpha and encoded once.
+// Returns nil when no child decodes and false when a child needs Vips (JPEG, animated WebP,
+// mismatched sizes, ...). A child may also be a DecodedTile from an earlier keep_pixels call.
+// Options: png: (see png_codec.h), lossless:, quality:, effort: (see webp_codec.h),
+// keep_pixels: (return a DecodedTile, see decoded_tile.h).
+extern "C" VALUE raster_downsample_quad(int argc, VALUE* argv, VALUE /*self*/) {
+    VALUE children, kernel_val, format_val, opts;
+    rb_scan_args(argc, argv, "3:", &children, &kernel_val, &format_val, &opts);
+
+    Check_Type(children, T_ARRAY);
+
+    if (RARRAY_LEN(children) != 4) {
+        rb_raise(rb_eArgError, "Expected 4 children, got %ld", RARRAY_LEN(children));
+    }
+
+    const RasterReduceKernel reduce = select_raster_kernel(parse_raster_kernel(kernel_val));
+    const RasterOutputOptions options = parse_raster_output_options(format_val, opts);
+
+    NativeError error;
+    if (!valid_quad(children, error)) raise_native_error(error);
+    const VALUE result = downsample_quad_impl(children, reduce, options, error);
+    RB_GC_GUARD(children);
+    if (error) raise_native_error(error);
+    return result;
+}
+
+// Batch form of downsample_quad: quads is an Array of 4-child Arrays, processed on the
+// native worker pool. Returns results in input order; an item that fails yields its
+// exception object instead of raising for the whole batch. Options: threads: (default nproc)
+// plus the downsample_quad options.
+extern "C" VALUE raster_downsample_batch(int argc, VALUE* argv, VALUE /*self*/) {
+    VALUE quads, kernel_val, format_val, opts;
+    rb_scan_args(argc, argv, "3:", &quads, &kernel_val, &format_val, &opts);
+
+    Check_Type(quads, T_ARRAY);
+    const RasterReduceKernel reduce = select_raster_kernel(parse_raster_kernel(kernel_val));
+    const RasterOutputOptions options = parse_raster_output_options(format_val, opts);
+    const unsigned threads = parse_batch_threads(opts);
+
+    try {
+        const VALUE results = downsample_batch_impl(quads, reduce, options, threads);
+        RB_GC_GUARD(quads);
+        return results;
+    } catch (const std::exception& e) {
+        rb_raise(rb_eRuntimeError, "C++ exception: %s", e.what());
+    }
+}
+
+// Cuts a metatile (a PNG/WebP of span × span tiles, e.g. one 512 px request for 2×2 tiles)
+// into its tiles: decoded once, each tile encoded straight from the decoded pixels in
+// format ('png' or 'webp'), opaque tiles as RGB. Returns span² Strings, northern row first
+// and west to east within a row; nil when the image does not decode and false when it
+// needs Vips (JPEG, animated WebP, not square, size not a multiple of span).
+// Options: threads: (default nproc) plus the downsample_quad output options.
+extern "C" VALUE raster_slice_metatile(int argc, VALUE* argv, VALUE /*self*/) {
+    VALUE blob, span_val, format_val, opts;
+    rb_scan_args(argc, argv, "3:", &blob, &span_val, &format_val, &opts);
+
+    Check_Type(blob, T_STRING);
+    const int span = NUM2INT(span_val);
+    if (span < 1 || span > MAX_METATILE_SPAN) {
+        rb_raise(rb_eArgError, "Invalid metatile span: %d (must be 1-%d)", span, MAX_METATILE_SPAN);
+    }
+    const RasterOutputOptions options = parse_raster_output_options(format_val, opts);
+    const unsigned threads = parse_batch_threads(opts);
+
+    NativeError error;
+    const VALUE result = slice_metatile_impl(blob, span, options, threads, error);
+    if (error) raise_native_error(error);
+    return result;
+}
+
+extern "C" void Init_raster_downsample_extension(void) {
+    VALUE RasterDownsampleFFI = rb_define_module("RasterDownsampleFFI");
+    rb_define_singleton_method(RasterDownsampleFFI, "downsample_quad", raster_downsample_quad, -1);
+    rb_define_singleton_method(RasterDownsampleFFI, "downsample_batch", raster_downsample_batch, -1);
+    rb_define_singleton_method(RasterDownsampleFFI, "slice_metatile", raster_slice_metatile, -1);
+    define_decoded_tile_class(RasterDownsampleFFI);
+    define_stage_stats_methods(RasterDownsampleFFI);
+}
@@ -0,0 +1,222 @@
+// 2× reduction kernels for RGBA raster tiles.
+// Filtering is done on premultiplied alpha so transparent quadrants (missing children)
+// do not bleed black into the edges of their neighbours.
+// Kept free of Ruby headers so the benchmark harness can include it directly.
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <numbers>
+
+// Same names as the Vips resize kernels plus a plain 2×2 box
+enum class RasterKernel {
+    Box,
+    Nearest,
+    Linear,
+    Cubic,
+    Mitchell,
+    Lanczos2,
+    Lanczos3
+};
+
+// 2n×2n RGBA (straight alpha) → n×n RGBA (straight alpha)
+using RasterReduceKernel = void (*)(const std::uint8_t* src, int output_size, float* rows, std::uint8_t* dst);
+
+// Each output pixel is the premultiplied average of its 2×2 block
+inline void reduce_box_rgba(const std::uint8_t* src, int output_size, float* /*rows*/, std::uint8_t* dst) noexcept {
+    const std::size_t src_stride = static_cast<std::size_t>(output_size) * 8u;
+
+    for (int y = 0; y < output_size; ++y) {
+        const std::uint8_t* top = src + static_cast<std::size_t>(y) * 2u * src_stride;
+        const std::uint8_t* bottom = top + src_stride;
+        std::uint8_t* out = dst + static_cast<std::size_t>(y) * output_size * 4u;
+
+        for (int x = 0; x < output_size; ++x, top += 8, bottom += 8, out += 4) {
+            const unsigned a0 = top[3], a1 = top[7], a2 = bottom[3], a3 = bottom[7];
+            const unsigned alpha = a0 + a1 + a2 + a3;
+            if (alpha == 0) {
+                out[0] = out[1] = out[2] = out[3] = 0;
+                continue;
+            }
+            for (int c = 0; c < 3; ++c) {
+                const unsigned sum = top[c] * a0 + top[4 + c] * a1 + bottom[c] * a2 + bottom[4 + c] * a3;
+                out[c] = static_cast<std::uint8_t>((sum + alpha / 2) / alpha);
+            }
+            out[3] = static_cast<std::uint8_t>((alpha + 2) / 4);
+        }
+    }
+}
+
+// Top-left pixel of each 2×2 block
+inline void reduce_nearest_rgba(const std::uint8_t* src, int output_size, float* /*rows*/, std::uint8_t* dst) noexcept {
+    const std::size_t src_stride = static_cast<std::size_t>(output_size) * 8u;
+
+    for (int y = 0; y < output_size; ++y) {
+        const std::uint8_t* in = src + static_cast<std::size_t>(y) * 2u * src_stride;
+        std::uint8_t* out = dst + static_cast<std::size_t>(y) * output_size * 4u;
+        for (int x = 0; x < output_size; ++x, in += 8, out += 4) {
+            out[0] = in[0];
+            out[1] = in[1];
+            out[2] = in[2];
+            out[3] = in[3];
+        }
+    }
+}
+
+constexpr int RASTER_MAX_TAPS = 12;
+
+// Filter weights for a 2× reduce. Output pixel i is centred between source pixels 2i and
+// 2i+1, so every output pixel uses the same taps at offsets first..first+count-1 from 2i.
+struct ReduceTaps {
+    int first = 0;
+    int count = 0;
+    float weight[RASTER_MAX_TAPS] = {};
+};
+
+inline double sinc(double x) noexcept {
+    if (x == 0.0) return 1.0;
+    const double px = std::numbers::pi * x;
+    return std::sin(px) / px;
+}
+
+// Mitchell–Netravali family: B=0, C=0.5 is Catmull-Rom (Vips "cubic"), B=C=1/3 is Mitchell
+inline double bicubic(double x, double b, double c) noexcept {
+    x = std::abs(x);
+    if (x < 1.0) {
+        return ((12 - 9 * b - 6 * c) * x * x * x + (-18 + 12 * b + 6 * c) * x * x + (6 - 2 * b)) / 6.0;
+    }
+    if (x < 2.0) {
+        return ((-b - 6 * c) * x * x * x + (6 * b + 30 * c) * x * x + (-12 * b - 48 * c) * x + (8 * b + 24 * c)) / 6.0;
+    }
+    return 0.0;
+}
+
+// Kernel value at distance x, measured in output pixels
+inline double kernel_weight(RasterKernel kernel, double x) noexcept {
+    switch (kernel) {
+        case RasterKernel::Linear: return std::max(0.0, 1.0 - std::abs(x));
+        case RasterKernel::Cubic: return bicubic(x, 0.0, 0.5);
+        case RasterKernel::Mitchell: return bicubic(x, 1.0 / 3.0, 1.0 / 3.0);
+        case RasterKernel::Lanczos2: return std::abs(x) < 2.0 ? sinc(x) * sinc(x / 2.0) : 0.0;
+        case RasterKernel::Lanczos3: return std::abs(x) < 3.0 ? sinc(x) * sinc(x / 3.0) : 0.0;
+        case RasterKernel::Box:
+        case RasterKernel::Nearest: break;
+    }
+    return 0.0;
+}
+
+inline int kernel_support(RasterKernel kernel) noexcept {
+    switch (kernel) {
+        case RasterKernel::Linear: return 1;
+        case RasterKernel::Lanczos3: return 3;
+        default: return 2;
+    }
+}
+
+inline ReduceTaps make_reduce_taps(RasterKernel kernel) noexcept {
+    ReduceTaps taps;
+    const int support = kernel_support(kernel);
+    taps.first = 1 - 2 * support;
+    taps.count = 4 * support;
+
+    double total = 0.0;
+    double weights[RASTER_MAX_TAPS];
+    for (int i = 0; i < taps.count; ++i) {
+        // Source pixel 2i+offset sits offset-0.5 source pixels from the output centre
+        weights[i] = kernel_weight(kernel, (taps.first + i - 0.5) / 2.0);
+        total += weights[i];
+    }
+    for (int i = 0; i < taps.count; ++i) {
+        taps.weight[i] = static_cast<float>(weights[i] / total);
+    }
+    return taps;
+}
+
+inline std::uint8_t clamp_to_byte(float value) noexcept {
+    return static_cast<std::uint8_t>(std::clamp(value, 0.0f, 255.0f) + 0.5f);
+}
+
+// Separable premultiplied reduce; the source is extended at the edges (as in Vips).
+// rows: scratch of 2n×n×4 floats holding the horizontally reduced, premultiplied rows.
+template <RasterKernel K>
+void reduce_separable_rgba(const std::uint8_t* src, int output_size, float* rows, std::uint8_t* dst) noexcept {
+    static const ReduceTaps taps = make_reduce_taps(K);
+    const int source_size = output_size * 2;
+    const std::size_t src_stride = static_cast<std::size_t>(source_size) * 4u;
+    const std::size_t row_floats = static_cast<std::size_t>(output_size) * 4u;
+    constexpr float inv_255 = 1.0f / 255.0f;
+
+    for (int y = 0; y < source_size; ++y) {
+        const std::uint8_t* in = src + static_cast<std::size_t>(y) * src_stride;
+        float* out = rows + static_cast<std::size_t>(y) * row_floats;
+
+        for (int x = 0; x < output_size; ++x, out += 4) {
+            float r = 0.0f, g = 0.0f, b = 0.0f, a = 0.0f;
+            for (int t = 0; t < taps.count; ++t) {
+                const int sx = std::clamp(2 * x + taps.first + t, 0, source_size - 1);
+                const std::uint8_t* px = in + static_cast<std::size_t>(sx) * 4u;
+                const float wa = taps.weight[t] * px[3];
+                r += wa * px[0];
+                g += wa * px[1];
+                b += wa * px[2];
+                a += wa;
+            }
+            out[0] = r * inv_255;
+            out[1] = g * inv_255;
+            out[2] = b * inv_255;
+            out[3] = a;
+        }
+    }
+
+    float accum[1024 * 4];
+    for (int y = 0; y < output_size; ++y) {
+        std::fill_n(accum, row_floats, 0.0f);
+        for (int t = 0; t < taps.count; ++t) {
+            const int sy = std::clamp(2 * y + taps.first + t, 0, source_size - 1);
+            const float* row = rows + static_cast<std::size_t>(sy) * row_floats;
+            const float w = taps.weight[t];
+            for (std::size_t i = 0; i < row_floats; ++i) accum[i] += w * row[i];
+        }
+
+        std::uint8_t* out = dst + static_cast<std::size_t>(y) * row_floats;
+        for (int x = 0; x < output_size; ++x, out += 4) {
+            const float* px = accum + static_cast<std::size_t>(x) * 4u;
+            // Negative lobes can push alpha below zero; such pixels are fully transparent
+            if (px[3] < 0.5f) {
+                out[0] = out[1] = out[2] = out[3] = 0;
+                continue;
+            }
+            const float unpremultiply = 255.0f / px[3];
+            out[0] = clamp_to_byte(px[0] * unpremultiply);
+            out[1] = clamp_to_byte(px[1] * unpremultiply);
+            out[2] = clamp_to_byte(px[2] * unpremultiply);
+            out[3] = clamp_to_byte(px[3]);
+        }
+    }
+}
+
+inline RasterReduceKernel select_raster_kernel(RasterKernel kernel) noexcept {
+    switch (kernel) {
+        case RasterKernel::Box: return reduce_box_rgba;
+        case RasterKernel::Nearest: return reduce_nearest_rgba;
+        case RasterKernel::Linear: return reduce_separable_rgba<RasterKernel::Linear>;
+        case RasterKernel::Cubic: return reduce_separable_rgba<RasterKernel::Cubic>;
+        case RasterKernel::Mitchell: return reduce_separable_rgba<RasterKernel::Mitchell>;
+        case RasterKernel::Lanczos2: return reduce_separable_rgba<RasterKernel::Lanczos2>;
+        case RasterKernel::Lanczos3: return reduce_separable_rgba<RasterKernel::Lanczos3>;
+    }
+    return reduce_box_rgba;
+}
+
+// Packs opaque RGBA pixels down to RGB in place
+inline void drop_alpha_in_place(std::uint8_t* pixels, std::size_t count) noexcept {
+    std::uint8_t* out = pixels;
+    const std::uint8_t* in = pixels;
+    for (std::size_t i = 0; i < count; ++i, in += 4, out += 3) {
+        out[0] = in[0];
+        out[1] = in[1];
+        out[2] = in[2];
+    }
+}
@@ -0,0 +1,36 @@
+// Per-thread scratch buffers for the native decode/reduce/encode passes.
+// Each buffer grows to the largest tile its thread has handled and is reused by the next
+// call, so steady-state conversions do not touch malloc. Storage is handed out
+// uninitialized: every user overwrites the whole range it asks for.
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+// Growth beyond this is released after the job instead of being kept for the thread's lifetime
+constexpr std::size_t SCRATCH_RETAIN_BYTES = 32u << 20;
+
+template <typename T>
+class ScratchBuffer {
+public:
+    // Storage for count elements; may throw std::bad_alloc when it has to grow
+    T* take(std::size_t count) {
+        if (count > capacity_) {
+            data_.reset();
+            data_ = std::make_unique_for_overwrite<T[]>(count);
+            capacity_ = count;
+        }
+        return data_.get();
+    }
+
+    void trim() noexcept {
+        if (capacity_ * sizeof(T) > SCRATCH_RETAIN_BYTES) {
+            data_.reset();
+            capacity_ = 0;
+        }
+    }
+
+private:
+    std::unique_ptr<T[]> data_;
+    std::size_t capacity_ = 0;
+};
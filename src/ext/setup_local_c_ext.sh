@@ -5,10 +5,20 @@ LERC_VERSION="4.0.0"
 LERC_SHA256="91431c2b16d0e3de6cbaea188603359f87caed08259a645fd5a3805784ee30a0"
 LERC_URL="https://github.com/Esri/lerc/archive/refs/tags/v${LERC_VERSION}.tar.gz"
 
-for tool in cmake make curl ruby g++; do
+for tool in cmake make curl ruby g++ pkg-config; do
     command -v $tool >/dev/null 2>&1 || { echo "Error: $tool required"; exit 1; }
 done
 
+if ! pkg-config --exists libpng; then
+    echo "Error: libpng not found. Please install libpng-dev"
+    exit 1
+fi
+
+if ! pkg-config --exists libwebp; then
+    echo "Error: libwebp not found. Please install libwebp-dev"
+    exit 1
+fi
+
 echo "Building LERC..."
 mkdir -p temp && cd temp
 curl -fsSL "$LERC_URL" -o lerc.tar.gz
@@ -19,5 +29,9 @@ make -j$(nproc) && sudo make install && sudo ldconfig
 cd .. && rm -rf temp
 
 echo "Building extension..."
-ruby extconf.rb && make
+if [ "$TPC_EXT_PGO" = "1" ]; then
+    ./pgo_build.sh extconf.rb
+else
+    ruby extconf.rb && make
+fi
 echo "✅ Done: $(ls *.so)"
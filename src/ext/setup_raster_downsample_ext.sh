@@ -0,0 +1,22 @@
+#!/bin/bash
+set -e
+
+for tool in ruby g++ pkg-config; do
+    command -v $tool >/dev/null 2>&1 || { echo "Error: $tool required"; exit 1; }
+done
+
+for lib in libpng libwebp; do
+    if ! pkg-config --exists $lib; then
+        echo "Error: $lib not found. Please install $lib-dev"
+        exit 1
+    fi
+done
+
+echo "Building raster_downsample_extension..."
+cd "$(dirname "$0")"
+if [ "$TPC_EXT_PGO" = "1" ]; then
+    ./pgo_build.sh raster_downsample_extconf.rb
+else
+    ruby raster_downsample_extconf.rb && make
+fi
+echo "✅ Done: $(ls raster_downsample_extension.so 2>/dev/null || echo 'raster_downsample_extension.so')"
@@ -5,13 +5,19 @@ for tool in ruby g++ pkg-config; do
     command -v $tool >/dev/null 2>&1 || { echo "Error: $tool required"; exit 1; }
 done
 
-if ! pkg-config --exists libpng; then
-    echo "Error: libpng not found. Please install libpng-dev"
-    exit 1
-fi
+for lib in libpng libwebp; do
+    if ! pkg-config --exists $lib; then
+        echo "Error: $lib not found. Please install $lib-dev"
+        exit 1
+    fi
+done
 
 echo "Building terrain_downsample_extension..."
 cd "$(dirname "$0")"
-ruby terrain_downsample_extconf.rb && make
+if [ "$TPC_EXT_PGO" = "1" ]; then
+    ./pgo_build.sh terrain_downsample_extconf.rb
+else
+    ruby terrain_downsample_extconf.rb && make
+fi
 echo "✅ Done: $(ls terrain_downsample_extension.so 2>/dev/null || echo 'terrain_downsample_extension.so')"
 
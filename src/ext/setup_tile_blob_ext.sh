@@ -0,0 +1,15 @@
+#!/bin/bash
+set -e
+
+for tool in ruby g++; do
+    command -v $tool >/dev/null 2>&1 || { echo "Error: $tool required"; exit 1; }
+done
+
+echo "Building tile_blob_extension..."
+cd "$(dirname "$0")"
+if [ "$TPC_EXT_PGO" = "1" ]; then
+    ./pgo_build.sh tile_blob_extconf.rb
+else
+    ruby tile_blob_extconf.rb && make
+fi
+echo "✅ Done: $(ls tile_blob_extension.so 2>/dev/null || echo 'tile_blob_extension.so')"
@@ -0,0 +1,131 @@
+// Opt-in per-stage timing of the native conversions. While a module's stats are enabled
+// (Module.stats_enabled = true), every call laps the monotonic clock between its stages and
+// counts input and output bytes; Module.last_stats then returns the figures of the calling
+// thread's latest call, summed over the items of a batch:
+//   { decode_ns:, quantize_ns:, downsample_ns:, encode_ns:, input_bytes:, output_bytes:, items: }
+// Disabled stats cost one relaxed load per call and no clock reads.
+#pragma once
+
+#include "ruby.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+// Internal linkage: every extension keeps its own switch and last-call figures
+namespace {
+
+enum class NativeStage : std::uint8_t {
+    Decode,
+    Quantize,
+    Downsample,
+    Encode
+};
+
+constexpr std::array<const char*, 4> NATIVE_STAGE_KEYS{"decode_ns", "quantize_ns", "downsample_ns", "encode_ns"};
+
+struct StageStats {
+    std::array<std::uint64_t, NATIVE_STAGE_KEYS.size()> ns{};
+    std::uint64_t input_bytes = 0;
+    std::uint64_t output_bytes = 0;
+    std::uint64_t items = 0;
+
+    StageStats& operator+=(const StageStats& other) noexcept {
+        for (std::size_t i = 0; i < ns.size(); ++i) ns[i] += other.ns[i];
+        input_bytes += other.input_bytes;
+        output_bytes += other.output_bytes;
+        items += other.items;
+        return *this;
+    }
+};
+
+std::atomic<bool> stage_stats_switch{false};
+
+bool stage_stats_enabled() noexcept {
+    return stage_stats_switch.load(std::memory_order_relaxed);
+}
+
+// Attributes the time since the previous lap (or construction) to a stage; inert while
+// stats are disabled. Safe without the GVL.
+class StageClock {
+public:
+    explicit StageClock(StageStats& stats) noexcept
+        : stats_(stage_stats_enabled() ? &stats : nullptr), last_(stats_ ? now() : 0) {
+        if (stats_) ++stats_->items;
+    }
+
+    void lap(NativeStage stage) noexcept {
+        if (!stats_) return;
+        const std::uint64_t t = now();
+        stats_->ns[static_cast<std::size_t>(stage)] += t - last_;
+        last_ = t;
+    }
+
+    void count_input(std::size_t bytes) noexcept {
+        if (stats_) stats_->input_bytes += bytes;
+    }
+
+    void count_output(std::size_t bytes) noexcept {
+        if (stats_) stats_->output_bytes += bytes;
+    }
+
+private:
+    static std::uint64_t now() noexcept {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<std::uint64_t>(ts.tv_sec) * 1'000'000'000u + static_cast<std::uint64_t>(ts.tv_nsec);
+    }
+
+    StageStats* stats_;
+    std::uint64_t last_;
+};
+
+StageStats& last_stage_stats() noexcept {
+    thread_local StageStats stats;
+    return stats;
+}
+
+// Under the GVL, once per Ruby call: the figures last_stats reports on this thread
+void publish_stage_stats(const StageStats& stats) noexcept {
+    if (stage_stats_enabled()) last_stage_stats() = stats;
+}
+
+namespace stage_stats_detail {
+
+VALUE set_enabled(VALUE /*self*/, VALUE flag) {
+    stage_stats_switch.store(RTEST(flag), std::memory_order_relaxed);
+    last_stage_stats() = StageStats{};
+    return flag;
+}
+
+VALUE enabled_p(VALUE /*self*/) {
+    return stage_stats_enabled() ? Qtrue : Qfalse;
+}
+
+VALUE last_stats(VALUE /*self*/) {
+    const StageStats& stats = last_stage_stats();
+    if (!stage_stats_enabled() || stats.items == 0) return Qnil;
+
+    const VALUE hash = rb_hash_new();
+    for (std::size_t i = 0; i < NATIVE_STAGE_KEYS.size(); ++i) {
+        rb_hash_aset(hash, ID2SYM(rb_intern(NATIVE_STAGE_KEYS[i])), ULL2NUM(stats.ns[i]));
+    }
+    rb_hash_aset(hash, ID2SYM(rb_intern("input_bytes")), ULL2NUM(stats.input_bytes));
+    rb_hash_aset(hash, ID2SYM(rb_intern("output_bytes")), ULL2NUM(stats.output_bytes));
+    rb_hash_aset(hash, ID2SYM(rb_intern("items")), ULL2NUM(stats.items));
+    return hash;
+}
+
+}  // namespace stage_stats_detail
+
+// Defines stats_enabled=, stats_enabled? and last_stats on an extension module
+void define_stage_stats_methods(VALUE module) {
+    using namespace stage_stats_detail;
+    rb_define_singleton_method(module, "stats_enabled=", set_enabled, 1);
+    rb_define_singleton_method(module, "stats_enabled?", enabled_p, 0);
+    rb_define_singleton_method(module, "last_stats", last_stats, 0);
+}
+
+}  // namespace
@@ -1,53 +1,21 @@
 #include "ruby.h"
 #include <png.h>
+#include <array>
+#include <new>
+#include <utility>
 #include <vector>
 #include <cstdint>
-#include <cmath>
+#include <cstring>
 #include <string_view>
-#include <algorithm>
 #include <limits>
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
-
-constexpr double MAPBOX_TERRAIN_RGB_OFFSET = 10000.0;
-constexpr double MAPBOX_TERRAIN_RGB_SCALE = 0.1;
-constexpr int32_t MAPBOX_TERRAIN_RGB_MAX_24BIT = 16777215;
-
-constexpr float TERRARIUM_OFFSET = 32768.0f;
-
-enum class DownsampleMethod {
-    Average,
-    Nearest,
-    Maximum
-};
-
-constexpr float decode_mapbox_terrain_rgb(std::uint8_t r, std::uint8_t g, std::uint8_t b) noexcept {
-    return -MAPBOX_TERRAIN_RGB_OFFSET + ((r * 256 * 256) + (g * 256) + b) * MAPBOX_TERRAIN_RGB_SCALE;
-}
-
-constexpr float decode_terrarium(std::uint8_t r, std::uint8_t g, std::uint8_t b) noexcept {
-    return (r * 256 + g + b / 256.0f) - TERRARIUM_OFFSET;
-}
-
-constexpr void encode_mapbox_terrain_rgb(float elevation, std::uint8_t& r, std::uint8_t& g, std::uint8_t& b) noexcept {
-    const int32_t code = std::clamp(
-        static_cast<int32_t>(std::round((elevation + MAPBOX_TERRAIN_RGB_OFFSET) / MAPBOX_TERRAIN_RGB_SCALE)),
-        0, MAPBOX_TERRAIN_RGB_MAX_24BIT);
-    // Pack 24-bit code into RGB: R=bits 16-23, G=bits 8-15, B=bits 0-7
-    r = static_cast<std::uint8_t>((code >> 16) & 0xFF);
-    g = static_cast<std::uint8_t>((code >> 8) & 0xFF);
-    b = static_cast<std::uint8_t>(code & 0xFF);
-}
-
-void encode_terrarium(float elevation, std::uint8_t& r, std::uint8_t& g, std::uint8_t& b) noexcept {
-    const float value = elevation + TERRARIUM_OFFSET;
-    const float H = std::floor(value);
-    const float F = value - H;
-    const int32_t H_int = static_cast<int32_t>(H);
-    r = static_cast<std::uint8_t>((H_int >> 8) & 0xFF);
-    g = static_cast<std::uint8_t>(H_int & 0xFF);
-    b = static_cast<std::uint8_t>(std::round(F * 256.0f));
-}
+#include "gvl_call.h"
+#include "decoded_tile.h"
+#include "png_codec.h"
+#include "webp_codec.h"
+#include "scratch_arena.h"
+#include "stage_stats.h"
+#include "worker_pool.h"
+#include "terrain_downsample_kernels.h"
 
 // RAII wrapper for libpng png_image
 struct PngImage {
@@ -61,198 +29,629 @@ struct PngImage {
 struct PngInfo {
     int width;
     int height;
-    std::vector<std::uint8_t> rgb_data;
+    std::uint8_t* rgb_data;
+};
+
+// Reused by every call on this thread (see scratch_arena.h)
+struct DownsampleScratch {
+    ScratchBuffer<std::uint8_t> decoded;
+    ScratchBuffer<std::uint8_t> mosaic;
+    ScratchBuffer<std::uint8_t> output;
+
+    void trim() noexcept {
+        decoded.trim();
+        mosaic.trim();
+        output.trim();
+    }
+};
+
+DownsampleScratch& downsample_scratch() noexcept {
+    thread_local DownsampleScratch scratch;
+    return scratch;
+}
+
+// Outcome of work done without the GVL; mapped to a Ruby value or exception afterwards
+enum class DownsampleStatus {
+    Ok,
+    Passthrough,
+    NoData,
+    InvalidPng,
+    UnsupportedPngFormat,
+    PngDecodeFailed,
+    PngEncodeFailed,
+    WebpEncodeFailed,
+    OutOfMemory,
+    CppException
+};
+
+struct DownsampleJob {
+    DownsampleStatus status = DownsampleStatus::Ok;
+    int detail = 0;
+    EncodedBuffer png;
+    TilePixels pixels;  // reduced tile, kept for keep_pixels: true
+    StageStats stats;
+};
+
+// Output of the quad calls
+struct QuadOutputOptions {
+    bool webp = false;
+    PngEncodeOptions png;
+    int webp_effort = WEBP_DEFAULT_EFFORT;
+    bool keep_pixels = false;
 };
 
-PngInfo decompress_png_to_rgb(VALUE png_data) {
+DownsampleStatus decompress_png_to_rgb(const InputBytes& png_data, PngInfo& info, int& detail) {
     PngImage png;
-    
-    if (!png_image_begin_read_from_memory(&png.image, RSTRING_PTR(png_data), RSTRING_LEN(png_data))) {
-        rb_raise(rb_eRuntimeError, "Failed to read PNG: invalid or corrupted data");
+
+    if (!png_image_begin_read_from_memory(&png.image, png_data.data(), png_data.size())) {
+        return DownsampleStatus::InvalidPng;
     }
-    
+
     if (png.image.format != PNG_FORMAT_RGB) {
-        rb_raise(rb_eRuntimeError, "Invalid PNG format: expected RGB, got %d", png.image.format);
-    }
-    
-    const int width = static_cast<int>(png.image.width);
-    const int height = static_cast<int>(png.image.height);
-    
-    std::vector<std::uint8_t> rgb_data(PNG_IMAGE_SIZE(png.image));
-    if (!png_image_finish_read(&png.image, nullptr, rgb_data.data(), 0, nullptr)) {
-        rb_raise(rb_eRuntimeError, "Failed to decode PNG data");
-    }
-    
-    return {width, height, std::move(rgb_data)};
+        detail = static_cast<int>(png.image.format);
+        return DownsampleStatus::UnsupportedPngFormat;
+    }
+
+    info.width = static_cast<int>(png.image.width);
+    info.height = static_cast<int>(png.image.height);
+
+    info.rgb_data = downsample_scratch().decoded.take(PNG_IMAGE_SIZE(png.image));
+    if (!png_image_finish_read(&png.image, nullptr, info.rgb_data, 0, nullptr)) {
+        return DownsampleStatus::PngDecodeFailed;
+    }
+
+    return DownsampleStatus::Ok;
+}
+
+DownsampleStatus create_png_from_rgb(const std::uint8_t* rgb, int width, int height,
+                                     const PngEncodeOptions& png_options, EncodedBuffer& out) noexcept {
+    return encode_png(rgb, width, height, 3, png_options, out)
+        ? DownsampleStatus::Ok
+        : DownsampleStatus::PngEncodeFailed;
 }
 
-VALUE create_png_from_rgb(const std::vector<std::uint8_t>& rgb, int width, int height) {
-    int png_len = 0;
-    unsigned char* png_data = stbi_write_png_to_mem(rgb.data(), width * 3, width, height, 3, &png_len);
-    
-    if (!png_data) {
-        rb_raise(rb_eRuntimeError, "PNG creation failed");
-    }
-    
-    VALUE result = rb_str_new(reinterpret_cast<const char*>(png_data), static_cast<long>(png_len));
-    std::free(png_data);
-    
+// Runs a job body without the GVL, turning C++ exceptions into status codes
+template <typename Fn>
+void run_without_gvl(DownsampleJob& job, Fn&& body) {
+    without_gvl([&]() noexcept {
+        try {
+            job.status = body();
+        } catch (const std::bad_alloc&) {
+            job.status = DownsampleStatus::OutOfMemory;
+        } catch (...) {
+            job.status = DownsampleStatus::CppException;
+        }
+        downsample_scratch().trim();
+    });
+}
+
+void describe_failure(const DownsampleJob& job, NativeError& error) noexcept {
+    switch (job.status) {
+        case DownsampleStatus::InvalidPng:
+            error.set(rb_eRuntimeError, "Failed to read PNG: invalid or corrupted data");
+            break;
+        case DownsampleStatus::UnsupportedPngFormat:
+            error.set(rb_eRuntimeError, "Invalid PNG format: expected RGB, got %d", job.detail);
+            break;
+        case DownsampleStatus::PngDecodeFailed:
+            error.set(rb_eRuntimeError, "Failed to decode PNG data");
+            break;
+        case DownsampleStatus::PngEncodeFailed:
+            error.set(rb_eRuntimeError, "PNG creation failed");
+            break;
+        case DownsampleStatus::WebpEncodeFailed:
+            error.set(rb_eRuntimeError, "WebP creation failed");
+            break;
+        case DownsampleStatus::OutOfMemory:
+            error.set(rb_eNoMemError, "Failed to allocate downsample buffers");
+            break;
+        case DownsampleStatus::CppException:
+            error.set(rb_eRuntimeError, "Unknown C++ exception occurred");
+            break;
+        case DownsampleStatus::Ok:
+        case DownsampleStatus::Passthrough:
+        case DownsampleStatus::NoData:
+            break;
+    }
+}
+
+DownsampleMethod parse_downsample_method(VALUE method_val) {
+    Check_Type(method_val, T_STRING);
+    const std::string_view method_str{RSTRING_PTR(method_val),
+                                     static_cast<size_t>(RSTRING_LEN(method_val))};
+
+    if (method_str == "average") return DownsampleMethod::Average;
+    if (method_str == "nearest") return DownsampleMethod::Nearest;
+    if (method_str == "maximum") return DownsampleMethod::Maximum;
+
+    rb_raise(rb_eArgError, "Unknown downsample method: %s (expected 'average', 'nearest', or 'maximum')", method_str.data());
+}
+
+bool parse_is_terrarium(VALUE encoding_type_val) {
+    Check_Type(encoding_type_val, T_STRING);
+    const std::string_view encoding_type{RSTRING_PTR(encoding_type_val),
+                                        static_cast<size_t>(RSTRING_LEN(encoding_type_val))};
+
+    if (encoding_type == "terrarium") return true;
+    if (encoding_type == "mapbox") return false;
+
+    rb_raise(rb_eArgError, "Unknown encoding type: %s (expected 'mapbox' or 'terrarium')", encoding_type.data());
+}
+
+VALUE downsample_png_impl(VALUE png_data, int target_size, DownsampleKernel downsample,
+                          const PngEncodeOptions& png_options, NativeError& error) {
+    const InputBytes input(png_data);
+    DownsampleJob job;
+    VALUE output = job.png.allocate();
+
+    run_without_gvl(job, [&] {
+        StageClock clock(job.stats);
+        clock.count_input(input.size());
+
+        PngInfo png_info;
+        if (const DownsampleStatus status = decompress_png_to_rgb(input, png_info, job.detail);
+            status != DownsampleStatus::Ok) {
+            return status;
+        }
+        clock.lap(NativeStage::Decode);
+
+        const int source_width = png_info.width;
+        const int source_height = png_info.height;
+
+        if (source_width <= target_size && source_height <= target_size) {
+            return DownsampleStatus::Passthrough;
+        }
+
+        const int scale_factor = source_width / target_size;
+        const std::size_t output_size = static_cast<std::size_t>(target_size) * target_size * 3u;
+        std::uint8_t* output_rgb = downsample_scratch().output.take(output_size);
+
+        downsample(png_info.rgb_data, source_width, scale_factor, output_rgb, target_size);
+        clock.lap(NativeStage::Downsample);
+
+        const DownsampleStatus status = create_png_from_rgb(output_rgb, target_size, target_size, png_options, job.png);
+        clock.lap(NativeStage::Encode);
+        clock.count_output(job.png.size());
+        return status;
+    });
+    publish_stage_stats(job.stats);
+
+    RB_GC_GUARD(output);
+    switch (job.status) {
+        case DownsampleStatus::Ok: return job.png.finish(output);
+        case DownsampleStatus::Passthrough: return png_data;
+        case DownsampleStatus::NoData: return Qnil;
+        default:
+            describe_failure(job, error);
+            return Qnil;
+    }
+}
+
+// Options: png: preset name or { preset:, level:, filter: } (see png_codec.h)
+extern "C" VALUE downsample_png(int argc, VALUE* argv, VALUE /*self*/) {
+    VALUE png_data, target_size_val, encoding_type_val, method_val, opts;
+    rb_scan_args(argc, argv, "4:", &png_data, &target_size_val, &encoding_type_val, &method_val, &opts);
+
+    Check_Type(png_data, T_STRING);
+    Check_Type(target_size_val, T_FIXNUM);
+
+    if (RSTRING_LEN(png_data) == 0) {
+        rb_raise(rb_eArgError, "Empty PNG data");
+    }
+
+    const int target_size = NUM2INT(target_size_val);
+    if (target_size <= 0 || target_size > 1024) {
+        rb_raise(rb_eArgError, "Invalid target size: %d (must be 1-1024)", target_size);
+    }
+
+    const bool is_terrarium = parse_is_terrarium(encoding_type_val);
+    const DownsampleKernel downsample = select_downsample_kernel(is_terrarium, parse_downsample_method(method_val));
+    const PngEncodeOptions png_options = parse_png_options(opts);
+
+    NativeError error;
+    const VALUE result = downsample_png_impl(png_data, target_size, downsample, png_options, error);
+    RB_GC_GUARD(png_data);
+    if (error) raise_native_error(error);
     return result;
 }
 
-inline float decode_elevation(const std::uint8_t* rgb, bool is_terrarium) noexcept {
-    return is_terrarium
-        ? decode_terrarium(rgb[0], rgb[1], rgb[2])
-        : decode_mapbox_terrain_rgb(rgb[0], rgb[1], rgb[2]);
+// Decodes one child PNG (or copies DecodedTile pixels) straight into its quadrant of the shared mosaic.
+// Returns false for undecodable or mismatched children so the caller can treat them as missing.
+bool decode_child_into_mosaic(const QuadChild& quad_child, int tile_size, std::uint8_t* dst, std::size_t row_stride) {
+    if (const TilePixels* decoded = quad_child.decoded) {
+        if (decoded->channels != 3 || decoded->size != tile_size) return false;
+
+        const std::size_t tile_row = static_cast<std::size_t>(tile_size) * 3u;
+        for (int y = 0; y < tile_size; ++y) {
+            std::memcpy(dst + y * row_stride, decoded->data.get() + y * tile_row, tile_row);
+        }
+        return true;
+    }
+
+    const InputBytes& child = quad_child.encoded;
+    PngImage png;
+
+    if (!png_image_begin_read_from_memory(&png.image, child.data(), child.size())) {
+        return false;
+    }
+
+    if (png.image.format != PNG_FORMAT_RGB ||
+        static_cast<int>(png.image.width) != tile_size ||
+        static_cast<int>(png.image.height) != tile_size) {
+        return false;
+    }
+
+    return png_image_finish_read(&png.image, nullptr, dst, static_cast<png_int_32>(row_stride), nullptr) != 0;
 }
 
-// Nearest: copy left-top pixel RGB (no decode/encode needed)
-void downsample_nearest(const std::uint8_t* input_ptr, int source_width,
-                       int src_x, int src_y,
-                       std::uint8_t& r, std::uint8_t& g, std::uint8_t& b) noexcept {
-    const int idx = (src_y * source_width + src_x) * 3;
-    r = input_ptr[idx];
-    g = input_ptr[idx + 1];
-    b = input_ptr[idx + 2];
+// Reads tile width from the PNG IHDR (or the DecodedTile) without decoding pixel data
+int probe_tile_width(const QuadChild& quad_child) {
+    if (quad_child.decoded) return quad_child.decoded->size;
+
+    const InputBytes& child = quad_child.encoded;
+    PngImage png;
+    if (!png_image_begin_read_from_memory(&png.image, child.data(), child.size())) {
+        return 0;
+    }
+    return static_cast<int>(png.image.width);
 }
 
-// Average: mean of 4 pixels in 2×2 block
-void downsample_average(const std::uint8_t* input_ptr, int source_width,
-                       int src_x, int src_y, bool is_terrarium,
-                       std::uint8_t& r, std::uint8_t& g, std::uint8_t& b) noexcept {
-    const int idx00 = (src_y * source_width + src_x) * 3;
-    const int idx10 = (src_y * source_width + (src_x + 1)) * 3;
-    const int idx01 = ((src_y + 1) * source_width + src_x) * 3;
-    const int idx11 = ((src_y + 1) * source_width + (src_x + 1)) * 3;
-    
-    const float e00 = decode_elevation(input_ptr + idx00, is_terrarium);
-    const float e10 = decode_elevation(input_ptr + idx10, is_terrarium);
-    const float e01 = decode_elevation(input_ptr + idx01, is_terrarium);
-    const float e11 = decode_elevation(input_ptr + idx11, is_terrarium);
-    
-    const float avg_elevation = (e00 + e10 + e01 + e11) * 0.25f;
-    
+// Fills a missing quadrant with the encoding of 0 m (terrain-RGB "no data")
+void fill_missing_quadrant(std::uint8_t* dst, std::size_t row_stride, int tile_size, bool is_terrarium) noexcept {
+    std::uint8_t r, g, b;
     if (is_terrarium) {
-        encode_terrarium(avg_elevation, r, g, b);
+        encode_terrarium(0.0f, r, g, b);
     } else {
-        encode_mapbox_terrain_rgb(avg_elevation, r, g, b);
+        encode_mapbox_terrain_rgb(0.0f, r, g, b);
+    }
+
+    for (int y = 0; y < tile_size; ++y) {
+        std::uint8_t* row = dst + y * row_stride;
+        for (int x = 0; x < tile_size; ++x) {
+            *row++ = r;
+            *row++ = g;
+            *row++ = b;
+        }
     }
 }
 
-// Maximum: highest elevation from 4 pixels in 2×2 block
-void downsample_maximum(const std::uint8_t* input_ptr, int source_width,
-                       int src_x, int src_y, bool is_terrarium,
-                       std::uint8_t& r, std::uint8_t& g, std::uint8_t& b) noexcept {
-    const int idx00 = (src_y * source_width + src_x) * 3;
-    const int idx10 = (src_y * source_width + (src_x + 1)) * 3;
-    const int idx01 = ((src_y + 1) * source_width + src_x) * 3;
-    const int idx11 = ((src_y + 1) * source_width + (src_x + 1)) * 3;
-    
-    const float e00 = decode_elevation(input_ptr + idx00, is_terrarium);
-    const float e10 = decode_elevation(input_ptr + idx10, is_terrarium);
-    const float e01 = decode_elevation(input_ptr + idx01, is_terrarium);
-    const float e11 = decode_elevation(input_ptr + idx11, is_terrarium);
-    
-    const float max_elevation = std::max({e00, e10, e01, e11});
-    
-    if (is_terrarium) {
-        encode_terrarium(max_elevation, r, g, b);
-    } else {
-        encode_mapbox_terrain_rgb(max_elevation, r, g, b);
+using QuadChildren = std::array<QuadChild, 4>;
+
+// Collects the non-empty children of a validated 4-element array; runs under the GVL
+QuadChildren collect_quad_children(VALUE children) {
+    QuadChildren child_blobs{};
+    for (long i = 0; i < 4; ++i) {
+        child_blobs[i] = make_quad_child(rb_ary_entry(children, i));
     }
+    return child_blobs;
 }
 
-extern "C" VALUE downsample_png(VALUE /*self*/, VALUE png_data, VALUE target_size_val, VALUE encoding_type_val, VALUE method_val) {
-    try {
-        Check_Type(png_data, T_STRING);
-        Check_Type(target_size_val, T_FIXNUM);
-        Check_Type(encoding_type_val, T_STRING);
-        Check_Type(method_val, T_STRING);
-        
-        if (RSTRING_LEN(png_data) == 0) {
-            rb_raise(rb_eArgError, "Empty PNG data");
-        }
-        
-        const int target_size = NUM2INT(target_size_val);
-        if (target_size <= 0 || target_size > 1024) {
-            rb_raise(rb_eArgError, "Invalid target size: %d (must be 1-1024)", target_size);
-        }
-        
-        const std::string_view encoding_type{RSTRING_PTR(encoding_type_val),
-                                            static_cast<size_t>(RSTRING_LEN(encoding_type_val))};
-        
-        bool is_terrarium = (encoding_type == "terrarium");
-        if (!is_terrarium && encoding_type != "mapbox") {
-            rb_raise(rb_eArgError, "Unknown encoding type: %s (expected 'mapbox' or 'terrarium')", encoding_type.data());
+// Decodes the children into one 2N×2N mosaic (northern row first) in scratch; undecodable or
+// missing quadrants become 0 m. Returns nullptr when no child decodes; tile_size is set to N,
+// the width of the first child whose header reads (a corrupt child does not sink the quad)
+std::uint8_t* decode_quad_mosaic(const QuadChildren& child_blobs, bool is_terrarium, int& tile_size) {
+    tile_size = 0;
+    for (const QuadChild& child : child_blobs) {
+        if (child.empty()) continue;
+
+        const int width = probe_tile_width(child);
+        if (width > 0 && width <= 1024) {
+            tile_size = width;
+            break;
         }
-        
-        const std::string_view method_str{RSTRING_PTR(method_val),
-                                         static_cast<size_t>(RSTRING_LEN(method_val))};
-        
-        DownsampleMethod downsample_method;
-        if (method_str == "average") {
-            downsample_method = DownsampleMethod::Average;
-        } else if (method_str == "nearest") {
-            downsample_method = DownsampleMethod::Nearest;
-        } else if (method_str == "maximum") {
-            downsample_method = DownsampleMethod::Maximum;
+    }
+
+    if (tile_size == 0) {
+        return nullptr;
+    }
+
+    const int mosaic_size = tile_size * 2;
+    const std::size_t row_stride = static_cast<std::size_t>(mosaic_size) * 3u;
+    std::uint8_t* mosaic = downsample_scratch().mosaic.take(row_stride * mosaic_size);
+
+    // TMS rows grow northwards, so children 2/3 form the top half of the image
+    constexpr std::array<std::pair<int, int>, 4> quadrant_origin{{{0, 1}, {1, 1}, {0, 0}, {1, 0}}};
+
+    int decoded_count = 0;
+    for (std::size_t i = 0; i < 4; ++i) {
+        const auto [qx, qy] = quadrant_origin[i];
+        std::uint8_t* dst = mosaic + qy * tile_size * row_stride + qx * tile_size * 3u;
+
+        if (!child_blobs[i].empty() && decode_child_into_mosaic(child_blobs[i], tile_size, dst, row_stride)) {
+            ++decoded_count;
         } else {
-            rb_raise(rb_eArgError, "Unknown downsample method: %s (expected 'average', 'nearest', or 'maximum')", method_str.data());
+            fill_missing_quadrant(dst, row_stride, tile_size, is_terrarium);
         }
-        
-        PngInfo png_info = decompress_png_to_rgb(png_data);
-        const int source_width = png_info.width;
-        const int source_height = png_info.height;
-        
-        if (source_width <= target_size && source_height <= target_size) {
-            return png_data;
+    }
+
+    return decoded_count > 0 ? mosaic : nullptr;
+}
+
+DownsampleStatus encode_terrain(const std::uint8_t* rgb, int width, int height, const QuadOutputOptions& options,
+                                EncodedBuffer& out) noexcept {
+    if (options.webp) {
+        return encode_webp_lossless(rgb, width, height, 3, options.webp_effort, out)
+            ? DownsampleStatus::Ok
+            : DownsampleStatus::WebpEncodeFailed;
+    }
+    return create_png_from_rgb(rgb, width, height, options.png, out);
+}
+
+// Mosaic → reduce → encode for one quad; safe to run without the GVL
+DownsampleStatus downsample_quad_job(const QuadChildren& child_blobs, bool is_terrarium, DownsampleKernel downsample,
+                                     const QuadOutputOptions& options, DownsampleJob& job) {
+    StageClock clock(job.stats);
+    for (const QuadChild& child : child_blobs) clock.count_input(child.encoded.size());
+
+    int tile_size = 0;
+    const std::uint8_t* mosaic = decode_quad_mosaic(child_blobs, is_terrarium, tile_size);
+    if (mosaic == nullptr) {
+        return DownsampleStatus::NoData;
+    }
+    clock.lap(NativeStage::Decode);
+
+    DownsampleScratch& scratch = downsample_scratch();
+    std::uint8_t* output_rgb = scratch.output.take(static_cast<std::size_t>(tile_size) * tile_size * 3u);
+    downsample(mosaic, tile_size * 2, 2, output_rgb, tile_size);
+    if (options.keep_pixels) job.pixels.assign(output_rgb, tile_size, 3, true);
+    clock.lap(NativeStage::Downsample);
+
+    const DownsampleStatus status = encode_terrain(output_rgb, tile_size, tile_size, options, job.png);
+    clock.lap(NativeStage::Encode);
+    clock.count_output(job.png.size());
+    return status;
+}
+
+// Ok → String (DecodedTile with keep_pixels), NoData → nil; failures are described in error.
+// output is the String the job's EncodedBuffer was attached to.
+VALUE quad_job_result(DownsampleJob& job, VALUE output, NativeError& error) {
+    switch (job.status) {
+        case DownsampleStatus::Ok: {
+            const VALUE data = job.png.finish(output);
+            return job.pixels.data ? wrap_decoded_tile(std::move(job.pixels), data) : data;
         }
-        
-        const int scale_factor = source_width / target_size;
-        const std::size_t output_size = static_cast<std::size_t>(target_size) * target_size * 3u;
-        std::vector<std::uint8_t> output_rgb(output_size);
-        
-        std::uint8_t* output_ptr = output_rgb.data();
-        const std::uint8_t* input_ptr = png_info.rgb_data.data();
-        
-        for (int out_y = 0; out_y < target_size; ++out_y) {
-            for (int out_x = 0; out_x < target_size; ++out_x) {
-                const int src_x = out_x * scale_factor;
-                const int src_y = out_y * scale_factor;
-                
-                std::uint8_t r, g, b;
-                
-                switch (downsample_method) {
-                    case DownsampleMethod::Nearest:
-                        downsample_nearest(input_ptr, source_width, src_x, src_y, r, g, b);
-                        break;
-                    
-                    case DownsampleMethod::Average:
-                        downsample_average(input_ptr, source_width, src_x, src_y, is_terrarium, r, g, b);
-                        break;
-                    
-                    case DownsampleMethod::Maximum:
-                        downsample_maximum(input_ptr, source_width, src_x, src_y, is_terrarium, r, g, b);
-                        break;
-                }
-                
-                *output_ptr++ = r;
-                *output_ptr++ = g;
-                *output_ptr++ = b;
-            }
+        case DownsampleStatus::Passthrough:
+        case DownsampleStatus::NoData: return Qnil;
+        default:
+            describe_failure(job, error);
+            return Qnil;
+    }
+}
+
+VALUE downsample_quad_impl(VALUE children, bool is_terrarium, DownsampleKernel downsample,
+                           const QuadOutputOptions& options, NativeError& error) {
+    const QuadChildren child_blobs = collect_quad_children(children);
+
+    DownsampleJob job;
+    VALUE output = job.png.allocate();
+    run_without_gvl(job, [&] { return downsample_quad_job(child_blobs, is_terrarium, downsample, options, job); });
+    publish_stage_stats(job.stats);
+
+    const VALUE result = quad_job_result(job, output, error);
+    RB_GC_GUARD(output);
+    return result;
+}
+
+QuadOutputOptions parse_quad_output_options(VALUE format_val, VALUE opts) {
+    Check_Type(format_val, T_STRING);
+    const std::string_view format{RSTRING_PTR(format_val), static_cast<size_t>(RSTRING_LEN(format_val))};
+
+    QuadOutputOptions options;
+    if (format == "webp") {
+        options.webp = true;
+        options.webp_effort = parse_webp_effort(opts);
+    } else if (format == "png") {
+        options.png = parse_png_options(opts);
+    } else {
+        rb_raise(rb_eArgError, "Unsupported output format: %s (expected 'png' or 'webp')", format.data());
+    }
+    options.keep_pixels = parse_keep_pixels(opts);
+    return options;
+}
+
+// Checks an Array of 4 children (String or nil) without raising; fills error on mismatch
+bool valid_quad(VALUE children, NativeError& error) {
+    if (!RB_TYPE_P(children, T_ARRAY)) {
+        error.set(rb_eTypeError, "Expected Array of 4 children, got %s", rb_obj_classname(children));
+        return false;
+    }
+    if (RARRAY_LEN(children) != 4) {
+        error.set(rb_eArgError, "Expected 4 children, got %ld", RARRAY_LEN(children));
+        return false;
+    }
+    for (long i = 0; i < 4; ++i) {
+        VALUE child = rb_ary_entry(children, i);
+        if (!valid_quad_child(child)) {
+            error.set(rb_eTypeError, "Child %ld must be String, DecodedTile or nil, got %s", i, rb_obj_classname(child));
+            return false;
         }
-        
-        return create_png_from_rgb(output_rgb, target_size, target_size);
-        
+    }
+    return true;
+}
+
+VALUE downsample_batch_impl(VALUE quads, bool is_terrarium, DownsampleKernel downsample,
+                            const QuadOutputOptions& options, unsigned threads) {
+    const long count = RARRAY_LEN(quads);
+    std::vector<QuadChildren> inputs(static_cast<std::size_t>(count));
+    std::vector<DownsampleJob> jobs(static_cast<std::size_t>(count));
+    std::vector<NativeError> errors(static_cast<std::size_t>(count));
+
+    for (long i = 0; i < count; ++i) {
+        VALUE quad = rb_ary_entry(quads, i);
+        if (valid_quad(quad, errors[i])) inputs[i] = collect_quad_children(quad);
+    }
+
+    // Destination Strings live in a Ruby Array while the pool writes into them
+    VALUE outputs = rb_ary_new_capa(count);
+    for (long i = 0; i < count; ++i) {
+        rb_ary_push(outputs, errors[i] ? Qnil : jobs[i].png.allocate());
+    }
+
+    without_gvl([&]() noexcept {
+        WorkerPool::shared().parallel_for(inputs.size(), threads, [&](std::size_t i) {
+            if (errors[i]) return;
+            DownsampleJob& job = jobs[i];
+            try {
+                job.status = downsample_quad_job(inputs[i], is_terrarium, downsample, options, job);
+            } catch (const std::bad_alloc&) {
+                job.status = DownsampleStatus::OutOfMemory;
+            } catch (...) {
+                job.status = DownsampleStatus::CppException;
+            }
+            downsample_scratch().trim();
+        });
+    });
+
+    StageStats stats;
+    for (const DownsampleJob& job : jobs) stats += job.stats;
+    publish_stage_stats(stats);
+
+    VALUE results = rb_ary_new_capa(count);
+    for (long i = 0; i < count; ++i) {
+        NativeError& error = errors[i];
+        const VALUE result = error ? Qnil : quad_job_result(jobs[i], rb_ary_entry(outputs, i), error);
+        rb_ary_push(results, error ? rb_exc_new_cstr(error.klass, error.message) : result);
+    }
+    RB_GC_GUARD(outputs);
+    return results;
+}
+
+// Builds a parent tile from 4 children [(2x,2y), (2x+1,2y), (2x,2y+1), (2x+1,2y+1)] in TMS order.
+// Children are decoded once into one 2N×2N mosaic (northern row first), reduced to N×N and encoded once
+// as 'png' or lossless 'webp'. A child may also be a DecodedTile from an earlier keep_pixels call.
+// Options: png: (see downsample_png), effort: (WebP), keep_pixels: (return a DecodedTile, see decoded_tile.h)
+extern "C" VALUE downsample_quad(int argc, VALUE* argv, VALUE /*self*/) {
+    VALUE children, encoding_type_val, method_val, format_val, opts;
+    rb_scan_args(argc, argv, "4:", &children, &encoding_type_val, &method_val, &format_val, &opts);
+
+    Check_Type(children, T_ARRAY);
+
+    if (RARRAY_LEN(children) != 4) {
+        rb_raise(rb_eArgError, "Expected 4 children, got %ld", RARRAY_LEN(children));
+    }
+
+    const bool is_terrarium = parse_is_terrarium(encoding_type_val);
+    const DownsampleKernel downsample = select_downsample_kernel(is_terrarium, parse_downsample_method(method_val));
+    const QuadOutputOptions options = parse_quad_output_options(format_val, opts);
+
+    NativeError error;
+    if (!valid_quad(children, error)) raise_native_error(error);
+    const VALUE result = downsample_quad_impl(children, is_terrarium, downsample, options, error);
+    RB_GC_GUARD(children);
+    if (error) raise_native_error(error);
+    return result;
+}
+
+// Batch form of downsample_quad: quads is an Array of 4-child Arrays, processed on the
+// native worker pool. Returns results in input order; an item that fails yields its
+// exception object instead of raising for the whole batch. Options: threads: (default nproc)
+// plus the downsample_quad options.
+extern "C" VALUE downsample_batch(int argc, VALUE* argv, VALUE /*self*/) {
+    VALUE quads, encoding_type_val, method_val, format_val, opts;
+    rb_scan_args(argc, argv, "4:", &quads, &encoding_type_val, &method_val, &format_val, &opts);
+
+    Check_Type(quads, T_ARRAY);
+    const bool is_terrarium = parse_is_terrarium(encoding_type_val);
+    const DownsampleKernel downsample = select_downsample_kernel(is_terrarium, parse_downsample_method(method_val));
+    const QuadOutputOptions options = parse_quad_output_options(format_val, opts);
+    const unsigned threads = parse_batch_threads(opts);
+
+    try {
+        const VALUE results = downsample_batch_impl(quads, is_terrarium, downsample, options, threads);
+        RB_GC_GUARD(quads);
+        return results;
     } catch (const std::exception& e) {
         rb_raise(rb_eRuntimeError, "C++ exception: %s", e.what());
-    } catch (...) {
-        rb_raise(rb_eRuntimeError, "Unknown C++ exception occurred");
     }
 }
 
+// One served tile of a stored pyramid; safe to run without the GVL. A single child is
+// re-encoded at its own size, 4 children are assembled into their 2N×2N tile.
+DownsampleStatus transform_tile_job(const QuadChildren& child_blobs, long count, bool from_terrarium,
+                                    EncodingKernel convert, const QuadOutputOptions& options, DownsampleJob& job) {
+    StageClock clock(job.stats);
+    for (const QuadChild& child : child_blobs) clock.count_input(child.encoded.size());
+
+    int width = 0;
+    int height = 0;
+    std::uint8_t* rgb = nullptr;
+    if (count == 1) {
+        if (child_blobs[0].empty()) return DownsampleStatus::NoData;
+
+        PngInfo png_info;
+        if (const DownsampleStatus status = decompress_png_to_rgb(child_blobs[0].encoded, png_info, job.detail);
+            status != DownsampleStatus::Ok) {
+            return status;
+        }
+        width = png_info.width;
+        height = png_info.height;
+        rgb = png_info.rgb_data;
+    } else {
+        int tile_size = 0;
+        rgb = decode_quad_mosaic(child_blobs, from_terrarium, tile_size);
+        if (rgb == nullptr) return DownsampleStatus::NoData;
+        width = height = tile_size * 2;
+    }
+    clock.lap(NativeStage::Decode);
+
+    // The encoding conversion is the pixel stage of a transform
+    if (convert) convert(rgb, static_cast<std::size_t>(width) * height);
+    clock.lap(NativeStage::Downsample);
+
+    const DownsampleStatus status = encode_terrain(rgb, width, height, options, job.png);
+    clock.lap(NativeStage::Encode);
+    clock.count_output(job.png.size());
+    return status;
+}
+
+// Serve-time transform of stored terrain tiles. children is [tile] to re-encode, or the 4
+// children [(2x,2y), (2x+1,2y), (2x,2y+1), (2x+1,2y+1)] in TMS order of the 2N×2N tile to
+// assemble (missing or undecodable ones become 0 m). Pixels are converted from_encoding →
+// to_encoding and encoded once as 'png' or lossless 'webp'; nil when no child decodes.
+// Options: png: (see downsample_png), effort: (WebP)
+extern "C" VALUE transform_tile(int argc, VALUE* argv, VALUE /*self*/) {
+    VALUE children, from_encoding_val, to_encoding_val, format_val, opts;
+    rb_scan_args(argc, argv, "4:", &children, &from_encoding_val, &to_encoding_val, &format_val, &opts);
+
+    Check_Type(children, T_ARRAY);
+    const long count = RARRAY_LEN(children);
+    if (count != 1 && count != 4) {
+        rb_raise(rb_eArgError, "Expected 1 or 4 children, got %ld", count);
+    }
+    for (long i = 0; i < count; ++i) {
+        const VALUE child = rb_ary_entry(children, i);
+        if (!NIL_P(child) && !RB_TYPE_P(child, T_STRING)) {
+            rb_raise(rb_eTypeError, "Child %ld must be String or nil, got %s", i, rb_obj_classname(child));
+        }
+    }
+
+    const bool from_terrarium = parse_is_terrarium(from_encoding_val);
+    const EncodingKernel convert = select_encoding_kernel(from_terrarium, parse_is_terrarium(to_encoding_val));
+    QuadOutputOptions options = parse_quad_output_options(format_val, opts);
+    options.keep_pixels = false;
+
+    QuadChildren child_blobs{};
+    for (long i = 0; i < count; ++i) child_blobs[i] = make_quad_child(rb_ary_entry(children, i));
+
+    DownsampleJob job;
+    VALUE output = job.png.allocate();
+    run_without_gvl(job, [&] { return transform_tile_job(child_blobs, count, from_terrarium, convert, options, job); });
+    publish_stage_stats(job.stats);
+
+    NativeError error;
+    const VALUE result = quad_job_result(job, output, error);
+    RB_GC_GUARD(output);
+    RB_GC_GUARD(children);
+    if (error) raise_native_error(error);
+    return result;
+}
+
 extern "C" void Init_terrain_downsample_extension(void) {
     VALUE TerrainDownsampleFFI = rb_define_module("TerrainDownsampleFFI");
-    rb_define_singleton_method(TerrainDownsampleFFI, "downsample_png", downsample_png, 4);
+    rb_define_singleton_method(TerrainDownsampleFFI, "downsample_png", downsample_png, -1);
+    rb_define_singleton_method(TerrainDownsampleFFI, "downsample_quad", downsample_quad, -1);
+    rb_define_singleton_method(TerrainDownsampleFFI, "downsample_batch", downsample_batch, -1);
+    rb_define_singleton_method(TerrainDownsampleFFI, "transform_tile", transform_tile, -1);
+    define_stage_stats_methods(TerrainDownsampleFFI);
+    define_decoded_tile_class(TerrainDownsampleFFI);
 }
-
@@ -0,0 +1,357 @@
+// Terrain-RGB decode/encode helpers and 2×2 reduction kernels.
+// Kept free of Ruby headers so the benchmark harness can include it directly.
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TPC_DOWNSAMPLE_X86 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define TPC_DOWNSAMPLE_NEON 1
+#endif
+
+constexpr double MAPBOX_TERRAIN_RGB_OFFSET = 10000.0;
+constexpr double MAPBOX_TERRAIN_RGB_SCALE = 0.1;
+constexpr int32_t MAPBOX_TERRAIN_RGB_MAX_24BIT = 16777215;
+
+constexpr float TERRARIUM_OFFSET = 32768.0f;
+
+enum class DownsampleMethod {
+    Average,
+    Nearest,
+    Maximum
+};
+
+constexpr float decode_mapbox_terrain_rgb(std::uint8_t r, std::uint8_t g, std::uint8_t b) noexcept {
+    return -MAPBOX_TERRAIN_RGB_OFFSET + ((r * 256 * 256) + (g * 256) + b) * MAPBOX_TERRAIN_RGB_SCALE;
+}
+
+constexpr float decode_terrarium(std::uint8_t r, std::uint8_t g, std::uint8_t b) noexcept {
+    return (r * 256 + g + b / 256.0f) - TERRARIUM_OFFSET;
+}
+
+constexpr void encode_mapbox_terrain_rgb(float elevation, std::uint8_t& r, std::uint8_t& g, std::uint8_t& b) noexcept {
+    const int32_t code = std::clamp(
+        static_cast<int32_t>(std::round((elevation + MAPBOX_TERRAIN_RGB_OFFSET) / MAPBOX_TERRAIN_RGB_SCALE)),
+        0, MAPBOX_TERRAIN_RGB_MAX_24BIT);
+    // Pack 24-bit code into RGB: R=bits 16-23, G=bits 8-15, B=bits 0-7
+    r = static_cast<std::uint8_t>((code >> 16) & 0xFF);
+    g = static_cast<std::uint8_t>((code >> 8) & 0xFF);
+    b = static_cast<std::uint8_t>(code & 0xFF);
+}
+
+// Rounds to the 1/256 m step of the code first, so a fraction that rounds up to a whole
+// metre carries into G (rounding the fraction alone wrapped B to 0 and lost that metre)
+inline void encode_terrarium(float elevation, std::uint8_t& r, std::uint8_t& g, std::uint8_t& b) noexcept {
+    const int32_t code = std::clamp(
+        static_cast<int32_t>(std::round((static_cast<double>(elevation) + TERRARIUM_OFFSET) * 256.0)),
+        0, MAPBOX_TERRAIN_RGB_MAX_24BIT);
+    r = static_cast<std::uint8_t>((code >> 16) & 0xFF);
+    g = static_cast<std::uint8_t>((code >> 8) & 0xFF);
+    b = static_cast<std::uint8_t>(code & 0xFF);
+}
+
+enum class TerrainEncoding {
+    Mapbox,
+    Terrarium
+};
+
+template <TerrainEncoding E>
+inline float decode_elevation(const std::uint8_t* rgb) noexcept {
+    if constexpr (E == TerrainEncoding::Terrarium) {
+        return decode_terrarium(rgb[0], rgb[1], rgb[2]);
+    } else {
+        return decode_mapbox_terrain_rgb(rgb[0], rgb[1], rgb[2]);
+    }
+}
+
+template <TerrainEncoding E>
+inline void encode_elevation(float elevation, std::uint8_t* rgb) noexcept {
+    if constexpr (E == TerrainEncoding::Terrarium) {
+        encode_terrarium(elevation, rgb[0], rgb[1], rgb[2]);
+    } else {
+        encode_mapbox_terrain_rgb(elevation, rgb[0], rgb[1], rgb[2]);
+    }
+}
+
+// Both encodings are affine in the packed 24-bit code (Mapbox: (h + 10000) × 10,
+// Terrarium: (h + 32768) × 256), so the 2×2 mean and max can be taken on the codes
+// directly: (sum + 2) >> 2 is the exact mean rounded half up, and the max code is the code
+// of the max elevation. This is what the vector kernels do. The float path they replace
+// (decode → average → encode) can land one code unit away, 0.1 m for Mapbox, because the
+// decoded elevations are rounded to float; bench/downsample_kernels_bench.cpp check holds
+// the kernels to that bound and the vector kernels to the scalar ones bit for bit.
+
+constexpr std::uint32_t rgb_code(const std::uint8_t* p) noexcept {
+    return (static_cast<std::uint32_t>(p[0]) << 16) | (static_cast<std::uint32_t>(p[1]) << 8) | p[2];
+}
+
+inline void store_rgb_code(std::uint32_t code, std::uint8_t* p) noexcept {
+    p[0] = static_cast<std::uint8_t>((code >> 16) & 0xFF);
+    p[1] = static_cast<std::uint8_t>((code >> 8) & 0xFF);
+    p[2] = static_cast<std::uint8_t>(code & 0xFF);
+}
+
+// Reduces output pixels [from, target_size) of one output row; row0/row1 are the two source rows
+template <DownsampleMethod M>
+inline void reduce_row_2x2_codes_scalar(const std::uint8_t* row0, const std::uint8_t* row1,
+                                        std::uint8_t* out, int from, int target_size) noexcept {
+    static_assert(M != DownsampleMethod::Nearest);
+    for (int out_x = from; out_x < target_size; ++out_x) {
+        const std::uint8_t* p0 = row0 + out_x * 6;
+        const std::uint8_t* p1 = row1 + out_x * 6;
+        const std::uint32_t c00 = rgb_code(p0), c10 = rgb_code(p0 + 3);
+        const std::uint32_t c01 = rgb_code(p1), c11 = rgb_code(p1 + 3);
+
+        std::uint32_t code;
+        if constexpr (M == DownsampleMethod::Maximum) {
+            code = std::max({c00, c10, c01, c11});
+        } else {
+            code = (c00 + c10 + c01 + c11 + 2) >> 2;
+        }
+        store_rgb_code(code, out + out_x * 3);
+    }
+}
+
+#if defined(TPC_DOWNSAMPLE_X86)
+
+// Unpacks 8 RGB pixels (24 bytes, reads 28) into 8 × int32 codes: each lane gets [b, g, r, 0]
+__attribute__((target("avx2")))
+inline __m256i load_codes_avx2(const std::uint8_t* p) noexcept {
+    const __m256i shuffle = _mm256_setr_epi8(
+        2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+        2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m256i raw = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 12)), 1);
+    return _mm256_shuffle_epi8(raw, shuffle);
+}
+
+// Packs 8 × int32 codes back into 24 RGB bytes
+__attribute__((target("avx2")))
+inline void store_codes_avx2(__m256i codes, std::uint8_t* out) noexcept {
+    const __m256i shuffle = _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    alignas(32) std::uint8_t packed[32];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(packed), _mm256_shuffle_epi8(codes, shuffle));
+    std::memcpy(out, packed, 12);
+    std::memcpy(out + 12, packed + 16, 12);
+}
+
+// 8 output pixels per iteration: 16 source pixels from each of the two rows
+template <DownsampleMethod M>
+__attribute__((target("avx2")))
+inline void reduce_row_2x2_codes_avx2(const std::uint8_t* row0, const std::uint8_t* row1,
+                                      std::uint8_t* out, int target_size) noexcept {
+    const __m256i even_odd = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    const __m256i rounding = _mm256_set1_epi32(2);
+    constexpr bool maximum = M == DownsampleMethod::Maximum;
+
+    int out_x = 0;
+    // Loads read 4 bytes past each 24-byte group, so keep at least one pixel of slack per row
+    for (; out_x + 9 <= target_size; out_x += 8) {
+        const std::uint8_t* p0 = row0 + out_x * 6;
+        const std::uint8_t* p1 = row1 + out_x * 6;
+
+        const __m256i a0 = load_codes_avx2(p0), b0 = load_codes_avx2(p0 + 24);
+        const __m256i a1 = load_codes_avx2(p1), b1 = load_codes_avx2(p1 + 24);
+
+        const __m256i a = maximum ? _mm256_max_epu32(a0, a1) : _mm256_add_epi32(a0, a1);
+        const __m256i b = maximum ? _mm256_max_epu32(b0, b1) : _mm256_add_epi32(b0, b1);
+
+        // Split horizontal neighbours: low half = even pixels, high half = odd pixels
+        const __m256i pa = _mm256_permutevar8x32_epi32(a, even_odd);
+        const __m256i pb = _mm256_permutevar8x32_epi32(b, even_odd);
+        const __m256i evens = _mm256_permute2x128_si256(pa, pb, 0x20);
+        const __m256i odds = _mm256_permute2x128_si256(pa, pb, 0x31);
+
+        const __m256i codes = maximum
+            ? _mm256_max_epu32(evens, odds)
+            : _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(evens, odds), rounding), 2);
+
+        store_codes_avx2(codes, out + out_x * 3);
+    }
+
+    reduce_row_2x2_codes_scalar<M>(row0, row1, out, out_x, target_size);
+}
+
+#endif
+
+#if defined(TPC_DOWNSAMPLE_NEON)
+
+inline uint32x4_t neon_codes(uint8x8_t r, uint8x8_t g, uint8x8_t b, bool high) noexcept {
+    const uint16x8_t r16 = vmovl_u8(r);
+    const uint16x8_t gb16 = vorrq_u16(vshlq_n_u16(vmovl_u8(g), 8), vmovl_u8(b));
+    return high
+        ? vorrq_u32(vshlq_n_u32(vmovl_high_u16(r16), 16), vmovl_high_u16(gb16))
+        : vorrq_u32(vshlq_n_u32(vmovl_u16(vget_low_u16(r16)), 16), vmovl_u16(vget_low_u16(gb16)));
+}
+
+// Deinterleaves 16 RGB pixels with vld3 into 4 × uint32x4 codes
+inline void load_codes_neon(const std::uint8_t* p, uint32x4_t codes[4]) noexcept {
+    const uint8x16x3_t rgb = vld3q_u8(p);
+    codes[0] = neon_codes(vget_low_u8(rgb.val[0]), vget_low_u8(rgb.val[1]), vget_low_u8(rgb.val[2]), false);
+    codes[1] = neon_codes(vget_low_u8(rgb.val[0]), vget_low_u8(rgb.val[1]), vget_low_u8(rgb.val[2]), true);
+    codes[2] = neon_codes(vget_high_u8(rgb.val[0]), vget_high_u8(rgb.val[1]), vget_high_u8(rgb.val[2]), false);
+    codes[3] = neon_codes(vget_high_u8(rgb.val[0]), vget_high_u8(rgb.val[1]), vget_high_u8(rgb.val[2]), true);
+}
+
+// 8 output pixels per iteration: 16 source pixels from each of the two rows
+template <DownsampleMethod M>
+inline void reduce_row_2x2_codes_neon(const std::uint8_t* row0, const std::uint8_t* row1,
+                                      std::uint8_t* out, int target_size) noexcept {
+    constexpr bool maximum = M == DownsampleMethod::Maximum;
+    const uint32x4_t rounding = vdupq_n_u32(2);
+
+    int out_x = 0;
+    for (; out_x + 8 <= target_size; out_x += 8) {
+        uint32x4_t c0[4], c1[4];
+        load_codes_neon(row0 + out_x * 6, c0);
+        load_codes_neon(row1 + out_x * 6, c1);
+
+        uint32x4_t reduced[2];
+        for (int half = 0; half < 2; ++half) {
+            const uint32x4_t lo = maximum ? vmaxq_u32(c0[half * 2], c1[half * 2]) : vaddq_u32(c0[half * 2], c1[half * 2]);
+            const uint32x4_t hi = maximum ? vmaxq_u32(c0[half * 2 + 1], c1[half * 2 + 1]) : vaddq_u32(c0[half * 2 + 1], c1[half * 2 + 1]);
+            // Pairwise ops combine horizontal neighbours and keep output order
+            reduced[half] = maximum
+                ? vpmaxq_u32(lo, hi)
+                : vshrq_n_u32(vaddq_u32(vpaddq_u32(lo, hi), rounding), 2);
+        }
+
+        const uint16x8_t high16 = vcombine_u16(vmovn_u32(vshrq_n_u32(reduced[0], 16)), vmovn_u32(vshrq_n_u32(reduced[1], 16)));
+        const uint16x8_t low16 = vcombine_u16(vmovn_u32(reduced[0]), vmovn_u32(reduced[1]));
+
+        uint8x8x3_t rgb;
+        rgb.val[0] = vmovn_u16(high16);
+        rgb.val[1] = vshrn_n_u16(low16, 8);
+        rgb.val[2] = vmovn_u16(low16);
+        vst3_u8(out + out_x * 3, rgb);
+    }
+
+    reduce_row_2x2_codes_scalar<M>(row0, row1, out, out_x, target_size);
+}
+
+#endif
+
+using ReduceRow2x2Fn = void (*)(const std::uint8_t*, const std::uint8_t*, std::uint8_t*, int);
+
+template <DownsampleMethod M>
+inline void reduce_row_2x2_codes_portable(const std::uint8_t* row0, const std::uint8_t* row1,
+                                          std::uint8_t* out, int target_size) noexcept {
+    reduce_row_2x2_codes_scalar<M>(row0, row1, out, 0, target_size);
+}
+
+// Picks the widest kernel the running CPU supports; resolved once per process
+template <DownsampleMethod M>
+inline ReduceRow2x2Fn select_reduce_row_2x2() noexcept {
+#if defined(TPC_DOWNSAMPLE_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return reduce_row_2x2_codes_avx2<M>;
+#elif defined(TPC_DOWNSAMPLE_NEON)
+    return reduce_row_2x2_codes_neon<M>;
+#endif
+    return reduce_row_2x2_codes_portable<M>;
+}
+
+template <DownsampleMethod M>
+inline ReduceRow2x2Fn reduce_row_2x2() noexcept {
+    static const ReduceRow2x2Fn fn = select_reduce_row_2x2<M>();
+    return fn;
+}
+
+// One instantiation per (encoding, method); nothing inside the loops depends on runtime flags.
+// Nearest is a strided gather of the top-left pixel of each block, 2× average/maximum go
+// through the code-domain row kernels, other scale factors decode the top-left 2×2 block.
+template <TerrainEncoding E, DownsampleMethod M>
+void downsample_rgb(const std::uint8_t* input_ptr, int source_width, int scale_factor,
+                    std::uint8_t* output_ptr, int target_size) noexcept {
+    const std::size_t in_stride = static_cast<std::size_t>(source_width) * 3u;
+    const std::size_t out_stride = static_cast<std::size_t>(target_size) * 3u;
+
+    if constexpr (M == DownsampleMethod::Nearest) {
+        const std::size_t src_step = static_cast<std::size_t>(scale_factor) * 3u;
+        for (int out_y = 0; out_y < target_size; ++out_y) {
+            const std::uint8_t* src = input_ptr + static_cast<std::size_t>(out_y) * scale_factor * in_stride;
+            std::uint8_t* dst = output_ptr + out_y * out_stride;
+            if (scale_factor == 1) {
+                std::memcpy(dst, src, out_stride);
+                continue;
+            }
+            for (int out_x = 0; out_x < target_size; ++out_x, src += src_step, dst += 3) {
+                std::memcpy(dst, src, 3);
+            }
+        }
+    } else {
+        if (scale_factor == 2) {
+            const ReduceRow2x2Fn reduce = reduce_row_2x2<M>();
+            for (int out_y = 0; out_y < target_size; ++out_y) {
+                const std::uint8_t* row0 = input_ptr + (2 * out_y) * in_stride;
+                reduce(row0, row0 + in_stride, output_ptr + out_y * out_stride, target_size);
+            }
+            return;
+        }
+
+        for (int out_y = 0; out_y < target_size; ++out_y) {
+            const std::uint8_t* row0 = input_ptr + static_cast<std::size_t>(out_y) * scale_factor * in_stride;
+            const std::uint8_t* row1 = row0 + in_stride;
+            std::uint8_t* dst = output_ptr + out_y * out_stride;
+
+            for (int out_x = 0; out_x < target_size; ++out_x, dst += 3) {
+                const std::size_t idx = static_cast<std::size_t>(out_x) * scale_factor * 3u;
+                const float e00 = decode_elevation<E>(row0 + idx);
+                const float e10 = decode_elevation<E>(row0 + idx + 3);
+                const float e01 = decode_elevation<E>(row1 + idx);
+                const float e11 = decode_elevation<E>(row1 + idx + 3);
+
+                if constexpr (M == DownsampleMethod::Maximum) {
+                    encode_elevation<E>(std::max({e00, e10, e01, e11}), dst);
+                } else {
+                    encode_elevation<E>((e00 + e10 + e01 + e11) * 0.25f, dst);
+                }
+            }
+        }
+    }
+}
+
+using DownsampleKernel = void (*)(const std::uint8_t*, int, int, std::uint8_t*, int);
+
+// Resolves the parsed encoding/method pair to its specialization once per call
+inline DownsampleKernel select_downsample_kernel(bool is_terrarium, DownsampleMethod method) noexcept {
+    switch (method) {
+        case DownsampleMethod::Nearest:
+            return is_terrarium ? downsample_rgb<TerrainEncoding::Terrarium, DownsampleMethod::Nearest>
+                                : downsample_rgb<TerrainEncoding::Mapbox, DownsampleMethod::Nearest>;
+        case DownsampleMethod::Maximum:
+            return is_terrarium ? downsample_rgb<TerrainEncoding::Terrarium, DownsampleMethod::Maximum>
+                                : downsample_rgb<TerrainEncoding::Mapbox, DownsampleMethod::Maximum>;
+        case DownsampleMethod::Average:
+            break;
+    }
+    return is_terrarium ? downsample_rgb<TerrainEncoding::Terrarium, DownsampleMethod::Average>
+                        : downsample_rgb<TerrainEncoding::Mapbox, DownsampleMethod::Average>;
+}
+
+// Re-encodes packed terrain-RGB pixels in place (mapbox ↔ terrarium); mapbox keeps 0.1 m steps
+template <TerrainEncoding From, TerrainEncoding To>
+void convert_terrain_rgb(std::uint8_t* rgb, std::size_t pixels) noexcept {
+    for (std::size_t i = 0; i < pixels; ++i, rgb += 3) {
+        encode_elevation<To>(decode_elevation<From>(rgb), rgb);
+    }
+}
+
+using EncodingKernel = void (*)(std::uint8_t*, std::size_t);
+
+// nullptr when both encodings are the same
+inline EncodingKernel select_encoding_kernel(bool from_terrarium, bool to_terrarium) noexcept {
+    if (from_terrarium == to_terrarium) return nullptr;
+    return from_terrarium ? convert_terrain_rgb<TerrainEncoding::Terrarium, TerrainEncoding::Mapbox>
+                          : convert_terrain_rgb<TerrainEncoding::Mapbox, TerrainEncoding::Terrarium>;
+}
@@ -0,0 +1,15 @@
+require "mkmf"
+require_relative "build_flags"
+
+TpcBuildFlags.apply
+
+$srcs = ["tile_blob_extension.cpp"]
+
+# Only the header: the SQLite functions are resolved from the sqlite3 gem at run time
+unless have_header("sqlite3.h")
+  abort "sqlite3.h not found. Please install libsqlite3-dev"
+end
+
+have_library("dl", "dlsym")
+
+create_makefile("tile_blob_extension")
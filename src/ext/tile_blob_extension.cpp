@@ -0,0 +1,272 @@
+#include "ruby.h"
+#include <sqlite3.h>
+#include <dlfcn.h>
+#include "gvl_call.h"
+#include "scratch_arena.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+// Tile reads through SQLite incremental blob I/O: the tile's rowid comes from one prepared
+// lookup and sqlite3_blob_read copies tile_data straight out of the page cache (or the mmap
+// window) into a per-thread buffer, without Sequel's datasets, SQL strings and row hashes.
+// Each read still returns one exact-size String: the memory cache and the response body keep
+// it, so a buffer shared between reads could be overwritten while they hold it.
+//
+// The extension is not linked against libsqlite3. Two SQLite copies in one process break
+// POSIX locking on a shared database file, so the API is resolved at run time from the
+// SQLite the sqlite3 gem has already loaded; when that copy does not export its symbols
+// (the gem's vendored build hides them) the reader is unavailable and callers use Sequel.
+namespace {
+
+struct SqliteApi {
+    decltype(&::sqlite3_open_v2) open_v2 = nullptr;
+    decltype(&::sqlite3_close_v2) close_v2 = nullptr;
+    decltype(&::sqlite3_exec) exec = nullptr;
+    decltype(&::sqlite3_busy_timeout) busy_timeout = nullptr;
+    decltype(&::sqlite3_errmsg) errmsg = nullptr;
+    decltype(&::sqlite3_prepare_v2) prepare_v2 = nullptr;
+    decltype(&::sqlite3_bind_int64) bind_int64 = nullptr;
+    decltype(&::sqlite3_step) step = nullptr;
+    decltype(&::sqlite3_column_int64) column_int64 = nullptr;
+    decltype(&::sqlite3_reset) reset = nullptr;
+    decltype(&::sqlite3_finalize) finalize = nullptr;
+    decltype(&::sqlite3_blob_open) blob_open = nullptr;
+    decltype(&::sqlite3_blob_bytes) blob_bytes = nullptr;
+    decltype(&::sqlite3_blob_read) blob_read = nullptr;
+    decltype(&::sqlite3_blob_close) blob_close = nullptr;
+    decltype(&::sqlite3_libversion) libversion = nullptr;
+
+    bool loaded() const noexcept { return libversion != nullptr; }
+};
+
+template <typename Fn>
+bool resolve(Fn& fn, const char* name) noexcept {
+    fn = reinterpret_cast<Fn>(dlsym(RTLD_DEFAULT, name));
+    return fn != nullptr;
+}
+
+// Resolved on first use (after the sqlite3 gem has been loaded) and kept once complete
+const SqliteApi* sqlite_api() noexcept {
+    static SqliteApi api;
+    if (api.loaded()) return &api;
+
+    SqliteApi found;
+    const bool complete =
+        resolve(found.open_v2, "sqlite3_open_v2") && resolve(found.close_v2, "sqlite3_close_v2") &&
+        resolve(found.exec, "sqlite3_exec") && resolve(found.busy_timeout, "sqlite3_busy_timeout") &&
+        resolve(found.errmsg, "sqlite3_errmsg") && resolve(found.prepare_v2, "sqlite3_prepare_v2") &&
+        resolve(found.bind_int64, "sqlite3_bind_int64") && resolve(found.step, "sqlite3_step") &&
+        resolve(found.column_int64, "sqlite3_column_int64") && resolve(found.reset, "sqlite3_reset") &&
+        resolve(found.finalize, "sqlite3_finalize") && resolve(found.blob_open, "sqlite3_blob_open") &&
+        resolve(found.blob_bytes, "sqlite3_blob_bytes") && resolve(found.blob_read, "sqlite3_blob_read") &&
+        resolve(found.blob_close, "sqlite3_blob_close") && resolve(found.libversion, "sqlite3_libversion");
+    if (!complete) return nullptr;
+
+    api = found;
+    return &api;
+}
+
+enum class ReadStatus {
+    Found,
+    Missing,
+    Failed,
+    OutOfMemory
+};
+
+// One read-only connection per route file. Falcon serves a process from one thread, so a
+// mutex around the connection costs nothing in practice and keeps the blob handle private.
+struct BlobReader {
+    const SqliteApi* api = nullptr;
+    sqlite3* db = nullptr;
+    sqlite3_stmt* lookup = nullptr;
+    char table[64] = {};
+    std::mutex mutex;
+
+    void close() noexcept {
+        if (lookup) api->finalize(lookup);
+        if (db) api->close_v2(db);
+        lookup = nullptr;
+        db = nullptr;
+    }
+};
+
+void reader_free(void* ptr) {
+    auto* reader = static_cast<BlobReader*>(ptr);
+    reader->close();
+    delete reader;
+}
+
+std::size_t reader_size(const void*) { return sizeof(BlobReader); }
+
+const rb_data_type_t reader_type = {
+    "TileBlobFFI::Reader",
+    {nullptr, reader_free, reader_size, nullptr, {nullptr}},
+    nullptr, nullptr, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+VALUE eTileBlobError = Qnil;
+
+BlobReader* get_reader(VALUE self) {
+    auto* reader = static_cast<BlobReader*>(rb_check_typeddata(self, &reader_type));
+    if (!reader->db) rb_raise(eTileBlobError, "reader is closed");
+    return reader;
+}
+
+VALUE reader_alloc(VALUE klass) {
+    auto* reader = new (std::nothrow) BlobReader();
+    if (!reader) rb_raise(rb_eNoMemError, "Failed to allocate TileBlobFFI::Reader");
+    return TypedData_Wrap_Struct(klass, &reader_type, reader);
+}
+
+struct TileRead {
+    ReadStatus status = ReadStatus::Missing;
+    sqlite3_int64 generated = 0;
+    const std::uint8_t* data = nullptr;
+    std::size_t size = 0;
+    char message[160] = {};
+};
+
+ReadStatus read_blob(const SqliteApi& api, sqlite3_blob* blob, ScratchBuffer<std::uint8_t>& buffer,
+                     TileRead& result) noexcept {
+    result.size = static_cast<std::size_t>(api.blob_bytes(blob));
+    if (result.size == 0) return ReadStatus::Found;
+
+    std::uint8_t* dst = nullptr;
+    try {
+        dst = buffer.take(result.size);
+    } catch (const std::bad_alloc&) {
+        return ReadStatus::OutOfMemory;
+    }
+    result.data = dst;
+    return api.blob_read(blob, dst, static_cast<int>(result.size), 0) == SQLITE_OK ? ReadStatus::Found : ReadStatus::Failed;
+}
+
+// Looks the tile up and reads its blob into buffer while the lookup statement is still
+// stepping, so the rowid and the blob come from the same snapshot. The blob handle is
+// closed right away: an open handle would pin the connection's read transaction.
+TileRead read_tile(BlobReader& reader, std::int64_t z, std::int64_t x, std::int64_t tms,
+                   ScratchBuffer<std::uint8_t>& buffer) noexcept {
+    const SqliteApi& api = *reader.api;
+    TileRead result;
+    std::lock_guard<std::mutex> lock(reader.mutex);
+
+    api.bind_int64(reader.lookup, 1, z);
+    api.bind_int64(reader.lookup, 2, x);
+    api.bind_int64(reader.lookup, 3, tms);
+    const int rc = api.step(reader.lookup);
+    if (rc == SQLITE_ROW) {
+        const sqlite3_int64 rowid = api.column_int64(reader.lookup, 0);
+        result.generated = api.column_int64(reader.lookup, 1);  // NULL reads as 0
+
+        sqlite3_blob* blob = nullptr;
+        if (api.blob_open(reader.db, "main", reader.table, "tile_data", rowid, 0, &blob) == SQLITE_OK) {
+            result.status = read_blob(api, blob, buffer, result);
+            if (result.status == ReadStatus::Failed) {
+                std::snprintf(result.message, sizeof(result.message), "%s", api.errmsg(reader.db));
+            }
+        } else {
+            result.status = ReadStatus::Failed;
+            std::snprintf(result.message, sizeof(result.message), "%s", api.errmsg(reader.db));
+        }
+        if (blob) api.blob_close(blob);
+    } else if (rc != SQLITE_DONE) {
+        result.status = ReadStatus::Failed;
+        std::snprintf(result.message, sizeof(result.message), "%s", api.errmsg(reader.db));
+    }
+    api.reset(reader.lookup);
+    return result;
+}
+
+ScratchBuffer<std::uint8_t>& blob_scratch() noexcept {
+    thread_local ScratchBuffer<std::uint8_t> scratch;
+    return scratch;
+}
+
+// Reader.new(path, lookup_sql, table): lookup_sql takes z, x, tms as ?1..?3 and returns the
+// blob's rowid in table and the tile's generated value
+extern "C" VALUE reader_initialize(VALUE self, VALUE path, VALUE lookup_sql, VALUE table) {
+    auto* reader = static_cast<BlobReader*>(rb_check_typeddata(self, &reader_type));
+    const char* path_str = StringValueCStr(path);
+    const char* sql = StringValueCStr(lookup_sql);
+    const char* table_str = StringValueCStr(table);
+    if (std::strlen(table_str) >= sizeof(reader->table)) rb_raise(rb_eArgError, "table name is too long");
+
+    const SqliteApi* api = sqlite_api();
+    if (!api) rb_raise(eTileBlobError, "SQLite symbols are not exported by the loaded sqlite3 library");
+
+    reader->close();
+    reader->api = api;
+    std::snprintf(reader->table, sizeof(reader->table), "%s", table_str);
+
+    NativeError error;
+    without_gvl([&]() noexcept {
+        const int flags = SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX;
+        if (api->open_v2(path_str, &reader->db, flags, nullptr) != SQLITE_OK) {
+            error.set(eTileBlobError, "cannot open %s: %s", path_str, reader->db ? api->errmsg(reader->db) : "out of memory");
+            return;
+        }
+        api->busy_timeout(reader->db, 10000);
+        api->exec(reader->db, "PRAGMA mmap_size=536870912", nullptr, nullptr, nullptr);
+        if (api->prepare_v2(reader->db, sql, -1, &reader->lookup, nullptr) != SQLITE_OK) {
+            error.set(eTileBlobError, "cannot prepare tile lookup: %s", api->errmsg(reader->db));
+        }
+    });
+    if (error) {
+        reader->close();
+        raise_native_error(error);
+    }
+    RB_GC_GUARD(path);
+    RB_GC_GUARD(lookup_sql);
+    RB_GC_GUARD(table);
+    return self;
+}
+
+// read(z, x, tms): [tile_data, generated] for a stored tile, nil when there is none
+extern "C" VALUE reader_read(VALUE self, VALUE z_val, VALUE x_val, VALUE tms_val) {
+    BlobReader* reader = get_reader(self);
+    const std::int64_t z = NUM2LL(z_val), x = NUM2LL(x_val), tms = NUM2LL(tms_val);
+    ScratchBuffer<std::uint8_t>& scratch = blob_scratch();
+
+    TileRead result;
+    without_gvl([&]() noexcept { result = read_tile(*reader, z, x, tms, scratch); });
+
+    switch (result.status) {
+        case ReadStatus::Missing: return Qnil;
+        case ReadStatus::Failed: rb_raise(eTileBlobError, "tile read failed: %s", result.message);
+        case ReadStatus::OutOfMemory: rb_raise(rb_eNoMemError, "Failed to allocate a %zu byte tile buffer", result.size);
+        case ReadStatus::Found: break;
+    }
+    const VALUE data = rb_str_new(reinterpret_cast<const char*>(result.data), static_cast<long>(result.size));
+    scratch.trim();
+    return rb_assoc_new(data, LL2NUM(result.generated));
+}
+
+extern "C" VALUE reader_close(VALUE self) {
+    auto* reader = static_cast<BlobReader*>(rb_check_typeddata(self, &reader_type));
+    std::lock_guard<std::mutex> lock(reader->mutex);
+    reader->close();
+    return Qnil;
+}
+
+extern "C" VALUE tile_blob_available(VALUE /*self*/) {
+    return sqlite_api() ? Qtrue : Qfalse;
+}
+
+}  // namespace
+
+extern "C" void Init_tile_blob_extension(void) {
+    VALUE TileBlobFFI = rb_define_module("TileBlobFFI");
+    eTileBlobError = rb_define_class_under(TileBlobFFI, "Error", rb_eStandardError);
+    rb_gc_register_address(&eTileBlobError);
+    rb_define_singleton_method(TileBlobFFI, "available?", tile_blob_available, 0);
+
+    VALUE Reader = rb_define_class_under(TileBlobFFI, "Reader", rb_cObject);
+    rb_define_alloc_func(Reader, reader_alloc);
+    rb_define_method(Reader, "initialize", reader_initialize, 3);
+    rb_define_method(Reader, "read", reader_read, 3);
+    rb_define_method(Reader, "close", reader_close, 0);
+}
@@ -0,0 +1,213 @@
+#include "ruby.h"
+#include <png.h>
+#include <webp/decode.h>
+#include "gvl_call.h"
+#include "scratch_arena.h"
+
+#include <csetjmp>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+// Same classes as VipsTileValidator.validate; Unsupported hands the blob back to Vips
+enum class TileClass {
+    Valid,
+    Corrupted,
+    Transparent,
+    PartialTransparent,
+    Unsupported,
+    OutOfMemory
+};
+
+// Tracks whether zero and non-zero alpha have been seen; both at once settles the answer
+struct AlphaScan {
+    bool seen_zero = false;
+    bool seen_nonzero = false;
+
+    bool settled() const noexcept { return seen_zero && seen_nonzero; }
+
+    // pixels with sample_bytes-wide alpha (1 or 2) at alpha_offset within each pixel_bytes stride
+    void scan(const std::uint8_t* row, std::size_t pixels, std::size_t pixel_bytes,
+              std::size_t alpha_offset, std::size_t sample_bytes) noexcept {
+        const std::uint8_t* alpha = row + alpha_offset;
+        for (std::size_t i = 0; i < pixels; ++i, alpha += pixel_bytes) {
+            const bool zero = sample_bytes == 2 ? (alpha[0] | alpha[1]) == 0 : *alpha == 0;
+            seen_zero |= zero;
+            seen_nonzero |= !zero;
+            if (settled()) return;
+        }
+    }
+
+    TileClass result() const noexcept {
+        if (!seen_nonzero) return TileClass::Transparent;
+        return seen_zero ? TileClass::PartialTransparent : TileClass::Valid;
+    }
+};
+
+struct ValidatorScratch {
+    ScratchBuffer<std::uint8_t> row;
+    ScratchBuffer<std::uint8_t> rgba;
+
+    void trim() noexcept {
+        row.trim();
+        rgba.trim();
+    }
+};
+
+ValidatorScratch& validator_scratch() noexcept {
+    thread_local ValidatorScratch scratch;
+    return scratch;
+}
+
+struct PngCursor {
+    const std::uint8_t* data;
+    std::size_t size;
+    std::size_t offset;
+};
+
+// Corrupted tiles are an expected outcome here, so libpng stays quiet about them
+[[noreturn]] void raise_png_error(png_structp png, png_const_charp) { png_longjmp(png, 1); }
+void ignore_png_warning(png_structp, png_const_charp) {}
+
+void read_from_cursor(png_structp png, png_bytep out, png_size_t length) {
+    auto* cursor = static_cast<PngCursor*>(png_get_io_ptr(png));
+    if (length > cursor->size - cursor->offset) png_error(png, "truncated PNG");
+    std::memcpy(out, cursor->data + cursor->offset, length);
+    cursor->offset += length;
+}
+
+// Only trivially destructible state lives in this frame: libpng reports errors via longjmp.
+// Reads the header, and for images Vips would load with 4 bands, streams rows until the
+// alpha answer is known. row_buffer must be called before any row is read.
+template <typename RowBuffer>
+TileClass classify_png_rows(png_structp png, png_infop info, PngCursor* cursor, bool check_transparency,
+                            RowBuffer&& row_buffer) {
+    if (setjmp(png_jmpbuf(png))) {
+        return TileClass::Corrupted;
+    }
+
+    png_set_read_fn(png, cursor, read_from_cursor);
+    png_read_info(png, info);
+    if (!check_transparency) return TileClass::Valid;
+
+    // Vips adds an alpha band for tRNS; only 4-band results (RGBA, RGB/palette + tRNS) are scanned
+    const int color_type = png_get_color_type(png, info);
+    const bool has_trns = png_get_valid(png, info, PNG_INFO_tRNS) != 0;
+    const bool rgba = color_type == PNG_COLOR_TYPE_RGB_ALPHA ||
+                      ((color_type == PNG_COLOR_TYPE_RGB || color_type == PNG_COLOR_TYPE_PALETTE) && has_trns);
+    if (!rgba) return TileClass::Valid;
+    if (png_get_interlace_type(png, info) != PNG_INTERLACE_NONE) return TileClass::Unsupported;
+
+    png_set_expand(png);
+    png_read_update_info(png, info);
+
+    const std::size_t width = png_get_image_width(png, info);
+    const std::size_t height = png_get_image_height(png, info);
+    const std::size_t sample_bytes = png_get_bit_depth(png, info) == 16 ? 2 : 1;
+    const std::size_t pixel_bytes = 4 * sample_bytes;
+    if (png_get_channels(png, info) != 4) return TileClass::Unsupported;
+
+    std::uint8_t* row = row_buffer(png_get_rowbytes(png, info));
+    if (!row) return TileClass::OutOfMemory;
+
+    AlphaScan alpha;
+    for (std::size_t y = 0; y < height && !alpha.settled(); ++y) {
+        png_read_row(png, row, nullptr);
+        alpha.scan(row, width, pixel_bytes, 3 * sample_bytes, sample_bytes);
+    }
+    return alpha.result();
+}
+
+TileClass classify_png(const InputBytes& input, bool check_transparency) {
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, raise_png_error, ignore_png_warning);
+    if (!png) return TileClass::OutOfMemory;
+    png_infop info = png_create_info_struct(png);
+    if (!info) {
+        png_destroy_read_struct(&png, nullptr, nullptr);
+        return TileClass::OutOfMemory;
+    }
+
+    PngCursor cursor{input.data(), input.size(), 0};
+    const TileClass result = classify_png_rows(png, info, &cursor, check_transparency, [](std::size_t bytes) noexcept {
+        try {
+            return validator_scratch().row.take(bytes);
+        } catch (const std::bad_alloc&) {
+            return static_cast<std::uint8_t*>(nullptr);
+        }
+    });
+    png_destroy_read_struct(&png, &info, nullptr);
+    return result;
+}
+
+TileClass classify_webp(const InputBytes& input, bool check_transparency) {
+    WebPBitstreamFeatures features;
+    if (WebPGetFeatures(input.data(), input.size(), &features) != VP8_STATUS_OK) return TileClass::Corrupted;
+    if (!check_transparency) return TileClass::Valid;
+    if (features.has_animation) return TileClass::Unsupported;
+    if (!features.has_alpha) return TileClass::Valid;
+
+    // The alpha plane is not decodable on its own, so the whole image is decoded once
+    const std::size_t stride = static_cast<std::size_t>(features.width) * 4u;
+    const std::size_t size = stride * static_cast<std::size_t>(features.height);
+    std::uint8_t* rgba = validator_scratch().rgba.take(size);
+    if (!WebPDecodeRGBAInto(input.data(), input.size(), rgba, size, static_cast<int>(stride))) {
+        return TileClass::Corrupted;
+    }
+
+    AlphaScan alpha;
+    alpha.scan(rgba, static_cast<std::size_t>(features.width) * features.height, 4, 3, 1);
+    return alpha.result();
+}
+
+TileClass classify_tile(const InputBytes& input, bool check_transparency) noexcept {
+    static constexpr std::uint8_t PNG_SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    const std::uint8_t* data = input.data();
+    const std::size_t size = input.size();
+
+    TileClass result = TileClass::Unsupported;
+    try {
+        if (size >= 8 && std::memcmp(data, PNG_SIGNATURE, 8) == 0) {
+            result = classify_png(input, check_transparency);
+        } else if (size >= 12 && std::memcmp(data, "RIFF", 4) == 0 && std::memcmp(data + 8, "WEBP", 4) == 0) {
+            result = classify_webp(input, check_transparency);
+        }
+    } catch (const std::bad_alloc&) {
+        result = TileClass::OutOfMemory;
+    }
+    validator_scratch().trim();
+    return result;
+}
+
+// Classifies a PNG or WebP tile like VipsTileValidator.validate: :valid, :corrupted and, with
+// check_transparency, :transparent or :partial_transparent. Images Vips would not load with
+// 4 bands are judged on their header alone; alpha rows are streamed and the scan stops as
+// soon as both transparent and non-transparent pixels are found.
+// Returns nil for formats handled only by Vips (JPEG, interlaced PNG, animated WebP, ...).
+extern "C" VALUE validate_tile(VALUE /*self*/, VALUE tile_data, VALUE check_transparency_val) {
+    Check_Type(tile_data, T_STRING);
+    if (RSTRING_LEN(tile_data) == 0) return ID2SYM(rb_intern("corrupted"));
+
+    const bool check_transparency = RTEST(check_transparency_val);
+    TileClass result = TileClass::Unsupported;
+    {
+        const InputBytes input(tile_data);
+        without_gvl([&]() noexcept { result = classify_tile(input, check_transparency); });
+    }
+    RB_GC_GUARD(tile_data);
+
+    switch (result) {
+        case TileClass::Valid: return ID2SYM(rb_intern("valid"));
+        case TileClass::Corrupted: return ID2SYM(rb_intern("corrupted"));
+        case TileClass::Transparent: return ID2SYM(rb_intern("transparent"));
+        case TileClass::PartialTransparent: return ID2SYM(rb_intern("partial_transparent"));
+        case TileClass::OutOfMemory: rb_raise(rb_eNoMemError, "Failed to allocate validation buffers");
+        case TileClass::Unsupported: break;
+    }
+    return Qnil;
+}
+
+extern "C" void Init_tile_validator_extension(void) {
+    VALUE TileValidatorFFI = rb_define_module("TileValidatorFFI");
+    rb_define_singleton_method(TileValidatorFFI, "validate", validate_tile, 2);
+}
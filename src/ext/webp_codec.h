@@ -0,0 +1,98 @@
+// libwebp encoders for native tile output.
+// Lossless keeps the packed elevation codes exact, so RGB terrain can be written to WebP
+// straight from the native buffer instead of going PNG → Vips → WebP. Raster tiles may
+// also be written lossy, with the same defaults as Vips webpsave.
+#pragma once
+
+#include "ruby.h"
+#include "gvl_call.h"
+#include <webp/encode.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// Same default as gap_filling.output_format.effort
+constexpr int WEBP_DEFAULT_EFFORT = 4;
+
+namespace webp_codec_detail {
+
+inline int write_to_buffer(const std::uint8_t* data, std::size_t size, const WebPPicture* picture) {
+    return static_cast<EncodedBuffer*>(picture->custom_ptr)->append(data, size) ? 1 : 0;
+}
+
+}  // namespace webp_codec_detail
+
+// Same defaults as gap_filling.output_format (and Vips webpsave)
+struct WebpEncodeOptions {
+    bool lossless = false;
+    float quality = 75.0f;
+    int effort = WEBP_DEFAULT_EFFORT;
+};
+
+// Encodes 8-bit RGB/RGBA pixels (channels 3-4) and appends the stream to out.
+// Lossless effort is the libwebp lossless preset (0 fastest - 9 smallest); lossy effort is
+// the encoder method (0-6). Safe without the GVL.
+inline bool encode_webp(const std::uint8_t* pixels, int width, int height, int channels,
+                        const WebpEncodeOptions& options, EncodedBuffer& out) noexcept {
+    if ((channels != 3 && channels != 4) || width <= 0 || height <= 0) return false;
+
+    WebPConfig config;
+    if (options.lossless) {
+        if (!WebPConfigInit(&config) || !WebPConfigLosslessPreset(&config, options.effort)) return false;
+    } else {
+        if (!WebPConfigPreset(&config, WEBP_PRESET_DEFAULT, options.quality)) return false;
+        config.method = options.effort;
+    }
+
+    WebPPicture picture;
+    if (!WebPPictureInit(&picture)) return false;
+    picture.use_argb = 1;
+    picture.width = width;
+    picture.height = height;
+    picture.writer = webp_codec_detail::write_to_buffer;
+    picture.custom_ptr = &out;
+
+    const int stride = width * channels;
+    const int imported = channels == 4 ? WebPPictureImportRGBA(&picture, pixels, stride)
+                                       : WebPPictureImportRGB(&picture, pixels, stride);
+    const bool ok = imported && WebPEncode(&config, &picture);
+    WebPPictureFree(&picture);
+    return ok;
+}
+
+inline bool encode_webp_lossless(const std::uint8_t* pixels, int width, int height, int channels, int effort,
+                                 EncodedBuffer& out) noexcept {
+    return encode_webp(pixels, width, height, channels, WebpEncodeOptions{true, 100.0f, effort}, out);
+}
+
+// effort: option of the native calls (libwebp lossless preset 0-9)
+inline int parse_webp_effort(VALUE opts) {
+    if (NIL_P(opts)) return WEBP_DEFAULT_EFFORT;
+
+    const VALUE effort = rb_hash_aref(opts, ID2SYM(rb_intern("effort")));
+    if (NIL_P(effort)) return WEBP_DEFAULT_EFFORT;
+
+    const int level = NUM2INT(effort);
+    if (level < 0 || level > 9) rb_raise(rb_eArgError, "Invalid WebP effort: %d (must be 0-9)", level);
+    return level;
+}
+
+// lossless:, quality: (0-100, lossy only) and effort: (0-9 lossless, 0-6 lossy) options
+inline WebpEncodeOptions parse_webp_options(VALUE opts) {
+    WebpEncodeOptions options;
+    if (NIL_P(opts)) return options;
+
+    options.lossless = RTEST(rb_hash_aref(opts, ID2SYM(rb_intern("lossless"))));
+    options.effort = parse_webp_effort(opts);
+    if (!options.lossless && options.effort > 6) {
+        rb_raise(rb_eArgError, "Invalid WebP effort: %d (must be 0-6 for lossy)", options.effort);
+    }
+
+    const VALUE quality = rb_hash_aref(opts, ID2SYM(rb_intern("quality")));
+    if (!NIL_P(quality)) {
+        const double q = NUM2DBL(quality);
+        if (q < 0.0 || q > 100.0) rb_raise(rb_eArgError, "Invalid WebP quality: %g (must be 0-100)", q);
+        options.quality = static_cast<float>(q);
+    }
+    return options;
+}
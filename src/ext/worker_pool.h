@@ -0,0 +1,135 @@
+// Fixed-size native worker pool for batch calls.
+// Workers never touch the Ruby API; batches are submitted with the GVL released and
+// every item reports its outcome through its own job slot.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+class WorkerPool {
+public:
+    explicit WorkerPool(unsigned size) {
+        workers_.reserve(size);
+        for (unsigned i = 0; i < size; ++i) {
+            workers_.emplace_back([this] { worker_loop(); });
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (std::thread& worker : workers_) worker.join();
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Process-wide pool; the first caller fixes its size (0 = hardware concurrency).
+    // A forked child gets a fresh pool: the parent's threads do not exist there.
+    static WorkerPool& shared(unsigned requested_size = 0) {
+        static std::mutex shared_mutex;
+        static std::unique_ptr<WorkerPool> pool;
+        static pid_t owner_pid = 0;
+
+        std::lock_guard lock(shared_mutex);
+        if (pool && owner_pid != getpid()) {
+            static_cast<void>(pool.release());
+        }
+        if (!pool) {
+            pool = std::make_unique<WorkerPool>(requested_size > 0 ? requested_size : default_size());
+            owner_pid = getpid();
+        }
+        return *pool;
+    }
+
+    static unsigned default_size() noexcept {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    unsigned size() const noexcept { return static_cast<unsigned>(workers_.size()); }
+
+    // Runs fn(i) for i in [0, count) on at most max_threads threads (0 = whole pool) and
+    // blocks until all items are done. The calling thread takes items as well.
+    // fn must not throw; batches from different callers are serialized.
+    void parallel_for(std::size_t count, unsigned max_threads, const std::function<void(std::size_t)>& fn) {
+        if (count == 0) return;
+
+        const unsigned helpers = std::min<std::size_t>(
+            {static_cast<std::size_t>(max_threads > 0 ? max_threads : size() + 1) - 1, size(), count - 1});
+        if (helpers == 0) {
+            for (std::size_t i = 0; i < count; ++i) fn(i);
+            return;
+        }
+
+        std::lock_guard submit(submit_mutex_);
+        {
+            std::lock_guard lock(mutex_);
+            task_ = &fn;
+            count_ = count;
+            next_.store(0, std::memory_order_relaxed);
+            helpers_wanted_ = helpers;
+            helpers_active_ = 0;
+            ++generation_;
+        }
+        wake_.notify_all();
+
+        drain();
+
+        std::unique_lock lock(mutex_);
+        helpers_wanted_ = 0;
+        done_.wait(lock, [this] { return helpers_active_ == 0; });
+        task_ = nullptr;
+    }
+
+private:
+    void drain() {
+        for (std::size_t i = next_.fetch_add(1, std::memory_order_relaxed); i < count_;
+             i = next_.fetch_add(1, std::memory_order_relaxed)) {
+            (*task_)(i);
+        }
+    }
+
+    void worker_loop() {
+        std::size_t seen_generation = 0;
+        std::unique_lock lock(mutex_);
+        for (;;) {
+            wake_.wait(lock, [&] { return stopping_ || (generation_ != seen_generation && helpers_wanted_ > 0); });
+            if (stopping_) return;
+
+            seen_generation = generation_;
+            --helpers_wanted_;
+            ++helpers_active_;
+            lock.unlock();
+
+            drain();
+
+            lock.lock();
+            if (--helpers_active_ == 0) done_.notify_all();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex submit_mutex_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    const std::function<void(std::size_t)>* task_ = nullptr;
+    std::size_t count_ = 0;
+    std::atomic<std::size_t> next_{0};
+    std::size_t generation_ = 0;
+    unsigned helpers_wanted_ = 0;
+    unsigned helpers_active_ = 0;
+    bool stopping_ = false;
+};
@@ -0,0 +1,102 @@
+require 'uri'
+
+# Metatile fetching: one upstream request for the size × size block of tiles around a missed
+# tile, cut natively into the block's tiles (RasterDownsampleFFI.slice_metatile decodes the
+# image once and encodes each tile in the route's output format). For upstreams that serve a
+# large tile or a bbox at about the latency of a single tile.
+#
+#   metatile:
+#     size: 2                  # 2 | 4 | 8 tiles per side
+#     url: "https://example.com/wms?BBOX={bbox}&WIDTH={width}&HEIGHT={height}"
+#     tile_size: 256           # Pixels per tile of the sliced block
+#
+# url placeholders: {z}/{x}/{y} address the block as a tile of zoom z - log2(size), {bbox} is
+# its EPSG:3857 extent (minx,miny,maxx,maxy), {width}/{height} its size in pixels. Without
+# url the route's target is requested at the block's zoom (512px tiles for size 2).
+module Metatile
+  extend self
+
+  SIZES = [2, 4, 8].freeze
+  HALF_WORLD = 20_037_508.342789244 # EPSG:3857 half extent, meters
+
+  Config = Struct.new(:size, :shift, :url, :tile_size, keyword_init: true)
+
+  # Validated metatile: of a route, nil when not configured
+  def config(route, route_name)
+    raw = route[:metatile]
+    return nil if raw.nil? || raw == false
+    return raw if raw.is_a?(Config)
+
+    raise ArgumentError, "metatile needs the raster_downsample extension (source '#{route_name}')" unless defined?(RasterDownsampleFFI)
+
+    raw = { size: raw } unless raw.is_a?(Hash)
+    size = Integer(raw[:size], exception: false)
+    unless SIZES.include?(size)
+      raise ArgumentError, "Invalid metatile.size '#{raw[:size]}' for source '#{route_name}'. Supported: #{SIZES.join(', ')}"
+    end
+    if route[:source_format] == 'lerc'
+      raise ArgumentError, "metatile is not supported with source_format: lerc (source '#{route_name}')"
+    end
+    if route.dig(:downsample_config, :enabled)
+      raise ArgumentError, "metatile is not supported with downsample_config (source '#{route_name}')"
+    end
+
+    Config.new(size: size, shift: size.bit_length - 1, url: raw[:url] || route[:target],
+               tile_size: Integer(raw[:tile_size] || 256))
+  end
+
+  # Upstream path of the block holding tile z/x/y (XYZ); nil at zooms with fewer tiles per
+  # side than the block, which are fetched one by one
+  def url(config, route, z, x, y)
+    return nil if z < config.shift
+
+    x0, y0 = origin(config, x, y)
+    url = config.url.gsub('{z}', (z - config.shift).to_s)
+                    .gsub('{x}', (x0 >> config.shift).to_s)
+                    .gsub('{y}', (y0 >> config.shift).to_s)
+                    .gsub('{bbox}', bbox(config, z, x0, y0))
+                    .gsub('{width}', (config.size * config.tile_size).to_s)
+                    .gsub('{height}', (config.size * config.tile_size).to_s)
+    url += "#{url.include?('?') ? '&' : '?'}#{URI.encode_www_form(route[:query_params])}" if route[:query_params]
+    url
+  end
+
+  # XYZ coordinates of the block's north-west tile
+  def origin(config, x, y)
+    mask = ~(config.size - 1)
+    [x & mask, y & mask]
+  end
+
+  # { [x, y] => tile } (XYZ) of the block's image in the route's output format (its own when
+  # the route has none); nil when the image does not decode, false when only Vips reads it
+  def slice(config, route, data, x, y)
+    format = route[:output_format] || (data.start_with?('RIFF') ? 'webp' : 'png')
+    tiles = RasterDownsampleFFI.slice_metatile(data, config.size, format, **output_options(route, format))
+    TileStageMetrics.record_native(route[:observability_source], RasterDownsampleFFI, 'slice_metatile')
+    return tiles unless tiles
+
+    x0, y0 = origin(config, x, y)
+    tiles.each_with_index.to_h { |tile, i| [[x0 + i % config.size, y0 + i / config.size], tile] }
+  end
+
+  private
+
+  def bbox(config, z, x0, y0)
+    tile_meters = 2 * HALF_WORLD / (1 << z)
+    min_x = -HALF_WORLD + x0 * tile_meters
+    max_y = HALF_WORLD - y0 * tile_meters
+    [min_x, max_y - config.size * tile_meters, min_x + config.size * tile_meters, max_y].map { _1.round(6) }.join(',')
+  end
+
+  # Encoder options of the route's webp_config, as convert_to_webp applies them
+  def output_options(route, format)
+    return { png: 'fast' } if format == 'png'
+
+    webp_config = route[:webp_config] || {}
+    if webp_config[:lossless] == false
+      { lossless: false, quality: webp_config[:quality] }.compact
+    else
+      { lossless: true, effort: webp_config[:effort] }.compact
+    end
+  end
+end
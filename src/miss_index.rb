@@ -0,0 +1,246 @@
+require 'sequel'
+
+# In-memory negative index over one route's misses table, so a request for a tile that was
+# never missed does not touch SQLite at all.
+#
+# A Bloom filter holds the key of every miss: a negative answer is exact and ends the lookup.
+# Misses recorded since startup (and recent ones at load) are kept in a bounded map with
+# their ts / status / reason and answer without the database; only keys the filter knows but
+# the map does not fall back to the caller's read. Every writer of misses must call record
+# (or forget_zoom for bulk deletes) so the map never disagrees with the table.
+#
+# Expired non-200 misses are no longer deleted on the request path: lookups treat them as
+# absent and a background sweep deletes them in one statement per interval.
+#
+# Misses written by another process reach neither the filter nor the map. When several
+# processes serve one database, ttl: makes map entries older than that fall back to the
+# database and the sweep rebuild the filter each time, so a change made elsewhere is seen
+# within ttl (map) or sweep_interval (filter). It is nil for the single-process server.
+class MissIndex
+  DEFAULT_RECENT_ENTRIES = 100_000
+  DEFAULT_SWEEP_INTERVAL = 60 # Seconds between sweeps of expired misses
+  BITS_PER_KEY = 10           # With HASHES = 7 about 1% false positives at capacity
+  HASHES = 7
+  MIN_CAPACITY = 1 << 16
+  MASK64 = (1 << 64) - 1
+
+  attr_reader :source_name
+
+  def initialize(db, source_name, timeout:, recent_entries: DEFAULT_RECENT_ENTRIES, sweep_interval: DEFAULT_SWEEP_INTERVAL,
+                 ttl: nil)
+    @db = db
+    @source_name = source_name
+    @timeout = timeout
+    @ttl = ttl
+    @recent_entries = recent_entries
+    @sweep_interval = sweep_interval
+    @mutex = Mutex.new
+    @recent = {}
+    @counters = Hash.new(0)
+    @rebuild_log = nil
+    @sweeper = nil
+    @bits, @capacity = build_filter(0)
+    @keys = 0
+    @stale = 0
+  end
+
+  # Loads every miss key into the filter and recent non-200 misses into the map
+  def load
+    cutoff = Time.now.to_i - @timeout
+    bits, capacity, keys = filter_from_db
+    recent = {}
+    @db[:misses].where(ts: (cutoff + 1)..).exclude(status: 200).order(:ts)
+                .select(:zoom_level, :tile_column, :tile_row, :ts, :status, :reason).each do |row|
+      recent[pack(row[:zoom_level], row[:tile_column], row[:tile_row])] = [entry_of(row), expiry]
+    end
+    recent.shift while recent.size > @recent_entries
+
+    @mutex.synchronize do
+      @bits, @capacity, @keys, @stale = bits, capacity, keys, 0
+      @recent = recent
+    end
+    LOGGER.info("event=miss_index_loaded source=#{@source_name} keys=#{keys} recent=#{recent.size}")
+    self
+  end
+
+  # Miss row ({ ts:, status:, reason: } at least) for a tile or nil; the block reads the
+  # database and is only called when the filter cannot rule the tile out
+  def fetch(z, x, tms)
+    key = pack(z, x, tms)
+    @mutex.synchronize do
+      unless filter_include?(key)
+        @counters[:negatives] += 1
+        return nil
+      end
+      if (cached = @recent.delete(key))
+        entry, expires_at = cached
+        if expires_at.nil? || expires_at > now
+          @recent[key] = cached
+          @counters[:hits] += 1
+          return entry
+        end
+      end
+      @counters[:fallbacks] += 1
+    end
+
+    row = yield
+    @mutex.synchronize do
+      if row
+        remember(key, entry_of(row)) unless @recent.key?(key)
+      else
+        @counters[:false_positives] += 1
+        @stale += 1
+      end
+    end
+    row
+  end
+
+  # A miss was written (or replaced) for the tile
+  def record(z, x, tms, ts:, status:, reason:)
+    key = pack(z, x, tms)
+    @mutex.synchronize do
+      filter_add(key)
+      @rebuild_log&.push(key)
+      @recent.delete(key)
+      remember(key, { ts: ts, status: status, reason: reason })
+    end
+  end
+
+  # Misses of a whole zoom level were deleted; the filter keeps their keys until it is rebuilt
+  def forget_zoom(z)
+    @mutex.synchronize do
+      before = @recent.size
+      @recent.delete_if { |key, _| key >> 58 == z }
+      @stale += before - @recent.size
+    end
+  end
+
+  # Deletes expired non-200 misses, permanent:* ones included as the request path always did,
+  # and rebuilds the filter once a quarter of its keys are gone or it is over capacity (on
+  # every sweep with a ttl, to pick up the misses of other processes)
+  def sweep
+    cutoff = Time.now.to_i - @timeout
+    deleted = @db[:misses].where(ts: 0..cutoff).exclude(status: 200).delete
+    @mutex.synchronize do
+      @recent.delete_if { |_, (entry, _)| entry[:status] != 200 && entry[:ts].to_i <= cutoff }
+      @stale += deleted
+      @counters[:swept] += deleted
+    end
+    rebuild if @ttl || rebuild_due?
+    deleted
+  end
+
+  def start_sweeper
+    @sweeper ||= Thread.new do
+      Thread.current.report_on_exception = false
+      loop do
+        sleep @sweep_interval
+        begin
+          sweep
+        rescue => e
+          LOGGER.warn("event=miss_index_sweep_error source=#{@source_name} error=#{e.message}")
+        end
+      end
+    end
+  end
+
+  def stop_sweeper
+    @sweeper&.kill
+    @sweeper = nil
+  end
+
+  # Exposes lookup counters and the map size through Metrics, attributed to the source
+  def register_metrics
+    attributes = { source: @source_name }
+    %i[negatives hits fallbacks false_positives swept].each do |name|
+      Metrics.register("tpc.miss_index.#{name}", description: "Miss index #{name.to_s.tr('_', ' ')}",
+                                                 attributes: attributes) { stats[name] }
+    end
+    Metrics.register('tpc.miss_index.recent_entries', kind: :gauge, description: 'Misses held in memory',
+                                                      attributes: attributes) { stats[:recent] }
+  end
+
+  def stats
+    @mutex.synchronize do
+      %i[negatives hits fallbacks false_positives swept].to_h { |name| [name, @counters[name]] }
+        .merge(recent: @recent.size, keys: @keys, capacity: @capacity, stale: @stale)
+    end
+  end
+
+  private
+
+  def remember(key, entry)
+    @recent[key] = [entry, expiry]
+    @recent.shift while @recent.size > @recent_entries
+  end
+
+  def now = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+
+  def expiry = @ttl && now + @ttl
+
+  def entry_of(row) = { ts: row[:ts], status: row[:status], reason: row[:reason] }
+
+  def rebuild_due?
+    @mutex.synchronize { @stale * 4 > [@keys, MIN_CAPACITY].max || @keys > @capacity }
+  end
+
+  # Builds a new filter from the table off the lock; keys recorded meanwhile are replayed
+  def rebuild
+    @mutex.synchronize { @rebuild_log = [] }
+    bits, capacity, keys = filter_from_db
+    @mutex.synchronize do
+      @bits, @capacity, @keys, @stale = bits, capacity, keys, 0
+      @rebuild_log.each { |key| filter_add(key) }
+      @rebuild_log = nil
+    end
+    LOGGER.debug("MissIndex: rebuilt filter for #{@source_name} with #{keys} keys")
+  rescue
+    @mutex.synchronize { @rebuild_log = nil }
+    raise
+  end
+
+  # Filter sized for twice the current keys, so misses recorded later keep it near 1%
+  def filter_from_db
+    misses = @db[:misses]
+    bits, capacity = build_filter(misses.count * 2)
+    keys = 0
+    misses.select(:zoom_level, :tile_column, :tile_row).each do |row|
+      add_bits(bits, capacity, pack(row[:zoom_level], row[:tile_column], row[:tile_row]))
+      keys += 1
+    end
+    [bits, capacity, keys]
+  end
+
+  def build_filter(keys)
+    capacity = [keys, MIN_CAPACITY].max
+    [("\0".b * (capacity * BITS_PER_KEY / 8)), capacity]
+  end
+
+  def filter_add(key)
+    @keys += 1
+    add_bits(@bits, @capacity, key)
+  end
+
+  def add_bits(bits, capacity, key)
+    each_bit(key, capacity * BITS_PER_KEY) { |bit| bits.setbyte(bit >> 3, bits.getbyte(bit >> 3) | (1 << (bit & 7))) }
+  end
+
+  def filter_include?(key)
+    each_bit(key, @capacity * BITS_PER_KEY) { |bit| return false if @bits.getbyte(bit >> 3)[bit & 7].zero? }
+    true
+  end
+
+  # Double hashing over two halves of a splitmix64 mix of the key
+  def each_bit(key, size)
+    h = (key + 0x9E3779B97F4A7C15) & MASK64
+    h = ((h ^ (h >> 30)) * 0xBF58476D1CE4E5B9) & MASK64
+    h = ((h ^ (h >> 27)) * 0x94D049BB133111EB) & MASK64
+    h ^= h >> 31
+    h1 = h & 0xFFFFFFFF
+    h2 = (h >> 32) | 1
+    HASHES.times { |i| yield (h1 + i * h2) % size }
+  end
+
+  # Same layout as TileCache: z < 32 and x, tms < 2^29
+  def pack(z, x, tms) = (z << 58) | (x << 29) | tms
+end
@@ -184,6 +184,7 @@ module UpstreamObservability
 
   def record(source:, z:, x:, y:, status:, reason:, duration_ms:, started_at: nil, finished_at: nil,
              bytes: nil, content_type: nil, host: nil, **attrs)
+    TileStageMetrics.record_stage(source, :fetch, duration_ms)
     event = event_for(status: status, reason: reason, duration_ms: duration_ms)
     return unless event
 
@@ -286,6 +287,202 @@ module UpstreamObservability
   end
 end
 
+# Process-local metrics. Components register observable instruments with a block that reads
+# their own counters, so hot paths only bump an Integer. Metrics.snapshot reads them all with
+# their attributes (per source). When an OpenTelemetry meter provider is configured
+# (opentelemetry-metrics-sdk), each metric name is also exported as one asynchronous
+# instrument reporting the sum over its registrations. Per-event values go to histograms
+# (Metrics.histogram), which snapshot as count/sum/max per attribute set.
+module Metrics
+  extend self
+
+  METER_NAME = 'tiles-proxy-cache'
+  MUTEX = Mutex.new # Routes register their metrics from the startup threads
+  KINDS = %i[counter gauge].freeze
+  Instrument = Struct.new(:name, :kind, :unit, :description, :attributes, :reader)
+
+  # Synchronous instrument: record keeps a [count, sum, max] per attribute set and forwards the
+  # value to the OpenTelemetry histogram of the same name when a meter provider is configured
+  class Histogram
+    attr_reader :name, :unit, :description
+
+    def initialize(name, unit, description, exported)
+      @name = name
+      @unit = unit
+      @description = description
+      @exported = exported
+      @series = {}
+      @mutex = Mutex.new
+    end
+
+    def record(value, attributes = {})
+      attributes = attributes.transform_keys(&:to_s)
+      @mutex.synchronize do
+        series = (@series[attributes] ||= [0, 0, value])
+        series[0] += 1
+        series[1] += value
+        series[2] = value if value > series[2]
+      end
+      @exported&.record(value, attributes: attributes)
+    rescue => e
+      LOGGER.debug("event=metric_record_error metric=#{@name} error=#{e.message}") if defined?(LOGGER)
+    end
+
+    def series = @mutex.synchronize { @series.transform_values(&:dup) }
+  end
+
+  # kind :counter is monotonic, :gauge a current value; reader returns a Numeric
+  def register(name, kind: :counter, unit: nil, description: nil, attributes: {}, &reader)
+    raise ArgumentError, "Unknown metric kind: #{kind}" unless KINDS.include?(kind)
+
+    instrument = Instrument.new(name, kind, unit, description, attributes.transform_keys(&:to_s), reader)
+    first = mutex.synchronize do
+      instruments << instrument
+      instruments.count { |other| other.name == name } == 1
+    end
+    export(instrument) if first
+    instrument
+  end
+
+  # One Histogram per name; later calls return the first one
+  def histogram(name, unit: nil, description: nil)
+    mutex.synchronize do
+      histograms[name] ||= Histogram.new(name, unit, description, export_histogram(name, unit, description))
+    end
+  end
+
+  # [{ name:, kind:, unit:, attributes:, value: }]; histogram values are { count:, sum:, max: }
+  def snapshot
+    observed = mutex.synchronize { instruments.dup }.map do |instrument|
+      {
+        name: instrument.name, kind: instrument.kind, unit: instrument.unit,
+        attributes: instrument.attributes, value: read(instrument)
+      }
+    end
+    observed + mutex.synchronize { histograms.values }.flat_map do |histogram|
+      histogram.series.map do |attributes, (count, sum, max)|
+        {
+          name: histogram.name, kind: :histogram, unit: histogram.unit,
+          attributes: attributes, value: { count: count, sum: sum, max: max }
+        }
+      end
+    end
+  end
+
+  private
+
+  def instruments = (@instruments ||= [])
+
+  def histograms = (@histograms ||= {})
+
+  def mutex = MUTEX
+
+  def read(instrument)
+    instrument.reader.call
+  rescue => e
+    LOGGER.debug("event=metric_read_error metric=#{instrument.name} error=#{e.message}") if defined?(LOGGER)
+    nil
+  end
+
+  def meter
+    return @meter if defined?(@meter)
+
+    provider = OpenTelemetry.meter_provider if defined?(OpenTelemetry) && OpenTelemetry.respond_to?(:meter_provider)
+    @meter = provider&.meter(METER_NAME)
+  end
+
+  def export(instrument)
+    return unless meter
+
+    create = instrument.kind == :counter ? :create_observable_counter : :create_observable_gauge
+    return unless meter.respond_to?(create)
+
+    name = instrument.name
+    total = -> { mutex.synchronize { instruments.select { |other| other.name == name } }.sum { |other| read(other) || 0 } }
+    meter.public_send(create, name, unit: instrument.unit, description: instrument.description, callback: total)
+  rescue => e
+    LOGGER.debug("event=metric_export_error metric=#{instrument.name} error=#{e.message}") if defined?(LOGGER)
+  end
+
+  def export_histogram(name, unit, description)
+    return unless meter.respond_to?(:create_histogram)
+
+    meter.create_histogram(name, unit: unit, description: description)
+  rescue => e
+    LOGGER.debug("event=metric_export_error metric=#{name} error=#{e.message}") if defined?(LOGGER)
+    nil
+  end
+end
+
+# Where the time of a tile miss goes: upstream fetch, the native stages (decode, quantize,
+# downsample, encode; read from the extensions' last_stats) and the SQLite write, as
+# histograms tagged by source and stage. TPC_NATIVE_STAGE_METRICS=true turns it on together
+# with the extensions' stats collection; otherwise every call here returns at once.
+module TileStageMetrics
+  extend self
+
+  NATIVE_STAGES = %i[decode quantize downsample encode].freeze
+
+  def enabled?
+    return @enabled if defined?(@enabled)
+
+    @enabled = ENV.fetch('TPC_NATIVE_STAGE_METRICS', 'false') == 'true'
+  end
+
+  # Switches on stats collection in the loaded extension modules
+  def enable(*extensions)
+    return unless enabled?
+
+    extensions.each { |extension| extension.stats_enabled = true if extension.respond_to?(:stats_enabled=) }
+  end
+
+  # After a native call on this thread: records its stages under source. A batch reports
+  # the per-tile mean of its items.
+  def record_native(source, extension, operation)
+    return unless enabled? && extension.respond_to?(:last_stats)
+
+    stats = extension.last_stats
+    return unless stats && stats[:items].positive?
+
+    items = stats[:items]
+    NATIVE_STAGES.each do |stage|
+      ns = stats[:"#{stage}_ns"]
+      record_stage(source, stage, ns / items / 1e6) if ns.positive?
+    end
+    attributes = { source: source, operation: operation }
+    size_histogram.record(stats[:input_bytes] / items, attributes.merge(direction: 'input'))
+    size_histogram.record(stats[:output_bytes] / items, attributes.merge(direction: 'output'))
+  end
+
+  def record_stage(source, stage, duration_ms)
+    return unless enabled? && duration_ms
+
+    duration_histogram.record(duration_ms, { source: source, stage: stage.to_s })
+  end
+
+  # Times the block as one stage and returns its result
+  def measure(source, stage)
+    return yield unless enabled?
+
+    started_at = Observability.monotonic_time
+    result = yield
+    record_stage(source, stage, (Observability.monotonic_time - started_at) * 1000)
+    result
+  end
+
+  private
+
+  def duration_histogram
+    @duration_histogram ||= Metrics.histogram('tpc.tile.stage.duration', unit: 'ms',
+                                              description: 'Time a tile spends in one fetch, conversion or write stage')
+  end
+
+  def size_histogram
+    @size_histogram ||= Metrics.histogram('tpc.tile.native.size', unit: 'By',
+                                          description: 'Input and output bytes per tile of a native conversion')
+  end
+end
+
 unless ENV['TPC_OBSERVABILITY_SETUP'] == 'false'
   Observability.configure_environment!
 end
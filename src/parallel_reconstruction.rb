@@ -0,0 +1,27 @@
+# Building blocks of the parallel gap-filling mode (gap_filling.workers > 1)
+
+# Per-worker deques of subtree roots. Each worker starts with a contiguous slice, so its
+# subtrees are neighbours; it takes from the front of its own deque and, once that runs
+# dry, steals the back half of the longest one. Coastlines and open ocean make subtrees
+# very uneven, and stealing keeps every worker busy until the last subtree is handed out.
+class SubtreeDeques
+  def initialize(roots, workers)
+    slice = [(roots.size.to_f / workers).ceil, 1].max
+    @deques = Array.new(workers) { |i| roots[i * slice, slice] || [] }
+    @mutex = Mutex.new
+  end
+
+  # Next root for a worker as [root, stolen]; nil when every deque is empty
+  def take(worker)
+    @mutex.synchronize do
+      own = @deques[worker]
+      return [own.shift, false] unless own.empty?
+
+      victim = @deques.max_by(&:size)
+      return nil if victim.empty?
+
+      own.concat(victim.pop((victim.size + 1) / 2))
+      [own.shift, true]
+    end
+  end
+end
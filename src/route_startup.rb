@@ -0,0 +1,163 @@
+require 'concurrent-ruby'
+
+# Opening of the routes off the boot path. configure validates every route and hands them to
+# a pool of threads (TPC_STARTUP_THREADS) that open their databases, so the server listens
+# at once. A request to a route that is not open yet opens it in the request, or waits for
+# the thread that is opening it; GET /ready answers 503 until every route is open. The
+# background jobs (autoscan, reconstruction schedules) start once all routes are settled,
+# so they do not compete with the opening of the others.
+#
+# A route that failed to open (a locked or unreachable file) is opened again by the next
+# request after a backoff that doubles from retry up to MAX_RETRY; its jobs start once it
+# is open. open must leave nothing running when it raises, and the route gets back the keys
+# it had before the attempt, so each retry starts from the configured route.
+class RouteStartup
+  DEFAULT_THREADS = 4
+  DEFAULT_WAIT = 30  # Seconds a request waits for a route another thread is opening
+  DEFAULT_RETRY = 5  # Seconds before a failed route is opened again
+  MAX_RETRY = 300
+
+  # open: ->(name, route) { ... } brings a route up; start: ->(name, route) { ... } starts its
+  # background jobs
+  def initialize(routes, open:, start:, threads: DEFAULT_THREADS, wait: DEFAULT_WAIT, retry_after: DEFAULT_RETRY)
+    @routes = routes
+    @open = open
+    @start = start
+    @threads = threads
+    @wait = wait
+    @retry_after = retry_after
+    @states = routes.keys.to_h { [_1, :pending] }
+    @errors = {}
+    @failures = Hash.new(0)
+    @retry_at = {}
+    @mutex = Mutex.new
+    @settled = ConditionVariable.new
+    @jobs_started = false
+    @ready_at = nil
+  end
+
+  def run
+    @started_at = Time.now
+    @pool = Concurrent::FixedThreadPool.new([@threads, 1].max)
+    @routes.each_key { |name| @pool.post { open(name) } }
+    @pool.shutdown
+    start_jobs({}) if @routes.empty?
+    self
+  end
+
+  # Opens the route now unless another thread already does (or it failed and waits for its
+  # retry); true once it is open, false when it failed or is still opening after the wait
+  def ensure_open(name)
+    return true if @states[name] == :open # Serving path, once the route is up
+
+    open(name)
+    deadline = now + @wait
+    @mutex.synchronize do
+      while @states[name] == :opening
+        remaining = deadline - now
+        break if remaining <= 0
+
+        @settled.wait(@mutex, remaining)
+      end
+      @states[name] == :open
+    end
+  end
+
+  # Every route open and the background jobs started
+  def ready? = @mutex.synchronize { !@ready_at.nil? && @errors.empty? }
+
+  # The routes opened so far, for the endpoints that go over all of them
+  def open_routes = @mutex.synchronize { @routes.select { |name, _| @states[name] == :open } }
+
+  def status
+    @mutex.synchronize do
+      seconds = ((@ready_at || Time.now) - (@started_at || Time.now)).round(2)
+      { ready: !@ready_at.nil? && @errors.empty?, seconds: seconds, routes: @states.transform_keys(&:to_s),
+        errors: @errors.transform_keys(&:to_s) }
+    end
+  end
+
+  # Blocks until every route is settled (specs, tools)
+  def wait(timeout = nil)
+    deadline = timeout && now + timeout
+    @mutex.synchronize do
+      until @ready_at
+        remaining = deadline && deadline - now
+        break if remaining && remaining <= 0
+
+        @settled.wait(@mutex, remaining)
+      end
+      !@ready_at.nil?
+    end
+  end
+
+  def shutdown
+    @pool&.kill
+  end
+
+  private
+
+  def now = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+
+  def open(name)
+    @mutex.synchronize do
+      return unless @states[name] == :pending || (@states[name] == :failed && @retry_at[name] <= now)
+
+      @states[name] = :opening
+    end
+
+    configured = @routes[name].dup
+    started = Time.now
+    state = begin
+      @open.call(name, @routes[name])
+      LOGGER.info("event=route_opened source=#{name} duration=#{(Time.now - started).round(2)}s")
+      @mutex.synchronize { @errors.delete(name) }
+      :open
+    rescue => e
+      @routes[name].replace(configured)
+      retry_in = @mutex.synchronize do
+        @errors[name] = e.message
+        @failures[name] += 1
+        [@retry_after * 2**(@failures[name] - 1), MAX_RETRY].min.tap { @retry_at[name] = now + _1 }
+      end
+      LOGGER.error("event=route_open_failed source=#{name} error=#{e.message} retry_in=#{retry_in}s")
+      LOGGER.debug("RouteStartup: backtrace: #{e.backtrace&.join("\n")}")
+      :failed
+    end
+
+    # The jobs of all routes start once, with the last one to settle; a route that opens on a
+    # retry after that starts its own
+    last, opened = @mutex.synchronize do
+      @states[name] = state
+      @settled.broadcast
+      if @jobs_started
+        [false, state == :open ? { name => @routes[name] } : {}]
+      elsif @states.values.none? { %i[pending opening].include?(_1) }
+        @jobs_started = true
+        [true, @routes.select { |route_name, _| @states[route_name] == :open }]
+      else
+        [false, {}]
+      end
+    end
+    last ? start_jobs(opened) : start_route_jobs(opened)
+  end
+
+  # Runs once, on the thread that settled the last route
+  def start_jobs(opened)
+    start_route_jobs(opened)
+
+    @mutex.synchronize do
+      @ready_at = Time.now
+      @settled.broadcast
+    end
+    LOGGER.info("event=routes_ready open=#{opened.size} failed=#{@errors.size} duration=#{(@ready_at - @started_at).round(2)}s")
+  end
+
+  def start_route_jobs(opened)
+    opened.each do |name, route|
+      @start.call(name, route)
+    rescue => e
+      LOGGER.error("event=route_jobs_start_failed source=#{name} error=#{e.message}")
+    end
+  end
+end
@@ -0,0 +1,75 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+require_relative '../autoscan_pipeline'
+
+RSpec.describe AimdWindow do
+  let(:window) { described_class.new(min: 1, max: 8, initial: 2) }
+
+  def respond(count, latency_ms: 50, congested: false)
+    count.times do
+      window.acquire
+      window.release(latency_ms: latency_ms, congested: congested)
+    end
+  end
+
+  it 'grows by about one request per window of fast responses' do
+    respond(2)
+    expect(window.limit).to eq(2)
+    respond(3)
+
+    expect(window.limit).to eq(3)
+    respond(200)
+    expect(window.limit).to eq(8)
+  end
+
+  it 'halves on throttling once per window of responses' do
+    respond(200)
+    respond(3, congested: true)
+
+    expect(window.limit).to eq(4)
+    expect(window.stats[:decreases]).to eq(1)
+  end
+
+  it 'backs off when latency rises well above the fastest seen' do
+    respond(200, latency_ms: 20)
+    respond(40, latency_ms: 400)
+
+    expect(window.limit).to be < 8
+    expect(window.stats).to include(baseline_ms: be < 40)
+  end
+
+  it 'does not hand out more slots than the limit' do
+    2.times { window.acquire }
+    halt = Concurrent::Promises.resolvable_event
+    halt.resolve
+
+    expect(window.acquire(halt)).to be(false)
+    expect(window.stats[:in_flight]).to eq(2)
+  end
+end
+
+RSpec.describe ScanWatermark do
+  let(:watermark) { described_class.new }
+
+  it 'moves only past tiles finished without a gap' do
+    first, second, third = [[0, 0], [0, 1], [0, 2]].map { |x, y| watermark.open(x, y) }
+
+    expect(watermark.finish(second)).to be_nil
+    expect(watermark.finish(first)).to eq([0, 1])
+    expect(watermark.pending).to eq(1)
+    watermark.finish(third)
+    expect(watermark.position).to eq([0, 2])
+    expect(watermark.wait_idle(0)).to be(true)
+  end
+
+  it 'stays before an abandoned tile' do
+    first, second, third = [[3, 0], [3, 1], [3, 2]].map { |x, y| watermark.open(x, y) }
+    watermark.finish(first)
+    watermark.finish(second, done: false)
+    watermark.finish(third)
+
+    expect(watermark.position).to eq([3, 0])
+    expect(watermark.pending).to eq(0)
+  end
+end
@@ -0,0 +1,34 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+require_relative '../coverage_index'
+
+RSpec.describe CoverageIndex do
+  def boundaries(bounds, z) = GeometryTileCalculator.tiles_for_bounds_string(bounds, z)
+
+  it 'agrees with the boundary check of the calculator' do
+    %w[30,40,60,70 170,-10,-170,10 0,0,0.0001,0.0001].each do |bounds|
+      index = described_class.new(bounds, 6)
+      (0..8).each do |z|
+        tiles = (0...(1 << [z, 5].min)).to_a.product((0...(1 << [z, 5].min)).to_a)
+        tiles.each do |x, y|
+          expect(index.cover?(z, x, y)).to eq(GeometryTileCalculator.tile_in_tile_boundaries?(x, y, z, boundaries(bounds, z)))
+        end
+      end
+    end
+  end
+
+  it 'keeps antimeridian bounds as two runs and merges them where they touch' do
+    index = described_class.new('170,-10,-170,10', 3)
+
+    expect(index.runs(3)).to eq([[0, 0, 3, 4], [7, 7, 3, 4]])
+    expect(index.runs(0)).to eq([[0, 0, 0, 0]])
+    expect(index.count(0)).to eq(1)
+    expect(index.segments(3).first).to eq(min_x: 0, min_y: 3, max_x: 0, max_y: 4)
+  end
+
+  it 'covers every tile of a route without bounds' do
+    expect(described_class.for_route({ maxzoom: 5 })).to be_nil
+    expect(described_class.for_route({ maxzoom: 5, metadata: { bounds: '30,40,60,70' } }).count(3)).to eq(6)
+  end
+end
@@ -0,0 +1,52 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+
+RSpec.describe LercFFI do
+  # 256×256 float grid: 100 m plus 10 m per 32 columns east and 5 m per 32 rows south
+  let(:lerc) { File.binread(File.expand_path('fixtures/lerc_steps_256.lerc', __dir__)) }
+
+  def elevation_at(blob, x, y)
+    r, g, b = Vips::Image.new_from_buffer(blob, '').getpoint(x, y).map(&:to_i)
+    -10000 + (r * 65536 + g * 256 + b) * 0.1
+  end
+
+  def pixels(blob) = Vips::Image.new_from_buffer(blob, '').write_to_memory
+
+  describe '.lerc_to_terrain' do
+    it 'matches lerc_to_mapbox_png for Mapbox PNG output' do
+      png = described_class.lerc_to_terrain(lerc, encoding: 'mapbox', format: 'png')
+
+      expect(png).to eq(described_class.lerc_to_mapbox_png(lerc))
+      expect(elevation_at(png, 0, 0)).to be_within(0.1).of(100)
+      expect(elevation_at(png, 40, 0)).to be_within(0.1).of(110)
+      expect(elevation_at(png, 255, 255)).to be_within(0.1).of(205)
+    end
+
+    it 'writes lossless WebP with the pixels of the PNG' do
+      webp = described_class.lerc_to_terrain(lerc, encoding: 'mapbox', format: 'webp')
+
+      expect(webp.byteslice(0, 4)).to eq('RIFF')
+      expect(webp.byteslice(8, 4)).to eq('WEBP')
+      expect(pixels(webp)).to eq(pixels(described_class.lerc_to_terrain(lerc, encoding: 'mapbox', format: 'png')))
+    end
+
+    it 'reduces to target_size on the float grid in the same pass' do
+      small = described_class.lerc_to_terrain(lerc, encoding: 'mapbox', format: 'png', target_size: 128, method: 'average')
+
+      image = Vips::Image.new_from_buffer(small, '')
+      expect([image.width, image.height]).to eq([128, 128])
+      expect(elevation_at(small, 20, 0)).to be_within(0.1).of(110)
+      expect(elevation_at(small, 127, 127)).to be_within(0.1).of(205)
+      expect(small).to eq(TerrainDownsampleFFI.downsample_png(described_class.lerc_to_mapbox_png(lerc), 128, 'mapbox', 'average'))
+    end
+
+    it 'rejects target sizes outside 1..1024' do
+      expect { described_class.lerc_to_terrain(lerc, target_size: 0) }.to raise_error(ArgumentError, /Invalid target size/)
+    end
+
+    it 'rejects formats other than png and webp' do
+      expect { described_class.lerc_to_terrain(lerc, format: 'jpeg') }.to raise_error(ArgumentError, /Unsupported output format/)
+    end
+  end
+end
@@ -0,0 +1,30 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+require_relative '../metatile'
+
+RSpec.describe Metatile do
+  let(:route) { { target: 'https://example.com/{z}/{x}/{y}.png', query_params: { key: 'k' } } }
+
+  it 'addresses the block as a tile of the parent zoom' do
+    config = described_class.config(route.merge(metatile: { size: 4 }), 'test')
+
+    expect(described_class.origin(config, 13, 6)).to eq([12, 4])
+    expect(described_class.url(config, route, 5, 13, 6)).to eq('https://example.com/3/3/1.png?key=k')
+    expect(described_class.url(config, route, 1, 1, 1)).to be_nil
+  end
+
+  it 'fills the bbox and pixel size of a WMS request' do
+    url = 'https://example.com/wms?BBOX={bbox}&WIDTH={width}&HEIGHT={height}'
+    config = described_class.config({ metatile: { size: 2, url: url, tile_size: 256 } }, 'test')
+
+    expect(described_class.url(config, {}, 1, 1, 0))
+      .to eq('https://example.com/wms?BBOX=-20037508.342789,-20037508.342789,20037508.342789,20037508.342789&WIDTH=512&HEIGHT=512')
+  end
+
+  it 'rejects sizes it cannot slice and sources it cannot read' do
+    expect { described_class.config({ metatile: { size: 3 } }, 'test') }.to raise_error(ArgumentError, /metatile.size/)
+    expect { described_class.config({ metatile: 2, source_format: 'lerc' }, 'test') }.to raise_error(ArgumentError, /lerc/)
+    expect(described_class.config({}, 'test')).to be_nil
+  end
+end
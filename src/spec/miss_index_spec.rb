@@ -0,0 +1,59 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+require_relative '../miss_index'
+
+RSpec.describe MissIndex do
+  let(:db) { tile_database }
+  let(:now) { Time.now.to_i }
+  let(:index) { described_class.new(db, 'test_source', timeout: 300).load }
+
+  def insert_miss(x, ts:, status:, reason:)
+    db[:misses].insert(zoom_level: 5, tile_column: x, tile_row: 1, ts: ts, reason: reason, status: status)
+  end
+
+  def database_read(x) = -> { db[:misses].where(zoom_level: 5, tile_column: x, tile_row: 1).first }
+
+  it 'answers tiles that were never missed without the database' do
+    insert_miss(1, ts: now, status: 404, reason: 'http_404')
+
+    expect(index.fetch(5, 2, 1) { raise 'database read' }).to be_nil
+    expect(index.fetch(5, 1, 1) { raise 'database read' }).to include(status: 404)
+  end
+
+  it 'reads older misses from the database once' do
+    insert_miss(1, ts: now - 1_000, status: 200, reason: 'transparent')
+
+    expect(index.fetch(5, 1, 1, &database_read(1))).to include(reason: 'transparent')
+    expect(index.fetch(5, 1, 1) { raise 'database read' }).to include(reason: 'transparent')
+  end
+
+  it 'serves recorded misses and forgets deleted zoom levels' do
+    index.record(6, 1, 1, ts: now, status: 500, reason: 'http_500')
+    expect(index.fetch(6, 1, 1) { raise 'database read' }).to include(status: 500)
+
+    index.forget_zoom(6)
+    expect(index.fetch(6, 1, 1) { nil }).to be_nil
+  end
+
+  it 'sweeps expired errors, permanent ones included, but keeps 200 misses' do
+    insert_miss(1, ts: now - 1_000, status: 500, reason: 'http_500')
+    insert_miss(2, ts: now - 1_000, status: 404, reason: 'permanent:http_404')
+    insert_miss(3, ts: now - 1_000, status: 200, reason: 'transparent')
+
+    expect(index.sweep).to eq(2)
+    expect(db[:misses].select_order_map(:tile_column)).to eq([3])
+  end
+
+  it 'sees the misses of other processes within its ttl' do
+    shared = described_class.new(db, 'test_source', timeout: 300, ttl: 0.05).load
+    shared.record(5, 1, 1, ts: now, status: 404, reason: 'http_404')
+    db[:misses].where(tile_column: 1).delete # A tile another process stored since
+    insert_miss(2, ts: now, status: 500, reason: 'http_500')
+
+    sleep 0.1
+    expect(shared.fetch(5, 1, 1, &database_read(1))).to be_nil
+    shared.sweep
+    expect(shared.fetch(5, 2, 1, &database_read(2))).to include(status: 500)
+  end
+end
@@ -240,3 +240,56 @@ RSpec.describe UpstreamObservability do
     )
   end
 end
+
+RSpec.describe Metrics do
+  it 'snapshots histograms as count, sum and max per attribute set' do
+    histogram = described_class.histogram('tpc.spec.histogram', unit: 'ms')
+    histogram.record(2.0, { source: 'demo', stage: 'decode' })
+    histogram.record(5.0, { source: 'demo', stage: 'decode' })
+    histogram.record(1.0, { source: 'demo', stage: 'encode' })
+
+    series = described_class.snapshot.select { |metric| metric[:name] == 'tpc.spec.histogram' }
+    decode = series.find { |metric| metric[:attributes]['stage'] == 'decode' }
+
+    expect(described_class.histogram('tpc.spec.histogram')).to be(histogram)
+    expect(series.size).to eq(2)
+    expect(decode).to include(kind: :histogram, unit: 'ms', value: { count: 2, sum: 7.0, max: 5.0 })
+  end
+end
+
+RSpec.describe TileStageMetrics do
+  FakeNativeExtension = Struct.new(:last_stats)
+
+  around do |example|
+    described_class.instance_variable_set(:@enabled, true)
+    example.run
+  ensure
+    described_class.remove_instance_variable(:@enabled)
+  end
+
+  def stage_series(source)
+    Metrics.snapshot.select { |metric| metric[:name] == 'tpc.tile.stage.duration' && metric[:attributes]['source'] == source }
+                    .to_h { |metric| [metric[:attributes]['stage'], metric[:value]] }
+  end
+
+  it 'records the native stages of the last call as per-tile milliseconds' do
+    extension = FakeNativeExtension.new(
+      decode_ns: 4_000_000, quantize_ns: 0, downsample_ns: 1_000_000, encode_ns: 8_000_000,
+      input_bytes: 800, output_bytes: 400, items: 2
+    )
+
+    described_class.record_native('native-spec', extension, 'lerc_to_terrain_batch')
+    series = stage_series('native-spec')
+
+    expect(series.keys).to contain_exactly('decode', 'downsample', 'encode')
+    expect(series['encode']).to eq(count: 1, sum: 4.0, max: 4.0)
+  end
+
+  it 'times stages measured in Ruby and the upstream fetch' do
+    expect(described_class.measure('store-spec', :store) { :written }).to eq(:written)
+    UpstreamObservability.record(source: 'store-spec', z: 1, x: 0, y: 0, status: 200, reason: 'ok', duration_ms: 12)
+
+    expect(stage_series('store-spec').keys).to contain_exactly('store', 'fetch')
+    expect(stage_series('store-spec')['fetch'][:sum]).to eq(12)
+  end
+end
@@ -0,0 +1,44 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+
+RSpec.describe 'RasterDownsampleFFI' do
+  before { skip 'raster_downsample extension not available' unless defined?(RasterDownsampleFFI) }
+
+  def create_colored_png(r, g, b, size = 256)
+    Vips::Image.black(size, size).add([r, g, b]).cast(:uchar).write_to_buffer('.png')
+  end
+
+  def pixel_at(blob, x, y) = Vips::Image.new_from_buffer(blob, '').getpoint(x, y).map(&:to_i)
+
+  describe '.downsample_quad' do
+    it 'places the children of TMS order in their quadrants' do
+      children = [create_colored_png(255, 0, 0), create_colored_png(0, 255, 0), create_colored_png(0, 0, 255), create_colored_png(255, 255, 0)]
+      result = RasterDownsampleFFI.downsample_quad(children, 'linear', 'png')
+
+      expect(pixel_at(result, 64, 64)).to eq([0, 0, 255])
+      expect(pixel_at(result, 192, 64)).to eq([255, 255, 0])
+      expect(pixel_at(result, 64, 192)).to eq([255, 0, 0])
+      expect(pixel_at(result, 192, 192)).to eq([0, 255, 0])
+    end
+
+    it 'leaves missing children transparent and returns nil without any' do
+      result = RasterDownsampleFFI.downsample_quad([create_colored_png(255, 0, 0), nil, nil, nil], 'box', 'png')
+
+      expect(pixel_at(result, 64, 192)).to eq([255, 0, 0, 255])
+      expect(pixel_at(result, 192, 64)).to eq([0, 0, 0, 0])
+      expect(RasterDownsampleFFI.downsample_quad([nil] * 4, 'box', 'png')).to be_nil
+    end
+
+    it 'hands quads it cannot read back to Vips with false' do
+      jpeg = Vips::Image.black(256, 256).write_to_buffer('.jpg')
+
+      expect(RasterDownsampleFFI.downsample_quad([jpeg, create_colored_png(255, 0, 0), nil, nil], 'box', 'png')).to be(false)
+      expect(RasterDownsampleFFI.downsample_quad([create_colored_png(1, 1, 1, 128), create_colored_png(255, 0, 0), nil, nil], 'box', 'png')).to be(false)
+    end
+
+    it 'rejects unknown kernels' do
+      expect { RasterDownsampleFFI.downsample_quad([create_colored_png(255, 0, 0)] * 4, 'bogus', 'png') }.to raise_error(ArgumentError, /Unknown kernel/)
+    end
+  end
+end
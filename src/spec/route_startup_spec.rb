@@ -0,0 +1,80 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+require_relative '../route_startup'
+
+RSpec.describe RouteStartup do
+  let(:routes) { { a: {}, b: {}, broken: {} } }
+  let(:started) { Queue.new }
+  let(:startup) do
+    described_class.new(routes, threads: 1, wait: 5,
+                                open: lambda { |name, route|
+                                  sleep 0.05
+                                  raise 'unreadable file' if name == :broken
+                                  route[:db] = name
+                                },
+                                start: ->(name, _) { started << name })
+  end
+
+  it 'opens a requested route ahead of the pool and starts the jobs once all are settled' do
+    startup.run
+    expect(startup.ensure_open(:b)).to be(true)
+    expect(routes[:b][:db]).to eq(:b)
+
+    expect(startup.wait(5)).to be(true)
+    expect(Array.new(started.size) { started.pop }).to contain_exactly(:a, :b)
+    expect(startup.open_routes.keys).to contain_exactly(:a, :b)
+  end
+
+  it 'reports the routes that failed to open as not ready' do
+    startup.run.wait(5)
+
+    expect(startup.ensure_open(:broken)).to be(false)
+    expect(startup.ready?).to be(false)
+    expect(startup.status).to include(routes: { 'a' => :open, 'b' => :open, 'broken' => :failed },
+                                      errors: { 'broken' => 'unreadable file' })
+  end
+
+  it 'opens a failed route again on a request after its backoff and starts its jobs' do
+    attempts = 0
+    flaky = described_class.new({ flaky: {} }, threads: 1, retry_after: 0.1,
+                                               open: ->(_, route) { (attempts += 1) == 1 ? raise('locked') : route[:db] = :flaky },
+                                               start: ->(name, _) { started << name })
+    flaky.run.wait(5)
+
+    expect(flaky.ensure_open(:flaky)).to be(false)
+    sleep 0.2
+    expect(flaky.ensure_open(:flaky)).to be(true)
+    expect(flaky.ready?).to be(true)
+    expect(started.pop).to eq(:flaky)
+    expect(attempts).to eq(2)
+  end
+
+  it 'closes what a failed open had started before the retry opens the route again' do
+    route = { mbtiles_file: tile_file('retried.mbtiles'), metadata: { format: 'png' }, miss_index: { sweep_interval: 60 } }
+    dbs = []
+    queues = []
+    allow(DatabaseManager).to receive(:open_database).and_wrap_original { |open, *args| open.call(*args).tap { dbs << _1 } }
+    allow(TileWriteQueue).to receive(:new).and_wrap_original { |new, *args, **opts| new.call(*args, **opts).tap { queues << _1 } }
+    attempts = 0
+    allow(DatabaseManager).to receive(:create_miss_index).and_wrap_original do |create, *args|
+      (attempts += 1) == 1 ? raise('miss index unreadable') : create.call(*args)
+    end
+    retried = described_class.new({ retried: route }, threads: 1, retry_after: 0.1,
+                                                      open: ->(name, r) { DatabaseManager.setup_route_database(r, name) },
+                                                      start: ->(*) {})
+    retried.run.wait(5)
+
+    expect(retried.ensure_open(:retried)).to be(false)
+    expect { queues.first.save_tile(1, 0, 0, 'tile') }.to raise_error(ClosedQueueError)
+    expect(dbs.first.pool.size).to eq(0)
+    expect(route).to eq(mbtiles_file: route[:mbtiles_file], metadata: { format: 'png' }, miss_index: { sweep_interval: 60 })
+
+    sleep 0.2
+    expect(retried.ensure_open(:retried)).to be(true)
+    expect([dbs.size, queues.size]).to eq([2, 2])
+    expect(route).to include(db: dbs.last, write_queue: queues.last, miss_index: be_a(MissIndex))
+  ensure
+    DatabaseManager.close_route_database(route, :retried)
+  end
+end
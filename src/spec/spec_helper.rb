@@ -19,17 +19,46 @@ require 'rspec-benchmark'
 require 'rack/test'
 require 'async/rspec'
 require 'rack/builder'
+require 'tmpdir'
 
 $app = Rack::Builder.parse_file(File.expand_path 'config.ru')
+Sinatra::Application.settings.route_startup.wait # Routes open in background threads
 
 module Rack::Test::JHelpers
   def app = $app
 end
 
+# MBTiles fixtures of the storage specs. Databases get the app's schema and are closed after
+# the example, with the directory of their files
+module TileDatabaseHelpers
+  # In memory, or at path when the code under test opens its own connections to the file
+  def tile_database(path = nil, **opts)
+    db = path ? Sequel.sqlite(path, **opts) : Sequel.sqlite(**opts)
+    DatabaseManager.send(:create_tables, db)
+    (@tile_databases ||= []) << db
+    db
+  end
+
+  # Path of a file in a temporary directory of the example
+  def tile_file(name = 'test.mbtiles') = File.join(@tile_dir ||= Dir.mktmpdir, name)
+
+  def insert_tile(db, z, x, y, data = "t#{z}/#{x}/#{y}", generated: nil)
+    row = { zoom_level: z, tile_column: x, tile_row: y, tile_data: Sequel.blob(data) }
+    row[:generated] = generated unless generated.nil?
+    db[:tiles].insert(row)
+  end
+
+  def close_tile_databases
+    @tile_databases&.each(&:disconnect)
+    FileUtils.remove_entry(@tile_dir) if @tile_dir
+  end
+end
+
 RSpec.configure do |config|
   config.include Rack::Test::Methods
   config.include Rack::Test::JHelpers
   config.include RSpec::Benchmark::Matchers
+  config.include TileDatabaseHelpers
   config.include_context Async::RSpec::Reactor
 
   config.before(:each) do
@@ -38,5 +67,6 @@ RSpec.configure do |config|
 
   config.after(:each) do
     ROUTES.each { |_, route| route[:client]&.close } if defined?(ROUTES)
+    close_tile_databases
   end
 end
@@ -0,0 +1,19 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+require 'open3'
+
+# The row kernels are C++ only (no Ruby entry point picks the scalar one), so their check runs
+# in the benchmark harness: vector and scalar kernels bit for bit, the specialized kernels
+# within one code unit of the legacy float path
+RSpec.describe 'terrain downsample kernels' do
+  let(:script) { File.expand_path('../ext/bench/run_downsample_kernels_bench.sh', __dir__) }
+
+  it 'agree with the scalar and legacy paths' do
+    skip 'g++ is not installed' unless system('command -v g++ > /dev/null 2>&1')
+
+    output, status = Open3.capture2e(script, 'check')
+    expect(status).to be_success, output
+    expect(output).to include('kernel check: ok')
+  end
+end
@@ -0,0 +1,79 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+
+RSpec.describe TerrainDownsampleFFI do
+  def create_terrain_png_mapbox(elevation, size = 256)
+    code = ((elevation + 10000) / 0.1).round
+    Vips::Image.black(size, size).add([code >> 16, (code >> 8) & 0xFF, code & 0xFF]).cast(:uchar).write_to_buffer('.png')
+  end
+
+  def quad(elevation) = Array.new(4) { |i| create_terrain_png_mapbox(elevation + 10 * i) }
+
+  describe 'calls without the GVL' do
+    it 'returns the same tiles when Ruby threads call it at once' do
+      quads = Array.new(8) { quad(50 * _1) }
+      expected = quads.map { described_class.downsample_quad(_1, 'mapbox', 'average', 'png') }
+
+      results = Array.new(4) do
+        Thread.new { quads.map { described_class.downsample_quad(_1, 'mapbox', 'average', 'png') } }
+      end.map(&:value)
+
+      expect(results).to all(eq(expected))
+    end
+
+    it 'raises the failures of the native job once the GVL is taken back' do
+      expect { described_class.downsample_png('not a png', 128, 'mapbox', 'average') }.to raise_error(RuntimeError, /Failed to read PNG/)
+      expect(described_class.downsample_quad(quad(100), 'mapbox', 'average', 'png')).to start_with("\x89PNG".b)
+    end
+  end
+
+  describe 'png: encoder option' do
+    def pixels(blob) = Vips::Image.new_from_buffer(blob, '').write_to_memory
+
+    it 'trades size for speed without changing the pixels' do
+      tiles = %w[fast default max].to_h { [_1, described_class.downsample_quad(quad(100), 'mapbox', 'average', 'png', png: _1)] }
+      stored = described_class.downsample_quad(quad(100), 'mapbox', 'average', 'png', png: { level: 0, filter: 'none' })
+
+      expect(tiles.values.map { pixels(_1) }.uniq).to eq([pixels(stored)])
+      expect(tiles['max'].bytesize).to be <= tiles['fast'].bytesize
+      expect(stored.bytesize).to be > tiles['fast'].bytesize
+    end
+
+    it 'rejects unknown presets, levels and filters' do
+      expect { described_class.downsample_quad(quad(100), 'mapbox', 'average', 'png', png: 'tiny') }.to raise_error(ArgumentError, /PNG preset/)
+      expect { described_class.downsample_quad(quad(100), 'mapbox', 'average', 'png', png: { level: 12 }) }.to raise_error(ArgumentError, /PNG level/)
+      expect { described_class.downsample_quad(quad(100), 'mapbox', 'average', 'png', png: { filter: 'x' }) }.to raise_error(ArgumentError, /PNG filter/)
+    end
+  end
+
+  describe 'per-thread scratch buffers' do
+    it 'leave no bytes of a larger tile in the next output' do
+      small = create_terrain_png_mapbox(10, 64)
+      fresh = Thread.new { described_class.downsample_png(small, 32, 'mapbox', 'average') }.value
+
+      described_class.downsample_png(create_terrain_png_mapbox(300, 512), 256, 'mapbox', 'average')
+      expect(described_class.downsample_png(small, 32, 'mapbox', 'average')).to eq(fresh)
+      expect(described_class.downsample_quad(quad(100), 'mapbox', 'average', 'png')).to eq(
+        Thread.new { described_class.downsample_quad(quad(100), 'mapbox', 'average', 'png') }.value
+      )
+    end
+  end
+
+  describe '.downsample_batch' do
+    it 'returns the tiles of downsample_quad in input order' do
+      quads = Array.new(6) { quad(50 * _1) }
+      expected = quads.map { described_class.downsample_quad(_1, 'mapbox', 'average', 'png') }
+
+      expect(described_class.downsample_batch(quads, 'mapbox', 'average', 'png', threads: 3)).to eq(expected)
+    end
+
+    it 'answers a failing item with its exception and keeps the others' do
+      results = described_class.downsample_batch([quad(100), quad(100).first(3), [nil] * 4], 'mapbox', 'average', 'png', threads: 2)
+
+      expect(results[0]).to eq(described_class.downsample_quad(quad(100), 'mapbox', 'average', 'png'))
+      expect(results[1]).to be_a(ArgumentError).and have_attributes(message: /Expected 4 children/)
+      expect(results[2]).to be_nil
+    end
+  end
+end
@@ -0,0 +1,36 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+require_relative '../tile_storage'
+
+RSpec.describe 'TileBlobFFI::Reader' do
+  let(:file) { tile_file('blob.mbtiles') }
+  let(:db) { tile_database(file) }
+  let(:reader) { TileBlobFFI::Reader.new(file, *TileStorage.blob_lookup(db)) }
+
+  before do
+    skip 'tile_blob extension or exported SQLite symbols not available' unless defined?(TileBlobFFI) && TileBlobFFI.available?
+
+    insert_tile(db, 3, 1, 2, "\x89PNG#{'x' * 4_000}".b, generated: 2)
+    insert_tile(db, 3, 2, 2, 'small')
+  end
+
+  after { reader.close if defined?(TileBlobFFI) && TileBlobFFI.available? }
+
+  it 'reads a stored tile and its generated value' do
+    data, generated = reader.read(3, 1, 2)
+
+    expect(data).to eq("\x89PNG#{'x' * 4_000}".b)
+    expect(generated).to eq(2)
+    expect(reader.read(3, 9, 9)).to be_nil
+  end
+
+  it 'returns a separate String per read for the cache and response to keep' do
+    first, = reader.read(3, 1, 2)
+    second, = reader.read(3, 2, 2)
+
+    expect(second).to eq('small')
+    expect(first).to eq("\x89PNG#{'x' * 4_000}".b)
+    expect(first).not_to be_frozen
+  end
+end
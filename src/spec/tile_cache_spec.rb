@@ -0,0 +1,63 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+require_relative '../tile_cache'
+
+RSpec.describe TileCache do
+  let(:cache) { described_class.new(max_bytes: described_class::SHARDS * 1_000) }
+
+  def row(data, generated = 0) = { tile_data: data, generated: generated }
+
+  # Coordinates of zoom 5 tiles that land in the same shard as (5, 0, 0)
+  def same_shard_keys(count)
+    home = cache.send(:shard_for, cache.send(:pack, 5, 0, 0))
+    (0..4_000).lazy.map { |x| [5, x, 0] }.select { |key| cache.send(:shard_for, cache.send(:pack, *key)).equal?(home) }.first(count)
+  end
+
+  it 'reads the database once per tile' do
+    reads = 0
+    2.times { cache.fetch(3, 1, 2) { reads += 1; row('tile') } }
+
+    expect(reads).to eq(1)
+    expect(cache.fetch(3, 1, 2) { row('other') }).to eq(row('tile'))
+    expect(cache.stats).to include(hits: 2, misses: 1, entries: 1)
+  end
+
+  it 'does not cache tiles that are not stored' do
+    expect(cache.fetch(3, 0, 0) { nil }).to be_nil
+    expect(cache.fetch(3, 0, 0) { row('late') }).to eq(row('late'))
+  end
+
+  it 'evicts least recently used tiles to stay within its byte budget' do
+    first, second, *rest = same_shard_keys(4)
+    cache.fetch(*first) { row('a' * 300) }
+    cache.fetch(*second) { row('b' * 300) }
+    cache.fetch(*first) { raise 'cached' }
+    rest.each { |key| cache.fetch(*key) { row('c' * 300) } }
+
+    expect(cache.stats[:evictions]).to eq(2)
+    expect(cache.fetch(*second) { row('reloaded') }).to eq(row('reloaded'))
+  end
+
+  it 'drops invalidated tiles and fills that raced with a write' do
+    cache.fetch(4, 1, 1) { row('old') }
+    cache.invalidate(4, 1, 1)
+    cache.fetch(4, 1, 1) do
+      cache.invalidate(4, 1, 1)
+      row('stale')
+    end
+
+    expect(cache.fetch(4, 1, 1) { row('new', 2) }).to eq(row('new', 2))
+    expect(cache.stats[:invalidations]).to eq(2)
+  end
+
+  it 'reads a tile again once its ttl has passed' do
+    expiring = described_class.new(max_bytes: described_class::SHARDS * 1_000, ttl: 0.05)
+    expiring.fetch(3, 1, 1) { row('first') }
+    expect(expiring.fetch(3, 1, 1) { row('early') }).to eq(row('first'))
+
+    sleep 0.1
+    expect(expiring.fetch(3, 1, 1) { row('written elsewhere') }).to eq(row('written elsewhere'))
+    expect(expiring.stats).to include(entries: 1, bytes: 'written elsewhere'.bytesize + described_class::ENTRY_OVERHEAD)
+  end
+end
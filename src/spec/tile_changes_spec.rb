@@ -0,0 +1,50 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+require_relative '../tile_changes'
+
+RSpec.describe TileChanges do
+  let(:db) { tile_database }
+
+  before { described_class.install(db) }
+
+  def upsert_tile(x, generated: 0)
+    TileStorage.upsert(db, generated: true)
+               .insert(zoom_level: 5, tile_column: x, tile_row: 1, tile_data: Sequel.blob("t#{x}"), generated: generated)
+  end
+
+  def journal = db[:tile_changes].order(:seq).select_map(%i[zoom_level tile_column tile_row propagated])
+
+  it 'journals source writes and regeneration marks but not generated tiles' do
+    upsert_tile(1)
+    upsert_tile(2, generated: 4)
+    upsert_tile(3)
+    upsert_tile(1)
+    db[:tiles].where(tile_column: 2).update(generated: -5)
+
+    expect(journal).to eq([[5, 3, 1, 0], [5, 1, 1, 0], [5, 2, 1, 0]])
+    expect(described_class.at_zoom(db, 5).select_order_map(:tile_column)).to eq([1, 2, 3])
+  end
+
+  it 'consumes processed and propagated rows and keeps later writes and marked tiles' do
+    upsert_tile(1)
+    upsert_tile(2, generated: -5)
+    head = described_class.head(db)
+    described_class.propagate(db, 4, [[0, 0], [1, 0]])
+    upsert_tile(3)
+
+    described_class.consume(db, head)
+    expect(journal).to eq([[5, 2, 1, 0], [5, 3, 1, 0]])
+  end
+
+  it 'starts a new journal with the tiles changed since the last reconstruction' do
+    fresh = tile_database
+    fresh[:metadata].insert(name: 'reconstruction_last_run', value: '2020-01-01T00:00:00Z')
+    fresh[:tiles].insert(zoom_level: 3, tile_column: 0, tile_row: 0, tile_data: Sequel.blob('a'), generated: 1,
+                         updated_at: '2019-12-31 00:00:00')
+    insert_tile(fresh, 3, 1, 0, 'b', generated: 1)
+
+    described_class.install(fresh)
+    expect(fresh[:tile_changes].select_map(:tile_column)).to eq([1])
+  end
+end
@@ -0,0 +1,60 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+require_relative '../tile_locks'
+
+RSpec.describe TileLocks do
+  # Two instances with their own owners stand for two worker processes on one file
+  let(:db) { tile_database(tile_file('locks.mbtiles')) }
+
+  def locks(owner) = described_class.new(db, 'test_source', owner: owner, poll_ms: 5)
+
+  def store_tile = insert_tile(db, 4, 1, 2)
+
+  it 'makes another process wait for the tile instead of fetching it' do
+    winner, loser = locks('worker-1'), locks('worker-2')
+    entered = Queue.new
+    fetch = Thread.new do
+      winner.synchronize(4, 1, 2) do |waited|
+        entered << waited
+        sleep 0.2
+        store_tile
+      end
+    end
+
+    expect(entered.pop).to be(false)
+    seen = loser.synchronize(4, 1, 2) { |waited| [waited, db[:tiles].count] }
+    fetch.join
+
+    expect(seen).to eq([true, 1])
+    expect(loser.stats).to include(waits: 1, leases: 1)
+    expect(db[:tile_locks].count).to eq(0)
+  end
+
+  it 'serializes requests of one process without waiting on its own lease' do
+    same = locks('worker-1')
+    order = Queue.new
+    threads = 3.times.map { |i| Thread.new { same.synchronize(4, 1, 2) { |waited| order << [i, waited]; sleep 0.02 } } }
+    threads.each(&:join)
+
+    expect(Array.new(3) { order.pop }.map(&:last)).to all(be(false))
+    expect(same.stats).to include(leases: 3, waits: 0, local: 0)
+  end
+
+  it 'takes over the lease of a process that died' do
+    survivor = locks('worker-2')
+    db[:tile_locks].insert(zoom_level: 4, tile_column: 1, tile_row: 2, owner: 'worker-1', token: 'dead', expires_at: Time.now.to_i - 1)
+
+    expect(survivor.synchronize(4, 1, 2) { |waited| waited }).to be(false)
+    expect(survivor.stats[:steals]).to eq(1)
+  end
+
+  it 'fetches itself once another process has held the lease past the wait timeout' do
+    impatient = described_class.new(db, 'test_source', owner: 'worker-2', poll_ms: 5, wait_timeout: 0.05)
+    db[:tile_locks].insert(zoom_level: 4, tile_column: 1, tile_row: 2, owner: 'worker-1', token: 'slow', expires_at: Time.now.to_i + 60)
+
+    expect(impatient.synchronize(4, 1, 2) { |waited| waited }).to be(true)
+    expect(impatient.stats).to include(waits: 1, timeouts: 1, leases: 0)
+    expect(db[:tile_locks].select_map(:token)).to eq(['slow'])
+  end
+end
@@ -173,6 +173,33 @@ RSpec.describe TileReconstructor do
       expect(decode_mapbox_elevation(*pixel_at(result, 192, 192).map(&:to_i))).to be_within(0.2).of(100)
     end
 
+    it 'fills missing children with zero elevation' do
+      children = [create_terrain_png_mapbox(100), nil, nil, nil]
+
+      result = reconstructor.send(:downsample_terrain_tiles, children, encoding: 'mapbox', format: 'png')
+
+      # children[0] is the south-west quadrant
+      expect(decode_mapbox_elevation(*pixel_at(result, 64, 192).map(&:to_i))).to be_within(0.2).of(100)
+      expect(decode_mapbox_elevation(*pixel_at(result, 64, 64).map(&:to_i))).to be_within(0.2).of(0)
+    end
+
+    it 'takes the tile size from the next child when the first one is corrupt' do
+      # A PNG signature with a truncated header, so it reaches the native probe
+      children = [create_terrain_png_mapbox(100).byteslice(0, 20), create_terrain_png_mapbox(100), nil, nil]
+
+      result = reconstructor.send(:downsample_terrain_tiles, children, encoding: 'mapbox', format: 'png')
+
+      img = Vips::Image.new_from_buffer(result, '')
+      expect([img.width, img.height]).to eq([256, 256])
+      # children[1] is the south-east quadrant; the corrupt south-west one reads as 0 m
+      expect(decode_mapbox_elevation(*pixel_at(result, 192, 192).map(&:to_i))).to be_within(0.2).of(100)
+      expect(decode_mapbox_elevation(*pixel_at(result, 64, 192).map(&:to_i))).to be_within(0.2).of(0)
+    end
+
+    it 'returns nil when all children are missing' do
+      expect(reconstructor.send(:downsample_terrain_tiles, [nil, nil, nil, nil], format: 'png')).to be_nil
+    end
+
     it 'returns WebP format when specified' do
       children = Array.new(4) { create_terrain_png_mapbox(100) }
       result = reconstructor.send(:downsample_terrain_tiles, children, format: 'webp', effort: 4)
@@ -612,4 +639,40 @@ RSpec.describe TileReconstructor do
       expect(result).to eq([nil, nil, nil, nil])
     end
   end
+
+  describe 'pyramid traversals' do
+    # 16 terrain tiles at zoom 3 under one zoom 1 tile; a full run builds zooms 2 and 1
+    def build_pyramid(**gap_filling)
+      db = tile_database(tile_file("#{gap_filling.values.join('_')}.mbtiles"))
+      (0..3).to_a.product((0..3).to_a).each { |x, y| insert_tile(db, 3, x, y, create_terrain_png_mapbox(10 * (x + 4 * y))) }
+      route = { db: db, minzoom: 1, maxzoom: 4, metadata: { encoding: 'mapbox' },
+                gap_filling: { terrain_method: 'average', output_format: { type: 'png' }, batch_size: 4, **gap_filling } }
+
+      inst = described_class.new(route, 'test_source')
+      inst.start_reconstruction(:full)
+      sleep 0.01 while inst.running?
+      db[:tiles].where(zoom_level: [1, 2]).order(:zoom_level, :tile_column, :tile_row).select_map(%i[zoom_level tile_column tile_row tile_data])
+    end
+
+    it 'builds the same tiles depth-first, from resident children, as breadth-first' do
+      breadth_first = build_pyramid(traversal: 'breadth_first')
+
+      expect(breadth_first.map { _1.first(3) }).to eq([[1, 0, 0], [2, 0, 0], [2, 0, 1], [2, 1, 0], [2, 1, 1]])
+      expect(build_pyramid(traversal: 'depth_first')).to eq(breadth_first)
+    end
+
+    it 'builds the same tiles on parallel workers over disjoint subtrees' do
+      expect(build_pyramid(traversal: 'breadth_first', workers: 2)).to eq(build_pyramid(traversal: 'breadth_first'))
+      expect(build_pyramid(traversal: 'depth_first', workers: 2)).to eq(build_pyramid(traversal: 'depth_first'))
+    end
+
+    it 'hands generated parents to the next quad as decoded pixels' do
+      quads = Array.new(4) { |i| Array.new(4) { |j| create_terrain_png_mapbox(100 * i + 10 * j) } }
+      kept = quads.map { TerrainDownsampleFFI.downsample_quad(_1, 'mapbox', 'average', 'png', keep_pixels: true) }
+
+      expect(kept.map(&:data)).to eq(quads.map { TerrainDownsampleFFI.downsample_quad(_1, 'mapbox', 'average', 'png') })
+      expect(TerrainDownsampleFFI.downsample_quad(kept, 'mapbox', 'average', 'png'))
+        .to eq(TerrainDownsampleFFI.downsample_quad(kept.map(&:data), 'mapbox', 'average', 'png'))
+    end
+  end
 end
@@ -0,0 +1,80 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+require_relative '../tile_shards'
+
+RSpec.describe TileShards do
+  let(:route) { { mbtiles_file: tile_file, shards: { zooms: [3, 5] } } }
+
+  def open_db(file) = tile_database(file).tap { TileStats.install(_1) }
+
+  def open_shards
+    route[:tile_shards] = described_class.open(route, 'test') { |file, _| open_db(file) }
+  end
+
+  before do
+    route[:db] = open_db(route[:mbtiles_file])
+    route[:db][:metadata].insert(name: 'format', value: 'png')
+  end
+
+  it 'moves the stored zooms into the files of their bands' do
+    (1..6).each { insert_tile(route[:db], _1, 0, 0) }
+    route[:db][:misses].insert(zoom_level: 4, tile_column: 0, tile_row: 0, ts: 1, status: 404)
+    shards = open_shards
+
+    expect(shards.map(&:file).map { File.basename(_1) }).to eq(%w[test.mbtiles test.z3.mbtiles test.z5.mbtiles])
+    expect(shards.map { _1.db[:tiles].select_order_map(:zoom_level) }).to eq([[1, 2], [3, 4], [5, 6]])
+    expect(described_class.db(route, 4)[:misses].count).to eq(1)
+    expect(route[:db][:misses].count).to eq(0)
+    expect(shards[1].db[:metadata].to_hash(:name, :value)).to include('format' => 'png', 'minzoom' => '3', 'maxzoom' => '4')
+  end
+
+  it 'routes zoom-keyed calls to the component of the zoom and the others to all' do
+    open_shards
+    components = Array.new(3) { double(flush: nil) }
+    router = described_class.combine(route, components, TileShards::WriteQueue)
+
+    expect(components[2]).to receive(:save_tile).with(7, 1, 2, 'data', generated: 3)
+    router.save_tile(7, 1, 2, 'data', generated: 3)
+    router.flush
+    expect(components).to all(have_received(:flush))
+    expect(described_class.combine(route, [components[0], nil, components[2]], TileShards::WriteQueue)).to be_nil
+  end
+
+  it 'has no file and no component for a zoom outside every band' do
+    open_shards
+    router = described_class.combine(route, Array.new(3) { double(read_tile: :stored) }, TileShards::WriteQueue)
+
+    expect(described_class.db(route, TileShards::MAX_ZOOM + 1)).to be_nil
+    expect(described_class.db(route, -1)).to be_nil
+    expect(router.read_tile(TileShards::MAX_ZOOM + 1, 0, 0)).to be_nil
+    expect(router.read_tile(4, 0, 0)).to eq(:stored)
+  end
+
+  it 'moves the pending change journal with the tiles' do
+    TileChanges.install(route[:db])
+    insert_tile(route[:db], 4, 1, 0)
+    TileChanges.propagate(route[:db], 4, [[2, 0]])
+    shards = described_class.open(route, 'test') { |file, _| open_db(file).tap { TileChanges.install(_1) } }
+
+    expect(route[:db][:tile_changes].count).to eq(0)
+    expect(shards[1].db[:tile_changes].select_order_map(%i[tile_column propagated])).to eq([[1, 0], [2, 1]])
+  end
+
+  it 'exports the shards as one MBTiles' do
+    open_shards
+    [1, 3, 6].each { insert_tile(described_class.db(route, _1), _1, 0, 0) }
+    path = tile_file('export.mbtiles')
+
+    expect(described_class.export(route, path)).to eq(3)
+    Sequel.sqlite(path) do |db|
+      expect(db[:tiles].select_order_map(:zoom_level)).to eq([1, 3, 6])
+      expect(db[:metadata].where(name: 'format').get(:value)).to eq('png')
+    end
+  end
+
+  it 'rejects bands out of order' do
+    expect { described_class.bands(route.merge(shards: { zooms: [5, 3] }), 'test') }.to raise_error(ArgumentError, /shards.zooms/)
+    expect(described_class.bands(route.merge(shards: nil), 'test')).to be_nil
+  end
+end
@@ -0,0 +1,50 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+require_relative '../tile_stats'
+
+RSpec.describe TileStats do
+  let(:db) { tile_database }
+
+  before { described_class.install(db) }
+
+  def insert_sized(x, zoom: 5, generated: 0, size: 10) = insert_tile(db, zoom, x, 1, 't' * size, generated: generated)
+
+  def tiles_at(x) = db[:tiles].where(zoom_level: 5, tile_column: x, tile_row: 1)
+
+  it 'counts inserted tiles and misses per zoom and class' do
+    insert_sized(1, size: 10)
+    insert_sized(2, generated: 1, size: 20)
+    insert_sized(3, zoom: 6, generated: -5, size: 5)
+    db[:misses].insert(zoom_level: 5, tile_column: 9, tile_row: 1, ts: Time.now.to_i)
+
+    expect(described_class.by_zoom(db, 0, 22)).to eq(
+      5 => { cached: 1, generated: 1, marked: 0, bytes: 30, misses: 1 },
+      6 => { cached: 0, generated: 0, marked: 1, bytes: 5, misses: 0 }
+    )
+  end
+
+  it 'moves updated tiles between classes and forgets deleted ones' do
+    insert_sized(1, generated: -5, size: 10)
+    tiles_at(1).update(generated: 1, tile_data: Sequel.blob('t' * 4))
+    insert_sized(2)
+    tiles_at(2).delete
+
+    expect(described_class.by_zoom(db, 5, 5)).to eq(5 => { cached: 0, generated: 1, marked: 0, bytes: 4, misses: 0 })
+  end
+
+  it 'fills the counters of an existing file and rebuilds them on repair' do
+    fresh = tile_database
+    insert_tile(fresh, 3, 0, 0, 'abc')
+    described_class.install(fresh)
+    expect(described_class.by_zoom(fresh, 3, 3)).to eq(3 => { cached: 1, generated: 0, marked: 0, bytes: 3, misses: 0 })
+
+    insert_sized(1)
+    db[:tile_stats].update(tile_count: 42)
+    db[:miss_stats].insert(zoom_level: 7, miss_count: 3)
+
+    expect(described_class.rebuild(db)).to eq(2)
+    expect(described_class.by_zoom(db, 0, 22)).to eq(5 => { cached: 1, generated: 0, marked: 0, bytes: 10, misses: 0 })
+    expect(described_class.miss_total(db)).to eq(0)
+  end
+end
@@ -0,0 +1,74 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+require_relative '../tile_storage'
+
+RSpec.describe TileStorage do
+  let(:db) { tile_database(tile_storage: 'dedup', after_connect: described_class.method(:register_functions)) }
+
+  def store(x, data, generated: nil) = insert_tile(db, 5, x, 1, data, generated: generated)
+
+  def tile(x) = db[:tiles].where(zoom_level: 5, tile_column: x, tile_row: 1).select(:tile_data, :generated).first
+
+  context 'with a converted file' do
+    before { described_class.configure(db, 'test') }
+
+    it 'stores byte-identical tiles once behind the tiles view' do
+      store(1, 'ocean')
+      store(2, 'ocean', generated: 2)
+      store(3, 'land')
+
+      expect(tile(2)).to eq(tile_data: 'ocean', generated: 2)
+      expect(db[:map].count).to eq(3)
+      expect(db[:images].select_order_map(:tile_data)).to eq(%w[land ocean])
+    end
+
+    it 'upserts through the insert trigger and keeps generated unless it is given' do
+      store(1, 'first', generated: 3)
+      store(1, 'second')
+
+      expect(tile(1)).to eq(tile_data: 'second', generated: 3)
+      expect(db[:map].count).to eq(1)
+    end
+
+    it 'rewrites the image of a tile through the update trigger' do
+      store(1, 'old')
+      db[:tiles].where(zoom_level: 5, tile_column: 1, tile_row: 1).update(tile_data: Sequel.blob('new'), generated: -5)
+
+      expect(tile(1)).to eq(tile_data: 'new', generated: -5)
+      expect(db[:images].select_map(:tile_data)).to eq(['new'])
+    end
+
+    it 'releases an image once no tile references it' do
+      store(1, 'shared')
+      store(2, 'shared')
+      db[:tiles].where(tile_column: 1).delete
+      expect(db[:images].select_map(:tile_data)).to eq(['shared'])
+
+      store(2, 'replaced')
+      expect(db[:images].select_map(:tile_data)).to eq(['replaced'])
+
+      db[:tiles].where(tile_column: 2).delete
+      expect(db[:images].count).to eq(0)
+    end
+  end
+
+  it 'converts a plain file in place once' do
+    store(1, 'ocean', generated: 1)
+    store(2, 'ocean', generated: 0)
+    2.times { described_class.configure(db, 'test') }
+
+    expect(described_class.view?(db)).to be(true)
+    expect(tile(1)).to eq(tile_data: 'ocean', generated: 1)
+    expect(db[:map].count).to eq(2)
+    expect(db[:images].count).to eq(1)
+  end
+
+  it 'keeps a plain file plain for routes without the dedup layout' do
+    plain = tile_database(tile_storage: 'tiles')
+    described_class.configure(plain, 'test')
+
+    expect(described_class.view?(plain)).to be(false)
+    expect(described_class.dedup?(plain)).to be(false)
+  end
+end
@@ -0,0 +1,55 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+require_relative '../tile_variants'
+
+RSpec.describe TileVariants do
+  let(:route) do
+    { metadata: { encoding: 'mapbox' }, tile_size: 256, content_type: 'image/png',
+      variants: [{ path: '/terrarium/:z/:x/:y', encoding: 'terrarium' }, { path: '/terrain512/:z/:x/:y', tile_size: 512 }] }
+  end
+  let(:variants) { described_class.for_route(route, 'test') }
+
+  def create_terrain_png_mapbox(elevation, size = 256)
+    code = ((elevation + 10000) / 0.1).round
+    Vips::Image.black(size, size).add([code >> 16, (code >> 8) & 0xFF, code & 0xFF]).cast(:uchar).write_to_buffer('.png')
+  end
+
+  def pixel_at(blob, x, y) = Vips::Image.new_from_buffer(blob, '').getpoint(x, y).map(&:to_i)
+
+  it 'converts the stored encoding and caches the output' do
+    stored = create_terrain_png_mapbox(100)
+    reads = 0
+    read = ->(*) { reads += 1; stored }
+
+    tile = variants.tile(variants.variants[0], 3, 4, 5, &read)
+    expect(variants.tile(variants.variants[0], 3, 4, 5, &read)).to eq(tile)
+    expect(reads).to eq(1)
+
+    r, g, b = pixel_at(tile, 0, 0)
+    expect(r * 256 + g + b / 256.0 - 32768).to eq(100)
+  end
+
+  it 'assembles 512px tiles from the children and drops them when a child changes' do
+    children = { [4, 8, 10] => 0, [4, 9, 10] => 100, [4, 8, 11] => 200 }.transform_values { create_terrain_png_mapbox(_1) }
+    reads = []
+    read = ->(z, x, tms) { reads << [z, x, tms]; children[[z, x, tms]] }
+
+    tile = variants.tile(variants.variants[1], 3, 4, 5, &read)
+    image = Vips::Image.new_from_buffer(tile, '')
+    expect([image.width, image.height]).to eq([512, 512])
+    expect(pixel_at(tile, 0, 0)).to eq(pixel_at(children[[4, 8, 11]], 0, 0)) # TMS row 11 is the northern half
+    expect(pixel_at(tile, 256, 256)).to eq(pixel_at(children[[4, 9, 10]], 0, 0))
+    expect(pixel_at(tile, 256, 0)).to eq(pixel_at(create_terrain_png_mapbox(0), 0, 0)) # Missing child: 0 m
+
+    variants.invalidate(4, 9, 11)
+    variants.tile(variants.variants[1], 3, 4, 5, &read)
+    expect(reads.size).to eq(8)
+  end
+
+  it 'needs a terrain source and a tile size it can build' do
+    expect { described_class.for_route(route.merge(metadata: {}), 'test') }.to raise_error(ArgumentError, /metadata.encoding/)
+    expect { described_class.for_route(route.merge(variants: [{ path: '/x', tile_size: 1024 }]), 'test') }
+      .to raise_error(ArgumentError, /tile_size/)
+  end
+end
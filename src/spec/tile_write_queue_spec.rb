@@ -0,0 +1,110 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+require_relative '../tile_write_queue'
+
+RSpec.describe TileWriteQueue do
+  # A file database: the writer thread commits through its own connection
+  let(:db) { tile_database(tile_file('queue.mbtiles')) }
+  let(:queue) { described_class.new(db, 'test_source', flush_interval_ms: 10_000) }
+
+  after { queue.close }
+
+  def stored_tile(z, x, y)
+    db[:tiles].where(zoom_level: z, tile_column: x, tile_row: y).select(:tile_data, :generated).first
+  end
+
+  it 'serves a pending tile before it is committed' do
+    queue.save_tile(3, 1, 2, 'tile-data')
+
+    expect(stored_tile(3, 1, 2)).to be_nil
+    expect(queue.read_tile(3, 1, 2) { :database }).to eq(tile_data: 'tile-data', generated: 0)
+    expect(queue.read_tile(3, 1, 3) { :database }).to eq(:database)
+  end
+
+  it 'commits coalesced rows on flush' do
+    queue.save_tile(3, 1, 2, 'first')
+    queue.save_tile(3, 1, 2, 'second', generated: 2)
+    queue.save_tile(3, 0, 0, 'other')
+    queue.flush
+
+    expect(queue.pending_rows).to eq(0)
+    expect(stored_tile(3, 1, 2)).to eq(tile_data: 'second', generated: 2)
+    expect(db[:tiles].count).to eq(2)
+  end
+
+  it 'applies marks and deletes in queue order' do
+    queue.save_tile(4, 0, 0, 'marked', generated: 3)
+    queue.mark_for_regeneration(4, 0, 0)
+    queue.save_tile(4, 1, 0, 'deleted')
+    queue.delete_tile(4, 1, 0)
+
+    expect(queue.read_tile(4, 0, 0) { nil }[:generated]).to eq(-5)
+    expect(queue.read_tile(4, 1, 0) { :database }).to be_nil
+
+    queue.flush
+    expect(stored_tile(4, 0, 0)[:generated]).to eq(-5)
+    expect(stored_tile(4, 1, 0)).to be_nil
+  end
+
+  it 'replaces misses and serves them while pending' do
+    queue.record_miss(5, 1, 1, ts: 1, reason: 'http_404', details: 'old', status: 404, response_body: nil)
+    queue.flush
+    queue.record_miss(5, 1, 1, ts: 2, reason: 'transparent', details: 'Tile is transparent', status: 200, response_body: nil)
+
+    expect(queue.read_miss(5, 1, 1) { nil }).to include(reason: 'transparent', status: 200)
+
+    queue.flush
+    expect(db[:misses].where(zoom_level: 5).select_map(:reason)).to eq(['transparent'])
+  end
+
+  it 'commits a lone row once it is due' do
+    eager = described_class.new(db, 'eager_source', flush_interval_ms: 20)
+    eager.save_tile(3, 2, 2, 'alone')
+    sleep 0.5
+
+    expect(stored_tile(3, 2, 2)[:tile_data]).to eq('alone')
+  ensure
+    eager.close
+  end
+
+  it 'releases a tile lease in the commit of its tile' do
+    db[:tile_locks].insert(zoom_level: 6, tile_column: 1, tile_row: 1, owner: 'test', token: 'lease', expires_at: Time.now.to_i + 60)
+    queue.save_tile(6, 1, 1, 'leased')
+    queue.release_lease(6, 1, 1, 'lease')
+
+    expect(db[:tile_locks].count).to eq(1)
+    queue.flush
+    expect(db[:tile_locks].count).to eq(0)
+    expect(stored_tile(6, 1, 1)[:tile_data]).to eq('leased')
+  end
+
+  it 'replaces a writer thread that died' do
+    writer = queue.instance_variable_get(:@thread)
+    writer.kill
+    writer.join
+
+    queue.save_tile(2, 2, 2, 'after death')
+    queue.flush
+
+    expect(queue.instance_variable_get(:@thread)).to be_alive
+    expect(stored_tile(2, 2, 2)[:tile_data]).to eq('after death')
+  end
+
+  it 'records the store stage only for batches that committed' do
+    allow(TileStageMetrics).to receive(:record_stage)
+    db.drop_table(:misses)
+    queue.record_miss(5, 0, 0, ts: 1, reason: 'http_404', details: '', status: 404, response_body: nil)
+    queue.flush
+
+    expect(TileStageMetrics).not_to have_received(:record_stage)
+  end
+
+  it 'commits pending rows on close' do
+    queue.save_tile(2, 1, 1, 'closing')
+    queue.close
+
+    expect(stored_tile(2, 1, 1)[:tile_data]).to eq('closing')
+    expect { queue.save_tile(2, 0, 0, 'late') }.to raise_error(ClosedQueueError)
+  end
+end
@@ -0,0 +1,59 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+require_relative '../vips_tile_validator'
+
+RSpec.describe VipsTileValidator do
+  let(:rgb) { Vips::Image.black(256, 256).add([10, 20, 30]).cast(:uchar) }
+
+  def with_alpha(alpha) = rgb.bandjoin(alpha.cast(:uchar)).write_to_buffer('.png')
+
+  let(:tiles) do
+    {
+      opaque: rgb.write_to_buffer('.png'),
+      transparent: with_alpha(Vips::Image.black(256, 256)),
+      partial: with_alpha(Vips::Image.xyz(256, 256)[0] > 127),
+      opaque_alpha: with_alpha(Vips::Image.black(256, 256).add(255))
+    }
+  end
+
+  it 'classifies PNG tiles natively as the Vips fallback does' do
+    skip 'tile_validator extension not available' unless defined?(TileValidatorFFI)
+
+    [true, false].each do |check_transparency|
+      tiles.each do |name, tile|
+        expect(TileValidatorFFI.validate(tile, check_transparency))
+          .to eq(described_class.validate_with_vips(tile, check_transparency: check_transparency)), "#{name}, #{check_transparency}"
+      end
+    end
+    expect(tiles.transform_values { described_class.validate(_1, check_transparency: true) }).to eq(
+      opaque: :valid, transparent: :transparent, partial: :partial_transparent, opaque_alpha: :valid
+    )
+  end
+
+  it 'reports a PNG cut off in its header as corrupted' do
+    skip 'tile_validator extension not available' unless defined?(TileValidatorFFI)
+
+    expect(described_class.validate(rgb.write_to_buffer('.png').byteslice(0, 40), check_transparency: false)).to eq(:corrupted)
+  end
+
+  it 'finds image data cut off inside IDAT when it decodes the rows for transparency' do
+    skip 'tile_validator extension not available' unless defined?(TileValidatorFFI)
+
+    tile = tiles[:partial]
+    idat = tile.index('IDAT')
+    truncated = tile.byteslice(0, idat + 4 + tile.byteslice(idat - 4, 4).unpack1('N') / 2)
+
+    expect(TileValidatorFFI.validate(truncated, false)).to eq(:valid) # Header-only read
+    expect(TileValidatorFFI.validate(truncated, true)).to eq(:corrupted)
+    expect(described_class.validate(truncated, check_transparency: true)).to eq(:corrupted)
+  end
+
+  it 'leaves formats it does not read to Vips' do
+    skip 'tile_validator extension not available' unless defined?(TileValidatorFFI)
+
+    jpeg = rgb.write_to_buffer('.jpg')
+    expect(TileValidatorFFI.validate(jpeg, true)).to be_nil
+    expect(described_class.validate(jpeg, check_transparency: true)).to eq(:valid)
+  end
+end
@@ -5,6 +5,9 @@ require 'time'
 require 'rbconfig'
 require_relative 'view_helpers'
 require_relative 'observability_setup'
+require_relative 'tile_stats'
+require_relative 'tile_shards'
+require_relative 'coverage_index'
 
 module StatsJobEntry
   module_function
@@ -15,7 +18,11 @@ module StatsJobEntry
 
     config_folder = ENV.fetch('STATS_CONFIG_FOLDER')
     routes = Dir["#{config_folder}/*.{yaml,yml}"].map { YAML.load_file(_1, symbolize_names: true) }.reduce({}, :merge)
-    result = StatsAggregator.new(routes:).call
+    result = if ENV['STATS_JOB_REPAIR'] == '1'
+               StatsAggregator.new(routes:, sqlite_options: StatsAggregator::REPAIR_SQLITE_OPTIONS, repair: true).call
+             else
+               StatsAggregator.new(routes:).call
+             end
 
     Marshal.dump({ ok: true, result: }, STDOUT)
     STDOUT.flush
@@ -26,6 +33,9 @@ module StatsJobEntry
   end
 end
 
+# Per-route statistics. Files with TileStats counters are read in O(zooms); others (not yet
+# opened by the service) fall back to scanning tiles and misses. repair: true recounts the
+# counters from the tables first (TileStats.rebuild), the explicit full rescan.
 class StatsAggregator
   include ViewHelpers
 
@@ -34,11 +44,21 @@ class StatsAggregator
     max_connections: 1,
     timeout: 10_000
   }.freeze
+  REPAIR_SQLITE_OPTIONS = DEFAULT_SQLITE_OPTIONS.merge(readonly: false).freeze
 
-  def initialize(routes:, sqlite_options: DEFAULT_SQLITE_OPTIONS, db_connector: nil)
+  def initialize(routes:, sqlite_options: DEFAULT_SQLITE_OPTIONS, db_connector: nil, repair: false)
     @routes = routes
     @sqlite_options = sqlite_options
     @db_connector = db_connector || method(:connect_sqlite)
+    @repair = repair
+  end
+
+  # In-process form over the routes' open databases (the service's /api/stats)
+  def self.from_open_databases(routes)
+    paths = Object.new.extend(ViewHelpers)
+    databases = routes.values.flat_map { |route| route[:tile_shards]&.map { [_1.file, _1.db] } || [[route[:mbtiles_file], route[:db]]] }
+                          .to_h { |file, db| [paths.resolve_mbtiles_path(file), db] }
+    new(routes:, db_connector: ->(db_path, **, &block) { block.call(databases.fetch(db_path)) })
   end
 
   def call
@@ -60,27 +80,22 @@ class StatsAggregator
     db_path = resolve_mbtiles_path(route[:mbtiles_file])
     raise ArgumentError, "MBTiles path is not configured for #{source_name}" if db_path.nil? || db_path.empty?
 
-    @db_connector.call(db_path, **@sqlite_options) do |db|
-      collect_source_stats(route:, source_name:, db:)
+    shard_paths = TileShards.bands(route, source_name)&.map { |_, file| resolve_mbtiles_path(file) }&.select { File.exist?(_1) }
+    with_databases([db_path, *shard_paths]) do |db, *shard_dbs|
+      collect_source_stats(route:, source_name:, db:, shard_dbs:)
     end
   end
 
-  def collect_source_stats(route:, source_name:, db:)
+  # shard_dbs: the zoom-band files of a sharded route (TileShards), counted with db
+  def collect_source_stats(route:, source_name:, db:, shard_dbs: [])
     min_zoom = route[:minzoom] || 1
     max_zoom = route[:maxzoom] || 20
 
-    cached_expr = Sequel.function(:sum, Sequel.case([[{ generated: 0 }, 1], [{ generated: nil }, 1]], 0))
-    generated_expr = Sequel.function(:sum, Sequel.case([[Sequel[:generated] > 0, 1]], 0))
-
-    tiles_by_zoom = if db.table_exists?(:tiles)
-                      db[:tiles]
-                        .select(:zoom_level, Sequel.as(cached_expr, :cached), Sequel.as(generated_expr, :generated))
-                        .where(zoom_level: min_zoom..max_zoom)
-                        .group(:zoom_level)
-                        .to_hash(:zoom_level)
-                    else
-                      {}
-                    end
+    # Each zoom is stored in one of the files, so the per-zoom rows merge without summing
+    tiles_by_zoom, errors_by_zoom, misses_count = [db, *shard_dbs].map { zoom_stats(_1, min_zoom, max_zoom) }
+                                                                  .reduce do |(tiles, errors, misses), (more_tiles, more_errors, more_misses)|
+      [tiles.merge(more_tiles), errors.merge(more_errors), misses + more_misses]
+    end
 
     autoscan_statuses = if db.table_exists?(:tile_scan_progress)
                           db[:tile_scan_progress]
@@ -90,20 +105,10 @@ class StatsAggregator
                           {}
                         end
 
-    errors_by_zoom = if db.table_exists?(:misses)
-                       db[:misses]
-                         .select(:zoom_level, Sequel.function(:count, :zoom_level).as(:count))
-                         .where(zoom_level: min_zoom..max_zoom)
-                         .group(:zoom_level)
-                         .to_hash(:zoom_level, :count)
-                     else
-                       {}
-                     end
-
-    bounds_str = route.dig(:metadata, :bounds) || '-180,-85.0511,180,85.0511'
+    coverage = route[:coverage] || CoverageIndex.new(route.dig(:metadata, :bounds) || CoverageIndex::WORLD_BOUNDS, max_zoom)
 
     coverage_data = (min_zoom..max_zoom).map do |zoom|
-      possible = GeometryTileCalculator.count_tiles_in_bounds_string(bounds_str, zoom)
+      possible = coverage.count(zoom)
       zoom_data = tiles_by_zoom[zoom] || {}
       cached = (zoom_data[:cached] || 0).to_i
       generated = (zoom_data[:generated] || 0).to_i
@@ -128,7 +133,8 @@ class StatsAggregator
 
     {
       tiles_count: total_cached + total_generated,
-      misses_count: db.table_exists?(:misses) ? db[:misses].count : 0,
+      misses_count: misses_count,
+      tiles_bytes: tiles_by_zoom.values.sum { _1[:bytes].to_i },
       cache_size: get_tiles_size(route),
       coverage_data: coverage_data,
       coverage_percentage: total_possible.positive? ? format('%.8f', (total_cached.to_f / total_possible) * 100).sub(/\.?0+$/, '') : '0'
@@ -137,6 +143,53 @@ class StatsAggregator
 
   private
 
+  def zoom_stats(db, min_zoom, max_zoom)
+    TileStats.rebuild(db) if @repair && TileStats.installed?(db)
+    TileStats.installed?(db) ? counted_zoom_stats(db, min_zoom, max_zoom) : scanned_zoom_stats(db, min_zoom, max_zoom)
+  end
+
+  # Yields the databases of paths, each connected through the db connector
+  def with_databases(paths, databases = [], &block)
+    return block.call(*databases) if paths.empty?
+
+    @db_connector.call(paths.first, **@sqlite_options) { |db| with_databases(paths.drop(1), databases + [db], &block) }
+  end
+
+  # [tiles_by_zoom, errors_by_zoom, misses_count] from the TileStats counters
+  def counted_zoom_stats(db, min_zoom, max_zoom)
+    zooms = TileStats.by_zoom(db, min_zoom, max_zoom)
+    [zooms, zooms.transform_values { _1[:misses] }, TileStats.miss_total(db)]
+  end
+
+  # The same from full scans of tiles and misses
+  def scanned_zoom_stats(db, min_zoom, max_zoom)
+    cached_expr = Sequel.function(:sum, Sequel.case([[{ generated: 0 }, 1], [{ generated: nil }, 1]], 0))
+    generated_expr = Sequel.function(:sum, Sequel.case([[Sequel[:generated] > 0, 1]], 0))
+
+    tiles_by_zoom = if db.table_exists?(:tiles)
+                      db[:tiles]
+                        .select(:zoom_level, Sequel.as(cached_expr, :cached), Sequel.as(generated_expr, :generated),
+                                Sequel.as(Sequel.function(:sum, Sequel.function(:length, :tile_data)), :bytes))
+                        .where(zoom_level: min_zoom..max_zoom)
+                        .group(:zoom_level)
+                        .to_hash(:zoom_level)
+                    else
+                      {}
+                    end
+
+    errors_by_zoom = if db.table_exists?(:misses)
+                       db[:misses]
+                         .select(:zoom_level, Sequel.function(:count, :zoom_level).as(:count))
+                         .where(zoom_level: min_zoom..max_zoom)
+                         .group(:zoom_level)
+                         .to_hash(:zoom_level, :count)
+                     else
+                       {}
+                     end
+
+    [tiles_by_zoom, errors_by_zoom, db.table_exists?(:misses) ? db[:misses].count : 0]
+  end
+
   def connect_sqlite(db_path, **options, &block)
     Sequel.connect("sqlite://#{db_path}", **Observability.sql_logging_options.merge(options), &block)
   end
@@ -144,24 +197,27 @@ end
 
 class StatsForkRunner
   DEFAULT_TIMEOUT = 60
+  DEFAULT_REPAIR_TIMEOUT = 3_600 # A repair scans every tile of every route
   DEFAULT_KILL_GRACE_PERIOD = 5
   POLL_INTERVAL = 0.1
 
-  Handle = Struct.new(:pid, :reader, :stderr_reader, :started_at, keyword_init: true)
+  Handle = Struct.new(:pid, :reader, :stderr_reader, :started_at, :timeout, keyword_init: true)
   Result = Struct.new(:status, :result, :error, keyword_init: true)
 
-  def initialize(timeout: DEFAULT_TIMEOUT, kill_grace_period: DEFAULT_KILL_GRACE_PERIOD)
+  def initialize(timeout: DEFAULT_TIMEOUT, repair_timeout: DEFAULT_REPAIR_TIMEOUT, kill_grace_period: DEFAULT_KILL_GRACE_PERIOD)
     @timeout = timeout
+    @repair_timeout = repair_timeout
     @kill_grace_period = kill_grace_period
   end
 
-  def start(&)
+  # repair: true runs the TileStats repair (StatsAggregator repair: true) in the child
+  def start(repair: false, &)
     reader, writer = IO.pipe
     stderr_reader, stderr_writer = IO.pipe
     started_at = Time.now.utc
 
     pid = Process.spawn(
-      stats_child_env,
+      stats_child_env.merge('STATS_JOB_REPAIR' => repair ? '1' : '0'),
       RbConfig.ruby,
       __FILE__,
       out: writer,
@@ -172,14 +228,15 @@ class StatsForkRunner
 
     writer.close
     stderr_writer.close
-    Handle.new(pid:, reader:, stderr_reader:, started_at:)
+    Handle.new(pid:, reader:, stderr_reader:, started_at:, timeout: repair ? @repair_timeout : @timeout)
   rescue
     close_ios(reader, writer, stderr_reader, stderr_writer)
     raise
   end
 
   def wait(handle)
-    deadline = monotonic_time + @timeout
+    timeout = handle.timeout || @timeout
+    deadline = monotonic_time + timeout
 
     loop do
       waited_pid, process_status = Process.waitpid2(handle.pid, Process::WNOHANG)
@@ -193,7 +250,7 @@ class StatsForkRunner
         terminate(handle.pid)
         wait_for_exit(handle.pid)
         load_payload(handle.reader)
-        return Result.new(status: 'timed_out', error: "Stats job timed out after #{@timeout}s")
+        return Result.new(status: 'timed_out', error: "Stats job timed out after #{timeout}s")
       end
 
       sleep POLL_INTERVAL
@@ -291,15 +348,16 @@ class StatsJobManager
     @current_job = nil
   end
 
-  def start
-    otl_span('stats.job.start', {}) do
+  def start(repair: false)
+    otl_span('stats.job.start', { repair: repair }) do
       cancel_active_job
 
       job_id = SecureRandom.uuid
-      handle = @runner.start { @job_factory.call }
+      handle = @runner.start(repair:) { @job_factory.call }
       job = {
         job_id: job_id,
         status: 'running',
+        repair: repair,
         started_at: handle.started_at.iso8601,
         finished_at: nil,
         result: nil,
@@ -0,0 +1,124 @@
+# In-process cache of served tiles for one route, bounded by bytes.
+# Keys are (z, x, tms) packed into one Integer; each shard is an LRU kept in a Hash's
+# insertion order (a hit moves the entry to the back, eviction takes from the front)
+# behind its own Mutex, so concurrent requests rarely wait on each other.
+#
+# Every write to a tile must call invalidate. A shard's epoch moves on each invalidation
+# and a fill is dropped when the epoch changed while the database was being read, so a
+# row read just before a write can never be cached after it.
+#
+# Invalidation only reaches the process that made the write. When several processes serve
+# one database, ttl: bounds how long an entry may outlive a write made by another one; it
+# is nil (entries never expire) for the single-process server.
+class TileCache
+  DEFAULT_MAX_MB = 64
+  SHARDS = 16
+  ENTRY_OVERHEAD = 80 # Approximate bytes per entry besides the tile itself
+
+  Shard = Struct.new(:mutex, :entries, :bytes, :epoch, :hits, :misses, :evictions, :invalidations)
+
+  attr_reader :max_bytes, :ttl
+
+  def initialize(max_bytes: DEFAULT_MAX_MB << 20, ttl: nil)
+    @max_bytes = max_bytes
+    @ttl = ttl
+    @shard_bytes = max_bytes / SHARDS
+    @shards = Array.new(SHARDS) { Shard.new(Mutex.new, {}, 0, 0, 0, 0, 0, 0) }
+  end
+
+  # Served row ({ tile_data:, generated: }) from the cache, or from the block (which reads the
+  # database) and then cached. tile_data is cached as a frozen String.
+  def fetch(z, x, tms)
+    key = pack(z, x, tms)
+    shard = shard_for(key)
+    epoch = shard.mutex.synchronize do
+      if (cached = shard.entries.delete(key))
+        entry, expires_at = cached
+        if expires_at.nil? || expires_at > now
+          shard.entries[key] = cached
+          shard.hits += 1
+          return entry
+        end
+        shard.bytes -= entry_bytes(entry)
+      end
+      shard.misses += 1
+      shard.epoch
+    end
+
+    row = yield
+    return row unless row
+
+    entry = { tile_data: string_of(row[:tile_data]).freeze, generated: row[:generated] }
+    store(shard, key, entry, epoch)
+    entry
+  end
+
+  def invalidate(z, x, tms)
+    key = pack(z, x, tms)
+    shard = shard_for(key)
+    shard.mutex.synchronize do
+      shard.epoch += 1
+      shard.invalidations += 1
+      cached = shard.entries.delete(key)
+      shard.bytes -= entry_bytes(cached.first) if cached
+    end
+  end
+
+  # Exposes the counters and the cache size through Metrics, attributed to the source
+  def register_metrics(source)
+    attributes = { source: source }
+    %i[hits misses evictions invalidations].each do |name|
+      Metrics.register("tpc.tile_cache.#{name}", description: "Tile cache #{name}", attributes: attributes) { stats[name] }
+    end
+    Metrics.register('tpc.tile_cache.bytes', kind: :gauge, unit: 'By', description: 'Bytes held by the tile cache',
+                                             attributes: attributes) { stats[:bytes] }
+  end
+
+  # Totals over all shards: entries, bytes, hits, misses, evictions, invalidations
+  def stats
+    totals = Hash.new(0)
+    @shards.each do |shard|
+      shard.mutex.synchronize do
+        totals[:entries] += shard.entries.size
+        %i[bytes hits misses evictions invalidations].each { |name| totals[name] += shard[name] }
+      end
+    end
+    totals.merge(max_bytes: @max_bytes)
+  end
+
+  private
+
+  def store(shard, key, entry, epoch)
+    size = entry_bytes(entry)
+    return if size > @shard_bytes
+
+    shard.mutex.synchronize do
+      return unless shard.epoch == epoch
+
+      old = shard.entries.delete(key)
+      shard.bytes -= entry_bytes(old.first) if old
+      shard.entries[key] = [entry, @ttl && now + @ttl]
+      shard.bytes += size
+      while shard.bytes > @shard_bytes
+        _, (evicted, _) = shard.entries.shift
+        shard.bytes -= entry_bytes(evicted)
+        shard.evictions += 1
+      end
+    end
+  end
+
+  def now = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+
+  # z < 32 and x, tms < 2^29 (zoom 29) fit side by side
+  def pack(z, x, tms) = (z << 58) | (x << 29) | tms
+
+  def shard_for(key) = @shards[(key ^ (key >> 29)) & (SHARDS - 1)]
+
+  def entry_bytes(entry) = entry[:tile_data].bytesize + ENTRY_OVERHEAD
+
+  def string_of(blob)
+    return blob if blob.is_a?(String)
+
+    blob.respond_to?(:read) ? blob.read : blob.to_s
+  end
+end
@@ -0,0 +1,111 @@
+require 'sequel'
+require 'time'
+
+# Journal of the tiles incremental gap filling has to revisit: one row per changed
+# (zoom_level, tile_column, tile_row), ordered by seq. SQLite triggers append every write of
+# source data (generated <= 0: fetched and cached tiles, regeneration marks) in the write's
+# own transaction; tiles the reconstructor generates are not journaled; it propagates
+# dirtiness upward itself (propagate) while it walks the levels. An incremental run reads
+# only the journal rows of each zoom instead of filtering all of the zoom's tiles by
+# updated_at, so it scales with the tiles changed since the last run.
+#
+# A run consumes the rows that existed when it started and the rows it propagated; writes
+# that land while it runs are kept for the next one. Tiles still marked for regeneration
+# stay in the journal until they are regenerated.
+module TileChanges
+  extend self
+
+  SOURCE_DATA = '(NEW.generated IS NULL OR NEW.generated <= 0)'
+  TRIGGERS = %i[tile_changes_insert tile_changes_update tile_changes_map_insert tile_changes_map_update].freeze
+
+  # Creates the journal and the triggers of the file's layout (after TileStorage.configure).
+  # A new journal starts with the tiles changed since the last reconstruction run.
+  def install(db)
+    db.transaction(mode: :immediate) do
+      created = !db.table_exists?(:tile_changes)
+      create_table(db)
+      drop_triggers(db)
+      create_triggers(db, TileStorage.view?(db) ? :map : :tiles)
+      backfill(db) if created
+    end
+  end
+
+  # Routes without gap filling keep no journal
+  def uninstall(db)
+    db.transaction do
+      drop_triggers(db)
+      db.drop_table?(:tile_changes)
+    end
+  end
+
+  def installed?(db) = db.table_exists?(:tile_changes)
+
+  # Latest seq; a run consumes the rows up to the head it saw when it started
+  def head(db) = db[:tile_changes].max(:seq) || 0
+
+  # Changed (tile_column, tile_row) of zoom z, as a subquery for tiles
+  def at_zoom(db, z) = db[:tile_changes].where(zoom_level: z).select(:tile_column, :tile_row)
+
+  # Journals the parents of changed tiles for the next level of the running walk. Rows of
+  # source writes are kept as they are, so they are not consumed as propagated ones.
+  def propagate(db, z, coords)
+    return if coords.empty?
+
+    rows = coords.map { |x, y| [z, x, y, 1] }
+    db[:tile_changes].insert_ignore.import(%i[zoom_level tile_column tile_row propagated], rows, slice: 500)
+  end
+
+  # Drops the rows a completed run has processed
+  def consume(db, head)
+    db[:tile_changes]
+      .where(Sequel.|(Sequel[:seq] <= head, { propagated: 1 }))
+      .exclude(Sequel.lit(
+        'EXISTS (SELECT 1 FROM tiles WHERE tiles.zoom_level = tile_changes.zoom_level AND ' \
+        'tiles.tile_column = tile_changes.tile_column AND tiles.tile_row = tile_changes.tile_row AND tiles.generated = -5)'
+      ))
+      .delete
+  end
+
+  private
+
+  def create_table(db)
+    db.create_table?(:tile_changes) do
+      Integer :seq, primary_key: true # rowid: new rows and moved ones take max + 1
+      Integer :zoom_level,  null: false
+      Integer :tile_column, null: false
+      Integer :tile_row,    null: false
+      Integer :propagated,  null: false, default: 0
+      unique %i[zoom_level tile_column tile_row], name: :tile_changes_key
+    end
+  end
+
+  # A rewritten tile moves to a new seq and a propagated row becomes a source row again. An
+  # upsert rather than INSERT OR REPLACE: the conflict clause of an outer upsert on tiles
+  # would override the trigger's.
+  def create_triggers(db, table)
+    journal = 'INSERT INTO tile_changes (zoom_level, tile_column, tile_row) ' \
+              'VALUES (NEW.zoom_level, NEW.tile_column, NEW.tile_row) ' \
+              'ON CONFLICT (zoom_level, tile_column, tile_row) DO UPDATE SET ' \
+              'seq = (SELECT max(seq) + 1 FROM tile_changes), propagated = 0;'
+    prefix = table == :map ? 'tile_changes_map' : 'tile_changes'
+    updated = table == :map ? 'generated, tile_id' : 'generated, tile_data'
+
+    db.run "CREATE TRIGGER #{prefix}_insert AFTER INSERT ON #{table} WHEN #{SOURCE_DATA} BEGIN #{journal} END"
+    db.run "CREATE TRIGGER #{prefix}_update AFTER UPDATE OF #{updated} ON #{table} WHEN #{SOURCE_DATA} BEGIN #{journal} END"
+  end
+
+  # The journal replaces the updated_at filter of incremental runs, so the tiles that filter
+  # would still select are journaled once. Without a previous run the next one is full.
+  def backfill(db)
+    last_run = db[:metadata].where(name: 'reconstruction_last_run').get(:value)
+    return unless last_run
+
+    changed = db[:tiles].where(Sequel.|(Sequel[:updated_at] > Time.parse(last_run).utc, { generated: -5 }))
+    db.run "INSERT OR IGNORE INTO tile_changes (zoom_level, tile_column, tile_row) " \
+           "#{changed.select(:zoom_level, :tile_column, :tile_row).sql}"
+    LOGGER.info("Journaled #{db[:tile_changes].count} tiles changed since the reconstruction of #{last_run}")
+  end
+
+  # The layout may have changed since the last start (plain → dedup), so triggers are recreated
+  def drop_triggers(db) = TRIGGERS.each { |name| db.run "DROP TRIGGER IF EXISTS #{name}" }
+end
@@ -0,0 +1,176 @@
+require 'sequel'
+require 'securerandom'
+require 'socket'
+
+# Coalesces cache misses of one route so a tile is fetched once, not once per thread, worker
+# and replica. Inside a process a per-tile Mutex lets one request through; across processes
+# sharing the MBTiles file the request that got through also holds a lease row in tile_locks,
+# and requests of other processes wait for the row to go away and then read what the winner
+# stored (its tile, or the miss it recorded) instead of fetching.
+#
+# With a write queue the lease is released in the same commit as the winner's tile or miss,
+# so a waiter never sees the lease gone before the result. Leases expire after lease_ttl, so
+# a worker that dies mid-fetch holds its tiles that long at most. A waiter gives up after
+# wait_timeout and fetches the tile itself, so a slow winner costs it one upstream request
+# at most rather than the whole lease.
+class TileLocks
+  DEFAULT_LEASE_TTL = 60 # Seconds; longer than an upstream fetch with its retries can take
+  DEFAULT_WAIT = 15      # Seconds a waiter polls; the read timeout of one upstream request
+  DEFAULT_POLL_MS = 25   # Interval of a waiter's checks of the winner's lease
+
+  LocalLock = Struct.new(:mutex, :users)
+
+  attr_reader :source_name
+
+  def initialize(db, source_name, shared: true, write_queue: nil, lease_ttl: DEFAULT_LEASE_TTL,
+                 wait_timeout: DEFAULT_WAIT, poll_ms: DEFAULT_POLL_MS, owner: nil)
+    @db = db
+    @source_name = source_name
+    @shared = shared
+    @write_queue = write_queue
+    @lease_ttl = lease_ttl
+    @wait_timeout = wait_timeout
+    @poll_interval = poll_ms / 1000.0
+    @fixed_owner = owner
+    @owner = nil
+    @owner_pid = nil
+    @mutex = Mutex.new
+    @local = {}
+    @counters = Hash.new(0)
+    clear_expired if shared
+  end
+
+  def shared? = @shared
+
+  # Runs the block as the only request fetching the tile. It yields true when the tile was
+  # being fetched by another process, whose tile or miss is then stored.
+  def synchronize(z, x, tms)
+    key = [z, x, tms]
+    local = checkout(key)
+    local.mutex.synchronize do
+      return yield(false) unless @shared
+
+      token, waited = acquire_lease(key)
+      begin
+        yield(waited)
+      ensure
+        release_lease(key, token)
+      end
+    end
+  ensure
+    checkin(key, local)
+  end
+
+  def register_metrics
+    attributes = { source: @source_name }
+    %i[leases waits steals timeouts].each do |name|
+      Metrics.register("tpc.tile_locks.#{name}", description: "Tile lock #{name}", attributes: attributes) { stats[name] }
+    end
+  end
+
+  def stats
+    @mutex.synchronize { %i[leases waits steals timeouts].to_h { |name| [name, @counters[name]] }.merge(local: @local.size) }
+  end
+
+  private
+
+  # Per-tile Mutex, dropped once nobody uses it so the map only holds tiles being fetched
+  def checkout(key)
+    @mutex.synchronize do
+      lock = (@local[key] ||= LocalLock.new(Mutex.new, 0))
+      lock.users += 1
+      lock
+    end
+  end
+
+  def checkin(key, lock)
+    @mutex.synchronize do
+      lock.users -= 1
+      @local.delete(key) if lock.users.zero?
+    end
+  end
+
+  # Takes the tile's lease, waiting while another process holds a live one; [token, waited].
+  # When the wait times out or the lease table cannot be written the request goes on without
+  # one (token nil)
+  def acquire_lease(key)
+    token = SecureRandom.hex(8)
+    waited = false
+    deadline = nil
+    until take_lease(key, token)
+      unless waited
+        waited = true
+        deadline = monotonic_now + @wait_timeout
+        count(:waits)
+      end
+      sleep @poll_interval while lease_held?(key) && monotonic_now < deadline
+      next if monotonic_now < deadline
+
+      count(:timeouts)
+      LOGGER.debug("TileLocks: gave up waiting for #{key.join('/')} of #{@source_name} after #{@wait_timeout}s")
+      return [nil, waited]
+    end
+    count(:leases)
+    [token, waited]
+  rescue Sequel::DatabaseError => e
+    LOGGER.warn("event=tile_lock_error source=#{@source_name} key=#{key.join('/')} error=#{e.message}")
+    [nil, waited]
+  end
+
+  # The row is written when the tile has no lease, its lease expired (a dead holder) or it is
+  # left by this process, whose requests for the tile are already serialized by the Mutex.
+  # A live lease of another process is seen by a plain read; otherwise one upsert guarded by
+  # the same condition takes the row, so no transaction holds the WAL write lock over the read
+  def take_lease((z, x, tms), token)
+    now = Time.now.to_i
+    leases = @db[:tile_locks].where(zoom_level: z, tile_column: x, tile_row: tms)
+    row = leases.select(:owner, :expires_at).first
+    return false if row && row[:owner] != owner && row[:expires_at] > now
+
+    @db[:tile_locks].insert_conflict(
+      target: %i[zoom_level tile_column tile_row],
+      update: { owner: Sequel[:excluded][:owner], token: Sequel[:excluded][:token], expires_at: Sequel[:excluded][:expires_at] },
+      update_where: Sequel.|({ Sequel[:tile_locks][:owner] => owner }, Sequel[:tile_locks][:expires_at] <= now)
+    ).insert(zoom_level: z, tile_column: x, tile_row: tms, owner: owner, token: token, expires_at: now + @lease_ttl)
+    return false unless leases.where(token: token).get(1) # Another process took it since the read
+
+    count(:steals) if row && row[:owner] != owner
+    true
+  end
+
+  def lease_held?((z, x, tms))
+    @db[:tile_locks].where(zoom_level: z, tile_column: x, tile_row: tms)
+                    .where(expires_at: (Time.now.to_i + 1)..).get(1)
+  end
+
+  # After the winner's writes; a later lease of this process on the tile has another token
+  def release_lease((z, x, tms), token)
+    return unless token
+    return @write_queue.release_lease(z, x, tms, token) if @write_queue
+
+    @db[:tile_locks].where(zoom_level: z, tile_column: x, tile_row: tms, token: token).delete
+  rescue => e
+    LOGGER.warn("event=tile_lock_release_error source=#{@source_name} z=#{z} x=#{x} tms=#{tms} error=#{e.message}")
+  end
+
+  # Workers forked after this object was built get their own owner
+  def owner
+    return @fixed_owner if @fixed_owner
+
+    unless @owner_pid == Process.pid
+      @owner_pid = Process.pid
+      @owner = "#{Socket.gethostname}:#{Process.pid}:#{SecureRandom.hex(4)}"
+    end
+    @owner
+  end
+
+  def clear_expired
+    @db[:tile_locks].where(expires_at: 0..Time.now.to_i).delete
+  rescue => e
+    LOGGER.warn("event=tile_lock_cleanup_error source=#{@source_name} error=#{e.message}")
+  end
+
+  def monotonic_now = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+
+  def count(name) = @mutex.synchronize { @counters[name] += 1 }
+end
@@ -2,12 +2,23 @@ require 'vips'
 require 'sequel'
 require 'set'
 require_relative 'ext/terrain_downsample_extension'
+require_relative 'ext/raster_downsample_extension'
 require_relative 'vips_tile_validator'
+require_relative 'parallel_reconstruction'
+require_relative 'tile_write_queue'
+require_relative 'tile_shards'
+require_relative 'tile_storage'
+require_relative 'tile_changes'
 
 class TileReconstructor
-  KERNELS = %i[nearest linear cubic mitchell lanczos2 lanczos3].freeze # Vips interpolation kernels
+  KERNELS = %i[box nearest linear cubic mitchell lanczos2 lanczos3].freeze # Raster kernels (box = 2×2 average, rest as in Vips)
+  NATIVE_RASTER_OPTIONS = { 'png' => %i[compression], 'webp' => %i[lossless effort Q] }.freeze # Write options RasterDownsampleFFI takes
   TERRAIN_ENCODINGS = %w[mapbox terrarium].freeze # Supported terrain RGB encodings
   TERRAIN_METHODS = %w[average nearest maximum].freeze # Terrain downsampling methods
+  PNG_SIGNATURE = "\x89PNG\r\n\x1A\n".b.freeze
+  DEFAULT_BATCH_SIZE = 256 # Parents loaded and downsampled per batch
+  TRAVERSALS = %w[breadth_first depth_first].freeze # gap_filling.traversal values
+  SUBTREES_PER_WORKER = 8 # Parallel builds split at the shallowest zoom with this many subtrees per worker
 
   def initialize(route, source_name)
     @route = route
@@ -18,6 +29,9 @@ class TileReconstructor
     @last_run = nil
     @schedule_time = parse_schedule_time
     @transparent_tile_data = nil
+    @writer = nil
+    @worker_progress = nil
+    @journal = false # TileChanges journal of the running build's file
   end
 
   def start_scheduler
@@ -71,11 +85,14 @@ class TileReconstructor
   end
 
   def status
-    {
+    status = {
       running: running?,
       last_run: @last_run,
       schedule_time: @schedule_time
     }
+    # Per-worker progress of the current (or last) parallel build
+    status[:workers] = @worker_progress if @worker_progress
+    status
   end
 
   private
@@ -138,34 +155,51 @@ class TileReconstructor
       downsample_opts = build_downsample_opts(@route)
 
       last_run_time = @reconstruction_mode == :full ? nil : get_last_run_timestamp(db)
+      @journal = TileChanges.installed?(db)
+      journal_heads = TileShards.dbs(@route).map { TileChanges.head(_1) } if @journal
       mode_name = @reconstruction_mode == :full ? "full rebuild" : (last_run_time ? "incremental (last run: #{last_run_time.iso8601})" : "full")
       LOGGER.info("TileReconstructor: starting #{mode_name} gap filling for #{@source_name} from zoom #{start_zoom} to #{minzoom}")
 
-      start_zoom.downto(minzoom) do |z|
-        break unless @running
-
-        begin
-          process_zoom_level(z, db, downsample_opts, minzoom, maxzoom, last_run_time)
-        rescue => e
-          LOGGER.error("event=reconstruction_zoom_error source=#{@source_name} zoom=#{z} error=#{e.message}")
-          LOGGER.debug("TileReconstructor: backtrace: #{e.backtrace.join("\n")}")
-        end
+      if downsample_opts[:workers] > 1
+        run_parallel(downsample_opts, minzoom, start_zoom, last_run_time)
+      elsif downsample_opts[:traversal] == 'depth_first'
+        run_depth_first(downsample_opts, minzoom, start_zoom, last_run_time)
+      else
+        run_breadth_first(downsample_opts, minzoom, start_zoom, last_run_time)
       end
+      write_queue&.flush
 
       save_last_run_timestamp(db)
+      TileShards.dbs(@route).zip(journal_heads) { |shard_db, head| TileChanges.consume(shard_db, head) } if @journal && @running
 
       LOGGER.info("TileReconstructor: gap filling completed for #{@source_name}")
     end
   end
 
-  def process_zoom_level(z, db, downsample_opts, minzoom, maxzoom, last_run_time = nil)
+  # Zoom by zoom from start_zoom down to minzoom
+  def run_breadth_first(downsample_opts, minzoom, start_zoom, last_run_time)
+    start_zoom.downto(minzoom) do |z|
+      break unless @running
+
+      begin
+        process_zoom_level(z, downsample_opts, minzoom, start_zoom + 1, last_run_time)
+      rescue => e
+        LOGGER.error("event=reconstruction_zoom_error source=#{@source_name} zoom=#{z} error=#{e.message}")
+        LOGGER.debug("TileReconstructor: backtrace: #{e.backtrace.join("\n")}")
+      end
+    end
+  end
+
+  def process_zoom_level(z, downsample_opts, minzoom, maxzoom, last_run_time = nil)
     otl_span('reconstruction.zoom', { source: @source_name, zoom: z }) do |span|
       parent_z = z - 1
       return if parent_z < minzoom
 
       LOGGER.info("TileReconstructor: processing zoom #{z} -> #{parent_z}")
 
-      all_tiles_z = load_tiles_for_zoom(z, db, last_run_time)
+      # The previous level may still sit in the write-behind queue
+      write_queue&.flush
+      all_tiles_z = load_tiles_for_zoom(z, last_run_time)
       return if all_tiles_z.empty?
 
       log_msg = last_run_time ? "loaded #{all_tiles_z.size} tiles for zoom #{z} (filtered by timestamp)" : "loaded #{all_tiles_z.size} tiles for zoom #{z}"
@@ -173,30 +207,26 @@ class TileReconstructor
 
       parent_coords_set = calculate_parent_coords(all_tiles_z)
       LOGGER.info("TileReconstructor: calculated #{parent_coords_set.size} unique parents for zoom #{parent_z}")
+      propagate_changes(parent_z, parent_coords_set, last_run_time)
 
       processed_count = 0
       generated_count = 0
       invalid_tiles_coords = []
       error_count = 0
 
-      parent_coords_set.each do |parent_coords|
+      # Parents are loaded, downsampled and saved in batches: one SELECT per zoom per batch and
+      # one native call per batch for terrain, so a full rebuild stays CPU-bound
+      parent_coords_set.each_slice(downsample_opts[:batch_size]) do |batch|
         break unless @running
 
-        begin
-          generated, invalid_coords = process_parent(parent_coords, z, parent_z, db, downsample_opts, minzoom)
-          generated_count += 1 if generated
-          invalid_tiles_coords.concat(invalid_coords) if invalid_coords.any?
-          processed_count += 1
-        rescue => e
-          error_count += 1
-          LOGGER.warn(
-            "event=reconstruction_parent_error source=#{@source_name} zoom=#{parent_z} " \
-            "x=#{parent_coords[0]} y=#{parent_coords[1]} error=#{e.message}"
-          )
-        end
+        summary = process_parent_batch(batch, z, parent_z, downsample_opts, minzoom)
+        processed_count += summary[:processed]
+        generated_count += summary[:generated]
+        error_count += summary[:errors]
+        invalid_tiles_coords.concat(summary[:invalid])
       end
 
-      cleanup_invalid_tiles(invalid_tiles_coords, db) if invalid_tiles_coords.any?
+      cleanup_invalid_tiles(invalid_tiles_coords) if invalid_tiles_coords.any?
 
       span&.add_attributes(
         parent_zoom: parent_z,
@@ -215,13 +245,293 @@ class TileReconstructor
     end
   end
 
-  # Processes single parent tile: loads parent + children, validates, decides, generates
-  # Returns: [generated, invalid_tiles_coords] where generated is true/false and invalid_tiles_coords is array of invalid child tiles
-  def process_parent(parent_coords, z, parent_z, db, downsample_opts, minzoom)
+  # Depth-first build: rebuilds the subtree of every minzoom tile with changed descendants,
+  # bottom-up. Parents generated on the way are handed to the next level as native
+  # DecodedTile pixels instead of being read back from SQLite and decoded again; the encoded
+  # tile is only written for storage. The lowest levels of a subtree (a chunk whose widest
+  # level fits one batch) are processed level by level in native batches; above that the
+  # walk recurses, so resident tiles stay bounded by one chunk plus 4 tiles per level.
+  def run_depth_first(downsample_opts, minzoom, start_zoom, last_run_time)
+    walk = new_walk(downsample_opts, minzoom, start_zoom, last_run_time)
+
+    roots = subtree_roots(walk, minzoom)
+    LOGGER.info("TileReconstructor: depth-first build of #{roots.size} subtrees under zoom #{minzoom} (chunk depth #{walk[:chunk_depth]})")
+
+    roots.each do |x, y|
+      break unless @running
+
+      otl_span('reconstruction.subtree', { source: @source_name, zoom: minzoom, x: x, y: y }) do
+        rebuild_subtree(minzoom, x, y, walk)
+      end
+    rescue => e
+      LOGGER.error("event=reconstruction_subtree_error source=#{@source_name} zoom=#{minzoom} x=#{x} y=#{y} error=#{e.message}")
+      LOGGER.debug("TileReconstructor: backtrace: #{e.backtrace.join("\n")}")
+    end
+
+    log_walk_summary(walk[:stats])
+  end
+
+  # Parallel build: the pyramid is split into the subtrees of one zoom (root_zoom), which
+  # share no tiles. Workers rebuild whole subtrees from start_zoom up to root_zoom, each in
+  # the configured traversal, and steal pending subtrees from each other when the load is
+  # uneven. All writes go through one TileWriteQueue per file (the route's, or private ones
+  # when write-behind is off), whose single writer thread commits them; a worker flushes it
+  # before it reads the next level of a subtree. The levels above root_zoom are then built
+  # breadth-first, after every subtree (and grandparent mark) has been committed.
+  def run_parallel(downsample_opts, minzoom, start_zoom, last_run_time)
+    workers = downsample_opts[:workers]
+    walk = new_walk(downsample_opts, minzoom, start_zoom, last_run_time)
+    root_zoom, roots = partition_subtrees(walk, workers)
+    LOGGER.info("TileReconstructor: parallel build of #{roots.size} subtrees at zoom #{root_zoom} on #{workers} workers")
+
+    deques = SubtreeDeques.new(roots.sort, workers)
+    @worker_progress = Array.new(workers) do |index|
+      { worker: index, subtrees: 0, steals: 0, current: nil, processed: 0, generated: 0, errors: 0 }
+    end
+    unless @route[:write_queue]
+      writers = TileShards.dbs(@route).map { TileWriteQueue.new(_1, @source_name) }
+      @writer = TileShards.combine(@route, writers, TileShards::WriteQueue)
+    end
+
+    threads = Array.new(workers) do |index|
+      Thread.new do
+        Thread.current.report_on_exception = false
+        run_subtree_worker(index, deques, root_zoom, walk.merge(stats: new_walk_stats))
+      end
+    end
+    worker_stats = threads.map(&:value)
+    write_queue.flush
+
+    stats = new_walk_stats
+    worker_stats.each do |by_zoom|
+      by_zoom.each { |z, counts| stats[z].merge!(counts) { |_, total, count| total + count } }
+    end
+    log_walk_summary(stats)
+
+    run_breadth_first(downsample_opts, minzoom, root_zoom, last_run_time) if @running
+  ensure
+    @writer&.close
+    @writer = nil
+  end
+
+  # Rebuilds subtrees taken from the deques until none are left
+  # Returns the worker's per-zoom stats
+  def run_subtree_worker(index, deques, root_zoom, walk)
+    progress = @worker_progress[index]
+
+    while @running && (taken = deques.take(index))
+      (x, y), stolen = taken
+      progress[:steals] += 1 if stolen
+      progress[:current] = "#{root_zoom}/#{x}/#{y}"
+
+      begin
+        otl_span('reconstruction.subtree', { source: @source_name, zoom: root_zoom, x: x, y: y, worker: index }) do
+          if walk[:opts][:traversal] == 'depth_first'
+            rebuild_subtree(root_zoom, x, y, walk)
+          else
+            walk[:start_zoom].downto(root_zoom + 1) do |child_z|
+              break unless @running
+
+              rebuild_level(child_z, descendant_range(root_zoom, x, y, child_z), nil, walk)
+            end
+          end
+        end
+      rescue => e
+        LOGGER.error("event=reconstruction_subtree_error source=#{@source_name} zoom=#{root_zoom} x=#{x} y=#{y} worker=#{index} error=#{e.message}")
+        LOGGER.debug("TileReconstructor: backtrace: #{e.backtrace.join("\n")}")
+      end
+
+      progress[:subtrees] += 1
+      %i[processed generated errors].each { |key| progress[key] = walk[:stats].sum { |_, stats| stats[key] } }
+    end
+
+    progress[:current] = nil
+    walk[:stats]
+  end
+
+  # Shallowest zoom whose subtrees give every worker SUBTREES_PER_WORKER of them to start
+  # with, so stealing has work to move around. Returns [root_zoom, roots]
+  def partition_subtrees(walk, workers)
+    root_zoom = walk[:minzoom]
+    roots = subtree_roots(walk, root_zoom)
+    while roots.size < workers * SUBTREES_PER_WORKER && root_zoom < walk[:start_zoom] - 1
+      root_zoom += 1
+      roots = subtree_roots(walk, root_zoom)
+    end
+    [root_zoom, roots.to_a]
+  end
+
+  def new_walk(downsample_opts, minzoom, start_zoom, last_run_time)
+    {
+      opts: downsample_opts, minzoom: minzoom, start_zoom: start_zoom, last_run_time: last_run_time,
+      chunk_depth: 1 + Math.log(downsample_opts[:batch_size], 4).floor,
+      stats: new_walk_stats
+    }
+  end
+
+  def new_walk_stats
+    Hash.new { |h, z| h[z] = { processed: 0, generated: 0, errors: 0, invalid: 0 } }
+  end
+
+  def log_walk_summary(walk_stats)
+    walk_stats.sort.reverse_each do |z, stats|
+      LOGGER.info(
+        "event=reconstruction_zoom_summary source=#{@source_name} zoom=#{z} " \
+        "parent_zoom=#{z - 1} processed=#{stats[:processed]} generated=#{stats[:generated]} " \
+        "invalid=#{stats[:invalid]} errors=#{stats[:errors]}"
+      )
+    end
+  end
+
+  # Tiles of root_zoom that have changed tiles anywhere below them
+  def subtree_roots(walk, root_zoom)
+    roots = Set.new
+    (root_zoom + 1..walk[:start_zoom]).each do |z|
+      shift = z - root_zoom
+      changed_tiles(z, walk[:last_run_time])
+        .select(Sequel.lit("tile_column >> #{shift}").as(:x), Sequel.lit("tile_row >> #{shift}").as(:y))
+        .distinct
+        .each { |row| roots.add([row[:x], row[:y]]) }
+    end
+    roots
+  end
+
+  # Rebuilds the tiles below (z, x, y), then (z, x, y) itself
+  # Returns the tiles generated at zoom z as resident rows ({ [z, x, y] => row })
+  def rebuild_subtree(z, x, y, walk)
+    if walk[:start_zoom] - z <= walk[:chunk_depth]
+      resident = {}
+      walk[:start_zoom].downto(z + 1) do |child_z|
+        break unless @running
+
+        resident = rebuild_level(child_z, descendant_range(z, x, y, child_z), resident, walk)
+      end
+      return resident
+    end
+
+    resident = {}
+    calculate_child_coords(x, y).each do |cx, cy|
+      break unless @running
+      next unless descendants_changed?(z + 1, cx, cy, walk)
+
+      resident.merge!(rebuild_subtree(z + 1, cx, cy, walk))
+    end
+    rebuild_level(z + 1, descendant_range(z, x, y, z + 1), resident, walk)
+  end
+
+  # Generates the parents of the changed tiles of child_z inside range; resident holds the
+  # child_z tiles generated by this walk, which are used without reading them back
+  # Returns the generated parents as resident rows
+  def rebuild_level(child_z, range, resident, walk)
+    # Queued writes of this subtree's previous level must be committed before it is read
+    write_queue&.flush
+    columns, rows = range
+    changed = changed_tiles(child_z, walk[:last_run_time])
+                .where(tile_column: columns, tile_row: rows)
+                .select(:tile_column, :tile_row)
+                .to_a
+    return {} if changed.empty?
+
+    stats = walk[:stats][child_z]
+    generated = {}
+    invalid_tiles_coords = []
+    parent_coords_set = calculate_parent_coords(changed)
+    propagate_changes(child_z - 1, parent_coords_set, walk[:last_run_time])
+    parent_coords_set.each_slice(walk[:opts][:batch_size]) do |batch|
+      break unless @running
+
+      summary = process_parent_batch(batch, child_z, child_z - 1, walk[:opts], walk[:minzoom], resident: resident)
+      stats[:processed] += summary[:processed]
+      stats[:generated] += summary[:generated]
+      stats[:errors] += summary[:errors]
+      invalid_tiles_coords.concat(summary[:invalid])
+      generated.merge!(summary[:resident])
+    end
+
+    stats[:invalid] += invalid_tiles_coords.size
+    cleanup_invalid_tiles(invalid_tiles_coords) if invalid_tiles_coords.any?
+    generated
+  end
+
+  def descendants_changed?(z, x, y, walk)
+    (z + 1..walk[:start_zoom]).any? do |zoom|
+      columns, rows = descendant_range(z, x, y, zoom)
+      changed_tiles(zoom, walk[:last_run_time]).where(tile_column: columns, tile_row: rows).get(:tile_column)
+    end
+  end
+
+  # Column and row ranges covered by (z, x, y) at a deeper zoom
+  def descendant_range(z, x, y, zoom)
+    shift = zoom - z
+    [(x << shift)..(((x + 1) << shift) - 1), (y << shift)..(((y + 1) << shift) - 1)]
+  end
+
+  # Processes a batch of parent tiles: batched load, per-parent validation and decision,
+  # one downsample pass for all parents that need generating, then per-parent save.
+  # With resident (depth-first builds) children generated earlier in the walk come from it,
+  # and generated parents are returned as resident rows holding their DecodedTile.
+  # Returns: { processed:, generated:, errors:, invalid: [invalid child tile coords], resident: }
+  def process_parent_batch(batch, z, parent_z, downsample_opts, minzoom, resident: nil)
+    summary = { processed: 0, generated: 0, errors: 0, invalid: [], resident: {} }
+    tiles = begin
+      load_parent_batch(batch, z, parent_z, minzoom, resident || {})
+    rescue => e
+      LOGGER.warn("event=reconstruction_batch_load_error source=#{@source_name} zoom=#{parent_z} parents=#{batch.size} error=#{e.message}")
+      summary[:errors] = batch.size
+      return summary
+    end
+
+    plans = batch.filter_map do |parent_coords|
+      plan = plan_parent(parent_coords, z, parent_z, tiles, minzoom)
+      summary[:invalid].concat(plan[:invalid_coords])
+      unless plan[:generate]
+        summary[:processed] += 1
+        next
+      end
+
+      plan
+    rescue => e
+      log_parent_error(parent_z, parent_coords, e)
+      summary[:errors] += 1
+      nil
+    end
+
+    results = downsample_children_batch(plans.map { |plan| plan[:children] }, downsample_opts, keep_pixels: !resident.nil?)
+
+    plans.zip(results).each do |plan, child_data|
+      px, py = plan[:coords]
+      generated = if child_data.is_a?(Exception)
+                    LOGGER.warn("event=reconstruction_generate_error source=#{@source_name} zoom=#{parent_z} x=#{px} y=#{py} error=#{child_data.message}")
+                    false
+                  else
+                    save_generated_parent(px, py, parent_z, child_data, plan[:used_count], downsample_opts,
+                                          plan[:grandparent_tile], plan[:parent_tile], plan[:parent_validation])
+                  end
+      summary[:generated] += 1 if generated
+      # Composited parents are stored with different pixels, so the next level reads them back
+      if generated && child_data.respond_to?(:data) && !composite_parent?(plan)
+        summary[:resident][[parent_z, px, py]] = {
+          zoom_level: parent_z, tile_column: px, tile_row: py, generated: plan[:used_count], pixels: child_data
+        }
+      end
+      summary[:processed] += 1
+    rescue => e
+      log_parent_error(parent_z, plan[:coords], e)
+      summary[:errors] += 1
+    end
+
+    summary
+  end
+
+  # Validates parent and children of one parent tile and decides whether it needs generating
+  def plan_parent(parent_coords, z, parent_z, tiles, minzoom)
     px, py = parent_coords
     child_coords = calculate_child_coords(px, py)
 
-    parent_tile, children_tiles, grandparent_tile = load_parent_and_children(px, py, z, parent_z, child_coords, db, minzoom)
+    parent_tile = tiles[[parent_z, px, py]]
+    children_tiles = child_coords.filter_map { |cx, cy| tiles[[z, cx, cy]] }
+    grandparent_tile = parent_z - 1 >= minzoom ? tiles[[parent_z - 1, px / 2, py / 2]] : nil
+
     parent_validation = validate_parent_tile(parent_tile)
     # parent_valid should be true only for :valid and :partial_transparent
     # false for :transparent, :invalid, :corrupted, or nil
@@ -230,25 +540,50 @@ class TileReconstructor
 
     children_data_array, used_count, invalid_tiles_coords = validate_children_tiles(children_tiles, child_coords)
 
-    return [false, invalid_tiles_coords] unless should_generate_parent?(parent_tile, parent_valid, used_count, parent_partial_transparency)
+    {
+      coords: parent_coords,
+      generate: should_generate_parent?(parent_tile, parent_valid, used_count, parent_partial_transparency),
+      children: children_data_array,
+      used_count: used_count,
+      invalid_coords: invalid_tiles_coords,
+      parent_tile: parent_tile,
+      parent_validation: parent_validation,
+      grandparent_tile: grandparent_tile
+    }
+  end
+
+  def log_parent_error(parent_z, parent_coords, error)
+    LOGGER.warn(
+      "event=reconstruction_parent_error source=#{@source_name} zoom=#{parent_z} " \
+      "x=#{parent_coords[0]} y=#{parent_coords[1]} error=#{error.message}"
+    )
+  end
 
-    generated = generate_and_save_parent(px, py, parent_z, children_data_array, used_count, downsample_opts, db, grandparent_tile, parent_tile, parent_validation)
-    [generated, invalid_tiles_coords]
+  def load_tiles_for_zoom(z, last_run_time = nil)
+    changed_tiles(z, last_run_time).select(:tile_column, :tile_row, :generated).to_a
   end
 
-  def load_tiles_for_zoom(z, db, last_run_time = nil)
+  # Tiles of zoom z that drive parent generation: all of them, or for incremental runs the
+  # journaled ones (TileChanges), or without a journal the ones updated since the last run
+  # or marked for regeneration
+  def changed_tiles(z, last_run_time = nil)
+    db = tile_db(z)
     query = db[:tiles].where(zoom_level: z)
+    return query unless last_run_time
+    return query.where(Sequel.lit('(tile_column, tile_row) IN ?', TileChanges.at_zoom(db, z))) if @journal
 
-    if last_run_time
-      last_run_utc = last_run_time.utc
-      conditions = [
-        Sequel[:updated_at] > last_run_utc,
-        Sequel[:generated] => -5
-      ]
-      query = query.where { Sequel.|(*conditions) }
-    end
+    last_run_utc = last_run_time.utc
+    conditions = [
+      Sequel[:updated_at] > last_run_utc,
+      Sequel[:generated] => -5
+    ]
+    query.where { Sequel.|(*conditions) }
+  end
 
-    query.select(:tile_column, :tile_row, :generated).to_a
+  # Generated parents are not journaled, so an incremental run journals the parents of the
+  # level it processes: the next level reads them as changed tiles
+  def propagate_changes(parent_z, parent_coords_set, last_run_time)
+    TileChanges.propagate(tile_db(parent_z), parent_z, parent_coords_set) if @journal && last_run_time
   end
 
   def calculate_parent_coords(all_tiles_z)
@@ -268,48 +603,41 @@ class TileReconstructor
     ]
   end
 
-  # Loads parent, children, and grandparent tiles from database in single query
-  # Grandparent is loaded without blob (only generated) for quality regeneration marking
-  # Returns: [parent_tile, children_tiles, grandparent_tile]
-  def load_parent_and_children(px, py, z, parent_z, child_coords, db, minzoom)
-    grandparent_z = parent_z - 1
-    gpx = px / 2
-    gpy = py / 2
-
-    parent_condition = Sequel.&(
-      Sequel[:zoom_level] => parent_z,
-      Sequel[:tile_column] => px,
-      Sequel[:tile_row] => py
-    )
-
-    child_conditions = child_coords.map do |cx, cy|
-      Sequel.&(
-        Sequel[:zoom_level] => z,
-        Sequel[:tile_column] => cx,
-        Sequel[:tile_row] => cy
-      )
+  # Loads parents, children and grandparents of a batch with one query per zoom level
+  # Grandparents are loaded without blob (only generated) for quality regeneration marking
+  # Children found in resident are taken from it instead of the database
+  # Returns: { [zoom, x, y] => tile row }
+  def load_parent_batch(batch, z, parent_z, minzoom, resident = {})
+    child_coords = batch.flat_map { |px, py| calculate_child_coords(px, py) }
+    tiles = {}
+
+    child_coords.each do |cx, cy|
+      row = resident[[z, cx, cy]]
+      tiles[[z, cx, cy]] = row if row
     end
+    stored_coords = child_coords.reject { |cx, cy| tiles.key?([z, cx, cy]) }
+    load_tiles_at(z, stored_coords, :tile_data).each { |t| tiles[[z, t[:tile_column], t[:tile_row]]] = t }
+    load_tiles_at(parent_z, batch, :tile_data).each { |t| tiles[[parent_z, t[:tile_column], t[:tile_row]]] = t }
 
-    conditions = [parent_condition, *child_conditions]
-
+    grandparent_z = parent_z - 1
     if grandparent_z >= minzoom
-      grandparent_condition = Sequel.&(
-        Sequel[:zoom_level] => grandparent_z,
-        Sequel[:tile_column] => gpx,
-        Sequel[:tile_row] => gpy
-      )
-      conditions << grandparent_condition
+      grandparent_coords = batch.map { |px, py| [px / 2, py / 2] }.uniq
+      load_tiles_at(grandparent_z, grandparent_coords).each { |t| tiles[[grandparent_z, t[:tile_column], t[:tile_row]]] = t }
     end
 
-    all_tiles = db[:tiles].where { Sequel.|(*conditions) }
-                          .select(:zoom_level, :tile_column, :tile_row, :tile_data, :generated)
-                          .to_a
+    tiles
+  end
 
-    parent_tile = all_tiles.find { |t| t[:zoom_level] == parent_z && t[:tile_column] == px && t[:tile_row] == py }
-    children_tiles = all_tiles.select { |t| t[:zoom_level] == z }
-    grandparent_tile = grandparent_z >= minzoom ? all_tiles.find { |t| t[:zoom_level] == grandparent_z && t[:tile_column] == gpx && t[:tile_row] == gpy } : nil
+  # Selects tiles of one zoom level by (x, y) list using a row-value IN, which keeps
+  # the statement flat regardless of batch size
+  def load_tiles_at(zoom, coords, *columns)
+    return [] if coords.empty?
 
-    [parent_tile, children_tiles, grandparent_tile]
+    values = coords.map { |x, y| "(#{Integer(x)}, #{Integer(y)})" }.join(', ')
+    tile_db(zoom)[:tiles].where(zoom_level: zoom)
+                         .where(Sequel.lit("(tile_column, tile_row) IN (VALUES #{values})"))
+                         .select(:zoom_level, :tile_column, :tile_row, :generated, *columns)
+                         .to_a
   end
 
   def validate_parent_tile(parent_tile)
@@ -339,6 +667,13 @@ class TileReconstructor
       next unless idx
       next if tile[:generated] == -1
 
+      # Generated earlier in the same depth-first walk: already decoded and known good
+      if tile[:pixels]
+        children_data_array[idx] = tile[:pixels]
+        used_count += 1
+        next
+      end
+
       validation = VipsTileValidator.validate(tile[:tile_data], check_transparency: true)
       if [:valid, :partial_transparent].include?(validation)
         children_data_array[idx] = tile[:tile_data]
@@ -371,10 +706,30 @@ class TileReconstructor
     end
   end
 
-  def generate_and_save_parent(px, py, parent_z, children_data_array, used_count, downsample_opts, db, grandparent_tile, parent_tile, parent_validation)
-    child_data = send(downsample_opts[:method], children_data_array, **downsample_opts[:args])
+  # Downsamples children of several parents; terrain and raster go through one native batch
+  # call each. Returns data (a DecodedTile with keep_pixels), nil or the per-item exception.
+  def downsample_children_batch(children_list, downsample_opts, keep_pixels: false)
+    return [] if children_list.empty?
+
+    if downsample_opts[:method] == :downsample_terrain_tiles
+      return downsample_terrain_batch(children_list, threads: downsample_opts[:threads], keep_pixels: keep_pixels, **downsample_opts[:args])
+    end
+
+    if downsample_opts[:method] == :downsample_raster_tiles
+      return downsample_raster_batch(children_list, threads: downsample_opts[:threads], keep_pixels: keep_pixels, **downsample_opts[:args])
+    end
+
+    children_list.map do |children_data|
+      send(downsample_opts[:method], children_data, **downsample_opts[:args])
+    rescue => e
+      e
+    end
+  end
+
+  def save_generated_parent(px, py, parent_z, child_data, used_count, downsample_opts, grandparent_tile, parent_tile, parent_validation)
     return false unless child_data
 
+    child_data = tile_blob(child_data)
     new_data = if parent_validation == :partial_transparent && parent_tile
                  composite_parent_over_child(parent_tile[:tile_data], child_data, downsample_opts[:args][:format])
                else
@@ -383,15 +738,28 @@ class TileReconstructor
 
     return false unless new_data
 
+    mark_grandparent = grandparent_tile && grandparent_tile[:generated] != 0
+    if (queue = write_queue)
+      queue.save_tile(parent_z, px, py, new_data, generated: used_count)
+      queue.mark_for_regeneration(*tile_key(grandparent_tile)) if mark_grandparent
+    else
+      store_generated_parent(px, py, parent_z, new_data, used_count, mark_grandparent ? grandparent_tile : nil)
+    end
+    invalidate_cached(parent_z, px, py)
+    invalidate_cached(*tile_key(grandparent_tile)) if mark_grandparent
+
+    true
+  rescue => e
+    LOGGER.warn("event=reconstruction_generate_error source=#{@source_name} zoom=#{parent_z} x=#{px} y=#{py} error=#{e.message}")
+    false
+  end
+
+  # The grandparent mark commits with the parent unless a shard boundary lies between them
+  def store_generated_parent(px, py, parent_z, new_data, used_count, grandparent_tile)
+    db = tile_db(parent_z)
+    same_file = grandparent_tile && tile_db(parent_z - 1) == db
     db.transaction do
-      db[:tiles].insert_conflict(
-        target: [:zoom_level, :tile_column, :tile_row],
-        update: {
-          tile_data: Sequel[:excluded][:tile_data],
-          generated: Sequel[:excluded][:generated],
-          updated_at: Sequel.lit("datetime('now', 'utc')")
-        }
-      ).insert(
+      TileStorage.upsert(db, generated: true).insert(
         zoom_level: parent_z,
         tile_column: px,
         tile_row: py,
@@ -400,31 +768,66 @@ class TileReconstructor
         updated_at: Sequel.lit("datetime('now', 'utc')")
       )
 
-      mark_grandparent_for_regeneration(grandparent_tile, db) if grandparent_tile && grandparent_tile[:generated] != 0
+      mark_grandparent_for_regeneration(grandparent_tile) if same_file
     end
+    mark_grandparent_for_regeneration(grandparent_tile) if grandparent_tile && !same_file
+  end
 
-    true
-  rescue => e
-    LOGGER.warn("event=reconstruction_generate_error source=#{@source_name} zoom=#{parent_z} x=#{px} y=#{py} error=#{e.message}")
-    false
+  def tile_key(tile) = [tile[:zoom_level], tile[:tile_column], tile[:tile_row]]
+
+  # Drops a tile the route's memory cache (and the variants built from it) may be serving
+  def invalidate_cached(z, x, y)
+    @route[:tile_cache]&.invalidate(z, x, y)
+    @route[:tile_variants]&.invalidate(z, x, y)
+  end
+
+  # Queue for reconstruction writes: the route's write-behind queue, or the private one of a
+  # parallel build. Queued writes are committed later, so a level is flushed before it is read
+  def write_queue
+    @writer || @route[:write_queue]
+  end
+
+  # Database holding zoom z (the route's shard of z)
+  def tile_db(z) = TileShards.db(@route, z)
+
+  def composite_parent?(plan)
+    plan[:parent_validation] == :partial_transparent && plan[:parent_tile]
+  end
+
+  # Encoded bytes of a tile that may be a DecodedTile from a depth-first build
+  def tile_blob(tile)
+    tile.respond_to?(:data) ? tile.data : tile
   end
 
-  def mark_grandparent_for_regeneration(grandparent_tile, db)
-    db[:tiles].where(
+  def mark_grandparent_for_regeneration(grandparent_tile)
+    tile_db(grandparent_tile[:zoom_level])[:tiles].where(
       zoom_level: grandparent_tile[:zoom_level],
       tile_column: grandparent_tile[:tile_column],
       tile_row: grandparent_tile[:tile_row]
     ).update(generated: -5, updated_at: Sequel.lit("datetime('now', 'utc')"))
   end
 
-  def cleanup_invalid_tiles(invalid_tiles_coords, db)
+  def cleanup_invalid_tiles(invalid_tiles_coords)
     return if invalid_tiles_coords.empty?
 
     processed_count = 0
     error_count = 0
+    queue = write_queue
 
     invalid_tiles_coords.each do |z, x, y, validation_status|
       begin
+        ts = Time.now.to_i
+        @route[:miss_index]&.record(z, x, y, ts: ts, status: 200, reason: validation_status.to_s)
+        if queue
+          queue.delete_tile(z, x, y)
+          queue.record_miss(z, x, y, ts: ts, reason: validation_status.to_s,
+                                     details: "Tile is #{validation_status}", status: 200, response_body: nil)
+          invalidate_cached(z, x, y)
+          processed_count += 1
+          next
+        end
+
+        db = tile_db(z)
         db.transaction do
           db[:tiles].where(
             zoom_level: z,
@@ -446,13 +849,14 @@ class TileReconstructor
             zoom_level: z,
             tile_column: x,
             tile_row: y,
-            ts: Time.now.to_i,
+            ts: ts,
             reason: reason,
             details: "Tile is #{validation_status}",
             status: 200,
             response_body: nil
           )
         end
+        invalidate_cached(z, x, y)
         processed_count += 1
       rescue => e
         error_count += 1
@@ -482,6 +886,16 @@ class TileReconstructor
     encoding = route.dig(:metadata, :encoding)
     gap_filling = route[:gap_filling]
     minzoom = route[:minzoom]
+    traversal = gap_filling[:traversal] || 'breadth_first'
+    raise ArgumentError, "Unknown traversal: #{traversal}" unless TRAVERSALS.include?(traversal)
+
+    workers = Integer(gap_filling[:workers] || 1)
+    raise ArgumentError, "workers must be at least 1: #{workers}" if workers < 1
+
+    batch_opts = {
+      batch_size: gap_filling[:batch_size] || DEFAULT_BATCH_SIZE, threads: gap_filling[:threads],
+      traversal: traversal, workers: workers
+    }
     output_format_config = gap_filling[:output_format].transform_keys(&:to_sym)
     format = output_format_config[:type]
 
@@ -489,49 +903,125 @@ class TileReconstructor
       method = gap_filling[:terrain_method]
       args = { encoding: encoding, method: method, format: format }
       args[:effort] = output_format_config[:effort] || 4 if format == 'webp'
+      # Offline rebuild: spend encode time on ratio unless a zlib level is configured
+      args[:png] = output_format_config[:compression] ? { level: output_format_config[:compression] } : 'max'
 
-      { method: :downsample_terrain_tiles, args: args, minzoom: minzoom }
+      { method: :downsample_terrain_tiles, args: args, minzoom: minzoom, **batch_opts }
     else
       kernel = gap_filling[:raster_method].to_sym
       vips_options = output_format_config.except(:type)
       vips_options[:Q] = vips_options.delete(:quality) if format == 'webp' && vips_options.key?(:quality)
 
-      { method: :downsample_raster_tiles, args: { format: format, kernel: kernel, **vips_options }, minzoom: minzoom }
+      { method: :downsample_raster_tiles, args: { format: format, kernel: kernel, **vips_options }, minzoom: minzoom, **batch_opts }
     end
   end
 
-  # Downsamples 4 raster tiles into one using Vips
-  # Missing tiles are replaced with transparent placeholders
+  # Downsamples 4 raster tiles into one
+  # Missing tiles are replaced with transparent quadrants. PNG/WebP children go through
+  # RasterDownsampleFFI; anything it cannot read or write falls back to Vips.
   def downsample_raster_tiles(children_data, format: 'png', kernel: :linear, **output_options)
     raise ArgumentError, "Expected 4 tiles, got #{children_data.size}" unless children_data.size == 4
     raise ArgumentError, "Unknown kernel: #{kernel}" unless KERNELS.include?(kernel)
 
+    native_args = native_raster_args(format, output_options)
+    if native_args
+      result = RasterDownsampleFFI.downsample_quad(children_data, kernel.to_s, format, **native_args)
+      TileStageMetrics.record_native(@source_name, RasterDownsampleFFI, 'raster_downsample_quad')
+      return result unless result == false
+    end
+
+    downsample_raster_with_vips(children_data, format, kernel, output_options)
+  end
+
+  # Batch form of downsample_raster_tiles: native quads run on the extension's worker pool,
+  # the rest (and quads it hands back with false) go through Vips one by one
+  def downsample_raster_batch(children_list, format: 'png', kernel: :linear, threads: nil, keep_pixels: false, **output_options)
+    raise ArgumentError, "Unknown kernel: #{kernel}" unless KERNELS.include?(kernel)
+
+    native_args = native_raster_args(format, output_options)
+    results = if native_args
+                RasterDownsampleFFI.downsample_batch(children_list, kernel.to_s, format, threads: threads || 0, keep_pixels: keep_pixels, **native_args)
+              else
+                Array.new(children_list.size, false)
+              end
+    TileStageMetrics.record_native(@source_name, RasterDownsampleFFI, 'raster_downsample_batch') if native_args
+
+    results.each_with_index.map do |result, i|
+      next result unless result == false
+
+      downsample_raster_with_vips(children_list[i], format, kernel, output_options)
+    rescue => e
+      e
+    end
+  end
+
+  # Native call options for a raster output, or nil when only Vips can write it
+  # (JPEG, or write options RasterDownsampleFFI does not take)
+  def native_raster_args(format, output_options)
+    return nil unless defined?(RasterDownsampleFFI)
+
+    supported = NATIVE_RASTER_OPTIONS[format]
+    return nil unless supported && (output_options.keys - supported).empty?
+
+    if format == 'png'
+      output_options[:compression] ? { png: { level: output_options[:compression] } } : {}
+    else
+      { lossless: output_options[:lossless], effort: output_options[:effort], quality: output_options[:Q] }.compact
+    end
+  end
+
+  def downsample_raster_with_vips(children_data, format, kernel, output_options)
+    raise ArgumentError, "Expected 4 tiles, got #{children_data.size}" unless children_data.size == 4
+
+    children_data = children_data.map { |tile| tile && tile_blob(tile) }
+
     # Fill missing tiles with transparent placeholders
     filled_children = fill_missing_tiles(children_data, format)
     return nil if filled_children.all?(&:nil?)
 
     combined = combine_4_tiles(filled_children)
-    combined.resize(0.5, kernel: kernel).write_to_buffer(".#{format}", **output_options)
+    reduced = kernel == :box ? combined.shrink(2, 2) : combined.resize(0.5, kernel: kernel)
+    reduced.write_to_buffer(".#{format}", **output_options)
   end
 
   # Downsamples 4 terrain tiles with elevation-aware algorithms
-  # Missing tiles are replaced with transparent placeholders
-  def downsample_terrain_tiles(children_data, encoding: 'mapbox', method: 'average', format:, effort: nil)
+  # Missing or undecodable tiles are treated as 0 m elevation
+  def downsample_terrain_tiles(children_data, encoding: 'mapbox', method: 'average', format:, effort: nil, png: nil)
     raise ArgumentError, "Expected 4 tiles, got #{children_data.size}" unless children_data.size == 4
     raise ArgumentError, "Unknown encoding: #{encoding}" unless TERRAIN_ENCODINGS.include?(encoding)
     raise ArgumentError, "Unknown method: #{method}" unless TERRAIN_METHODS.include?(method)
     raise ArgumentError, "Unknown format: #{format}" unless %w[png webp].include?(format)
 
-    # Fill missing tiles with transparent placeholders
-    filled_children = fill_missing_tiles(children_data, format)
-    return nil if filled_children.all?(&:nil?)
+    # Children are decoded straight into one native mosaic; missing quadrants become 0 m
+    result = TerrainDownsampleFFI.downsample_quad(children_data.map { |data| terrain_child_png(data) }, encoding, method, format,
+                                                  **{ png: png, effort: effort }.compact)
+    TileStageMetrics.record_native(@source_name, TerrainDownsampleFFI, 'terrain_downsample_quad')
+    result
+  end
 
-    combined = combine_4_tiles(filled_children)
-    combined_png = combined.write_to_buffer('.png')
-    result_png = TerrainDownsampleFFI.downsample_png(combined_png, 256, encoding, method)
+  # Batch form of downsample_terrain_tiles: all quads go through one native call on the
+  # extension's worker pool; per-item failures come back as exception objects
+  def downsample_terrain_batch(children_list, encoding: 'mapbox', method: 'average', format:, effort: nil, png: nil, threads: nil, keep_pixels: false)
+    raise ArgumentError, "Unknown encoding: #{encoding}" unless TERRAIN_ENCODINGS.include?(encoding)
+    raise ArgumentError, "Unknown method: #{method}" unless TERRAIN_METHODS.include?(method)
+    raise ArgumentError, "Unknown format: #{format}" unless %w[png webp].include?(format)
+
+    quads = children_list.map { |children_data| children_data.map { |data| terrain_child_png(data) } }
+    results = TerrainDownsampleFFI.downsample_batch(quads, encoding, method, format, threads: threads || 0, keep_pixels: keep_pixels,
+                                                    **{ png: png, effort: effort }.compact)
+    TileStageMetrics.record_native(@source_name, TerrainDownsampleFFI, 'terrain_downsample_batch')
+    results
+  end
 
-    return result_png if format == 'png'
-    Vips::Image.new_from_buffer(result_png, '').write_to_buffer('.webp', lossless: true, effort: effort || 4)
+  # Native quad kernel reads PNG (and DecodedTile) only; other formats (e.g. WebP parents) are converted once via Vips
+  def terrain_child_png(tile_data)
+    return tile_data unless tile_data.is_a?(String)
+    return nil if tile_data.empty?
+    return tile_data if tile_data.byteslice(0, PNG_SIGNATURE.bytesize).b == PNG_SIGNATURE
+
+    Vips::Image.new_from_buffer(tile_data, '').write_to_buffer('.png')
+  rescue Vips::Error
+    nil
   end
 
   def combine_4_tiles(children_data)
@@ -0,0 +1,211 @@
+require 'sequel'
+
+# Zoom-band shards of a route's storage (route option shards: { zooms: [13, 16] }). Each band
+# that starts at one of the zooms lives in its own MBTiles file next to mbtiles_file
+# (name.z13.mbtiles holds zooms 13-15, name.z16.mbtiles zooms 16 and up); the route's own
+# file keeps the zooms below the first band, the metadata and the autoscan progress.
+#
+# Everything keyed by a tile is stored with its zoom: tiles, misses and coalescing leases,
+# with the tile_stats and tile_changes of the band. Each file has its own WAL writer,
+# write-behind queue, lease table and miss index, so autoscan, live misses and
+# reconstruction of different bands do not wait for each other, and VACUUM and checkpoints
+# go file by file. Every shard is a standard MBTiles of its band; export writes the single
+# file of all of them.
+module TileShards
+  extend self
+
+  MAX_ZOOM = 30
+
+  Shard = Struct.new(:name, :zooms, :file, :db, keyword_init: true)
+
+  # [[zooms, file], ...] of the route's shards option; nil when the route is not sharded
+  def bands(route, route_name)
+    starts = route.dig(:shards, :zooms)
+    return nil if starts.nil? || starts.empty?
+
+    starts = starts.map { Integer(_1) }
+    unless starts.each_cons(2).all? { |a, b| a < b } && starts.first.positive? && starts.last <= MAX_ZOOM
+      raise ArgumentError, "Invalid shards.zooms #{starts} for source '#{route_name}': ascending zooms 1-#{MAX_ZOOM}"
+    end
+
+    base = route[:mbtiles_file].delete_suffix('.mbtiles')
+    ends = starts.drop(1).map { _1 - 1 } + [MAX_ZOOM]
+    starts.zip(ends).map { |first, last| [first..last, "#{base}.z#{first}.mbtiles"] }
+  end
+
+  # Opens the band files with the block (which brings a file to the route's schema), copies
+  # the metadata of the route's file into them and moves stored rows into the file of their
+  # zoom. Returns the shards (the route's file first, kept as route[:tile_shards]) or nil for a
+  # route without bands
+  def open(route, route_name)
+    bands = bands(route, route_name) or return nil
+
+    main = Shard.new(name: route_name.to_s, zooms: 0..(bands.first[0].first - 1), file: route[:mbtiles_file], db: route[:db])
+    shards = [main] + bands.map do |zooms, file|
+      name = "#{route_name}/z#{zooms.first}"
+      Shard.new(name: name, zooms: zooms, file: file, db: yield(file, name))
+    end
+    shards.drop(1).each { |shard| copy_metadata(main.db, shard) }
+    shards.each { |shard| rebalance(shard, shards) }
+    shards
+  end
+
+  # Database holding zoom z of the route; nil for a zoom outside every band (above MAX_ZOOM),
+  # which holds no tiles
+  def db(route, z)
+    shards = route[:tile_shards] or return route[:db]
+
+    shards.find { _1.zooms.cover?(z) }&.db
+  end
+
+  # Every database of the route, the route's own first
+  def dbs(route) = route[:tile_shards]&.map(&:db) || [route[:db]]
+
+  # One of the route's components per file (parallel to route[:tile_shards]) behind the
+  # component's interface; the single component of a route without shards, nil when one of
+  # the files has none
+  def combine(route, components, router)
+    return components.first unless route[:tile_shards]
+    return nil if components.any?(&:nil?)
+
+    router.new(route[:tile_shards], components)
+  end
+
+  # Writes a standard single-file MBTiles of the route (metadata and a plain tiles table) to
+  # path, file by file; the route keeps serving and writing meanwhile
+  def export(route, path)
+    File.delete(path) if File.exist?(path)
+    out = Sequel.connect("sqlite://#{path}")
+    out.create_table(:metadata) { String :name, null: false; String :value; unique :name }
+    out.create_table(:tiles) do
+      Integer :zoom_level,  null: false
+      Integer :tile_column, null: false
+      Integer :tile_row,    null: false
+      File    :tile_data,   null: false
+      unique %i[zoom_level tile_column tile_row], name: :tile_index
+    end
+    out.disconnect
+
+    dbs(route).each_with_index do |db, i|
+      attached(db, path, :export) do
+        db.transaction do
+          db.run 'INSERT INTO export.metadata (name, value) SELECT name, value FROM main.metadata' if i.zero?
+          db.run 'INSERT OR REPLACE INTO export.tiles (zoom_level, tile_column, tile_row, tile_data) ' \
+                 'SELECT zoom_level, tile_column, tile_row, tile_data FROM main.tiles'
+        end
+      end
+    end
+    Sequel.connect("sqlite://#{path}") { |db| db[:tiles].count }
+  end
+
+  # Component calls keyed by zoom go to the component of the zoom's file, the others to all.
+  # A zoom outside every band has no file: its calls do nothing and return nil (no tile)
+  class Router
+    def self.by_zoom(*names)
+      names.each do |name|
+        define_method(name) do |z, *args, **opts, &block|
+          for_zoom(z)&.public_send(name, z, *args, **opts, &block)
+        end
+      end
+    end
+
+    def self.to_all(*names)
+      names.each do |name|
+        define_method(name) do |*args, **opts, &block|
+          @components.each { _1.public_send(name, *args, **opts, &block) }
+          nil
+        end
+      end
+    end
+
+    attr_reader :components
+
+    def initialize(shards, components)
+      @shards = shards
+      @components = components
+    end
+
+    def for_zoom(z)
+      index = @shards.index { _1.zooms.cover?(z) }
+      index && @components[index]
+    end
+  end
+
+  class WriteQueue < Router
+    by_zoom :save_tile, :mark_for_regeneration, :delete_tile, :record_miss, :release_lease, :read_tile, :read_miss
+    to_all :flush, :close
+
+    def pending_rows = @components.sum(&:pending_rows)
+  end
+
+  class Locks < Router
+    by_zoom :synchronize
+  end
+
+  class MissIndex < Router
+    by_zoom :fetch, :record, :forget_zoom
+    to_all :stop_sweeper
+  end
+
+  class BlobReader < Router
+    by_zoom :read
+    to_all :close
+  end
+
+  private
+
+  def copy_metadata(main_db, shard)
+    rows = main_db[:metadata].exclude(name: %w[minzoom maxzoom]).select_map(%i[name value])
+    rows += [['minzoom', shard.zooms.first.to_s], ['maxzoom', [shard.zooms.last, MAX_ZOOM].min.to_s]]
+    shard.db[:metadata].insert_conflict(target: :name, update: { value: Sequel[:excluded][:value] })
+                       .import(%i[name value], rows)
+  end
+
+  # Moves the tiles, misses and leases of zooms outside a file's band (a file that predates its
+  # shards, or bands that changed) into the file of their zoom. Zooms come from tile_stats so
+  # the check costs nothing once the files are balanced
+  def rebalance(shard, shards)
+    zooms = shard.db[:tile_stats].where { tile_count > 0 }.distinct.select_map(:zoom_level) |
+            shard.db[:miss_stats].where { miss_count > 0 }.select_map(:zoom_level)
+    zooms.reject { shard.zooms.cover?(_1) }.group_by { |z| shards.find { _1.zooms.cover?(z) } }.each do |target, moved|
+      started = Time.now
+      move(shard.db, target.file, moved)
+      LOGGER.info("Moved zooms #{moved.sort.join(',')} of #{shard.name} to #{target.name} in #{(Time.now - started).round(2)}s")
+    end
+  end
+
+  def move(db, file, zooms)
+    list = zooms.map { Integer(_1) }.join(', ')
+    attached(db, file, :target) do
+      db.transaction(mode: :immediate) do
+        db.run 'INSERT OR REPLACE INTO target.tiles (zoom_level, tile_column, tile_row, tile_data, generated, updated_at) ' \
+               "SELECT zoom_level, tile_column, tile_row, tile_data, generated, updated_at FROM main.tiles WHERE zoom_level IN (#{list})"
+        db.run "INSERT OR REPLACE INTO target.misses SELECT * FROM main.misses WHERE zoom_level IN (#{list})"
+        move_journal(db, list) if db.table_exists?(Sequel[:main][:tile_changes])
+        %w[tiles misses tile_locks].each { |table| db.run "DELETE FROM main.#{table} WHERE zoom_level IN (#{list})" }
+      end
+    end
+  end
+
+  # Pending TileChanges rows go with their tiles, so the next incremental reconstruction still
+  # sees them; rows the target already journaled for the moved tiles are kept
+  def move_journal(db, list)
+    if db.table_exists?(Sequel[:target][:tile_changes])
+      db.run 'INSERT OR IGNORE INTO target.tile_changes (zoom_level, tile_column, tile_row, propagated) ' \
+             "SELECT zoom_level, tile_column, tile_row, propagated FROM main.tile_changes WHERE zoom_level IN (#{list}) ORDER BY seq"
+    end
+    db.run "DELETE FROM main.tile_changes WHERE zoom_level IN (#{list})"
+  end
+
+  # Runs the block on one connection of db with file attached as schema
+  def attached(db, file, schema)
+    db.synchronize do
+      db.run "ATTACH DATABASE #{db.literal(file)} AS #{schema}"
+      begin
+        yield
+      ensure
+        db.run "DETACH DATABASE #{schema}"
+      end
+    end
+  end
+end
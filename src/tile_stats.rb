@@ -0,0 +1,161 @@
+require 'sequel'
+
+# Persistent per-zoom counters of a route's MBTiles file, so statistics are read in O(zooms)
+# instead of scanning tiles and misses.
+#
+# tile_stats holds tile_count / tile_bytes per (zoom_level, generated) where generated is the
+# class of the tile's generated value: 0 cached (0 or NULL), 1 generated, -1 marked for
+# regeneration. miss_stats holds miss_count per zoom_level. SQLite triggers apply the deltas
+# of every insert, update and delete in the statement's own transaction, so write-behind
+# commits, reconstruction writes and bulk deletes keep them exact without their writers
+# knowing. With the dedup layout the triggers sit on map and images and tile_bytes counts the
+# bytes of each tile's image (the size the plain table would have).
+#
+# The counters are filled once when the tables are created; rebuild is the explicit repair.
+module TileStats
+  extend self
+
+  CLASS_OF = ->(value) { "(CASE WHEN #{value} > 0 THEN 1 WHEN #{value} < 0 THEN -1 ELSE 0 END)" }
+  CLASSES = { 0 => :cached, 1 => :generated, -1 => :marked }.freeze
+  TRIGGERS = %i[tile_stats_insert tile_stats_delete tile_stats_update tile_stats_map_insert tile_stats_map_delete
+                tile_stats_map_update_old tile_stats_map_update_new tile_stats_image_insert
+                miss_stats_insert miss_stats_delete].freeze
+
+  # Creates the tables and the triggers of the file's layout (after TileStorage.configure)
+  def install(db)
+    db.transaction(mode: :immediate) do
+      created = !db.table_exists?(:tile_stats)
+      create_tables(db)
+      drop_triggers(db)
+      TileStorage.view?(db) ? create_dedup_triggers(db) : create_plain_triggers(db)
+      create_miss_triggers(db)
+      next unless created
+
+      started = Time.now
+      rebuild_zooms(db, tile_zooms(db) | miss_zooms(db))
+      LOGGER.info("Filled tile_stats from #{db[:tile_stats].sum(:tile_count).to_i} tiles in #{(Time.now - started).round(2)}s")
+    end
+  end
+
+  def installed?(db) = db.table_exists?(:tile_stats) && db.table_exists?(:miss_stats)
+
+  # Repair: recounts every zoom from tiles and misses, one zoom per transaction. Each holds
+  # the write lock while its zoom is scanned, so writers wait for it.
+  def rebuild(db)
+    zooms = db.transaction do
+      tile_zooms(db) | miss_zooms(db) | db[:tile_stats].distinct.select_map(:zoom_level) |
+        db[:miss_stats].select_map(:zoom_level)
+    end
+    zooms.sort.each { |zoom| db.transaction(mode: :immediate) { rebuild_zooms(db, [zoom]) } }
+    zooms.size
+  end
+
+  # { zoom => { cached:, generated:, marked:, bytes:, misses: } } for min_zoom..max_zoom
+  def by_zoom(db, min_zoom, max_zoom)
+    zooms = Hash.new { |hash, zoom| hash[zoom] = { cached: 0, generated: 0, marked: 0, bytes: 0, misses: 0 } }
+    db.transaction do
+      db[:tile_stats].where(zoom_level: min_zoom..max_zoom).each do |row|
+        stats = zooms[row[:zoom_level]]
+        stats[CLASSES[row[:generated]]] += row[:tile_count]
+        stats[:bytes] += row[:tile_bytes]
+      end
+      db[:miss_stats].where(zoom_level: min_zoom..max_zoom).each { |row| zooms[row[:zoom_level]][:misses] += row[:miss_count] }
+    end
+    zooms.default_proc = nil
+    zooms
+  end
+
+  def miss_total(db) = db[:miss_stats].sum(:miss_count).to_i
+
+  private
+
+  def create_tables(db)
+    db.create_table?(:tile_stats) do
+      Integer :zoom_level, null: false
+      Integer :generated,  null: false
+      Integer :tile_count, null: false, default: 0
+      Integer :tile_bytes, null: false, default: 0
+      primary_key %i[zoom_level generated], name: :tile_stats_pk
+    end
+    db.create_table?(:miss_stats) do
+      Integer :zoom_level, primary_key: true
+      Integer :miss_count, null: false, default: 0
+    end
+  end
+
+  def tile_zooms(db) = db[:tiles].distinct.select_map(:zoom_level)
+
+  def miss_zooms(db) = db.table_exists?(:misses) ? db[:misses].distinct.select_map(:zoom_level) : []
+
+  def rebuild_zooms(db, zooms)
+    return if zooms.empty?
+
+    db[:tile_stats].where(zoom_level: zooms).delete
+    db[:miss_stats].where(zoom_level: zooms).delete
+    db.run <<~SQL
+      INSERT INTO tile_stats (zoom_level, generated, tile_count, tile_bytes)
+        SELECT zoom_level, #{CLASS_OF.('generated')}, count(*), coalesce(sum(length(tile_data)), 0) FROM tiles
+        WHERE zoom_level IN (#{zooms.map { Integer(_1) }.join(', ')}) GROUP BY 1, 2
+    SQL
+    return unless db.table_exists?(:misses)
+
+    db.run <<~SQL
+      INSERT INTO miss_stats (zoom_level, miss_count)
+        SELECT zoom_level, count(*) FROM misses WHERE zoom_level IN (#{zooms.map { Integer(_1) }.join(', ')}) GROUP BY 1
+    SQL
+  end
+
+  # Adds count and bytes to a tile_stats row (SQL of one trigger statement)
+  def tile_delta(zoom, generated, count, bytes)
+    "INSERT INTO tile_stats (zoom_level, generated, tile_count, tile_bytes) " \
+      "VALUES (#{zoom}, #{CLASS_OF.(generated)}, #{count}, #{bytes}) " \
+      'ON CONFLICT (zoom_level, generated) DO UPDATE SET ' \
+      'tile_count = tile_count + excluded.tile_count, tile_bytes = tile_bytes + excluded.tile_bytes;'
+  end
+
+  def create_plain_triggers(db)
+    db.run "CREATE TRIGGER tile_stats_insert AFTER INSERT ON tiles BEGIN " \
+           "#{tile_delta('NEW.zoom_level', 'NEW.generated', 1, 'length(NEW.tile_data)')} END"
+    db.run "CREATE TRIGGER tile_stats_delete AFTER DELETE ON tiles BEGIN " \
+           "#{tile_delta('OLD.zoom_level', 'OLD.generated', -1, '-length(OLD.tile_data)')} END"
+    db.run "CREATE TRIGGER tile_stats_update AFTER UPDATE OF zoom_level, generated, tile_data ON tiles BEGIN " \
+           "#{tile_delta('OLD.zoom_level', 'OLD.generated', -1, '-length(OLD.tile_data)')} " \
+           "#{tile_delta('NEW.zoom_level', 'NEW.generated', 1, 'length(NEW.tile_data)')} END"
+  end
+
+  # map rows are counted with the bytes of their image. The view's triggers write map before
+  # images, so a row whose image is new counts 0 bytes and the image insert adds them; old
+  # values are taken in BEFORE triggers, while map_release_* has not dropped the image yet.
+  def create_dedup_triggers(db)
+    image_bytes = ->(row) { "coalesce((SELECT length(tile_data) FROM images WHERE tile_id = #{row}.tile_id), 0)" }
+
+    db.run "CREATE TRIGGER tile_stats_map_insert AFTER INSERT ON map BEGIN " \
+           "#{tile_delta('NEW.zoom_level', 'NEW.generated', 1, image_bytes.('NEW'))} END"
+    db.run "CREATE TRIGGER tile_stats_map_delete BEFORE DELETE ON map BEGIN " \
+           "#{tile_delta('OLD.zoom_level', 'OLD.generated', -1, "-#{image_bytes.('OLD')}")} END"
+    db.run "CREATE TRIGGER tile_stats_map_update_old BEFORE UPDATE OF zoom_level, generated, tile_id ON map BEGIN " \
+           "#{tile_delta('OLD.zoom_level', 'OLD.generated', -1, "-#{image_bytes.('OLD')}")} END"
+    db.run "CREATE TRIGGER tile_stats_map_update_new AFTER UPDATE OF zoom_level, generated, tile_id ON map BEGIN " \
+           "#{tile_delta('NEW.zoom_level', 'NEW.generated', 1, image_bytes.('NEW'))} END"
+    db.run <<~SQL
+      CREATE TRIGGER tile_stats_image_insert AFTER INSERT ON images BEGIN
+        INSERT INTO tile_stats (zoom_level, generated, tile_count, tile_bytes)
+          SELECT zoom_level, #{CLASS_OF.('generated')}, 0, count(*) * length(NEW.tile_data) FROM map
+          WHERE tile_id = NEW.tile_id GROUP BY 1, 2
+          ON CONFLICT (zoom_level, generated) DO UPDATE SET tile_bytes = tile_bytes + excluded.tile_bytes;
+      END
+    SQL
+  end
+
+  def create_miss_triggers(db)
+    delta = lambda do |row, count|
+      "INSERT INTO miss_stats (zoom_level, miss_count) VALUES (#{row}.zoom_level, #{count}) " \
+        'ON CONFLICT (zoom_level) DO UPDATE SET miss_count = miss_count + excluded.miss_count;'
+    end
+    db.run "CREATE TRIGGER miss_stats_insert AFTER INSERT ON misses BEGIN #{delta.('NEW', 1)} END"
+    db.run "CREATE TRIGGER miss_stats_delete AFTER DELETE ON misses BEGIN #{delta.('OLD', -1)} END"
+  end
+
+  # The layout may have changed since the last start (plain → dedup), so triggers are recreated
+  def drop_triggers(db) = TRIGGERS.each { |name| db.run "DROP TRIGGER IF EXISTS #{name}" }
+end
@@ -0,0 +1,168 @@
+require 'sequel'
+require 'digest'
+
+# Storage layouts of a route's MBTiles file (route option storage: tiles | dedup).
+#
+# 'tiles' is the plain tiles table. 'dedup' is the deduplicated MBTiles layout that mbutil
+# writes: map (z/x/y -> tile_id) and images (tile_id -> tile_data) behind a tiles view, so a
+# byte-identical tile (open ocean, nodata terrain, transparent parents) is stored once.
+# Everything keeps reading the view; INSTEAD OF triggers turn INSERT / UPDATE / DELETE on it
+# into map and images writes, and triggers on map drop images no tile references any more.
+module TileStorage
+  extend self
+
+  LAYOUTS = %w[tiles dedup].freeze
+  HASH_FUNCTION = 'tpc_tile_hash'
+  NOW = Sequel.lit("datetime('now', 'utc')")
+  KEY_COLUMNS = %i[zoom_level tile_column tile_row].freeze
+
+  def layout(route)
+    value = (route[:storage] || 'tiles').to_s
+    raise ArgumentError, "Unknown storage layout '#{value}' (expected #{LAYOUTS.join(' or ')})" unless LAYOUTS.include?(value)
+
+    value
+  end
+
+  # after_connect hook: the tile_id of a blob is its MD5 in hex, as mbutil computes it, so
+  # files stay interchangeable with the usual MBTiles tools
+  def register_functions(conn)
+    return unless conn.respond_to?(:create_function)
+
+    conn.create_function(HASH_FUNCTION, 1) { |func, blob| func.result = Digest::MD5.hexdigest(blob.to_s) }
+  end
+
+  # The connection's layout; set from the route at connect and from the file once it is open
+  def dedup?(db) = db.opts[:tile_storage] == 'dedup'
+
+  # Dataset whose insert upserts a tile. generated: true also overwrites generated; otherwise
+  # a stored value is kept (0 for new tiles). SQLite cannot UPSERT a view, so with the dedup
+  # layout a plain insert is used and the view's trigger does the upsert (NULL generated keeps)
+  def upsert(db, generated: false)
+    return db[:tiles] if dedup?(db)
+
+    update = { tile_data: Sequel[:excluded][:tile_data], updated_at: NOW }
+    update[:generated] = Sequel[:excluded][:generated] if generated
+    db[:tiles].insert_conflict(target: KEY_COLUMNS, update: update)
+  end
+
+  # Lookup for TileBlobFFI::Reader: SQL taking z, x, tms that returns the rowid of the tile's
+  # blob and its generated value, and the table the rowid belongs to
+  def blob_lookup(db)
+    return ['SELECT rowid, generated FROM tiles WHERE zoom_level = ?1 AND tile_column = ?2 AND tile_row = ?3', 'tiles'] unless dedup?(db)
+
+    ['SELECT images.rowid, map.generated FROM map JOIN images ON images.tile_id = map.tile_id ' \
+     'WHERE map.zoom_level = ?1 AND map.tile_column = ?2 AND map.tile_row = ?3', 'images']
+  end
+
+  # Brings an opened file to the route's layout and records the layout the file really has.
+  # This is the only place a file is converted and it runs on every open, whatever version
+  # the migrations are at: new files start as the plain table the migrations expect and are
+  # converted while empty, existing plain files once. A dedup file stays dedup even when the
+  # route asks for the plain table
+  def configure(db, source_name)
+    convert(db) if dedup?(db) && !view?(db)
+    actual = view?(db) ? 'dedup' : 'tiles'
+    if actual != db.opts[:tile_storage]
+      LOGGER.warn("event=tile_storage_layout_kept source=#{source_name} configured=#{db.opts[:tile_storage]} layout=#{actual}")
+    end
+    db.opts[:tile_storage] = actual
+  end
+
+  def view?(db) = db.views.include?(:tiles)
+
+  def create_schema(db)
+    db.create_table?(:images) do
+      String :tile_id, null: false
+      File   :tile_data, null: false
+      unique :tile_id, name: :images_id
+    end
+    db.create_table?(:map) do
+      Integer :zoom_level,  null: false
+      Integer :tile_column, null: false
+      Integer :tile_row,    null: false
+      String  :tile_id,     null: false
+      Integer :generated,   default: 0
+      DateTime :updated_at, default: NOW
+      unique [:zoom_level, :tile_column, :tile_row], name: :map_index
+      index :tile_id, name: :idx_map_tile_id
+      index [:zoom_level, :generated], name: :idx_map_zoom_generated
+      index [:zoom_level, :updated_at], name: :idx_map_zoom_updated
+    end
+
+    db.run <<~SQL
+      CREATE VIEW IF NOT EXISTS tiles AS
+        SELECT map.zoom_level AS zoom_level, map.tile_column AS tile_column, map.tile_row AS tile_row,
+               images.tile_data AS tile_data, map.generated AS generated, map.updated_at AS updated_at
+        FROM map JOIN images ON images.tile_id = map.tile_id
+    SQL
+    create_triggers(db)
+  end
+
+  # Rewrites a plain tiles table into map and images in one transaction
+  def convert(db)
+    otl_span('db.tile_storage_convert', {}) do
+      started = Time.now
+      db.transaction do
+        db.run 'ALTER TABLE tiles RENAME TO tiles_plain'
+        %i[tile_index idx_tiles_zoom_level idx_tiles_zoom_size idx_tiles_zoom_generated idx_tiles_zoom_updated].each do |name|
+          db.run "DROP INDEX IF EXISTS #{name}"
+        end
+        create_schema(db)
+        db.run <<~SQL
+          INSERT INTO map (zoom_level, tile_column, tile_row, tile_id, generated, updated_at)
+            SELECT zoom_level, tile_column, tile_row, #{HASH_FUNCTION}(tile_data), generated, updated_at FROM tiles_plain
+        SQL
+        db.run <<~SQL
+          INSERT OR IGNORE INTO images (tile_id, tile_data)
+            SELECT map.tile_id, tiles_plain.tile_data FROM map
+            JOIN tiles_plain USING (zoom_level, tile_column, tile_row)
+        SQL
+        db.drop_table(:tiles_plain)
+      end
+      LOGGER.info("Converted tiles to the dedup layout: #{db[:map].count} tiles, #{db[:images].count} images " \
+                  "in #{(Time.now - started).round(2)}s")
+    end
+  end
+
+  private
+
+  def create_triggers(db)
+    key_of = ->(row) { KEY_COLUMNS.map { |column| "#{column} = #{row}.#{column}" }.join(' AND ') }
+
+    # The map upsert runs first so the image is stored under the tile_id it computed
+    db.run <<~SQL
+      CREATE TRIGGER IF NOT EXISTS tiles_insert INSTEAD OF INSERT ON tiles BEGIN
+        INSERT INTO map (zoom_level, tile_column, tile_row, tile_id, generated, updated_at)
+          VALUES (NEW.zoom_level, NEW.tile_column, NEW.tile_row, #{HASH_FUNCTION}(NEW.tile_data),
+                  COALESCE(NEW.generated, 0), COALESCE(NEW.updated_at, datetime('now', 'utc')))
+          ON CONFLICT (zoom_level, tile_column, tile_row) DO UPDATE SET
+            tile_id = excluded.tile_id,
+            generated = COALESCE(NEW.generated, map.generated),
+            updated_at = excluded.updated_at;
+        INSERT OR IGNORE INTO images (tile_id, tile_data)
+          SELECT tile_id, NEW.tile_data FROM map WHERE #{key_of.('NEW')};
+      END
+    SQL
+    db.run <<~SQL
+      CREATE TRIGGER IF NOT EXISTS tiles_update INSTEAD OF UPDATE ON tiles BEGIN
+        UPDATE map SET zoom_level = NEW.zoom_level, tile_column = NEW.tile_column, tile_row = NEW.tile_row,
+                       generated = NEW.generated, updated_at = NEW.updated_at,
+                       tile_id = CASE WHEN NEW.tile_data IS OLD.tile_data THEN tile_id
+                                      ELSE #{HASH_FUNCTION}(NEW.tile_data) END
+          WHERE #{key_of.('OLD')};
+        INSERT OR IGNORE INTO images (tile_id, tile_data)
+          SELECT tile_id, NEW.tile_data FROM map WHERE #{key_of.('NEW')} AND NEW.tile_data IS NOT OLD.tile_data;
+      END
+    SQL
+    db.run <<~SQL
+      CREATE TRIGGER IF NOT EXISTS tiles_delete INSTEAD OF DELETE ON tiles BEGIN
+        DELETE FROM map WHERE #{key_of.('OLD')};
+      END
+    SQL
+
+    release = 'DELETE FROM images WHERE tile_id = OLD.tile_id AND NOT EXISTS (SELECT 1 FROM map WHERE tile_id = OLD.tile_id);'
+    db.run "CREATE TRIGGER IF NOT EXISTS map_release_update AFTER UPDATE OF tile_id ON map " \
+           "WHEN OLD.tile_id IS NOT NEW.tile_id BEGIN #{release} END"
+    db.run "CREATE TRIGGER IF NOT EXISTS map_release_delete AFTER DELETE ON map BEGIN #{release} END"
+  end
+end
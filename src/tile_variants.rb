@@ -0,0 +1,99 @@
+require_relative 'tile_cache'
+
+# Serve-time variants of a terrain route: the one stored pyramid served in the other
+# terrain-RGB encoding and/or as tiles of twice the stored size, tile z/x/y assembled from its
+# 4 stored children at z + 1. TerrainDownsampleFFI.transform_tile decodes the stored tiles
+# once, converts the pixels and encodes once; each variant keeps its outputs in its own
+# TileCache, invalidated with the stored tiles they were built from.
+#
+#   variants:
+#     - path: "/terrain_terrarium/:z/:x/:y"
+#       encoding: terrarium         # mapbox | terrarium (default: metadata.encoding)
+#       tile_size: 512              # Stored size (default) or twice it
+#       cache_mb: 16                # Transformed tiles kept per variant
+class TileVariants
+  DEFAULT_CACHE_MB = 16
+  ENCODINGS = %w[mapbox terrarium].freeze
+  PNG_SIGNATURE = "\x89PNG\r\n\x1A\n".b.freeze
+
+  Variant = Struct.new(:path, :encoding, :scaled, :cache, keyword_init: true)
+
+  attr_reader :variants
+
+  # Variants of a route (after DatabaseManager.setup_route_database), nil without any
+  def self.for_route(route, route_name)
+    configs = route[:variants]
+    configs && !configs.empty? ? new(route, route_name, configs) : nil
+  end
+
+  def initialize(route, route_name, configs)
+    @route = route
+    @source = route_name.to_s
+    @encoding = route.dig(:metadata, :encoding)
+    raise ArgumentError, "variants need a terrain source with metadata.encoding (source '#{route_name}')" unless ENCODINGS.include?(@encoding)
+
+    stored_size = route[:tile_size] || 256
+    @variants = configs.map do |config|
+      encoding = (config[:encoding] || @encoding).to_s
+      raise ArgumentError, "Invalid variant encoding '#{encoding}' for source '#{route_name}'. Supported: #{ENCODINGS.join(', ')}" unless ENCODINGS.include?(encoding)
+
+      tile_size = Integer(config[:tile_size] || stored_size)
+      unless [stored_size, stored_size * 2].include?(tile_size)
+        raise ArgumentError, "Invalid variant tile_size #{tile_size} for source '#{route_name}'. Supported: #{stored_size}, #{stored_size * 2}"
+      end
+
+      cache = TileCache.new(max_bytes: (config[:cache_mb] || DEFAULT_CACHE_MB) << 20)
+      cache.register_metrics("#{@source}#{config[:path]}")
+      Variant.new(path: config[:path], encoding: encoding, scaled: tile_size != stored_size, cache: cache)
+    end
+    @format = route[:output_format] || route[:content_type].to_s.delete_prefix('image/')
+  end
+
+  # Transformed tile z/x/tms of a variant from its cache, or built from the stored tiles the
+  # block yields for (z, x, tms); nil when none of them exists
+  def tile(variant, z, x, tms, &stored)
+    entry = variant.cache.fetch(z, x, tms) do
+      sources = if variant.scaled
+                  [[2 * x, 2 * tms], [2 * x + 1, 2 * tms], [2 * x, 2 * tms + 1], [2 * x + 1, 2 * tms + 1]]
+                    .map { |cx, cy| stored.call(z + 1, cx, cy) }
+                else
+                  [stored.call(z, x, tms)]
+                end
+      next nil if sources.none?
+
+      data = TerrainDownsampleFFI.transform_tile(sources.map { png_of(_1) }, @encoding, variant.encoding, @format, **output_options)
+      TileStageMetrics.record_native(@source, TerrainDownsampleFFI, 'terrain_transform_tile')
+      data && { tile_data: data, generated: 1 }
+    end
+    entry && entry[:tile_data]
+  end
+
+  # Drops the variant tiles built from stored tile z/x/tms
+  def invalidate(z, x, tms)
+    @variants.each do |variant|
+      if variant.scaled
+        variant.cache.invalidate(z - 1, x >> 1, tms >> 1) if z.positive?
+      else
+        variant.cache.invalidate(z, x, tms)
+      end
+    end
+  end
+
+  private
+
+  # Stored WebP tiles go through Vips, as the reconstructor's terrain children do
+  def png_of(data)
+    return nil if data.nil? || data.empty?
+    return data if data.byteslice(0, PNG_SIGNATURE.bytesize).b == PNG_SIGNATURE
+
+    Vips::Image.new_from_buffer(data, '').write_to_buffer('.png')
+  rescue Vips::Error
+    nil
+  end
+
+  def output_options
+    return { png: 'fast' } unless @format == 'webp'
+
+    { effort: @route.dig(:webp_config, :effort) }.compact
+  end
+end
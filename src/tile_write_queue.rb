@@ -0,0 +1,287 @@
+require 'sequel'
+require 'set'
+require_relative 'tile_storage'
+
+# Write-behind queue for one route's SQLite database. Tile upserts, misses, regeneration
+# marks, invalid-tile deletes and tile lock releases are queued and committed by one writer thread, several
+# hundred rows per transaction through prepared statements, instead of every request and
+# worker taking the WAL write lock for a single row.
+#
+# Pending rows are coalesced per tile key (the last write wins, as it would in SQLite) and
+# stay readable through read_tile / read_miss until their transaction has committed, so a
+# tile that was just fetched is served from the queue rather than fetched again.
+class TileWriteQueue
+  DEFAULT_MAX_ROWS = 256  # Pending rows that trigger a commit
+  DEFAULT_FLUSH_MS = 50   # Longest a queued row waits for its commit
+  NOW = Sequel.lit("datetime('now', 'utc')")
+
+  # Rows waiting for one commit. tiles: key => [tile_data, generated] where a nil generated
+  # leaves the stored value alone (cache fills) and an Integer sets it (reconstruction)
+  # releases: key => lease token of a TileLocks lease, dropped after the key's writes
+  Batch = Struct.new(:tiles, :deletes, :marks, :misses, :releases, :seq) do
+    def self.empty = new({}, Set.new, Set.new, {}, {}, 0)
+
+    def size = tiles.size + deletes.size + marks.size + misses.size + releases.size
+  end
+
+  attr_reader :source_name
+
+  def initialize(db, source_name, max_rows: DEFAULT_MAX_ROWS, flush_interval_ms: DEFAULT_FLUSH_MS)
+    @db = db
+    @source_name = source_name
+    @max_rows = max_rows
+    @flush_interval = flush_interval_ms / 1000.0
+    @mutex = Mutex.new
+    @wake = ConditionVariable.new
+    @committed = ConditionVariable.new
+    @pending = Batch.empty
+    @inflight = nil
+    @pending_since = nil
+    @seq = 0
+    @committed_seq = 0
+    @flush_waiters = 0
+    @closed = false
+    prepare_statements
+    start_writer
+  end
+
+  # Upserts tile_data; generated: nil keeps the stored generated value (0 for new rows)
+  def save_tile(z, x, tms, data, generated: nil)
+    enqueue(z, x, tms) do |batch, key|
+      batch.deletes.delete(key)
+      # An explicit generated overrides an earlier mark; a cache fill keeps both
+      batch.marks.delete(key) unless generated.nil?
+      batch.tiles[key] = [data, generated.nil? ? batch.tiles[key]&.last : generated]
+    end
+  end
+
+  # Marks an existing tile for regeneration (generated: -5)
+  def mark_for_regeneration(z, x, tms)
+    enqueue(z, x, tms) { |batch, key| batch.marks.add(key) unless batch.deletes.include?(key) }
+  end
+
+  def delete_tile(z, x, tms)
+    enqueue(z, x, tms) do |batch, key|
+      batch.tiles.delete(key)
+      batch.marks.delete(key)
+      batch.deletes.add(key)
+    end
+  end
+
+  # Replaces the miss of a tile; row holds ts, reason, details, status, response_body
+  def record_miss(z, x, tms, row)
+    enqueue(z, x, tms) { |batch, key| batch.misses[key] = row }
+  end
+
+  # Drops a TileLocks lease in the commit that stores the tile or miss fetched under it
+  def release_lease(z, x, tms, token)
+    enqueue(z, x, tms) { |batch, key| batch.releases[key] = token }
+  end
+
+  # Tile row as the tiles table would return it once pending writes are committed
+  # ({ tile_data:, generated: } or nil); the block reads the database when nothing is pending
+  def read_tile(z, x, tms)
+    key = [z, x, tms]
+    @mutex.synchronize do
+      [@pending, @inflight].compact.each do |batch|
+        return nil if batch.deletes.include?(key)
+
+        if (data, generated = batch.tiles[key])
+          generated = -5 if batch.marks.include?(key)
+          return { tile_data: data, generated: generated || 0 }
+        end
+      end
+    end
+    yield
+  end
+
+  # Pending miss row (with the key columns) or the block's database read
+  def read_miss(z, x, tms)
+    key = [z, x, tms]
+    @mutex.synchronize do
+      [@pending, @inflight].compact.each do |batch|
+        row = batch.misses[key]
+        return { zoom_level: z, tile_column: x, tile_row: tms, **row } if row
+      end
+    end
+    yield
+  end
+
+  # Blocks until every write queued before the call is committed
+  def flush
+    @mutex.synchronize do
+      target = @seq
+      next if @committed_seq >= target
+
+      ensure_writer
+      @flush_waiters += 1
+      @wake.signal
+      begin
+        @committed.wait(@mutex) while @committed_seq < target && @thread.alive?
+      ensure
+        @flush_waiters -= 1
+      end
+    end
+  end
+
+  # Commits everything still queued and stops the writer; later writes raise
+  def close
+    @mutex.synchronize do
+      @closed = true
+      ensure_writer
+      @wake.signal
+    end
+    @thread.join
+  end
+
+  def pending_rows
+    @mutex.synchronize { @pending.size + (@inflight&.size || 0) }
+  end
+
+  private
+
+  # Applies the block to the pending batch under the lock
+  def enqueue(z, x, tms)
+    @mutex.synchronize do
+      raise ClosedQueueError, "write queue for #{@source_name} is closed" if @closed
+
+      ensure_writer
+      yield @pending, [z, x, tms]
+      @pending.seq = (@seq += 1)
+      # The writer sleeps without a deadline while nothing is pending
+      @wake.signal if @pending_since.nil? || @pending.size >= @max_rows
+      @pending_since ||= monotonic_now
+    end
+    true
+  end
+
+  def monotonic_now = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+
+  def start_writer
+    @thread = Thread.new { run }
+  end
+
+  # Under the lock. A writer that died (a bug, a non-StandardError) is replaced, so queued
+  # rows are not left pending forever behind a thread that is gone
+  def ensure_writer
+    return if @thread.alive?
+
+    LOGGER.error("event=write_queue_died source=#{@source_name} pending=#{@pending.size + (@inflight&.size || 0)}")
+    start_writer
+  end
+
+  def run
+    # A replacement writer first commits the batch its predecessor died with
+    batch = @mutex.synchronize { @inflight }
+    while (batch ||= next_batch)
+      commit(batch)
+      @mutex.synchronize do
+        @inflight = nil
+        @committed_seq = batch.seq
+        @committed.broadcast
+      end
+      batch = nil
+    end
+  end
+
+  # Waits until the pending batch is due (full, old enough, flushed or closing) and takes it
+  def next_batch
+    @mutex.synchronize do
+      loop do
+        if @pending.size.zero?
+          return nil if @closed
+
+          @wake.wait(@mutex)
+          next
+        end
+
+        wait = @pending_since + @flush_interval - monotonic_now
+        break if @closed || @flush_waiters.positive? || @pending.size >= @max_rows || wait <= 0
+
+        @wake.wait(@mutex, wait)
+      end
+
+      @pending_since = nil
+      @inflight = @pending
+      @pending = Batch.empty
+      @inflight
+    end
+  end
+
+  # The store stage of TileStageMetrics is the commit time shared out over its rows
+  def commit(batch)
+    started_at = monotonic_now
+    begin
+      @db.transaction { apply(batch) }
+    rescue => e
+      LOGGER.warn("event=tile_write_queue_commit_error source=#{@source_name} rows=#{batch.size} error=#{e.message}")
+      return apply_each(batch)
+    end
+    TileStageMetrics.record_stage(@source_name, :store, (monotonic_now - started_at) * 1000 / batch.size)
+  end
+
+  # Deletes go first so they never undo a later write; marks follow the upserts they apply to
+  # and lease releases come last, once the result of the fetch is written
+  def apply(batch)
+    batch.deletes.each { |z, x, tms| @db.call(:twq_delete_tile, z: z, x: x, y: tms) }
+    batch.tiles.each { |key, (data, generated)| upsert_tile(key, data, generated) }
+    batch.marks.each { |z, x, tms| @db.call(:twq_mark_tile, z: z, x: x, y: tms) }
+    batch.misses.each { |key, row| upsert_miss(key, row) }
+    batch.releases.each { |key, token| release_lease_row(key, token) }
+  end
+
+  # After a failed transaction every row is retried on its own, so one bad row (or a lock
+  # timeout) costs only itself
+  def apply_each(batch)
+    failed = 0
+    [
+      *batch.deletes.map { |z, x, tms| -> { @db.call(:twq_delete_tile, z: z, x: x, y: tms) } },
+      *batch.tiles.map { |key, (data, generated)| -> { upsert_tile(key, data, generated) } },
+      *batch.marks.map { |z, x, tms| -> { @db.call(:twq_mark_tile, z: z, x: x, y: tms) } },
+      *batch.misses.map { |key, row| -> { upsert_miss(key, row) } },
+      *batch.releases.map { |key, token| -> { release_lease_row(key, token) } }
+    ].each do |write|
+      write.call
+    rescue => e
+      failed += 1
+      LOGGER.debug("TileWriteQueue: row write failed for #{@source_name}: #{e.message}")
+    end
+    LOGGER.error("event=tile_write_queue_rows_lost source=#{@source_name} rows=#{failed}") if failed.positive?
+  end
+
+  def upsert_tile((z, x, tms), data, generated)
+    binds = { z: z, x: x, y: tms, data: Sequel.blob(data) }
+    return @db.call(:twq_upsert_tile, binds) if generated.nil?
+
+    @db.call(:twq_upsert_generated_tile, **binds, generated: generated)
+  end
+
+  def upsert_miss((z, x, tms), row)
+    @db.call(:twq_upsert_miss, z: z, x: x, y: tms, ts: row[:ts], reason: row[:reason], details: row[:details],
+                               status: row[:status], body: Sequel.blob(row[:response_body] || ''))
+  end
+
+  def release_lease_row((z, x, tms), token)
+    @db.call(:twq_release_lease, z: z, x: x, y: tms, token: token)
+  end
+
+  def prepare_statements
+    key = { zoom_level: :$z, tile_column: :$x, tile_row: :$y }
+    tiles = @db[:tiles]
+
+    TileStorage.upsert(@db).prepare(:insert, :twq_upsert_tile, **key, tile_data: :$data, updated_at: NOW)
+    TileStorage.upsert(@db, generated: true)
+               .prepare(:insert, :twq_upsert_generated_tile, **key, tile_data: :$data, generated: :$generated, updated_at: NOW)
+
+    tiles.where(key).prepare(:update, :twq_mark_tile, generated: -5, updated_at: NOW)
+    tiles.where(key).prepare(:delete, :twq_delete_tile)
+
+    @db[:misses].insert_conflict(
+      target: %i[zoom_level tile_column tile_row],
+      update: %i[ts reason details status response_body].to_h { |column| [column, Sequel[:excluded][column]] }
+    ).prepare(:insert, :twq_upsert_miss, **key, ts: :$ts, reason: :$reason, details: :$details,
+                                               status: :$status, response_body: :$body)
+
+    @db[:tile_locks].where(**key, token: :$token).prepare(:delete, :twq_release_lease)
+  end
+end
@@ -1,15 +1,25 @@
 # frozen_string_literal: true
 
 require 'vips'
+require_relative 'tile_shards'
 
 module VipsTileValidator
-  # Validates tile data using Vips library
+  # Validates tile data: PNG and WebP through TileValidatorFFI, anything else through Vips
   # @param tile_data [String, nil] Binary tile data
   # @param check_transparency [Boolean] If true, analyzes alpha channel for transparency detection
   # @return [Symbol] :valid, :corrupted, or (if check_transparency=true) :transparent, :partial_transparent
   def self.validate(tile_data, check_transparency:)
     return :corrupted if tile_data.nil? || tile_data.empty?
 
+    if defined?(TileValidatorFFI) && (result = TileValidatorFFI.validate(tile_data, check_transparency))
+      return result
+    end
+
+    validate_with_vips(tile_data, check_transparency: check_transparency)
+  end
+
+  # Vips fallback for formats the native validator does not handle (JPEG, interlaced PNG, animated WebP)
+  def self.validate_with_vips(tile_data, check_transparency:)
     img = nil
     alpha = nil
 
@@ -50,11 +60,10 @@ module VipsTileValidator
     loader = route[:autoscan_loader]
     was_autoscan_running = loader&.enabled? && loader.running? ? loader.stop_completely : false
 
-    db = route[:db]
     check_transparency = route.dig(:validation, :check_transparency)
     raise "validation.check_transparency must be specified when validation.enabled is true" if check_transparency.nil?
 
-    total_count = db[:tiles].where(generated: 0).count
+    total_count = TileShards.dbs(route).sum { _1[:tiles].where(generated: 0).count }
 
     cleanup_state = {
       running: true,
@@ -106,10 +115,9 @@ module VipsTileValidator
   # @param state [Hash] Cleanup state
   def self.cleanup_database(route, source_name, check_transparency, state)
     otl_span('validator.cleanup', { source: source_name }) do |span|
-      db = route[:db]
       stats = state[:stats]
 
-      tiles_coords = db[:tiles].where(generated: 0).select(:zoom_level, :tile_column, :tile_row).all
+      tiles_coords = TileShards.dbs(route).flat_map { _1[:tiles].where(generated: 0).select(:zoom_level, :tile_column, :tile_row).all }
       idx = 0
 
       while idx < tiles_coords.size
@@ -119,6 +127,7 @@ module VipsTileValidator
         z = tile_coord[:zoom_level]
         x = tile_coord[:tile_column]
         tile_row = tile_coord[:tile_row]
+        db = TileShards.db(route, z)
 
         begin
           tile_data = db[:tiles].where(
@@ -157,6 +166,9 @@ module VipsTileValidator
                 response_body: nil
               )
             end
+            route[:miss_index]&.record(z, x, tile_row, ts: Time.now.to_i, status: 200, reason: validation_result.to_s)
+            route[:tile_cache]&.invalidate(z, x, tile_row)
+            route[:tile_variants]&.invalidate(z, x, tile_row)
             stats[:invalid] += 1
           else
             stats[:valid] += 1